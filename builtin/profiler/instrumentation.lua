@@ -189,6 +189,11 @@ local function init()
 				class = "ABM",
 				label = spec.label,
 			}
+			spec.action_batch = instrument {
+				func = spec.action_batch,
+				class = "ABM",
+				label = spec.label,
+			}
 			orig_register_abm(spec)
 		end
 	end
@@ -0,0 +1,164 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "active_object_grid.h"
+#include <algorithm>
+#include <cmath>
+#include "constants.h"
+#include "util/numeric.h"
+
+v3POS ActiveObjectGrid::getCell(v3f pos)
+{
+	const f32 size = ACTIVE_OBJECT_GRID_CELL_SIZE * BS;
+	return v3POS(std::floor(pos.X / size), std::floor(pos.Y / size),
+			std::floor(pos.Z / size));
+}
+
+bool ActiveObjectGrid::isCellNear(v3POS cell, v3f pos, f32 radius)
+{
+	const f32 size = ACTIVE_OBJECT_GRID_CELL_SIZE * BS;
+	// Distance to the nearest point of the cell
+	v3f nearest(
+		rangelim(pos.X, cell.X * size, (cell.X + 1) * size),
+		rangelim(pos.Y, cell.Y * size, (cell.Y + 1) * size),
+		rangelim(pos.Z, cell.Z * size, (cell.Z + 1) * size));
+	return nearest.getDistanceFromSQ(pos) <= radius * radius;
+}
+
+void ActiveObjectGrid::insert(u16 id, v3f pos, bool player)
+{
+	auto lock = lock_unique_rec();
+	auto it = m_ids.find(id);
+	if (it != m_ids.end()) {
+		eraseFromCell(it->second.cell, id);
+		m_ids.erase(it);
+	}
+	v3POS cell = getCell(pos);
+	m_ids[id] = Entry{cell, player};
+	m_cells[cell].push_back(id);
+	if (player && std::find(m_players.begin(), m_players.end(), id) == m_players.end())
+		m_players.push_back(id);
+}
+
+void ActiveObjectGrid::remove(u16 id)
+{
+	auto lock = lock_unique_rec();
+	auto it = m_ids.find(id);
+	if (it == m_ids.end())
+		return;
+	eraseFromCell(it->second.cell, id);
+	if (it->second.player)
+		m_players.erase(std::remove(m_players.begin(), m_players.end(), id),
+				m_players.end());
+	m_ids.erase(it);
+}
+
+void ActiveObjectGrid::move(u16 id, v3f pos)
+{
+	v3POS cell = getCell(pos);
+	auto lock = lock_unique_rec();
+	auto it = m_ids.find(id);
+	if (it == m_ids.end() || it->second.cell == cell)
+		return;
+	eraseFromCell(it->second.cell, id);
+	it->second.cell = cell;
+	m_cells[cell].push_back(id);
+}
+
+bool ActiveObjectGrid::getIdCell(u16 id, v3POS &cell, bool &player)
+{
+	auto lock = lock_shared_rec();
+	auto it = m_ids.find(id);
+	if (it == m_ids.end())
+		return false;
+	cell = it->second.cell;
+	player = it->second.player;
+	return true;
+}
+
+void ActiveObjectGrid::eraseFromCell(v3POS cell, u16 id)
+{
+	auto it = m_cells.find(cell);
+	if (it == m_cells.end())
+		return;
+	std::vector<u16> &ids = it->second;
+	auto i = std::find(ids.begin(), ids.end(), id);
+	if (i != ids.end()) {
+		*i = ids.back();
+		ids.pop_back();
+	}
+	if (ids.empty())
+		m_cells.erase(it);
+}
+
+void ActiveObjectGrid::getIdsNear(v3f pos, f32 radius, std::vector<u16> &ids)
+{
+	v3f r(radius, radius, radius);
+	addIdsInCells(getCell(pos - r), getCell(pos + r), &pos, radius, ids);
+}
+
+void ActiveObjectGrid::getIdsInBox(const aabb3f &box, std::vector<u16> &ids)
+{
+	addIdsInCells(getCell(box.MinEdge), getCell(box.MaxEdge), NULL, 0, ids);
+}
+
+void ActiveObjectGrid::addIdsInCells(v3POS from, v3POS to, const v3f *center,
+		f32 radius, std::vector<u16> &ids)
+{
+	auto in_range = [&](const v3POS &cell) -> bool {
+		if (cell.X < from.X || cell.Y < from.Y || cell.Z < from.Z ||
+				cell.X > to.X || cell.Y > to.Y || cell.Z > to.Z)
+			return false;
+		return !center || isCellNear(cell, *center, radius);
+	};
+
+	auto lock = lock_shared_rec();
+	u64 range_cells = (u64)(to.X - from.X + 1) * (to.Y - from.Y + 1) * (to.Z - from.Z + 1);
+	if (range_cells > m_cells.size()) {
+		// Fewer occupied cells than cells in range
+		for (const auto &cell : m_cells)
+			if (in_range(cell.first))
+				ids.insert(ids.end(), cell.second.begin(), cell.second.end());
+		return;
+	}
+	v3POS cell;
+	for (cell.Z = from.Z; cell.Z <= to.Z; ++cell.Z)
+	for (cell.Y = from.Y; cell.Y <= to.Y; ++cell.Y)
+	for (cell.X = from.X; cell.X <= to.X; ++cell.X) {
+		auto it = m_cells.find(cell);
+		if (it != m_cells.end() && in_range(cell))
+			ids.insert(ids.end(), it->second.begin(), it->second.end());
+	}
+}
+
+void ActiveObjectGrid::getPlayerIds(std::vector<u16> &ids)
+{
+	auto lock = lock_shared_rec();
+	ids.insert(ids.end(), m_players.begin(), m_players.end());
+}
+
+size_t ActiveObjectGrid::size()
+{
+	auto lock = lock_shared_rec();
+	return m_ids.size();
+}
+
+size_t ActiveObjectGrid::getCellCount()
+{
+	auto lock = lock_shared_rec();
+	return m_cells.size();
+}
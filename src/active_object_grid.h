@@ -0,0 +1,77 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ACTIVE_OBJECT_GRID_HEADER
+#define ACTIVE_OBJECT_GRID_HEADER
+
+#include <unordered_map>
+#include <vector>
+#include "irr_v3d.h"
+#include "irr_aabb3d.h"
+#include "threading/lock.h"
+#include "util/unordered_map_hash.h"
+
+/*
+	Active object ids by cell of ACTIVE_OBJECT_GRID_CELL_SIZE nodes, so
+	radius and box queries visit the objects nearby instead of all of
+	them. Queries return the ids in the touched cells: callers check the
+	exact position, the grid knows only the cell of each id.
+
+	Updated by ServerActiveObject::setBasePosition only when an object
+	crosses a cell border.
+*/
+
+#define ACTIVE_OBJECT_GRID_CELL_SIZE (MAP_BLOCKSIZE * 2)
+
+class ActiveObjectGrid : public maybe_shared_locker {
+public:
+	static v3POS getCell(v3f pos);
+	// Cell touches the sphere
+	static bool isCellNear(v3POS cell, v3f pos, f32 radius);
+
+	// player: also listed by getPlayerIds()
+	void insert(u16 id, v3f pos, bool player = false);
+	void remove(u16 id);
+	void move(u16 id, v3f pos);
+	// False if id is not in the grid
+	bool getIdCell(u16 id, v3POS &cell, bool &player);
+
+	// Appends ids of the cells touching the sphere
+	void getIdsNear(v3f pos, f32 radius, std::vector<u16> &ids);
+	// Appends ids of the cells touching the box
+	void getIdsInBox(const aabb3f &box, std::vector<u16> &ids);
+	void getPlayerIds(std::vector<u16> &ids);
+
+	size_t size();
+	size_t getCellCount();
+
+private:
+	struct Entry {
+		v3POS cell;
+		bool player;
+	};
+
+	void addIdsInCells(v3POS from, v3POS to, const v3f *center, f32 radius,
+			std::vector<u16> &ids);
+	void eraseFromCell(v3POS cell, u16 id);
+
+	unordered_map_v3POS<std::vector<u16>> m_cells;
+	std::unordered_map<u16, Entry> m_ids;
+	std::vector<u16> m_players;
+};
+
+#endif
@@ -1133,7 +1133,8 @@ void Client::sendLegacyInit(const std::string &playerName, const std::string &pl
 	u16 proto_version_min = g_settings->getFlag("send_pre_v25_init") ?
 		CLIENT_PROTOCOL_VERSION_MIN_LEGACY : CLIENT_PROTOCOL_VERSION_MIN;
 
-	pkt << (u8) SER_FMT_VER_HIGHEST_READ;
+	// Minetest servers do not know the block codec byte
+	pkt << (u8) (SER_FMT_VER_CODEC - 1);
 
 	std::string tmp = playerName;
 	tmp.resize(tmp.size()+PLAYERNAME_SIZE);
@@ -1156,7 +1157,7 @@ void Client::sendInit(const std::string &playerName)
 	u16 proto_version_min = g_settings->getFlag("send_pre_v25_init") ?
 		CLIENT_PROTOCOL_VERSION_MIN_LEGACY : CLIENT_PROTOCOL_VERSION_MIN;
 
-	pkt << (u8) SER_FMT_VER_HIGHEST_READ << (u16) supp_comp_modes;
+	pkt << (u8) (SER_FMT_VER_CODEC - 1) << (u16) supp_comp_modes;
 	pkt << (u16) proto_version_min << (u16) CLIENT_PROTOCOL_VERSION_MAX;
 	pkt << playerName;
 
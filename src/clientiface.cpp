@@ -182,15 +182,18 @@ int RemoteClient::GetNextBlocks (
 		Get the starting value of the block finder radius.
 	*/
 
+	bool view_changed = false;
 	if(m_last_center != center)
 	{
 		m_last_center = center;
 		m_nearest_unsent_reset_timer = 999;
+		view_changed = true;
 	}
 
 	if (m_last_direction.getDistanceFrom(camera_dir)>0.4) { // 1 = 90deg
 		m_last_direction = camera_dir;
 		m_nearest_unsent_reset_timer = 999;
+		view_changed = true;
 	}
 
 	/*infostream<<"m_nearest_unsent_reset_timer="
@@ -280,6 +283,10 @@ int RemoteClient::GetNextBlocks (
 	static const s16 d_max_gen_s = g_settings->getS16("max_block_generate_distance");
 	s16 d_max_gen = MYMIN(d_max_gen_s, wanted_range);
 
+	if (view_changed)
+		emerge->updateView(peer_id, camera_pos / (MAP_BLOCKSIZE * BS), camera_dir,
+			MYMAX(d_max_gen_s, full_d_max));
+
 	// Don't loop very much at a time
 	s16 max_d_increment_at_time = 10;
 	if(d_max > d_start + max_d_increment_at_time)
@@ -691,6 +698,7 @@ void RemoteClient::SetBlocksNotSent(std::map<v3s16, MapBlock*> &blocks)
 
 void RemoteClient::SetBlockDeleted(v3s16 p) {
 	m_blocks_sent.erase(p);
+	m_blocks_sent_version.erase(p);
 }
 
 void RemoteClient::notifyEvent(ClientStateEvent event)
@@ -959,8 +967,13 @@ void ClientInterface::send(u16 peer_id,u8 channelnum,
 void ClientInterface::send(u16 peer_id,u8 channelnum,
 		const msgpack::sbuffer &buffer, bool reliable)
 {
-	SharedBuffer<u8> data((unsigned char*)buffer.data(), buffer.size());
-	send(peer_id, channelnum, data, reliable);
+	m_con->Send(peer_id, channelnum, buffer, reliable);
+}
+
+void ClientInterface::send(const std::vector<u16> &peer_ids, u8 channelnum,
+		const msgpack::sbuffer &buffer, bool reliable)
+{
+	m_con->Send(peer_ids, channelnum, buffer, reliable);
 }
 #endif
 
@@ -1008,8 +1021,14 @@ void ClientInterface::sendToAll(u16 channelnum,
 void ClientInterface::sendToAll(u16 channelnum,
 		const msgpack::sbuffer &buffer, bool reliable)
 {
-	SharedBuffer<u8> data((unsigned char*)buffer.data(), buffer.size());
-	sendToAll(channelnum, data, reliable);
+	std::vector<u16> peer_ids;
+	{
+		auto lock = m_clients.lock_shared_rec();
+		for (auto & client : m_clients)
+			if (client.second->net_proto_version != 0)
+				peer_ids.push_back(client.second->peer_id);
+	}
+	m_con->Send(peer_ids, channelnum, buffer, reliable);
 }
 #endif
 
@@ -242,6 +242,8 @@ class RemoteClient
 	//
 	std::atomic_ushort net_proto_version;
 	u16 net_proto_version_fm;
+	// BlockCodec for TOCLIENT_BLOCKDATA, negotiated in TOSERVER_INIT_LEGACY
+	u8 block_codec;
 
 	std::atomic_int m_nearest_unsent_reset;
 	std::atomic_int wanted_range;
@@ -287,6 +289,7 @@ class RemoteClient
 	{
 		net_proto_version = 0;
 		net_proto_version_fm = 0;
+		block_codec = BLOCK_CODEC_ZLIB;
 		m_nearest_unsent_d = 0;
 		m_nearest_unsent_reset = 0;
 
@@ -408,6 +411,11 @@ class RemoteClient
 	unsigned int m_nearest_unsent_reset_want = 0;
 
 public:
+	/*
+		MapBlock::m_modified_counter of blocks on the client, base for
+		delta updates. Reliable channel: sent means received.
+	*/
+	concurrent_unordered_map<v3POS, u64, v3POSHash, v3POSEqual> m_blocks_sent_version;
 	std::atomic_int m_nearest_unsent_d;
 private:
 
@@ -481,6 +489,8 @@ class ClientInterface {
 
 	/* send message to client */
 	void send(u16 peer_id, u8 channelnum, const msgpack::sbuffer &data, bool reliable);
+	/* send one message to several clients, encoded and copied once */
+	void send(const std::vector<u16> &peer_ids, u8 channelnum, const msgpack::sbuffer &data, bool reliable);
 
 	void send(u16 peer_id, u8 channelnum, SharedBuffer<u8> data, bool reliable); //todo: delete
 
@@ -129,7 +129,7 @@ void ClientMap::OnRegisterSceneNode()
 	ISceneNode::OnRegisterSceneNode();
 }
 
-static bool isOccluded(Map *map, v3s16 p0, v3s16 p1, float step, float stepfac,
+static bool isOccluded(MapBlockNeighborhood &map, v3s16 p0, v3s16 p1, float step, float stepfac,
 		float start_off, float end_off, u32 needed_count, INodeDefManager *nodemgr,
 		unordered_map_v3POS<bool> & occlude_cache)
 {
@@ -148,7 +148,7 @@ static bool isOccluded(Map *map, v3s16 p0, v3s16 p1, float step, float stepfac,
 			cache = false;
 			is_transparent = occlude_cache[p];
 		} else {
-		MapNode n = map->getNodeTry(p);
+		MapNode n = map.getNodeTry(p);
 		if (n.getContent() == CONTENT_IGNORE) {
 			cache = false;
 		}
@@ -306,6 +306,7 @@ void ClientMap::updateDrawList(video::IVideoDriver* driver, float dtime, unsigne
 	u32 calls = 0, end_ms = porting::getTimeMs() + u32(max_cycle_ms);
 
 	unordered_map_v3POS<bool> occlude_cache;
+	MapBlockNeighborhood occlude_blocks(this, getNodeBlockPos(cam_pos_nodes));
 
 	while (!draw_nearest.empty()) {
 		auto ir = draw_nearest.back();
@@ -375,23 +376,23 @@ void ClientMap::updateDrawList(video::IVideoDriver* driver, float dtime, unsigne
 			if (occlusion_culling_enabled &&
 				range > 1 && smesh_size &&
 					// For the central point of the mapblock 'endoff' can be halved
-					isOccluded(this, spn, cpn,
+					isOccluded(occlude_blocks, spn, cpn,
 						step, stepfac, startoff, endoff / 2.0f, needed_count, nodemgr, occlude_cache) &&
-					isOccluded(this, spn, cpn + v3s16(bs2,bs2,bs2),
+					isOccluded(occlude_blocks, spn, cpn + v3s16(bs2,bs2,bs2),
 						step, stepfac, startoff, endoff, needed_count, nodemgr, occlude_cache) &&
-					isOccluded(this, spn, cpn + v3s16(bs2,bs2,-bs2),
+					isOccluded(occlude_blocks, spn, cpn + v3s16(bs2,bs2,-bs2),
 						step, stepfac, startoff, endoff, needed_count, nodemgr, occlude_cache) &&
-					isOccluded(this, spn, cpn + v3s16(bs2,-bs2,bs2),
+					isOccluded(occlude_blocks, spn, cpn + v3s16(bs2,-bs2,bs2),
 						step, stepfac, startoff, endoff, needed_count, nodemgr, occlude_cache) &&
-					isOccluded(this, spn, cpn + v3s16(bs2,-bs2,-bs2),
+					isOccluded(occlude_blocks, spn, cpn + v3s16(bs2,-bs2,-bs2),
 						step, stepfac, startoff, endoff, needed_count, nodemgr, occlude_cache) &&
-					isOccluded(this, spn, cpn + v3s16(-bs2,bs2,bs2),
+					isOccluded(occlude_blocks, spn, cpn + v3s16(-bs2,bs2,bs2),
 						step, stepfac, startoff, endoff, needed_count, nodemgr, occlude_cache) &&
-					isOccluded(this, spn, cpn + v3s16(-bs2,bs2,-bs2),
+					isOccluded(occlude_blocks, spn, cpn + v3s16(-bs2,bs2,-bs2),
 						step, stepfac, startoff, endoff, needed_count, nodemgr, occlude_cache) &&
-					isOccluded(this, spn, cpn + v3s16(-bs2,-bs2,bs2),
+					isOccluded(occlude_blocks, spn, cpn + v3s16(-bs2,-bs2,bs2),
 						step, stepfac, startoff, endoff, needed_count, nodemgr, occlude_cache) &&
-					isOccluded(this, spn, cpn + v3s16(-bs2,-bs2,-bs2),
+					isOccluded(occlude_blocks, spn, cpn + v3s16(-bs2,-bs2,-bs2),
 						step, stepfac, startoff, endoff, needed_count, nodemgr, occlude_cache)) {
 				blocks_occlusion_culled++;
 				continue;
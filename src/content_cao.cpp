@@ -1045,6 +1045,28 @@ v3s16 GenericCAO::getLightPosition()
 	return floatToInt(m_position, BS);
 }
 
+void GenericCAO::updatePosition(bool do_interpolate, bool is_end_position)
+{
+	// Place us a bit higher if we're physical, to not sink into
+	// the ground due to sucky collision detection...
+	if(m_prop.physical)
+		m_position += v3f(0,0.002,0);
+
+	m_position_recd = porting::getTimeMs();
+
+	if(getParent() != NULL) // Just in case
+		return;
+
+	if(do_interpolate)
+	{
+		if(!m_prop.physical)
+			pos_translator.update(m_position, is_end_position, m_update_interval);
+	} else {
+		pos_translator.init(m_position);
+	}
+	updateNodePos();
+}
+
 void GenericCAO::updateNodePos()
 {
 	if (getParent() != NULL)
@@ -1642,24 +1664,26 @@ void GenericCAO::processMessage(const std::string &data)
 		bool is_end_position = readU8(is);
 		m_update_interval = readF1000(is);
 
-		// Place us a bit higher if we're physical, to not sink into
-		// the ground due to sucky collision detection...
-		if(m_prop.physical)
-			m_position += v3f(0,0.002,0);
-
-		m_position_recd = porting::getTimeMs();
-
-		if(getParent() != NULL) // Just in case
+		updatePosition(do_interpolate, is_end_position);
+	} else if (cmd == GENERIC_CMD_UPDATE_MOVEMENT) {
+		GenericMovement movement = gob_read_update_movement(is);
+		if (movement.keyframe) {
+			m_keyframe_seq = movement.keyframe_seq;
+			m_keyframe_position = movement.position;
+		} else if (movement.keyframe_seq != m_keyframe_seq) {
+			// Delta from a keyframe we did not get (yet)
 			return;
-
-		if(do_interpolate)
-		{
-			if(!m_prop.physical)
-				pos_translator.update(m_position, is_end_position, m_update_interval);
 		} else {
-			pos_translator.init(m_position);
+			movement.position += m_keyframe_position;
 		}
-		updateNodePos();
+		m_position = movement.position;
+		m_velocity = movement.velocity;
+		m_acceleration = movement.acceleration;
+		if(fabs(m_prop.automatic_rotate) < 0.001)
+			m_yaw = movement.yaw;
+		m_update_interval = movement.update_interval;
+
+		updatePosition(movement.do_interpolate, movement.is_movement_end);
 	} else if (cmd == GENERIC_CMD_SET_TEXTURE_MOD) {
 		std::string mod = deSerializeString(is);
 		updateTextures(mod);
@@ -114,6 +114,9 @@ class GenericCAO : public ClientActiveObject
 
 	unsigned int m_position_recd = 0;
 	float m_update_interval = 0.1;
+	// GENERIC_CMD_UPDATE_MOVEMENT deltas are relative to this, -1: none yet
+	int m_keyframe_seq = -1;
+	v3f m_keyframe_position;
 
 public:
 	GenericCAO(IGameDef *gamedef, ClientEnvironment *env);
@@ -200,6 +203,9 @@ class GenericCAO : public ClientActiveObject
 
 	void updateNodePos();
 
+	// After a position update from the server
+	void updatePosition(bool do_interpolate, bool is_end_position);
+
 	void step(float dtime, ClientEnvironment *env);
 
 	void updateTexturePos();
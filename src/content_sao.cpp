@@ -324,7 +324,8 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 	if(send_recommended == false)
 		return;
 
-	if(!isAttached())
+	// The environment spaces the updates by the distance to the players
+	if(!isAttached() && m_movement_send_interval)
 	{
 		// TODO: force send when acceleration changes enough?
 		float minchange = 0.2*BS;
@@ -738,9 +739,10 @@ void LuaEntitySAO::sendPosition(bool do_interpolate, bool is_movement_end)
 	m_last_sent_velocity = m_velocity;
 	//m_last_sent_acceleration = m_acceleration;
 
-	float update_interval = m_env->getSendRecommendedInterval();
+	float update_interval = m_env->getSendRecommendedInterval() *
+			MYMAX(m_movement_send_interval, 1);
 
-	std::string str = gob_cmd_update_position(
+	sendMovement(
 		getBasePosition(),
 		m_velocity,
 		m_acceleration,
@@ -749,9 +751,6 @@ void LuaEntitySAO::sendPosition(bool do_interpolate, bool is_movement_end)
 		is_movement_end,
 		update_interval
 	);
-	// create message and add to list
-	ActiveObjectMessage aom(getId(), false, str);
-	m_messages_out.push(aom);
 }
 
 bool LuaEntitySAO::getCollisionBox(aabb3f *toset) {
@@ -1059,7 +1058,7 @@ void PlayerSAO::step(float dtime, bool send_recommended)
 			pos = m_base_position + v3f(0,BS*1,0);
 			vel = m_player->getSpeed();
 		}
-		std::string str = gob_cmd_update_position(
+		sendMovement(
 			pos,
 			vel,
 			acc,
@@ -1068,9 +1067,6 @@ void PlayerSAO::step(float dtime, bool send_recommended)
 			false,
 			update_interval
 		);
-		// create message and add to list
-		ActiveObjectMessage aom(getId(), false, str);
-		m_messages_out.push(aom);
 	}
 
 	if (!m_armor_groups_sent) {
@@ -31,6 +31,9 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "util/string.h"
 
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+#include <algorithm>
+#include <memory>
 
 
 #define ENSURE_STATUS_OK(s) \
@@ -40,8 +43,8 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 	}
 
 
-Database_LevelDB::Database_LevelDB(const std::string &savedir)
-	: m_database(savedir, "map")
+Database_LevelDB::Database_LevelDB(const std::string &savedir, bool morton)
+	: m_morton(morton), m_database(savedir, "map")
 {
 }
 
@@ -51,13 +54,27 @@ Database_LevelDB::~Database_LevelDB()
 
 bool Database_LevelDB::saveBlock(const v3s16 &pos, const std::string &data)
 {
-	if (!m_database.put(getBlockAsString(pos), data)) {
-		warningstream << "WARNING: saveBlock: LevelDB error saving block "
-			<< pos << ": "<< m_database.get_error() << std::endl;
+	return saveBlocks({{pos, data}});
+}
+
+bool Database_LevelDB::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	if (!m_database.db)
+		return false;
+	leveldb::WriteBatch batch;
+	std::string keys[2];
+	for (const auto &block : blocks) {
+		batch.Put(blockKey(block.first), block.second);
+		// delete other formats
+		otherKeys(block.first, keys);
+		for (const auto &key : keys)
+			batch.Delete(key);
+	}
+	if (!m_database.process_status(m_database.db->Write(m_database.write_options, &batch))) {
+		warningstream << "WARNING: saveBlocks: LevelDB error saving "
+			<< blocks.size() << " blocks: " << m_database.get_error() << std::endl;
 		return false;
 	}
-	m_database.del(i64tos(getBlockAsInteger(pos))); // delete old format
-
 	return true;
 }
 
@@ -67,21 +84,91 @@ void Database_LevelDB::loadBlock(const v3s16 &pos, std::string *block)
 	std::string datastr;
 */
 
-	m_database.get(getBlockAsString(pos), *block);
+	m_database.get(blockKey(pos), *block);
 	if (block->length())
 		return;
 
-	m_database.get(i64tos(getBlockAsInteger(pos)), *block);
+	std::string keys[2];
+	otherKeys(pos, keys);
+	for (const auto &key : keys) {
+		m_database.get(key, *block);
+		if (block->length())
+			return;
+	}
 
 /*
 	*block = (status.ok()) ? datastr : "";
 */
 }
 
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> &blocks)
+{
+	blocks.resize(pos.size());
+	if (!m_database.db)
+		return;
+	// All reads from one consistent state of database
+	leveldb::ReadOptions options = m_database.read_options;
+	options.snapshot = m_database.db->GetSnapshot();
+
+	if (m_morton) {
+		/*
+			Walk one iterator over keys in sorted order. Nearby blocks are
+			neighbours in the table, so a few Next() replace most seeks
+			and a shell of blocks becomes mostly sequential reads.
+		*/
+		std::vector<std::pair<std::string, size_t>> keys;
+		keys.reserve(pos.size());
+		for (size_t i = 0; i < pos.size(); ++i) {
+			blocks[i].clear();
+			keys.emplace_back(getBlockAsMorton(pos[i]), i);
+		}
+		std::sort(keys.begin(), keys.end());
+		std::unique_ptr<leveldb::Iterator> it(m_database.db->NewIterator(options));
+		bool positioned = false;
+		for (const auto &key : keys) {
+			int steps = 0;
+			while (positioned && it->Valid() && it->key().compare(key.first) < 0 && steps++ < 8)
+				it->Next();
+			if (!positioned || !it->Valid() || it->key().compare(key.first) < 0) {
+				it->Seek(key.first);
+				positioned = true;
+			}
+			if (!it->Valid())
+				break;
+			if (it->key() == key.first)
+				blocks[key.second] = it->value().ToString();
+		}
+		it.reset();
+	} else {
+		for (size_t i = 0; i < pos.size(); ++i) {
+			blocks[i].clear();
+			m_database.db->Get(options, blockKey(pos[i]), &blocks[i]);
+		}
+	}
+
+	std::string keys[2];
+	for (size_t i = 0; i < pos.size(); ++i) {
+		if (!blocks[i].empty())
+			continue;
+		otherKeys(pos[i], keys);
+		for (const auto &key : keys)
+			if (m_database.db->Get(options, key, &blocks[i]).ok())
+				break;
+	}
+	m_database.db->ReleaseSnapshot(options.snapshot);
+}
+
 bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 {
-	auto ok = m_database.del(getBlockAsString(pos));
-	if (ok) {
+	if (!m_database.db)
+		return false;
+	leveldb::WriteBatch batch;
+	batch.Delete(blockKey(pos));
+	std::string keys[2];
+	otherKeys(pos, keys);
+	for (const auto &key : keys)
+		batch.Delete(key);
+	if (!m_database.process_status(m_database.db->Write(m_database.write_options, &batch))) {
 		warningstream << "WARNING: deleteBlock: LevelDB error deleting block "
 			<< (pos) << ": " << m_database.get_error() << std::endl;
 		return false;
@@ -104,5 +191,40 @@ void Database_LevelDB::listAllLoadableBlocks(std::vector<v3s16> &dst)
 #endif
 }
 
-#endif // USE_LEVELDB
+size_t Database_LevelDB::convertKeys(const std::vector<v3s16> &blocks, bool morton)
+{
+	if (!m_database.db)
+		return 0;
+	size_t count = 0;
+	leveldb::WriteBatch batch;
+	std::string data;
+	for (const auto &pos : blocks) {
+		const std::string key_new = morton ? getBlockAsMorton(pos) : getBlockAsString(pos);
+		// Old formats in loadBlock() priority order
+		const std::string keys[] = {
+			key_new,
+			morton ? getBlockAsString(pos) : getBlockAsMorton(pos),
+			i64tos(getBlockAsInteger(pos)),
+		};
+		bool found = false;
+		for (const auto &key : keys) {
+			data.clear();
+			if (!m_database.db->Get(m_database.read_options, key, &data).ok())
+				continue;
+			if (key == key_new) {
+				found = true;
+				continue;
+			}
+			if (!found)
+				batch.Put(key_new, data);
+			batch.Delete(key);
+			found = true;
+		}
+		count += found;
+	}
+	if (!m_database.process_status(m_database.db->Write(m_database.write_options, &batch)))
+		throw DatabaseException("LevelDB error converting keys: " + m_database.get_error());
+	return count;
+}
 
+#endif // USE_LEVELDB
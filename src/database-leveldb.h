@@ -29,23 +29,49 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "database.h"
 #include "key_value_storage.h"
+#include "util/string.h"
 #include <string>
 
 class Database_LevelDB : public Database
 {
 public:
-	Database_LevelDB(const std::string &savedir);
+	// morton: Z-order keys (world.mt leveldb_keys = morton), else "aX,Y,Z"
+	Database_LevelDB(const std::string &savedir, bool morton = false);
 	~Database_LevelDB();
 
 	void open() { m_database.open(); };
 	void close() { m_database.close(); };
+	bool isOpen() const { return m_database.db != nullptr; }
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> &blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
+	// Rewrite blocks stored with any key format to the morton or string
+	// format, returns number of blocks found
+	size_t convertKeys(const std::vector<v3s16> &blocks, bool morton);
+
 private:
+	std::string blockKey(const v3s16 &pos) const
+	{
+		return m_morton ? getBlockAsMorton(pos) : getBlockAsString(pos);
+	}
+	/*
+		Keys of the other formats in lookup order. Blocks are read with any
+		of them, so a world stays whole while --migrate-keys runs or after
+		it was interrupted; saves and deletes remove them.
+	*/
+	void otherKeys(const v3s16 &pos, std::string (&keys)[2]) const
+	{
+		keys[0] = m_morton ? getBlockAsString(pos) : i64tos(getBlockAsInteger(pos));
+		keys[1] = m_morton ? i64tos(getBlockAsInteger(pos)) : getBlockAsMorton(pos);
+	}
+
+	bool m_morton;
+
 	//leveldb::DB *m_database;
 	KeyValueStorage m_database;
 };
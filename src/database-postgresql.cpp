@@ -36,9 +36,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <netinet/in.h>
 #endif
 
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
 #include "log.h"
 #include "exceptions.h"
 #include "settings.h"
+#include "util/unordered_map_hash.h"
 
 Database_PostgreSQL::Database_PostgreSQL(const Settings &conf) :
 	m_connect_string(""),
@@ -125,6 +129,11 @@ void Database_PostgreSQL::initStatements()
 			"WHERE posX = $1::int4 AND posY = $2::int4 AND "
 			"posZ = $3::int4");
 
+	prepareStatement("read_blocks",
+			"SELECT b.posX, b.posY, b.posZ, b.data FROM blocks b "
+			"JOIN unnest($1::int4[], $2::int4[], $3::int4[]) AS p(x, y, z) "
+			"ON b.posX = p.x AND b.posY = p.y AND b.posZ = p.z");
+
 	prepareStatement("write_block",
 			"INSERT INTO blocks (posX, posY, posZ, data) VALUES "
 			"($1::int4, $2::int4, $3::int4, $4::bytea) "
@@ -249,6 +258,59 @@ void Database_PostgreSQL::loadBlock(const v3s16 &pos,
 	PQclear(results);
 }
 
+// int4 column of result in binary format
+static inline s32 pg_bin_to_s32(PGresult *res, int row, int col)
+{
+	u32 value;
+	memcpy(&value, PQgetvalue(res, row, col), sizeof(value));
+	return (s32) ntohl(value);
+}
+
+void Database_PostgreSQL::loadBlocks(const std::vector<v3s16> &pos,
+		std::vector<std::string> &blocks)
+{
+	blocks.assign(pos.size(), "");
+	if (pos.empty())
+		return;
+
+	verifyDatabase();
+
+	// Coordinates as text arrays, one query for all blocks
+	std::ostringstream xs, ys, zs;
+	std::unordered_map<v3s16, size_t, v3POSHash, v3POSEqual> index;
+	for (size_t i = 0; i < pos.size(); ++i) {
+		const char *sep = i ? "," : "{";
+		xs << sep << pos[i].X;
+		ys << sep << pos[i].Y;
+		zs << sep << pos[i].Z;
+		index[pos[i]] = i;
+	}
+	xs << "}";
+	ys << "}";
+	zs << "}";
+	std::string x = xs.str(), y = ys.str(), z = zs.str();
+
+	const void *args[] = { x.c_str(), y.c_str(), z.c_str() };
+	const int argLen[] = { 0, 0, 0 };
+	const int argFmt[] = { 0, 0, 0 };
+
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+			argLen, argFmt, false);
+
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		v3s16 p(pg_bin_to_s32(results, row, 0),
+			pg_bin_to_s32(results, row, 1),
+			pg_bin_to_s32(results, row, 2));
+		auto it = index.find(p);
+		if (it != index.end())
+			blocks[it->second] = std::string(PQgetvalue(results, row, 3),
+					PQgetlength(results, row, 3));
+	}
+
+	PQclear(results);
+}
+
 bool Database_PostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
@@ -141,6 +141,53 @@ void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+void Database_Redis::loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> &blocks)
+{
+	blocks.resize(pos.size());
+	if (pos.empty())
+		return;
+
+	// HMGET hash key1 key2 ... in one round trip
+	std::vector<std::string> keys;
+	keys.reserve(pos.size());
+	for (const auto &p : pos)
+		keys.push_back(i64tos(getBlockAsInteger(p)));
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	argv.reserve(keys.size() + 2);
+	argvlen.reserve(keys.size() + 2);
+	argv.push_back("HMGET");
+	argvlen.push_back(5);
+	argv.push_back(hash.c_str());
+	argvlen.push_back(hash.size());
+	for (const auto &key : keys) {
+		argv.push_back(key.c_str());
+		argvlen.push_back(key.size());
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			argv.size(), &argv[0], &argvlen[0]));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' failed: ") + ctx->errstr);
+	}
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != pos.size()) {
+		std::string errstr = reply->type == REDIS_REPLY_ERROR ?
+			std::string(reply->str, reply->len) : "invalid reply";
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' errored: ") + errstr);
+	}
+	for (size_t i = 0; i < reply->elements; ++i) {
+		redisReply *element = reply->element[i];
+		if (element->type == REDIS_REPLY_STRING)
+			blocks[i].assign(element->str, element->len);
+		else
+			blocks[i].clear(); // block not found in database
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
@@ -0,0 +1,435 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "database-region.h"
+
+#if USE_REGION
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "exceptions.h"
+#include "filesys.h"
+#include "log.h"
+#include "porting.h"
+#include "threading/thread_pool.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+#include "util/strfnd.h"
+#include "util/string.h"
+
+/*
+	File format, numbers big endian:
+	[0] "FMRG" magic
+	[4] u32 format version
+	[8] u8 padding[8]
+	[16] REGION_BLOCKS table entries: u64 offset, u32 size, u32 padding
+	[REGION_DATA] records: u16 block index, u32 size, data
+	Records are only appended; the table entry is written after its data
+	is synced, so a crash loses at most the last save of a block.
+*/
+#define REGION_MAGIC "FMRG"
+#define REGION_VERSION 1
+#define REGION_TABLE 16
+#define REGION_ENTRY 16
+#define REGION_DATA (REGION_TABLE + REGION_ENTRY * Database_Region::REGION_BLOCKS)
+#define REGION_RECORD 6
+// Mapping grows by at least this, files are read through it
+#define REGION_MAP_STEP (1 << 20)
+// Region files kept open
+#define REGION_OPEN_MAX 256
+// Absent region files remembered, forgotten all at once when full
+#define REGION_ABSENT_MAX 65536
+// Compact when garbage is bigger than this and than live data
+#define REGION_COMPACT_MIN (1 << 20)
+
+class RegionCompactThread : public thread_pool {
+	Database_Region *m_db;
+public:
+	RegionCompactThread(Database_Region *db):
+		thread_pool("RegionCompact"),
+		m_db(db)
+	{}
+
+	void * run() {
+		u32 next = porting::getTimeMs() + 10000;
+		while (!stopRequested()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			if (porting::getTimeMs() < next)
+				continue;
+			try {
+				m_db->compact();
+			} catch (std::exception &e) {
+				errorstream << m_name << ": exception: " << e.what() << std::endl;
+			}
+			next = porting::getTimeMs() + 10000;
+		}
+		return nullptr;
+	}
+};
+
+Database_Region::Region::~Region()
+{
+	if (map)
+		munmap(map, map_size);
+	if (fd >= 0)
+		::close(fd);
+}
+
+Database_Region::Database_Region(const std::string &savedir) :
+	m_dir(savedir + DIR_DELIM + "map.region"),
+	m_compact_thread(new RegionCompactThread(this))
+{
+	if (!fs::CreateAllDirs(m_dir))
+		throw DatabaseException("Region: Failed to create directory " + m_dir);
+	m_compact_thread->start();
+}
+
+Database_Region::~Database_Region()
+{
+	m_compact_thread->join();
+}
+
+void Database_Region::close()
+{
+	std::lock_guard<Mutex> lock(m_regions_mutex);
+	m_regions.clear();
+	m_absent.clear();
+}
+
+v3s16 Database_Region::regionPos(const v3s16 &pos)
+{
+	return getContainerPos(pos, REGION_SIZE);
+}
+
+u32 Database_Region::regionIndex(const v3s16 &pos)
+{
+	v3s16 rel = pos - regionPos(pos) * REGION_SIZE;
+	return rel.X + rel.Y * REGION_SIZE + rel.Z * REGION_SIZE * REGION_SIZE;
+}
+
+Database_Region::RegionPtr Database_Region::getRegion(const v3s16 &region_pos, bool create)
+{
+	u32 now = porting::getTimeMs();
+	std::lock_guard<Mutex> lock(m_regions_mutex);
+	auto it = m_regions.find(region_pos);
+	if (it != m_regions.end()) {
+		it->second->last_use = now;
+		return it->second;
+	}
+
+	std::string path = m_dir + DIR_DELIM + "r." + itos(region_pos.X) + "." +
+		itos(region_pos.Y) + "." + itos(region_pos.Z);
+	if (!create) {
+		if (m_absent.count(region_pos))
+			return nullptr;
+		if (!fs::PathExists(path)) {
+			if (m_absent.size() >= REGION_ABSENT_MAX)
+				m_absent.clear();
+			m_absent.insert(region_pos);
+			return nullptr;
+		}
+	}
+
+	// Forget least recently used one nobody else holds: a second Region of
+	// the same file would append over the records of the first one.
+	// New references are only taken under m_regions_mutex.
+	if (m_regions.size() >= REGION_OPEN_MAX) {
+		auto oldest = m_regions.end();
+		for (auto i = m_regions.begin(); i != m_regions.end(); ++i)
+			if (i->second.use_count() == 1 && (oldest == m_regions.end() ||
+					i->second->last_use < oldest->second->last_use))
+				oldest = i;
+		if (oldest != m_regions.end())
+			m_regions.erase(oldest);
+	}
+
+	RegionPtr region(new Region);
+	region->path = path;
+	region->last_use = now;
+	openRegion(*region, create);
+	m_absent.erase(region_pos);
+	m_regions[region_pos] = region;
+	return region;
+}
+
+void Database_Region::openRegion(Region &region, bool create)
+{
+	region.fd = ::open(region.path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+	if (region.fd < 0)
+		throw DatabaseException("Region: Failed to open " + region.path +
+			": " + strerror(errno));
+
+	struct stat st;
+	if (fstat(region.fd, &st))
+		throw DatabaseException("Region: Failed to stat " + region.path);
+	region.file_size = st.st_size;
+
+	std::vector<u8> header(REGION_DATA, 0);
+	if (region.file_size == 0) {
+		memcpy(&header[0], REGION_MAGIC, 4);
+		writeU32(&header[4], REGION_VERSION);
+		if (pwrite(region.fd, &header[0], header.size(), 0) != (ssize_t)header.size())
+			throw DatabaseException("Region: Failed to write " + region.path);
+		region.file_size = header.size();
+	} else if (region.file_size < REGION_DATA ||
+			pread(region.fd, &header[0], header.size(), 0) != (ssize_t)header.size() ||
+			memcmp(&header[0], REGION_MAGIC, 4) ||
+			readU32(&header[4]) != REGION_VERSION) {
+		throw DatabaseException("Region: Invalid file " + region.path);
+	}
+
+	u64 live = REGION_DATA;
+	for (u32 i = 0; i < REGION_BLOCKS; ++i) {
+		const u8 *entry = &header[REGION_TABLE + i * REGION_ENTRY];
+		region.table[i].offset = readU64(entry);
+		region.table[i].size = readU32(entry + 8);
+		if (region.table[i].offset + region.table[i].size > region.file_size)
+			region.table[i] = {0, 0}; // record lost in crash
+		if (region.table[i].size)
+			live += REGION_RECORD + region.table[i].size;
+	}
+	region.garbage = region.file_size - live;
+
+	mapRegion(region);
+}
+
+// Requires unique lock. Mapping always covers whole file, so readers
+// need only a shared lock.
+void Database_Region::mapRegion(Region &region)
+{
+	if (region.map && region.file_size <= region.map_size)
+		return;
+	if (region.map)
+		munmap(region.map, region.map_size);
+	// Pages beyond end of file are mapped but never touched
+	region.map_size = (region.file_size * 2 / REGION_MAP_STEP + 1) * REGION_MAP_STEP;
+	void *map = mmap(nullptr, region.map_size, PROT_READ, MAP_SHARED, region.fd, 0);
+	if (map == MAP_FAILED) {
+		region.map = nullptr;
+		region.map_size = 0;
+		throw DatabaseException("Region: Failed to map " + region.path +
+			": " + strerror(errno));
+	}
+	region.map = (u8 *)map;
+}
+
+// Requires unique lock
+bool Database_Region::appendRecords(Region &region,
+		const std::vector<std::pair<u32, const std::string *>> &records)
+{
+	std::string buf;
+	size_t total = 0;
+	for (const auto &record : records)
+		total += REGION_RECORD + record.second->size();
+	buf.reserve(total);
+
+	std::vector<entry_type> entries;
+	entries.reserve(records.size());
+	u8 head[REGION_RECORD];
+	for (const auto &record : records) {
+		entries.push_back({region.file_size + buf.size() + REGION_RECORD,
+			(u32)record.second->size()});
+		writeU16(head, record.first);
+		writeU32(head + 2, record.second->size());
+		buf.append((char *)head, REGION_RECORD);
+		buf.append(*record.second);
+	}
+
+	// Data first, then table, one sequential write for all records.
+	// Synced before the table points to it.
+	if (pwrite(region.fd, buf.data(), buf.size(), region.file_size) != (ssize_t)buf.size() ||
+			fsync(region.fd)) {
+		warningstream << "Region: Failed to write " << region.path << ": "
+			<< strerror(errno) << std::endl;
+		return false;
+	}
+	region.file_size += buf.size();
+
+	bool ok = true;
+	for (size_t i = 0; i < records.size(); ++i) {
+		auto &entry = region.table[records[i].first];
+		if (entry.size)
+			region.garbage += REGION_RECORD + entry.size;
+		entry = entries[i];
+		u8 raw[REGION_ENTRY] = {};
+		writeU64(raw, entry.offset);
+		writeU32(raw + 8, entry.size);
+		if (pwrite(region.fd, raw, REGION_ENTRY,
+				REGION_TABLE + records[i].first * REGION_ENTRY) != REGION_ENTRY)
+			ok = false;
+	}
+	if (!ok)
+		warningstream << "Region: Failed to write table of " << region.path
+			<< ": " << strerror(errno) << std::endl;
+
+	mapRegion(region);
+	return ok;
+}
+
+bool Database_Region::saveBlock(const v3s16 &pos, const std::string &data)
+{
+	RegionPtr region = getRegion(regionPos(pos), true);
+	auto lock = region->lock_unique_rec();
+	return appendRecords(*region, {{regionIndex(pos), &data}});
+}
+
+bool Database_Region::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	// Group by region, later saves of same block win as they come later
+	std::map<v3s16, std::vector<std::pair<u32, const std::string *>>> regions;
+	for (const auto &block : blocks)
+		regions[regionPos(block.first)].emplace_back(regionIndex(block.first), &block.second);
+
+	bool ok = true;
+	for (const auto &ir : regions) {
+		RegionPtr region = getRegion(ir.first, true);
+		auto lock = region->lock_unique_rec();
+		ok = appendRecords(*region, ir.second) && ok;
+	}
+	return ok;
+}
+
+void Database_Region::loadBlock(const v3s16 &pos, std::string *block)
+{
+	RegionPtr region = getRegion(regionPos(pos), false);
+	if (!region)
+		return;
+	auto lock = region->lock_shared_rec();
+	const auto &entry = region->table[regionIndex(pos)];
+	if (!entry.size)
+		return;
+	block->assign((const char *)region->map + entry.offset, entry.size);
+}
+
+bool Database_Region::deleteBlock(const v3s16 &pos)
+{
+	RegionPtr region = getRegion(regionPos(pos), false);
+	if (!region)
+		return true;
+	auto lock = region->lock_unique_rec();
+	u32 index = regionIndex(pos);
+	auto &entry = region->table[index];
+	if (!entry.size)
+		return true;
+	region->garbage += REGION_RECORD + entry.size;
+	entry = {0, 0};
+	u8 raw[REGION_ENTRY] = {};
+	return pwrite(region->fd, raw, REGION_ENTRY,
+		REGION_TABLE + index * REGION_ENTRY) == REGION_ENTRY;
+}
+
+void Database_Region::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	for (const auto &file : fs::GetDirListing(m_dir)) {
+		Strfnd f(file.name);
+		if (file.dir || f.next(".") != "r")
+			continue;
+		v3s16 region_pos;
+		region_pos.X = stoi(f.next("."));
+		region_pos.Y = stoi(f.next("."));
+		region_pos.Z = stoi(f.next("."));
+		if (!f.at_end())
+			continue; // .tmp of compaction
+		RegionPtr region = getRegion(region_pos, false);
+		if (!region)
+			continue;
+		auto lock = region->lock_shared_rec();
+		for (u32 i = 0; i < REGION_BLOCKS; ++i) {
+			if (!region->table[i].size)
+				continue;
+			dst.push_back(region_pos * REGION_SIZE + v3s16(
+				i % REGION_SIZE,
+				i / REGION_SIZE % REGION_SIZE,
+				i / (REGION_SIZE * REGION_SIZE)));
+		}
+	}
+}
+
+void Database_Region::compact()
+{
+	std::vector<RegionPtr> regions;
+	{
+		std::lock_guard<Mutex> lock(m_regions_mutex);
+		regions.reserve(m_regions.size());
+		for (const auto &ir : m_regions)
+			regions.push_back(ir.second);
+	}
+	for (const auto &region : regions) {
+		{
+			auto lock = region->lock_shared_rec();
+			if (!needCompact(*region))
+				continue;
+		}
+		compactRegion(*region);
+	}
+}
+
+// Requires lock
+bool Database_Region::needCompact(const Region &region)
+{
+	return region.garbage > REGION_COMPACT_MIN && region.garbage * 2 > region.file_size;
+}
+
+// Write live records into new file and replace old one
+void Database_Region::compactRegion(Region &region)
+{
+	auto lock = region.lock_unique_rec();
+	// Saved to meanwhile
+	if (!needCompact(region))
+		return;
+	std::vector<std::pair<u32, const std::string *>> records;
+	std::vector<std::string> data;
+	data.reserve(REGION_BLOCKS);
+	for (u32 i = 0; i < REGION_BLOCKS; ++i) {
+		const auto &entry = region.table[i];
+		if (!entry.size)
+			continue;
+		data.emplace_back((const char *)region.map + entry.offset, entry.size);
+		records.emplace_back(i, &data.back());
+	}
+
+	u64 size_old = region.file_size;
+	Region compacted;
+	compacted.path = region.path + ".tmp";
+	::unlink(compacted.path.c_str());
+	openRegion(compacted, true);
+	if (!appendRecords(compacted, records) || fsync(compacted.fd) ||
+			!fs::Rename(compacted.path, region.path)) {
+		::unlink(compacted.path.c_str());
+		return;
+	}
+
+	std::swap(region.fd, compacted.fd);
+	std::swap(region.map, compacted.map);
+	std::swap(region.map_size, compacted.map_size);
+	region.file_size = compacted.file_size;
+	region.garbage = compacted.garbage;
+	region.table = compacted.table;
+
+	verbosestream << "Region: Compacted " << region.path << " " << size_old
+		<< " -> " << region.file_size << " bytes" << std::endl;
+}
+
+#endif
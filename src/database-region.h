@@ -0,0 +1,107 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DATABASE_REGION_HEADER
+#define DATABASE_REGION_HEADER
+
+#include "config.h"
+
+#ifndef _WIN32
+#define USE_REGION 1
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "database.h"
+#include "threading/lock.h"
+#include "threading/mutex.h"
+#include "util/unordered_map_hash.h"
+
+class thread_pool;
+
+/*
+	Map stored in region files of REGION_SIZE^3 blocks.
+	File: header, offset table of all blocks, then records appended on
+	every save. Files are mmap'd, so reading a block is a copy from
+	memory. Space of overwritten records is reclaimed by a compaction
+	thread which rewrites regions with mostly garbage.
+*/
+
+class Database_Region : public Database
+{
+public:
+	Database_Region(const std::string &savedir);
+	~Database_Region();
+
+	bool saveBlock(const v3s16 &pos, const std::string &data);
+	bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
+	void loadBlock(const v3s16 &pos, std::string *block);
+	bool deleteBlock(const v3s16 &pos);
+	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+
+	void open() {}
+	void close();
+
+	// Rewrite regions with more garbage than live data, called from thread
+	void compact();
+
+	static const s16 REGION_SIZE = 16;
+	static const u32 REGION_BLOCKS = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+
+private:
+	struct entry_type {
+		u64 offset;
+		u32 size;
+	};
+
+	struct Region : public shared_locker {
+		~Region();
+		std::string path;
+		int fd = -1;
+		u8 *map = nullptr;
+		size_t map_size = 0;
+		u64 file_size = 0;
+		u64 garbage = 0;
+		std::array<entry_type, REGION_BLOCKS> table;
+		std::atomic<u32> last_use;
+	};
+	typedef std::shared_ptr<Region> RegionPtr;
+
+	RegionPtr getRegion(const v3s16 &region_pos, bool create);
+	void openRegion(Region &region, bool create);
+	void mapRegion(Region &region);
+	bool appendRecords(Region &region, const std::vector<std::pair<u32, const std::string *>> &records);
+	static bool needCompact(const Region &region);
+	void compactRegion(Region &region);
+
+	static v3s16 regionPos(const v3s16 &pos);
+	static u32 regionIndex(const v3s16 &pos);
+
+	std::string m_dir;
+	std::unordered_map<v3POS, RegionPtr, v3POSHash, v3POSEqual> m_regions;
+	// Regions without a file, loading a missing block skips the stat
+	unordered_set_v3POS m_absent;
+	Mutex m_regions_mutex;
+	std::unique_ptr<thread_pool> m_compact_thread;
+};
+
+#endif
+
+#endif
@@ -254,6 +254,25 @@ void Database_SQLite3::loadBlock(const v3s16 &pos, std::string *block)
 
 	verifyDatabase();
 
+	readBlock(pos, block);
+}
+
+void Database_SQLite3::loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> &blocks)
+{
+	std::lock_guard<Mutex> lock(mutex);
+
+	verifyDatabase();
+
+	// Same prepared statement stepped for every block under one lock
+	blocks.resize(pos.size());
+	for (size_t i = 0; i < pos.size(); ++i) {
+		blocks[i].clear();
+		readBlock(pos[i], &blocks[i]);
+	}
+}
+
+void Database_SQLite3::readBlock(const v3s16 &pos, std::string *block)
+{
 	bindPos(m_stmt_read, pos);
 
 	if (sqlite3_step(m_stmt_read) != SQLITE_ROW) {
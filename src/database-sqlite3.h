@@ -47,6 +47,7 @@ class Database_SQLite3 : public Database
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> &blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 	bool initialized() const { return m_initialized; }
@@ -60,6 +61,8 @@ class Database_SQLite3 : public Database
 	void verifyDatabase();
 
 	void bindPos(sqlite3_stmt *stmt, const v3s16 &pos, int index=1);
+	// Requires mutex held
+	void readBlock(const v3s16 &pos, std::string *block);
 
 	bool m_initialized;
 
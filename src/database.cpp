@@ -72,17 +72,62 @@ v3s16 Database::getIntegerAsBlock(s64 i)
 	return pos;
 }
 
+// Every third bit of result is a bit of v
+static inline u64 morton_spread(u16 v)
+{
+	u64 x = v;
+	x = (x | x << 16) & 0x0000ff0000ffULL;
+	x = (x | x << 8) & 0x00f00f00f00fULL;
+	x = (x | x << 4) & 0x0c30c30c30c3ULL;
+	x = (x | x << 2) & 0x249249249249ULL;
+	return x;
+}
+
+static inline u16 morton_compact(u64 x)
+{
+	x &= 0x249249249249ULL;
+	x = (x | x >> 2) & 0x0c30c30c30c3ULL;
+	x = (x | x >> 4) & 0x00f00f00f00fULL;
+	x = (x | x >> 8) & 0x0000ff0000ffULL;
+	x = (x | x >> 16) & 0x00000000ffffULL;
+	return x;
+}
+
+std::string Database::getBlockAsMorton(const v3s16 &pos)
+{
+	// Shift to unsigned so negative coordinates sort first
+	u64 code = morton_spread(pos.X + 0x8000) |
+		morton_spread(pos.Y + 0x8000) << 1 |
+		morton_spread(pos.Z + 0x8000) << 2;
+	std::string key(7, 'm');
+	for (size_t n = 6; n > 0; --n, code >>= 8)
+		key[n] = code & 0xFF;
+	return key;
+}
+
 std::string Database::getBlockAsString(const v3s16 &pos) const {
 	std::ostringstream os;
 	os << "a" << pos.X << "," << pos.Y << "," << pos.Z;
 	return os.str().c_str();
 }
 
+v3s16 Database::getMortonAsBlock(const std::string &key)
+{
+	u64 code = 0;
+	for (size_t n = 1; n < 7; ++n)
+		code = code << 8 | (u8)key[n];
+	return v3s16((s32)morton_compact(code) - 0x8000,
+		(s32)morton_compact(code >> 1) - 0x8000,
+		(s32)morton_compact(code >> 2) - 0x8000);
+}
+
 v3s16 Database::getStringAsBlock(const std::string &i) const {
 	std::istringstream is(i);
 	v3s16 pos;
 	char c;
-	if (i[0] == 'a') {
+	if (i[0] == 'm' && i.size() == 7) {
+		return getMortonAsBlock(i);
+	} else if (i[0] == 'a') {
 		is >> c; // 'a'
 		is >> pos.X;
 		is >> c; // ','
@@ -94,3 +139,22 @@ v3s16 Database::getStringAsBlock(const std::string &i) const {
 	}
 	return pos;
 }
+
+bool Database::saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks)
+{
+	bool ok = true;
+	beginSave();
+	for (const auto &block : blocks)
+		ok = saveBlock(block.first, block.second) && ok;
+	endSave();
+	return ok;
+}
+
+void Database::loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> &blocks)
+{
+	blocks.resize(pos.size());
+	for (size_t i = 0; i < pos.size(); ++i) {
+		blocks[i].clear();
+		loadBlock(pos[i], &blocks[i]);
+	}
+}
@@ -25,6 +25,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <vector>
 #include <string>
+#include <utility>
 #include "irr_v3d.h"
 #include "irrlichttypes.h"
 #include <string>
@@ -39,7 +40,11 @@ class Database
 	virtual void endSave() {}
 
 	virtual bool saveBlock(const v3s16 &pos, const std::string &data) = 0;
+	// Group commit, default is saveBlock() calls between beginSave() and endSave()
+	virtual bool saveBlocks(const std::vector<std::pair<v3s16, std::string>> &blocks);
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
+	// Multi-get, blocks[i] is data of pos[i] or empty when missing
+	virtual void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> &blocks);
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
 	static s64 getBlockAsInteger(const v3s16 &pos);
@@ -52,6 +57,10 @@ class Database
 
 	std::string getBlockAsString(const v3POS &pos) const;
 	v3POS getStringAsBlock(const std::string &i) const;
+	// Z-order key, 'm' + 6 bytes big endian of interleaved coordinate bits.
+	// Byte order of keys follows 3D locality.
+	static std::string getBlockAsMorton(const v3POS &pos);
+	static v3POS getMortonAsBlock(const std::string &key);
 	virtual void open() {};
 	virtual void close() {};
 };
@@ -184,6 +184,7 @@ void fm_set_default_settings(Settings *settings) {
 	settings->setDefault("liquid_send", android ? "3.0" : "1.0");
 	settings->setDefault("liquid_relax", android ? "1" : "2");
 	settings->setDefault("liquid_fast_flood", "-200");
+	settings->setDefault("liquid_threads", threads ? "2" : "1");
 
 	// Weather
 	settings->setDefault("weather", threads ? "true" : "false");
@@ -241,10 +242,18 @@ void fm_set_default_settings(Settings *settings) {
 	settings->setDefault("emergequeue_limit_diskonly", ""); // autodetect from number of cpus
 	settings->setDefault("emergequeue_limit_generate", ""); // autodetect from number of cpus
 	settings->setDefault("emergequeue_limit_total", ""); // autodetect from number of cpus
+	settings->setDefault("emerge_prefetch", "64");
+	settings->setDefault("mapgen_task_threads", threads ? "4" : "0");
 	settings->setDefault("num_emerge_threads", ""); // "1"
 	settings->setDefault("server_map_save_interval", "300"); // "5.3"
 	settings->setDefault("sqlite_synchronous", "1"); // "2"
 	settings->setDefault("save_generated_block", "true");
+	settings->setDefault("map_compression", "zlib"); // zlib, zstd, lz4
+	settings->setDefault("map_compression_dictionary", "");
+	settings->setDefault("map_save_threads", threads ? "2" : "0");
+	settings->setDefault("network_compression", "lz4");
+	settings->setDefault("block_send_cache_size", android ? "8" : "64");
+	settings->setDefault("block_delta_max", "256");
 	settings->setDefault("block_delete_time", threads && arm ? "60" : threads ? "30" : "10");
 
 #if (ENET_IPV6 || MINETEST_PROTO || USE_SCTP)
@@ -282,6 +291,7 @@ void fm_set_default_settings(Settings *settings) {
 	settings->setDefault("animation_wd_stop", "219");
 */
 	settings->setDefault("more_threads", "true");
+	settings->setDefault("receive_threads", "4");
 	settings->setDefault("console_enabled", debug ? "true" : "false");
 
 	if (win32) {
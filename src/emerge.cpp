@@ -23,12 +23,17 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "emerge.h"
 
+#include <algorithm>
+#include <array>
+#include <deque>
 #include <iostream>
-#include <queue>
+#include <unordered_map>
 
 #include "util/container.h"
 #include "util/thread.h"
 #include "threading/event.h"
+#include "threading/mpmc_queue.h"
+#include "threading/task_graph.h"
 
 #include "config.h"
 #include "constants.h"
@@ -47,9 +52,16 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "serverobject.h"
 #include "settings.h"
 #include "voxel.h"
+#include "util/unordered_map_hash.h"
 
 #include "threading/thread_pool.h"
 
+// Chunk queues of a thread by coarse priority, nearest taken first
+#define EMERGE_PRIORITY_BUCKETS 4
+// Priority (distance in blocks) where the second bucket starts, each next
+// bucket starts twice as far
+#define EMERGE_BUCKET_NEAR 3.0f
+
 class EmergeThread : public thread_pool {
 public:
 	bool enable_mapgen_debug_info;
@@ -61,8 +73,12 @@ class EmergeThread : public thread_pool {
 	void *run();
 	void signal();
 
-	// Requires queue mutex held
-	bool pushBlock(v3s16 pos);
+	// Any thread, false if the queue is full
+	bool pushChunk(v3s16 chunkpos, u8 bucket);
+	// Chunks queued or worked on, approximate
+	u32 getQueueDepth() { return m_depth; }
+	// Waiting for work, signal() makes it steal from the deepest queue
+	bool isIdle() { return m_idle; }
 
 	void cancelPendingItems();
 
@@ -77,9 +93,51 @@ class EmergeThread : public thread_pool {
 	Mapgen *m_mapgen;
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+
+	// Pushed by any thread, popped by this thread and by idle threads
+	// stealing from it. One ring per priority bucket, drained in order.
+	std::array<std::unique_ptr<mpmc_queue<v3s16>>, EMERGE_PRIORITY_BUCKETS> m_chunk_queues;
+	std::atomic<u32> m_depth;
+	std::atomic_bool m_idle;
+
+	struct QueuedChunk {
+		v3s16 pos;
+		float priority;
+		u32 seq;
+
+		// Heap order, best on top, FIFO between equal
+		bool operator<(const QueuedChunk &other) const
+		{
+			if (priority != other.priority)
+				return priority > other.priority;
+			return seq > other.seq;
+		}
+	};
+	// Next chunks taken from m_chunk_queues to be ordered exactly by
+	// priority. Heap, this thread only, not stealable, so kept small.
+	std::vector<QueuedChunk> m_window;
+	u32 m_chunk_seq;
+	u32 m_views_version;
+
+	// Chunk worked on and its requested blocks left, this thread only
+	v3s16 m_chunk_pos;
+	bool m_chunk_active;
+	std::vector<std::pair<v3s16, BlockEmergeData> > m_chunk_blocks;
+
+	void reprioritize();
+	// From the nearest non empty bucket
+	bool popQueued(v3s16 *chunkpos);
+	size_t queuedSize();
+	bool popChunk(v3s16 *chunkpos);
+	bool stealChunk(v3s16 *chunkpos);
+
+	// Database data of queued blocks, loaded in one multi-get.
+	// Empty string: not in database.
+	std::unordered_map<v3POS, std::string, v3POSHash, v3POSEqual> m_prefetched;
+	u32 m_prefetch_time;
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	void prefetchBlocks(v3s16 pos);
 
 	EmergeAction getBlockOrStartGen(
 		v3s16 pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
@@ -106,6 +164,8 @@ EmergeManager::EmergeManager(IGameDef *gamedef)
 	// This is because the *only* thread ever starting or stopping
 	// EmergeThreads should be the ServerThread.
 	this->m_threads_active = false;
+	this->m_views_version = 0;
+	this->m_blocks_count = 0;
 
 	enable_mapgen_debug_info = g_settings->getBool("enable_mapgen_debug_info");
 
@@ -121,6 +181,13 @@ EmergeManager::EmergeManager(IGameDef *gamedef)
 	if (nthreads < 1)
 		nthreads = 1;
 
+	m_task_threads = 0;
+#if ENABLE_THREADS
+	m_task_threads = g_settings->getS16("mapgen_task_threads");
+#endif
+	if (m_task_threads > 0)
+		m_task_pool.reset(new task_pool("MapgenTasks"));
+
 	m_qlimit_total = g_settings->getU16("emergequeue_limit_total");
 	if (!g_settings->getU16NoEx("emergequeue_limit_diskonly", m_qlimit_diskonly))
 		{ }
@@ -204,6 +271,9 @@ void EmergeManager::startThreads()
 	for (u32 i = 0; i != m_threads.size(); i++)
 		m_threads[i]->start();
 
+	if (m_task_pool)
+		m_task_pool->start(m_task_threads);
+
 	m_threads_active = true;
 }
 
@@ -223,6 +293,9 @@ void EmergeManager::stopThreads()
 	for (u32 i = 0; i != m_threads.size(); i++)
 		m_threads[i]->wait();
 
+	if (m_task_pool)
+		m_task_pool->join();
+
 	m_threads_active = false;
 }
 
@@ -256,29 +329,123 @@ bool EmergeManager::enqueueBlockEmergeEx(
 	EmergeCompletionCallback callback,
 	void *callback_param)
 {
-	EmergeThread *thread = NULL;
+	v3s16 chunkpos = getContainingChunk(blockpos);
 	bool entry_already_exists = false;
+	bool chunk_already_exists = false;
 
 	{
-		MutexAutoLock queuelock(m_queue_mutex);
+		ChunkShard &shard = getChunkShard(chunkpos);
+		MutexAutoLock shardlock(shard.mutex);
 
-		if (!pushBlockEmergeData(blockpos, peer_id, flags,
-				callback, callback_param, &entry_already_exists))
+		if (!pushBlockEmergeData(shard, chunkpos, blockpos, peer_id, flags,
+				callback, callback_param,
+				&entry_already_exists, &chunk_already_exists))
 			return false;
+	}
 
-		if (entry_already_exists)
-			return true;
+	// Queued already, or worked on and will be seen by that thread
+	if (entry_already_exists || chunk_already_exists)
+		return true;
 
-		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
+	u8 bucket = getPriorityBucket(blockpos);
+	EmergeThread *thread = getOptimalThread();
+	bool queued = thread->pushChunk(chunkpos, bucket);
+	for (size_t i = 0; !queued && i != m_threads.size(); i++) {
+		thread = m_threads[i];
+		queued = thread->pushChunk(chunkpos, bucket);
+	}
+	if (!queued) {
+		errorstream << "EmergeManager: all queues full, cancelling chunk "
+			<< PP(chunkpos) << std::endl;
+		cancelChunk(chunkpos);
+		return false;
 	}
 
 	thread->signal();
 
+	/*
+		The thread may be busy with an expensive chunk, an idle thread
+		steals the backlog; waking one is enough, it steals until empty.
+		A thread going idle after this check tries to steal once more.
+	*/
+	if (thread->getQueueDepth() > 1) {
+		for (EmergeThread *other : m_threads) {
+			if (other != thread && other->isIdle()) {
+				other->signal();
+				break;
+			}
+		}
+	}
+
 	return true;
 }
 
 
+void EmergeManager::updateView(u16 peer_id, v3f pos, v3f dir, s16 range)
+{
+	MutexAutoLock viewslock(m_views_mutex);
+	m_views[peer_id] = {pos, dir, range};
+	m_views_version++;
+}
+
+
+void EmergeManager::removeView(u16 peer_id)
+{
+	MutexAutoLock viewslock(m_views_mutex);
+	if (m_views.erase(peer_id))
+		m_views_version++;
+}
+
+
+float EmergeManager::getPriority(v3s16 pos, bool *in_range)
+{
+	*in_range = m_views.empty();
+	if (m_views.empty())
+		return 0;
+
+	// Distance to nearest player, behind the camera counts up to twice as far
+	v3f p(pos.X + 0.5f, pos.Y + 0.5f, pos.Z + 0.5f);
+	float best = -1;
+	for (const auto &it : m_views) {
+		const EmergeView &view = it.second;
+		v3f d = p - view.pos;
+		float dist = d.getLength();
+		if (dist <= view.range + 1)
+			*in_range = true;
+		float dot = dist > 0.001f ? d.dotProduct(view.dir) / dist : 1;
+		float priority = dist * (1.5f - 0.5f * dot);
+		if (best < 0 || priority < best)
+			best = priority;
+	}
+	return best;
+}
+
+
+/*
+	Bucket is fixed when the chunk is queued. Coarse buckets keep far
+	chunks behind near ones in the rings, the window orders exactly.
+*/
+u8 EmergeManager::getPriorityBucket(v3s16 blockpos)
+{
+	MutexAutoLock viewslock(m_views_mutex);
+	bool in_range;
+	float priority = getPriority(blockpos, &in_range);
+	u8 bucket = 0;
+	for (float limit = EMERGE_BUCKET_NEAR;
+			bucket + 1 < EMERGE_PRIORITY_BUCKETS && priority >= limit; limit *= 2)
+		++bucket;
+	return bucket;
+}
+
+
+bool EmergeManager::isDroppable(const BlockEmergeData &bedata)
+{
+	return bedata.peer_requested != PEER_ID_INEXISTENT &&
+		bedata.callbacks.empty() &&
+		!(bedata.flags & BLOCK_EMERGE_FORCE_QUEUE);
+}
+
+
 //
 // Mapgen-related helper functions
 //
@@ -338,18 +505,33 @@ bool EmergeManager::isBlockUnderground(v3s16 blockpos)
 	return blockpos.Y * (MAP_BLOCKSIZE + 1) <= mgparams->water_level;
 }
 
+EmergeManager::ChunkShard &EmergeManager::getChunkShard(v3s16 chunkpos)
+{
+	// Chunk positions are multiples of chunksize, spread them
+	size_t h = v3POSHash()(chunkpos);
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return m_chunk_shards[h % CHUNK_SHARDS];
+}
+
+
 bool EmergeManager::pushBlockEmergeData(
+	ChunkShard &shard,
+	v3s16 chunkpos,
 	v3s16 pos,
 	u16 peer_requested,
 	u16 flags,
 	EmergeCompletionCallback callback,
 	void *callback_param,
-	bool *entry_already_exists)
+	bool *entry_already_exists,
+	bool *chunk_already_exists)
 {
+	MutexAutoLock peerlock(m_peer_mutex);
 	u16 &count_peer = m_peer_queue_count[peer_requested];
 
 	if ((flags & BLOCK_EMERGE_FORCE_QUEUE) == 0) {
-		if (m_blocks_enqueued.size() >= m_qlimit_total)
+		if (m_blocks_count >= m_qlimit_total)
 			return false;
 		if (peer_requested != PEER_ID_INEXISTENT) {
 			u16 qlimit_peer = (flags & BLOCK_EMERGE_ALLOW_GEN) ?
@@ -359,8 +541,12 @@ bool EmergeManager::pushBlockEmergeData(
 		}
 	}
 
+	auto chunk_res = shard.chunks.insert(std::make_pair(chunkpos, EmergeChunk()));
+	*chunk_already_exists = !chunk_res.second;
+
 	std::pair<std::map<v3s16, BlockEmergeData>::iterator, bool> findres;
-	findres = m_blocks_enqueued.insert(std::make_pair(pos, BlockEmergeData()));
+	findres = chunk_res.first->second.blocks.insert(
+		std::make_pair(pos, BlockEmergeData()));
 
 	BlockEmergeData &bedata = findres.first->second;
 	*entry_already_exists   = !findres.second;
@@ -375,34 +561,109 @@ bool EmergeManager::pushBlockEmergeData(
 		bedata.peer_requested = peer_requested;
 
 		count_peer++;
+		m_blocks_count++;
 	}
 
 	return true;
 }
 
 
-bool EmergeManager::popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata)
+void EmergeManager::popChunkData(EmergeChunk &chunk,
+	std::vector<std::pair<v3s16, BlockEmergeData> > *blocks)
+{
+	MutexAutoLock peerlock(m_peer_mutex);
+
+	for (auto &block : chunk.blocks) {
+		auto it = m_peer_queue_count.find(block.second.peer_requested);
+		if (it != m_peer_queue_count.end()) {
+			u16 &count_peer = it->second;
+			assert(count_peer != 0);
+			count_peer--;
+		}
+		m_blocks_count--;
+		if (blocks)
+			blocks->push_back(std::move(block));
+	}
+
+	chunk.blocks.clear();
+}
+
+
+bool EmergeManager::takeChunkBlocks(v3s16 chunkpos,
+	std::vector<std::pair<v3s16, BlockEmergeData> > *blocks)
 {
-	std::map<v3s16, BlockEmergeData>::iterator it;
-	UNORDERED_MAP<u16, u16>::iterator it2;
+	ChunkShard &shard = getChunkShard(chunkpos);
+	MutexAutoLock shardlock(shard.mutex);
 
-	it = m_blocks_enqueued.find(pos);
-	if (it == m_blocks_enqueued.end())
+	auto it = shard.chunks.find(chunkpos);
+	if (it == shard.chunks.end())
 		return false;
 
-	*bedata = it->second;
+	if (it->second.blocks.empty()) {
+		shard.chunks.erase(it);
+		return false;
+	}
+
+	// The entry stays while the thread works on the chunk
+	popChunkData(it->second, blocks);
+	return true;
+}
+
 
-	it2 = m_peer_queue_count.find(bedata->peer_requested);
-	if (it2 == m_peer_queue_count.end())
+/*
+	Players moved away: player requests no player is in range of anymore
+	are dropped, the player asks again when it comes closer.
+*/
+bool EmergeManager::prioritizeChunk(v3s16 chunkpos, float *priority)
+{
+	MutexAutoLock viewslock(m_views_mutex);
+	ChunkShard &shard = getChunkShard(chunkpos);
+	MutexAutoLock shardlock(shard.mutex);
+
+	auto it = shard.chunks.find(chunkpos);
+	if (it == shard.chunks.end())
 		return false;
 
-	u16 &count_peer = it2->second;
-	assert(count_peer != 0);
-	count_peer--;
+	bool chunk_in_range = false;
+	bool droppable = true;
+	float best = -1;
+	for (const auto &block : it->second.blocks) {
+		bool in_range;
+		float p = getPriority(block.first, &in_range);
+		chunk_in_range |= in_range;
+		droppable &= isDroppable(block.second);
+		if (best < 0 || p < best)
+			best = p;
+	}
+	*priority = best < 0 ? 0 : best;
 
-	m_blocks_enqueued.erase(it);
+	if (chunk_in_range || !droppable)
+		return true;
 
-	return true;
+	g_profiler->add("Emerge: dropped out of range", it->second.blocks.size());
+	popChunkData(it->second, nullptr);
+	shard.chunks.erase(it);
+	return false;
+}
+
+
+void EmergeManager::cancelChunk(v3s16 chunkpos)
+{
+	std::vector<std::pair<v3s16, BlockEmergeData> > blocks;
+	{
+		ChunkShard &shard = getChunkShard(chunkpos);
+		MutexAutoLock shardlock(shard.mutex);
+
+		auto it = shard.chunks.find(chunkpos);
+		if (it == shard.chunks.end())
+			return;
+		popChunkData(it->second, &blocks);
+		shard.chunks.erase(it);
+	}
+
+	for (const auto &block : blocks)
+		EmergeThread::runCompletionCallbacks(block.first, EMERGE_CANCELLED,
+			block.second.callbacks);
 }
 
 
@@ -413,13 +674,13 @@ EmergeThread *EmergeManager::getOptimalThread()
 	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
 
 	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	u32 depth_lowest = m_threads[0]->getQueueDepth();
 
 	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
-		if (nitems < nitems_lowest) {
+		u32 depth = m_threads[i]->getQueueDepth();
+		if (depth < depth_lowest) {
 			index = i;
-			nitems_lowest = nitems;
+			depth_lowest = depth;
 		}
 	}
 
@@ -431,15 +692,28 @@ EmergeThread *EmergeManager::getOptimalThread()
 //// EmergeThread
 ////
 
+// Chunks, per thread
+#define EMERGE_CHUNK_QUEUE_SIZE 4096
+// Chunks ordered by priority, not stealable
+#define EMERGE_WINDOW_SIZE 4
+
 EmergeThread::EmergeThread(Server *server, int ethreadid) :
 	enable_mapgen_debug_info(false),
 	id(ethreadid),
 	m_server(server),
 	m_map(NULL),
 	m_emerge(NULL),
-	m_mapgen(NULL)
+	m_mapgen(NULL),
+	m_depth(0),
+	m_idle(false),
+	m_chunk_seq(0),
+	m_views_version(0),
+	m_chunk_active(false),
+	m_prefetch_time(0)
 {
 	m_name = "Emerge-" + itos(ethreadid);
+	for (auto &queue : m_chunk_queues)
+		queue.reset(new mpmc_queue<v3s16>(EMERGE_CHUNK_QUEUE_SIZE));
 }
 
 
@@ -455,28 +729,124 @@ void EmergeThread::signal()
 }
 
 
-bool EmergeThread::pushBlock(v3s16 pos)
+bool EmergeThread::pushChunk(v3s16 chunkpos, u8 bucket)
+{
+	// Count first, a thief may take it right after the push
+	m_depth++;
+	if (m_chunk_queues[bucket]->push(chunkpos))
+		return true;
+	m_depth--;
+	return false;
+}
+
+
+bool EmergeThread::popQueued(v3s16 *chunkpos)
+{
+	for (auto &queue : m_chunk_queues)
+		if (queue->pop(*chunkpos))
+			return true;
+	return false;
+}
+
+
+size_t EmergeThread::queuedSize()
+{
+	size_t size = 0;
+	for (auto &queue : m_chunk_queues)
+		size += queue->size();
+	return size;
+}
+
+
+void EmergeThread::reprioritize()
+{
+	m_views_version = m_emerge->m_views_version;
+
+	auto keep = m_window.begin();
+	for (auto it = m_window.begin(); it != m_window.end(); ++it) {
+		if (!m_emerge->prioritizeChunk(it->pos, &it->priority)) {
+			m_depth--;
+			continue;
+		}
+		*keep++ = *it;
+	}
+	m_window.erase(keep, m_window.end());
+	std::make_heap(m_window.begin(), m_window.end());
+}
+
+
+/*
+	Take a chunk of the thread with the deepest queue. Whole chunks move,
+	so generation of one chunk still happens in one thread.
+*/
+bool EmergeThread::stealChunk(v3s16 *chunkpos)
 {
-	m_block_queue.push(pos);
+	EmergeThread *victim = NULL;
+	size_t depth_highest = 0;
+	for (EmergeThread *thread : m_emerge->m_threads) {
+		size_t depth = thread->queuedSize();
+		if (thread != this && depth > depth_highest) {
+			victim = thread;
+			depth_highest = depth;
+		}
+	}
+	if (!victim || !victim->popQueued(chunkpos))
+		return false;
+
+	victim->m_depth--;
+	m_depth++;
+	g_profiler->add("Emerge: steals", 1);
+	return true;
+}
+
+
+bool EmergeThread::popChunk(v3s16 *chunkpos)
+{
+	if (m_views_version != m_emerge->m_views_version)
+		reprioritize();
+
+	g_profiler->avg("Emerge: queue depth", m_depth);
+
+	v3s16 queued;
+	while (m_window.size() < EMERGE_WINDOW_SIZE && popQueued(&queued)) {
+		float priority;
+		if (!m_emerge->prioritizeChunk(queued, &priority)) {
+			m_depth--;
+			continue;
+		}
+		m_window.push_back({queued, priority, m_chunk_seq++});
+		std::push_heap(m_window.begin(), m_window.end());
+	}
+
+	if (m_window.empty())
+		return stealChunk(chunkpos);
+
+	std::pop_heap(m_window.begin(), m_window.end());
+	*chunkpos = m_window.back().pos;
+	m_window.pop_back();
 	return true;
 }
 
 
 void EmergeThread::cancelPendingItems()
 {
-	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+	for (const auto &block : m_chunk_blocks)
+		runCompletionCallbacks(block.first, EMERGE_CANCELLED, block.second.callbacks);
+	m_chunk_blocks.clear();
 
-	while (!m_block_queue.empty()) {
-		BlockEmergeData bedata;
-		v3s16 pos;
+	if (m_chunk_active)
+		m_emerge->cancelChunk(m_chunk_pos);
+	m_chunk_active = false;
 
-		pos = m_block_queue.front();
-		m_block_queue.pop();
+	for (const auto &queued : m_window)
+		m_emerge->cancelChunk(queued.pos);
+	m_window.clear();
 
-		m_emerge->popBlockEmergeData(pos, &bedata);
+	v3s16 chunkpos;
+	while (popQueued(&chunkpos))
+		m_emerge->cancelChunk(chunkpos);
 
-		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
-	}
+	m_depth = 0;
 }
 
 
@@ -499,20 +869,71 @@ void EmergeThread::runCompletionCallbacks(
 
 bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
-	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+	for (;;) {
+		if (!m_chunk_blocks.empty()) {
+			*pos = m_chunk_blocks.back().first;
+			*bedata = std::move(m_chunk_blocks.back().second);
+			m_chunk_blocks.pop_back();
+			return true;
+		}
 
-	if (m_block_queue.empty())
-		return false;
+		// Blocks requested while working on the chunk, or it is done
+		if (m_chunk_active) {
+			if (m_emerge->takeChunkBlocks(m_chunk_pos, &m_chunk_blocks))
+				continue;
+			m_chunk_active = false;
+			m_depth--;
+		}
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+		if (!popChunk(&m_chunk_pos))
+			return false;
+		m_chunk_active = true;
+	}
+}
 
-	m_emerge->popBlockEmergeData(*pos, bedata);
 
-	return true;
-}
+/*
+	Load pos and the blocks queued after it with one database request.
+	Blocks in memory are skipped, and a block can not be loaded, changed
+	and unloaded again within EMERGE_PREFETCH_TTL, so the data stays valid.
+	Blocks saved but not written yet are taken from the saver by loadBlock.
+*/
+#define EMERGE_PREFETCH_TTL 2000 // ms, far below block_delete_time
 
+void EmergeThread::prefetchBlocks(v3s16 pos)
+{
+	static const u16 prefetch_max = g_settings->getU16("emerge_prefetch");
+	if (prefetch_max < 2)
+		return;
 
+	u32 now = porting::getTimeMs();
+	if (m_prefetched.count(pos) && now - m_prefetch_time < EMERGE_PREFETCH_TTL)
+		return;
+	m_prefetched.clear();
+
+	std::vector<v3s16> positions;
+	positions.push_back(pos);
+	// Blocks left of the chunk, popped from the back
+	for (auto it = m_chunk_blocks.rbegin(); it != m_chunk_blocks.rend(); ++it) {
+		if (positions.size() >= prefetch_max)
+			break;
+		positions.push_back(it->first);
+	}
+	positions.erase(std::remove_if(positions.begin(), positions.end(),
+		[this](const v3s16 &p) {
+			return blockpos_over_limit(p) ||
+				m_map->getBlockNoCreateNoEx(p, false, true);
+		}), positions.end());
+	if (positions.size() < 2)
+		return;
+
+	std::vector<std::string> blobs;
+	m_map->loadBlocksData(positions, blobs);
+	for (size_t i = 0; i < positions.size(); ++i)
+		m_prefetched[positions[i]].swap(blobs[i]);
+	m_prefetch_time = now;
+	g_profiler->avg("Emerge: prefetch blocks", positions.size());
+}
 
 
 EmergeAction EmergeThread::getBlockOrStartGen(
@@ -533,7 +954,13 @@ EmergeAction EmergeThread::getBlockOrStartGen(
 	{
 		MAP_NOTHREAD_LOCK(m_map);
 		// 2). Attempt to load block from disk if it was not in the memory
-		*block = m_map->loadBlock(pos);
+		auto it = m_prefetched.find(pos);
+		if (it != m_prefetched.end()) {
+			*block = m_map->loadBlock(pos, &it->second);
+			m_prefetched.erase(it);
+		} else {
+			*block = m_map->loadBlock(pos);
+		}
 	}
 
 		if (*block && (*block)->isGenerated())
@@ -640,13 +1067,21 @@ void *EmergeThread::run()
 		MapBlock *block;
 
 		if (!popBlockEmerge(&pos, &bedata)) {
-			m_queue_event.wait();
-			continue;
+			// Pushes seeing m_idle wake this thread, others are stolen now
+			m_idle = true;
+			if (!popBlockEmerge(&pos, &bedata)) {
+				m_queue_event.wait();
+				m_idle = false;
+				continue;
+			}
+			m_idle = false;
 		}
 
 		if (blockpos_over_limit(pos))
 			continue;
 
+		prefetchBlocks(pos);
+
 		bool allow_gen = bedata.flags & BLOCK_EMERGE_ALLOW_GEN;
 		EMERGE_DBG_OUT("pos=" PP(pos) " allow_gen=" << allow_gen);
 
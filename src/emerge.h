@@ -23,9 +23,12 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef EMERGE_HEADER
 #define EMERGE_HEADER
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include "irr_v3d.h"
 #include "util/container.h"
+#include "util/unordered_map_hash.h"
 #include "mapgen.h" // for MapgenParams
 #include "map.h"
 
@@ -46,6 +49,7 @@ class BiomeManager;
 class OreManager;
 class DecorationManager;
 class SchematicManager;
+class task_pool;
 
 // Structure containing inputs/outputs for chunk generation
 struct BlockMakeData {
@@ -146,6 +150,14 @@ class EmergeManager {
 
 	Mapgen *getCurrentMapgen();
 
+	// Shared by mapgens for tasks of one chunk, nullptr if disabled
+	task_pool *getTaskPool() { return m_task_pool.get(); }
+
+	// Player views for queue priorities: pos in blocks, dir normalized,
+	// range in blocks. Requests out of every range are dropped.
+	void updateView(u16 peer_id, v3f pos, v3f dir, s16 range);
+	void removeView(u16 peer_id);
+
 	// Mapgen helpers methods
 	Biome *getBiomeAtPoint(v3s16 p);
 	int getSpawnLevelAtPoint(v2s16 p);
@@ -159,26 +171,79 @@ class EmergeManager {
 	std::vector<EmergeThread *> m_threads;
 	bool m_threads_active;
 
-	Mutex m_queue_mutex;
-	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
+	std::unique_ptr<task_pool> m_task_pool;
+	s16 m_task_threads;
+
+	/*
+		Requests are queued by mapgen chunk: a chunk is in the queue of one
+		thread, or worked on by one thread, until it has no requested blocks
+		left. Blocks requested meanwhile join the chunk, so a chunk is never
+		generated by two threads. Entries are split over shards with own
+		locks, enqueue and the emerge threads only meet on one shard.
+	*/
+	struct EmergeChunk {
+		std::map<v3s16, BlockEmergeData> blocks;
+	};
+	struct ChunkShard {
+		Mutex mutex;
+		unordered_map_v3POS<EmergeChunk> chunks;
+	};
+	static const size_t CHUNK_SHARDS = 16;
+	ChunkShard m_chunk_shards[CHUNK_SHARDS];
+	std::atomic<u32> m_blocks_count;
+
+	Mutex m_peer_mutex;
 	UNORDERED_MAP<u16, u16> m_peer_queue_count;
 
 	u16 m_qlimit_total;
 	u16 m_qlimit_diskonly;
 	u16 m_qlimit_generate;
 
-	// Requires m_queue_mutex held
-	EmergeThread *getOptimalThread();
+	struct EmergeView {
+		v3f pos;
+		v3f dir;
+		s16 range;
+	};
+	Mutex m_views_mutex;
+	UNORDERED_MAP<u16, EmergeView> m_views;
+	std::atomic<u32> m_views_version;
+
+	ChunkShard &getChunkShard(v3s16 chunkpos);
 
+	EmergeThread *getOptimalThread();
+	// Requires m_views_mutex held. Lower is sooner
+	float getPriority(v3s16 pos, bool *in_range);
+	// Queue bucket of a chunk requested for blockpos, 0 is nearest
+	u8 getPriorityBucket(v3s16 blockpos);
+	// Nobody waits for it except the requesting player
+	bool isDroppable(const BlockEmergeData &bedata);
+
+	// Requires shard mutex held
 	bool pushBlockEmergeData(
+		ChunkShard &shard,
+		v3s16 chunkpos,
 		v3s16 pos,
 		u16 peer_requested,
 		u16 flags,
 		EmergeCompletionCallback callback,
 		void *callback_param,
-		bool *entry_already_exists);
+		bool *entry_already_exists,
+		bool *chunk_already_exists);
+
+	// Requires shard mutex held. Moves the blocks out, blocks may be NULL
+	void popChunkData(EmergeChunk &chunk,
+		std::vector<std::pair<v3s16, BlockEmergeData> > *blocks);
+
+	// Blocks of a chunk requested since the last call. The chunk is done
+	// and removed when there are none left, then false is returned.
+	bool takeChunkBlocks(v3s16 chunkpos,
+		std::vector<std::pair<v3s16, BlockEmergeData> > *blocks);
+
+	// Priority of the best block of a queued chunk. false if the chunk is
+	// gone: dropped as out of every view range, or cancelled
+	bool prioritizeChunk(v3s16 chunkpos, float *priority);
 
-	bool popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata);
+	void cancelChunk(v3s16 chunkpos);
 
 	friend class EmergeThread;
 
@@ -20,6 +20,7 @@ You should have received a copy of the GNU General Public License
 along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <fstream>
 #include "environment.h"
 #include "filesys.h"
@@ -67,6 +68,12 @@ std::mt19937 random_gen(random_device());
 // A number that is much smaller than the timeout for particle spawners should/could ever be
 #define PARTICLE_SPAWNER_NO_EXPIRY -1024.f
 
+// Object movement send steps by distance to the nearest player, nodes
+#define MOVEMENT_SEND_RANGE_NEAR (MAP_BLOCKSIZE * 3)
+#define MOVEMENT_SEND_RANGE_MIDDLE (MAP_BLOCKSIZE * 6)
+#define MOVEMENT_SEND_INTERVAL_MIDDLE 2
+#define MOVEMENT_SEND_INTERVAL_FAR 4
+
 Environment::Environment():
 	m_time_of_day_speed(0),
 /*
@@ -423,6 +430,21 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block, u32 stamp)
 	MapNode n;
 	content_t c;
 	lbm_lookup_map::const_iterator it = getLBMsIntroducedAfter(stamp);
+
+	// Don't scan nodes if no content of block has a lbm
+	MapBlock::content_counts_type contents;
+	if (block->getContentCounts(contents)) {
+		bool found = false;
+		for (auto & ic : contents) {
+			for (auto iit = it; iit != m_lbm_lookup.end() && !found; ++iit)
+				found = iit->second.lookup(ic.first);
+			if (found)
+				break;
+		}
+		if (!found)
+			return;
+	}
+
 	for (pos.X = 0; pos.X < MAP_BLOCKSIZE; pos.X++)
 	for (pos.Y = 0; pos.Y < MAP_BLOCKSIZE; pos.Y++)
 	for (pos.Z = 0; pos.Z < MAP_BLOCKSIZE; pos.Z++)
@@ -531,6 +553,8 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_circuit(m_script, map, gamedef->ndef(), path_world),
 	m_path_world(path_world),
 	m_send_recommended_timer(0),
+	m_send_recommended_step(0),
+	m_movement_deltas(false),
 	m_active_objects_last(0),
 	m_active_block_abm_last(0),
 	m_active_block_abm_dtime(0),
@@ -992,15 +1016,32 @@ void ServerEnvironment::loadDefaultMeta()
 				block->abm_triggers->clear();
 		}
 
-#if ENABLE_THREADS
-		auto map = std::unique_ptr<VoxelManipulator> (new VoxelManipulator);
-		{
-			//ScopeProfiler sp(g_profiler, "ABM copy", SPT_ADD);
-			m_env->getServerMap().copy_27_blocks_to_vm(block, *map);
+		auto *ndef = m_env->getGameDef()->ndef();
+
+		int heat_num = 0;
+		int heat_sum = 0;
+
+		// Skip the node scan if no content in block can trigger an abm
+		MapBlock::content_counts_type contents;
+		bool contents_known = block->getContentCounts(contents);
+		if (contents_known) {
+			bool can_trigger = false;
+			for (auto & ic : contents) {
+				int hot = ((ItemGroupList) ndef->get(ic.first).groups)["hot"];
+				if (hot) {
+					heat_num += ic.second;
+					heat_sum += hot * ic.second;
+				}
+				if (m_aabms[ic.first])
+					can_trigger = true;
+			}
+			applyHeat(block, heat_num, heat_sum);
+			if (!can_trigger)
+				return;
 		}
-#else
-		ServerMap *map = &m_env->getServerMap();
-#endif
+
+		// Pin 27 blocks around instead of copying them
+		MapBlockNeighborhood map(&m_env->getServerMap(), block->getPos());
 
 		{
 		//auto lock = block->try_lock_unique_rec();
@@ -1015,34 +1056,27 @@ void ServerEnvironment::loadDefaultMeta()
 		u32 active_object_count = this->countObjects(block, &m_env->getServerMap(), active_object_count_wider);
 		m_env->m_added_objects = 0;
 
-		auto *ndef = m_env->getGameDef()->ndef();
-
 #if !ENABLE_THREADS
 		auto lock_map = m_env->getServerMap().m_nothread_locker.try_lock_shared_rec();
 		if (!lock_map->owns_lock())
 			return;
 #endif
 
-		int heat_num = 0;
-		int heat_sum = 0;
-
 		v3POS bpr = block->getPosRelative();
+		// One guard for the lock-free reads of the whole block
+		epoch_read_guard guard;
 		v3s16 p0;
 		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
 		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
 		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
 		{
 			v3POS p = p0 + bpr;
-#if ENABLE_THREADS
-			MapNode n = map->getNodeTry(p);
-#else
-			MapNode n = block->getNodeTry(p0);
-#endif
+			MapNode n = block->getNodeNoGuard(p0);
 			content_t c = n.getContent();
 			if (c == CONTENT_IGNORE)
 				continue;
 
-			{
+			if (!contents_known) {
 				int hot = ((ItemGroupList) ndef->get(n).groups)["hot"];
 				//todo: int cold = ((ItemGroupList) ndef->get(n).groups)["cold"];
 				//also humidity todo.
@@ -1073,7 +1107,7 @@ void ServerEnvironment::loadDefaultMeta()
 					{
 						if(p1 == p)
 							continue;
-						MapNode n = map->getNodeTry(p1);
+						MapNode n = map.getNodeTry(p1);
 						content_t c = n.getContent();
 						if (c == CONTENT_IGNORE)
 							continue;
@@ -1095,6 +1129,15 @@ void ServerEnvironment::loadDefaultMeta()
 				block->abm_triggers->emplace_back(abm_trigger_one{i, p, c, active_object_count, active_object_count_wider, neighbor_pos, activate});
 			}
 		}
+		if (!contents_known)
+			applyHeat(block, heat_num, heat_sum);
+
+	//infostream<<"ABMHandler::apply reult p="<<block->getPos()<<" apply result:"<< (block->abm_triggers ? block->abm_triggers->size() : 0) <<std::endl;
+
+	}
+
+	void ABMHandler::applyHeat(MapBlock *block, int heat_num, int heat_sum)
+	{
 		if (heat_num) {
 			float heat_avg = heat_sum/heat_num;
 			const int min = 2 * MAP_BLOCKSIZE;
@@ -1109,9 +1152,6 @@ void ServerEnvironment::loadDefaultMeta()
 			}
 			//infostream<<"heat_num=" << heat_num << " heat_sum="<<heat_sum<<" heat_add="<<heat_add << " bheat_add"<<block->heat_add<< " heat_avg="<<heat_avg << " heatnow="<<block->heat<< " magic="<<magic << std::endl;
 		}
-
-	//infostream<<"ABMHandler::apply reult p="<<block->getPos()<<" apply result:"<< (block->abm_triggers ? block->abm_triggers->size() : 0) <<std::endl;
-
 	}
 
 void MapBlock::abmTriggersRun(ServerEnvironment * m_env, u32 time, bool activate) {
@@ -1146,6 +1186,13 @@ void MapBlock::abmTriggersRun(ServerEnvironment * m_env, u32 time, bool activate
 			dtime = 1;
 
 		unordered_map_v3POS<int> active_object_added;
+		MapBlockNeighborhood neighborhood(map, getPos());
+
+		struct abm_batch {
+			std::vector<std::pair<v3POS, MapNode>> nodes;
+			u32 active_object_count, active_object_count_wider;
+		};
+		std::unordered_map<ActiveBlockModifier *, abm_batch> batches;
 
 		//infostream<<"MapBlock::abmTriggersRun " << " abm_triggers="<<abm_triggers.get()<<" size()="<<abm_triggers->size()<<" time="<<time<<" dtime="<<dtime<<" activate="<<activate<<std::endl;
 		m_abm_timestamp = time;
@@ -1173,19 +1220,28 @@ void MapBlock::abmTriggersRun(ServerEnvironment * m_env, u32 time, bool activate
 					continue;
 			//infostream<<"HIT! dtime="<<dtime<<" Achance="<<abm->abmws->chance<<" Ainterval="<<abm->abmws->interval<< " Rchance="<<chance<<" Rintervals="<<intervals << std::endl;
 
-			MapNode node = map->getNodeTry(abm_trigger->pos);
+			MapNode node = neighborhood.getNodeTry(abm_trigger->pos);
 			if (node.getContent() != abm_trigger->content) {
 				if (node)
 					abm_trigger = abm_triggers->erase(abm_trigger);
 				continue;
 			}
 			//ScopeProfiler sp3(g_profiler, "ABM trigger nodes call", SPT_ADD);
+			if (abm->abmws->abm->getBatched()) {
+				auto & batch = batches[abm->abmws->abm];
+				if (batch.nodes.empty()) {
+					batch.active_object_count = abm_trigger->active_object_count;
+					batch.active_object_count_wider = abm_trigger->active_object_count_wider;
+				}
+				batch.nodes.emplace_back(abm_trigger->pos, node);
+				continue;
+			}
 			v3POS blockpos = getNodeBlockPos(abm_trigger->pos);
 			int active_object_add = 0;
 			if (active_object_added.count(blockpos))
 				active_object_add = active_object_added[blockpos];
 			abm->abmws->abm->trigger(m_env, abm_trigger->pos, node,
-				abm_trigger->active_object_count+active_object_add, abm_trigger->active_object_count_wider+active_object_add, map->getNodeTry(abm_trigger->neighbor_pos), activate);
+				abm_trigger->active_object_count+active_object_add, abm_trigger->active_object_count_wider+active_object_add, neighborhood.getNodeTry(abm_trigger->neighbor_pos), activate);
 
 				// Count surrounding objects again if the abms added any
 				//infostream<<" m_env->m_added_objects="<<m_env->m_added_objects<<" add="<<active_object_add<<" bp="<<getNodeBlockPos(abm_trigger->pos)<<std::endl;
@@ -1201,6 +1257,14 @@ void MapBlock::abmTriggersRun(ServerEnvironment * m_env, u32 time, bool activate
 					m_env->m_added_objects = 0;
 				}
 		}
+
+		for (auto & ir : batches) {
+			//ScopeProfiler sp3(g_profiler, "ABM trigger batch call", SPT_ADD);
+			ir.first->triggerBatch(m_env, ir.second.nodes,
+				ir.second.active_object_count, ir.second.active_object_count_wider, activate);
+			m_env->m_added_objects = 0;
+		}
+
 		if (abm_triggers->empty())
 			abm_triggers.reset();
 }
@@ -1384,25 +1448,31 @@ bool ServerEnvironment::swapNode(v3s16 p, const MapNode &n)
 void ServerEnvironment::getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius)
 {
 	int obj_null = 0, obj_count = 0;
+	// Candidates from the grid, filtered in place
+	size_t start = objects.size(), kept = start;
+	m_active_object_grid.getIdsNear(pos, radius, objects);
 	auto lock = m_active_objects.lock_shared_rec();
-	for(auto i = m_active_objects.begin();
-			i != m_active_objects.end(); ++i)
+	for (size_t i = start; i < objects.size(); ++i)
 	{
 		++obj_count;
-		ServerActiveObject* obj = i->second;
+		u16 id = objects[i];
+		auto n = m_active_objects.find(id);
+		if (n == m_active_objects.end())
+			continue;
+		ServerActiveObject* obj = n->second;
 		if (!obj) {
 			++obj_null;
 			continue;
 		}
-		u16 id = i->first;
 		if (obj->m_removed || obj->m_pending_deactivation)
 			continue;
 
 		v3f objectpos = obj->getBasePosition();
 		if (objectpos.getDistanceFrom(pos) > radius)
 			continue;
-		objects.push_back(id);
+		objects[kept++] = id;
 	}
+	objects.resize(kept);
 	if (obj_null)
 		infostream<<"ServerEnvironment::getObjectsInsideRadius(): "<<"got null objects: "<<obj_null<<"/"<<obj_count<<std::endl;
 }
@@ -1452,6 +1522,7 @@ void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 	// Remove references from m_active_objects
 	for (std::vector<u16>::iterator i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
+		m_active_object_grid.remove(*i);
 		m_active_objects.erase(*i);
 	}
 
@@ -1904,7 +1975,39 @@ void ServerEnvironment::step(float dtime, float uptime, unsigned int max_cycle_m
 				m_send_recommended_timer = 0;
 			}
 			send_recommended = true;
-		}
+			++m_send_recommended_step;
+		}
+
+		// Movement of objects far from every player is sent every few
+		// send steps only, the interval is the same for a whole grid cell
+		std::vector<v3f> player_positions;
+		unordered_map_v3POS<u8> cell_intervals;
+		if (send_recommended) {
+			auto lock = m_players.lock_shared_rec();
+			for (auto & player : m_players)
+				if (player->peer_id && player->getPlayerSAO())
+					player_positions.emplace_back(player->getPlayerSAO()->getBasePosition());
+		}
+		auto movement_send_interval = [&](ServerActiveObject *obj) -> u8 {
+			if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+				return 1;
+			v3POS cell = ActiveObjectGrid::getCell(obj->getBasePosition());
+			auto it = cell_intervals.find(cell);
+			if (it != cell_intervals.end())
+				return it->second;
+			u8 interval = MOVEMENT_SEND_INTERVAL_FAR;
+			for (const auto & pos : player_positions) {
+				if (ActiveObjectGrid::isCellNear(cell, pos, MOVEMENT_SEND_RANGE_NEAR * BS)) {
+					interval = 1;
+					break;
+				}
+				if (ActiveObjectGrid::isCellNear(cell, pos, MOVEMENT_SEND_RANGE_MIDDLE * BS))
+					interval = MOVEMENT_SEND_INTERVAL_MIDDLE;
+			}
+			cell_intervals[cell] = interval;
+			return interval;
+		};
+
 		u32 n = 0, calls = 0, end_ms = porting::getTimeMs() + max_cycle_ms;
 
 		for(auto & obj : objects) {
@@ -1920,6 +2023,13 @@ void ServerEnvironment::step(float dtime, float uptime, unsigned int max_cycle_m
 			// Step object
 			if (!obj->m_uptime_last)  // not very good place, but minimum modifications
 				obj->m_uptime_last = uptime - dtime;
+			obj->m_movement_send_interval = 0;
+			if (send_recommended) {
+				u8 interval = movement_send_interval(obj);
+				// Spread the far objects over the send steps
+				if ((m_send_recommended_step + obj->getId()) % interval == 0)
+					obj->m_movement_send_interval = interval;
+			}
 			obj->step(uptime > obj->m_uptime_last ? uptime - obj->m_uptime_last : dtime, send_recommended);
 			obj->m_uptime_last = uptime;
 			// Read messages from object
@@ -2160,31 +2270,37 @@ void ServerEnvironment::getAddedActiveObjects(PlayerSAO *playersao, s16 radius,
 	if (player_radius_f < 0)
 		player_radius_f = 0;
 
-	std::unordered_map<u16, bool> current_objects;
-	{
-		auto lock = current_objects_shared.try_lock_shared_rec();
-		if (!lock->owns_lock())
-			return;
-		current_objects = current_objects_shared;
-	}
+	auto current_lock = current_objects_shared.try_lock_shared_rec();
+	if (!current_lock->owns_lock())
+		return;
 
 	/*
-		Go through the object list,
+		Go through the objects in the cells around the player, and all
+		players if they are visible from any distance,
 		- discard m_removed objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
+	auto player_position = playersao->getBasePosition();
+	std::vector<u16> ids;
+	m_active_object_grid.getIdsNear(player_position,
+			player_radius_f > radius_f ? player_radius_f : radius_f, ids);
+	if (player_radius_f == 0)
+		m_active_object_grid.getPlayerIds(ids);
+	// Lowest ids first like before, each once
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
 	int count = 0;
 	auto lock = m_active_objects.try_lock_shared_rec();
 	if (!lock->owns_lock())
 		return;
-	auto player_position = playersao->getBasePosition();
-	for (auto i = m_active_objects.begin();
-			i != m_active_objects.end(); ++i) {
-		u16 id = i->first;
-
+	for (u16 id : ids) {
 		// Get object
+		auto i = m_active_objects.find(id);
+		if (i == m_active_objects.end())
+			continue;
 		ServerActiveObject *object = i->second;
 		if (object == NULL)
 			continue;
@@ -2203,8 +2319,8 @@ void ServerEnvironment::getAddedActiveObjects(PlayerSAO *playersao, s16 radius,
 			continue;
 
 		// Discard if already on current_objects
-		auto n = current_objects.find(id);
-		if(n != current_objects.end())
+		auto n = current_objects_shared.find(id);
+		if(n != current_objects_shared.end())
 			continue;
 		// Add to added_objects
 		added_objects.push(id);
@@ -2228,14 +2344,9 @@ void ServerEnvironment::getRemovedActiveObjects(PlayerSAO *playersao, s16 radius
 	if (player_radius_f < 0)
 		player_radius_f = 0;
 
-	std::vector<u16> current_objects_vector;
-	{
-		auto lock = current_objects.try_lock_shared_rec();
-		if (!lock->owns_lock())
-			return;
-		for (auto & i : current_objects)
-			current_objects_vector.emplace_back(i.first);
-	}
+	auto current_lock = current_objects.try_lock_shared_rec();
+	if (!current_lock->owns_lock())
+		return;
 
 	/*
 		Go through current_objects; object is removed if:
@@ -2247,11 +2358,9 @@ void ServerEnvironment::getRemovedActiveObjects(PlayerSAO *playersao, s16 radius
 	*/
 	auto player_position = playersao->getBasePosition();
 
-	for(auto
-			i = current_objects_vector.begin();
-			i != current_objects_vector.end(); ++i)
+	for (auto & i : current_objects)
 	{
-		u16 id = *i;
+		u16 id = i.first;
 		ServerActiveObject *object = getActiveObject(id, true);
 
 		if (object == NULL) {
@@ -2365,6 +2474,8 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 			<<"added (id="<<object->getId()<<")"<<std::endl;*/
 
 	m_active_objects.set(object->getId(), object);
+	m_active_object_grid.insert(object->getId(), object->getBasePosition(),
+			object->getType() == ACTIVEOBJECT_TYPE_PLAYER);
 
 /*
 	m_active_objects[object->getId()] = object;
@@ -2510,6 +2621,7 @@ void ServerEnvironment::removeRemovedObjects(unsigned int max_cycle_ms)
 
 		// Delete
 		if(obj->environmentDeletes()) {
+			m_active_object_grid.remove(id);
 			m_active_objects.set(id, nullptr);
 			objects_to_delete.push_back(obj);
 		}
@@ -2527,6 +2639,7 @@ void ServerEnvironment::removeRemovedObjects(unsigned int max_cycle_ms)
 	for(auto i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
 		objects_to_delete.push_back(m_active_objects.get(*i));
+		m_active_object_grid.remove(*i);
 		m_active_objects.erase(*i);
 	}
 	objects_to_remove.clear();
@@ -2937,6 +3050,7 @@ void ServerEnvironment::deactivateFarObjects(bool force_delete)
 		// Delete active object
 		if(obj->environmentDeletes())
 		{
+			m_active_object_grid.remove(id);
 			m_active_objects.set(id, nullptr);
 			objects_to_delete.push_back(obj);
 		}
@@ -2953,6 +3067,7 @@ void ServerEnvironment::deactivateFarObjects(bool force_delete)
 		if (lock->owns_lock())
 			for(auto & i : objects_to_remove) {
 			objects_to_delete.push_back(m_active_objects.get(i));
+			m_active_object_grid.remove(i);
 			m_active_objects.erase(i);
 		}
 		objects_to_remove.clear();
@@ -39,6 +39,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include <map>
 #include "irr_v3d.h"
 #include "activeobject.h"
+#include "active_object_grid.h"
 #include "util/numeric.h"
 #include "mapnode.h"
 #include "mapblock.h"
@@ -194,6 +195,11 @@ class ActiveBlockModifier
 	//virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n, MapNode neighbor){};
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 			u32 active_object_count, u32 active_object_count_wider, MapNode neighbor, bool activate = false){};
+	// Batched ABMs get all nodes of one block that passed chance in one triggerBatch() call
+	virtual bool getBatched()
+	{ return false; }
+	virtual void triggerBatch(ServerEnvironment *env, const std::vector<std::pair<v3POS, MapNode>> &nodes,
+			u32 active_object_count, u32 active_object_count_wider, bool activate = false){};
 };
 
 struct ABMWithState
@@ -328,6 +334,7 @@ class ABMHandler
 	~ABMHandler();
 	u32 countObjects(MapBlock *block, ServerMap * map, u32 &wider);
 	void apply(MapBlock *block, bool activate = false);
+	void applyHeat(MapBlock *block, int heat_num, int heat_sum);
 
 };
 
@@ -375,6 +382,11 @@ class ServerEnvironment : public Environment
 
 	float getSendRecommendedInterval()
 		{ return m_recommended_send_interval; }
+	// Every client reads GENERIC_CMD_UPDATE_MOVEMENT, kept by the server
+	bool getMovementDeltas()
+		{ return m_movement_deltas; }
+	void setMovementDeltas(bool deltas)
+		{ m_movement_deltas = deltas; }
 
 	//Player * getPlayer(u16 peer_id) { return Environment::getPlayer(peer_id); };
 	//Player * getPlayer(const std::string &name);
@@ -410,6 +422,8 @@ class ServerEnvironment : public Environment
 	*/
 
 	ServerActiveObject* getActiveObject(u16 id, bool removed = false);
+	// Cells of active objects, kept by addActiveObjectRaw and setBasePosition
+	ActiveObjectGrid & getActiveObjectGrid() { return m_active_object_grid; }
 
 	/*
 		Add an active object to the environment.
@@ -603,6 +617,7 @@ class ServerEnvironment : public Environment
 	const std::string m_path_world;
 	// Active object list
 	ActiveObjectMap m_active_objects;
+	ActiveObjectGrid m_active_object_grid;
 
 	std::vector<u16> objects_to_remove;
 	std::vector<ServerActiveObject*> objects_to_delete;
@@ -613,6 +628,8 @@ class ServerEnvironment : public Environment
 private:
 	// Some timers
 	float m_send_recommended_timer;
+	u32 m_send_recommended_step;
+	std::atomic_bool m_movement_deltas;
 	IntervalLimiter m_object_management_interval;
 	// List of active blocks
 	ActiveBlockList m_active_blocks;
@@ -15,6 +15,10 @@ You should have received a copy of the GNU General Public License
 along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <tuple>
 #include "irr_v3d.h"
 #include "map.h"
 #include "gamedef.h"
@@ -25,6 +29,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "scripting_game.h"
 #include "profiler.h"
 #include "emerge.h"
+#include "threading/task_graph.h"
 
 #define LIQUID_DEBUG 0
 
@@ -69,51 +74,76 @@ const s8 liquid_random_map[4][7] = {
 #define D_TOP 6
 #define D_SELF 1
 
-u32 Map::transformLiquidsReal(Server *m_server, unsigned int max_cycle_ms) {
+// Shared read-only state of one transformLiquidsReal() cycle
+struct LiquidStep {
+	u32 initial_size;
+	u32 end_ms;
+	u8 relax;
+	int fast_flood;
+	int water_level;
+	s16 liquid_pressure;
+	u16 loop_rand;
+};
+
+// Queue of one region taken out of Map::m_transforming_liquid and its results
+struct LiquidRegionWork {
+	v3POS region;
+	UniqueQueue<v3POS> queue;
+	std::list<v3POS> must_reflow, must_reflow_second, must_reflow_third;
+	// Scripts and nodeUpdate are not thread safe, run by the owning thread after the pass
+	// setNode of a dropped node waits for node_drop, pending nodes are read
+	// from drop_nodes so the rest of the pass sees them and drops only once
+	std::vector<std::pair<v3POS, MapNode>> drops;
+	unordered_map_v3POS<size_t> drop_nodes;
+	std::vector<v3POS> falls;
+	u32 loopcount = 0;
+	s32 regenerated = 0;
+};
+
+void Map::transformLiquidsRealRegion(Server *m_server, LiquidRegionWork & work, const LiquidStep & step) {
 
 	INodeDefManager *nodemgr = m_gamedef->ndef();
 
-	DSTACK(FUNCTION_NAME);
-	//TimeTaker timer("transformLiquidsReal()");
-	u32 loopcount = 0;
-	u32 initial_size = transforming_liquid_size();
+	u32 & loopcount = work.loopcount;
+	u32 initial_size = step.initial_size;
+	u32 region_size = work.queue.size();
 
-	s32 regenerated = 0;
+	s32 & regenerated = work.regenerated;
 
 #if LIQUID_DEBUG
 	bool debug = 1;
 #endif
 
-	u8 relax = g_settings->getS16("liquid_relax");
-	static int fast_flood = g_settings->getS16("liquid_fast_flood");
-	static int water_level = g_settings->getS16("water_level");
-	s16 liquid_pressure = m_server->m_emerge->mgparams->liquid_pressure;
-	//g_settings->getS16NoEx("liquid_pressure", liquid_pressure);
+	const u8 relax = step.relax;
+	const int fast_flood = step.fast_flood;
+	const int water_level = step.water_level;
+	const s16 liquid_pressure = step.liquid_pressure;
 
 	// list of nodes that due to viscosity have not reached their max level height
-	//unordered_map_v3POS<bool> must_reflow, must_reflow_second, must_reflow_third;
-	std::list<v3POS> must_reflow, must_reflow_second, must_reflow_third;
+	auto & must_reflow = work.must_reflow;
+	auto & must_reflow_second = work.must_reflow_second;
+	auto & must_reflow_third = work.must_reflow_third;
 	// List of MapBlocks that will require a lighting update (due to lava)
 	int falling = 0;
-	u16 loop_rand = myrand();
+	const u16 loop_rand = step.loop_rand;
+
+	const u32 end_ms = step.end_ms;
 
-	u32 end_ms = porting::getTimeMs() + max_cycle_ms;
+	// Queue is mostly ordered by place, keep neighbor blocks resolved
+	MapBlockNeighborhood neighborhood(this);
 
 NEXT_LIQUID:
 	;
-	while (transforming_liquid_size() > 0) {
+	while (work.queue.size() > 0) {
 		// This should be done here so that it is done when continue is used
-		if (loopcount >= initial_size * 2 || porting::getTimeMs() > end_ms)
+		if (loopcount >= region_size * 2 || porting::getTimeMs() > end_ms)
 			break;
 		++loopcount;
 		/*
 			Get a queued transforming liquid node
 		*/
-		v3POS p0;
-		{
-			//MutexAutoLock lock(m_transforming_liquid_mutex);
-			p0 = transforming_liquid_pop();
-		}
+		v3POS p0 = work.queue.front();
+		work.queue.pop_front();
 		s16 total_level = 0;
 		//u16 level_max = 0;
 		// surrounding flowing liquid nodes
@@ -139,7 +169,11 @@ u32 Map::transformLiquidsReal(Server *m_server, unsigned int max_cycle_ms) {
 			u8 i = liquid_explore_map[e];
 			NodeNeighbor & nb = neighbors[i];
 			nb.pos = p0 + liquid_flow_dirs[i];
-			nb.node = getNode(neighbors[i].pos);
+			const auto drop_it = work.drop_nodes.find(nb.pos);
+			if (drop_it != work.drop_nodes.end())
+				nb.node = work.drops[drop_it->second].second;
+			else
+				nb.node = neighborhood.getNodeTry(nb.pos);
 			nb.content = nb.node.getContent();
 			NeighborType nt = NEIGHBOR_SAME_LEVEL;
 			switch (i) {
@@ -673,17 +707,23 @@ u32 Map::transformLiquidsReal(Server *m_server, unsigned int max_cycle_ms) {
 				continue;
 			}
 
-			if (neighbors[i].drop) {// && level_max > 1 && total_level >= level_max - 1
-				m_server->getEnv().getScriptIface()->node_drop(neighbors[i].pos, 2);
-			}
-
 			neighbors[i].node.setContent(liquid_kind_flowing);
 			neighbors[i].node.setLevel(nodemgr, liquid_levels_want[i], 1);
 
-			try {
-				setNode(neighbors[i].pos, neighbors[i].node, true);
-			} catch(InvalidPositionException &e) {
-				verbosestream << "transformLiquidsReal: setNode() failed:" << neighbors[i].pos << ":" << e.what() << std::endl;
+			const auto drop_it = work.drop_nodes.find(neighbors[i].pos);
+			if (drop_it != work.drop_nodes.end()) {
+				// still pending, replace the node set after the drop
+				work.drops[drop_it->second].second = neighbors[i].node;
+			} else if (neighbors[i].drop) {// && level_max > 1 && total_level >= level_max - 1
+				// node_drop must see the old node, so set it after the drop
+				work.drop_nodes.emplace(neighbors[i].pos, work.drops.size());
+				work.drops.emplace_back(neighbors[i].pos, neighbors[i].node);
+			} else {
+				try {
+					setNode(neighbors[i].pos, neighbors[i].node, true);
+				} catch(InvalidPositionException &e) {
+					verbosestream << "transformLiquidsReal: setNode() failed:" << neighbors[i].pos << ":" << e.what() << std::endl;
+				}
 			}
 
 			// If node emits light, MapBlock requires lighting update
@@ -705,7 +745,7 @@ u32 Map::transformLiquidsReal(Server *m_server, unsigned int max_cycle_ms) {
 		}
 
 		if (fall_down) {
-			m_server->getEnv().nodeUpdate(neighbors[D_BOTTOM].pos, 1);
+			work.falls.push_back(neighbors[D_BOTTOM].pos);
 		}
 
 #if LIQUID_DEBUG
@@ -725,7 +765,131 @@ u32 Map::transformLiquidsReal(Server *m_server, unsigned int max_cycle_ms) {
 		}*/
 		//g_profiler->graphAdd("liquids", 1);
 	}
+}
+
+u32 Map::transformLiquidsReal(Server *m_server, unsigned int max_cycle_ms) {
+
+	DSTACK(FUNCTION_NAME);
+	//TimeTaker timer("transformLiquidsReal()");
+	LiquidStep step;
+	step.initial_size = transforming_liquid_size();
+	if (!step.initial_size)
+		return 0;
 
+	step.end_ms = porting::getTimeMs() + max_cycle_ms;
+	step.relax = g_settings->getS16("liquid_relax");
+	static int fast_flood = g_settings->getS16("liquid_fast_flood");
+	static int water_level = g_settings->getS16("water_level");
+	step.fast_flood = fast_flood;
+	step.water_level = water_level;
+	step.liquid_pressure = m_server->m_emerge->mgparams->liquid_pressure;
+	//g_settings->getS16NoEx("liquid_pressure", liquid_pressure);
+	step.loop_rand = myrand();
+
+	unsigned int threads = std::max<unsigned int>(1, g_settings->getU16("liquid_threads"));
+	task_pool *pool = getTaskPool();
+
+	/*
+		Take whole queue and split regions into 8 passes by parity of region
+		coordinates. Regions of one pass are never adjacent, so nodes changed
+		from two regions (own nodes and one node border) never overlap and
+		regions of one pass can be solved in parallel.
+		Passes run one after another, start pass rotates every cycle.
+	*/
+	std::array<std::vector<std::unique_ptr<LiquidRegionWork>>, 8> passes;
+	{
+		std::lock_guard<Mutex> lock(m_transforming_liquid_mutex);
+		for (auto & ir : m_transforming_liquid) {
+			std::unique_ptr<LiquidRegionWork> work(new LiquidRegionWork);
+			work->region = ir.first;
+			work->queue = std::move(ir.second);
+			passes[(ir.first.X & 1) | (ir.first.Y & 1) << 1 | (ir.first.Z & 1) << 2].emplace_back(std::move(work));
+		}
+		m_transforming_liquid.clear();
+		m_transforming_liquid_size = 0;
+	}
+
+	u32 regions = 0;
+	++m_liquid_pass;
+	for (unsigned int pass_i = 0; pass_i < passes.size(); ++pass_i) {
+		auto & pass = passes[(m_liquid_pass + pass_i) % passes.size()];
+		if (pass.empty() || porting::getTimeMs() > step.end_ms)
+			continue;
+
+		// same order every time for same queue
+		std::sort(pass.begin(), pass.end(), [](const std::unique_ptr<LiquidRegionWork> & a, const std::unique_ptr<LiquidRegionWork> & b) {
+			return std::tie(a->region.Z, a->region.Y, a->region.X) < std::tie(b->region.Z, b->region.Y, b->region.X);
+		});
+
+		// Idle workers take next unsolved region of the pass
+		std::atomic_uint next(0);
+		auto worker = [&]() {
+			unsigned int i;
+			while ((i = next++) < pass.size()) {
+				if (porting::getTimeMs() > step.end_ms)
+					break;
+				try {
+					transformLiquidsRealRegion(m_server, *pass[i], step);
+				} catch (std::exception &e) {
+					errorstream << "transformLiquidsReal: region " << pass[i]->region << " exception: " << e.what() << std::endl;
+				}
+			}
+		};
+
+		// This thread and up to threads - 1 of the shared task pool
+		task_graph graph(pool);
+		for (unsigned int t = 0; t < threads && t < pass.size(); ++t)
+			graph.add(worker);
+		graph.run();
+		regions += pass.size();
+
+		for (auto & work : pass) {
+			for (auto & ir : work->drops) {
+				m_server->getEnv().getScriptIface()->node_drop(ir.first, 2);
+				try {
+					setNode(ir.first, ir.second, true);
+				} catch(InvalidPositionException &e) {
+					verbosestream << "transformLiquidsReal: setNode() failed:" << ir.first << ":" << e.what() << std::endl;
+				}
+			}
+			work->drops.clear();
+			work->drop_nodes.clear();
+			for (const auto & p : work->falls)
+				m_server->getEnv().nodeUpdate(p, 1);
+			work->falls.clear();
+		}
+	}
+
+	u32 loopcount = 0;
+	s32 regenerated = 0;
+	{
+		//TimeTaker timer13("transformLiquidsReal() reflow");
+		std::lock_guard<Mutex> lock(m_transforming_liquid_mutex);
+
+		// not processed first
+		for (auto & pass : passes) {
+			for (auto & work : pass) {
+				loopcount += work->loopcount;
+				regenerated += work->regenerated;
+				while (work->queue.size()) {
+					transforming_liquid_add_nolock(work->queue.front());
+					work->queue.pop_front();
+				}
+			}
+		}
+		for (auto & pass : passes) {
+			for (auto & work : pass) {
+				for (const auto & p : work->must_reflow)
+					transforming_liquid_add_nolock(p);
+				for (const auto & p : work->must_reflow_second)
+					transforming_liquid_add_nolock(p);
+				for (const auto & p : work->must_reflow_third)
+					transforming_liquid_add_nolock(p);
+			}
+		}
+	}
+
+	u32 initial_size = step.initial_size;
 	u32 ret = loopcount >= initial_size ? 0 : transforming_liquid_size();
 	if (ret || loopcount > m_liquid_step_flow)
 		m_liquid_step_flow += (m_liquid_step_flow > loopcount ? -1 : 1) * (int)loopcount / 10;
@@ -733,34 +897,14 @@ u32 Map::transformLiquidsReal(Server *m_server, unsigned int max_cycle_ms) {
 	if (loopcount)
 		infostream<<"Map::transformLiquidsReal(): loopcount="<<loopcount<<" initial_size="<<initial_size
 		<<" avgflow="<<m_liquid_step_flow
-		<<" reflow="<<must_reflow.size()
-		<<" reflow_second="<<must_reflow_second.size()
-		<<" reflow_third="<<must_reflow_third.size()
+		<<" regions="<<regions
 		<<" queue="<< transforming_liquid_size()
-		<<" per="<< porting::getTimeMs() - (end_ms - max_cycle_ms)
+		<<" per="<< porting::getTimeMs() - (step.end_ms - max_cycle_ms)
 		<<" ret="<<ret<<std::endl;
 	*/
 
-	{
-		//TimeTaker timer13("transformLiquidsReal() reflow");
-		//auto lock = m_transforming_liquid.lock_unique_rec();
-		std::lock_guard<Mutex> lock(m_transforming_liquid_mutex);
-
-		//m_transforming_liquid.insert(must_reflow.begin(), must_reflow.end());
-		for (const auto & p : must_reflow)
-			m_transforming_liquid.push_back(p);
-		must_reflow.clear();
-		//m_transforming_liquid.insert(must_reflow_second.begin(), must_reflow_second.end());
-		for (const auto & p : must_reflow_second)
-			m_transforming_liquid.push_back(p);
-		must_reflow_second.clear();
-		//m_transforming_liquid.insert(must_reflow_third.begin(), must_reflow_third.end());
-		for (const auto & p : must_reflow_third)
-			m_transforming_liquid.push_back(p);
-		must_reflow_third.clear();
-	}
-
 	g_profiler->add("Server: liquids real processed", loopcount);
+	g_profiler->avg("Server: liquids regions", regions);
 	if (regenerated)
 		g_profiler->add("Server: liquids regenerated", regenerated);
 	if (loopcount < initial_size)
@@ -26,6 +26,8 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "mg_biome.h"
 #include "gamedef.h"
 #include "util/directiontables.h"
+#include "light_propagator.h"
+#include "threading/task_graph.h"
 
 
 #if HAVE_THREAD_LOCAL
@@ -57,16 +59,10 @@ MapBlock* Map::getBlockNoCreateNoEx(v3POS p, bool trylock, bool nocache) {
 			}
 	}
 
-	MapBlockP block;
-	{
-		auto lock = trylock ? m_blocks.try_lock_shared_rec() : m_blocks.lock_shared_rec();
-		if (!lock->owns_lock())
-			return nullptr;
-		auto n = m_blocks.find(p);
-		if(n == m_blocks.end())
-			return nullptr;
-		block = n->second;
-	}
+	// Locks only the shard holding p
+	MapBlockP block = m_blocks.get(p, trylock);
+	if (!block)
+		return nullptr;
 
 	if (!nocache) {
 #if ENABLE_THREADS && !HAVE_THREAD_LOCAL
@@ -99,7 +95,6 @@ MapBlock * Map::createBlankBlockNoInsert(v3POS & p) {
 }
 
 MapBlock * Map::createBlankBlock(v3POS & p) {
-	auto lock = m_blocks.lock_unique_rec();
 	MapBlock *block = getBlockNoCreateNoEx(p, false, true);
 	if (block != NULL) {
 		infostream << "Block already created p=" << block->getPos() << std::endl;
@@ -108,7 +103,11 @@ MapBlock * Map::createBlankBlock(v3POS & p) {
 
 	block = createBlankBlockNoInsert(p);
 
-	m_blocks.set(p, block);
+	if (!m_blocks.set_new(p, block)) {
+		// Other thread was faster
+		delete block;
+		return getBlockNoCreateNoEx(p, false, true);
+	}
 
 	return block;
 }
@@ -118,16 +117,11 @@ bool Map::insertBlock(MapBlock *block) {
 
 	m_db_miss.erase(block_p);
 
-	auto lock = m_blocks.lock_unique_rec();
-
-	auto block2 = getBlockNoCreateNoEx(block_p, false, true);
-	if(block2) {
+	// Insert into container
+	if (!m_blocks.set_new(block_p, block)) {
 		verbosestream << "Block already exists " << block_p << std::endl;
 		return false;
 	}
-
-	// Insert into container
-	m_blocks.set(block_p, block);
 	return true;
 }
 
@@ -174,11 +168,17 @@ MapNode Map::getNodeNoLock(v3POS p) //dont use
 	return block->getNodeNoLock(p - blockpos*MAP_BLOCKSIZE);
 }
 */
-v3POS Map::transforming_liquid_pop() {
+bool Map::transforming_liquid_pop(v3POS &p) {
 	std::lock_guard<Mutex> lock(m_transforming_liquid_mutex);
-	auto front = m_transforming_liquid.front();
-	m_transforming_liquid.pop_front();
-	return front;
+	auto it = m_transforming_liquid.begin();
+	if (it == m_transforming_liquid.end())
+		return false;
+	p = it->second.front();
+	it->second.pop_front();
+	if (!it->second.size())
+		m_transforming_liquid.erase(it);
+	--m_transforming_liquid_size;
+	return true;
 
 	//auto lock = m_transforming_liquid.lock_unique_rec();
 	//auto it = m_transforming_liquid.begin();
@@ -330,6 +330,31 @@ void Map::copy_27_blocks_to_vm(MapBlock * block, VoxelManipulator & vmanip) {
 
 
 
+MapBlockNeighborhood::MapBlockNeighborhood(Map *map, v3POS blockpos):
+	m_map(map)
+{
+	setCenter(blockpos);
+}
+
+void MapBlockNeighborhood::setCenter(v3POS blockpos) {
+	m_center = blockpos;
+	m_origin = (blockpos - v3POS(1, 1, 1)) * MAP_BLOCKSIZE;
+	m_resolved = 0;
+}
+
+void MapBlockNeighborhood::resolveBlock(u8 i) {
+	v3POS bp = m_center + v3POS(i % 3 - 1, (i / 3) % 3 - 1, i / 9 - 1);
+	m_blocks[i] = m_map->getBlockNoCreateNoEx(bp);
+	m_resolved |= 1 << i;
+}
+
+MapBlock * MapBlockNeighborhood::getBlock(v3POS blockpos) {
+	v3POS rel = blockpos - m_center + v3POS(1, 1, 1);
+	if ((u16)rel.X > 2 || (u16)rel.Y > 2 || (u16)rel.Z > 2)
+		return m_map->getBlockNoCreateNoEx(blockpos);
+	return getBlockIndex(rel.Z * 9 + rel.Y * 3 + rel.X);
+}
+
 u32 Map::timerUpdate(float uptime, float unload_timeout, u32 max_loaded_blocks,
                      unsigned int max_cycle_ms,
                      std::vector<v3POS> *unloaded_blocks) {
@@ -477,147 +502,190 @@ u32 Map::updateLighting(concurrent_map<v3POS, MapBlock*>  & a_blocks, std::map<v
 	return updateLighting(lighting_mblocks, processed, max_cycle_ms);
 }
 
-u32 Map::updateLighting(Map::lighting_map_t & a_blocks, unordered_map_v3POS<int> & processed, unsigned int max_cycle_ms) {
-
-	std::map<v3POS, MapBlock*> modified_blocks;
+/*
+	Dirty block columns are lit in tiles of LIGHTING_TILE x LIGHTING_TILE
+	columns, one task per tile. Light changes reach at most two blocks out
+	of a column: sources found while unspreading are up to one block away
+	and spread up to one more. Tiles with the same parity of coordinates
+	are a whole tile apart, so they are lit in parallel, in four passes.
+*/
+#define LIGHTING_TILE 5
 
-	INodeDefManager *nodemgr = m_gamedef->ndef();
+namespace {
+struct LightingTile {
+	LightingTile(v2POS pos, Map *map, INodeDefManager *ndef) :
+		pos(pos), light(map, ndef) {}
 
-	int ret = 0;
+	v2POS pos;
+	std::vector<v3POS> columns;
+	LightPropagator light;
+	std::map<v3POS, MapBlock*> modified_blocks;
+	unordered_map_v3POS<int> processed;
+	// Not lightable, removed from the queue
+	std::vector<v3POS> dropped;
 	int loopcount = 0;
+	bool timeout = false;
+};
+}
 
-	TimeTaker timer("updateLighting");
-
-	// For debugging
-	//bool debug=true;
-	//u32 count_was = modified_blocks.size();
+static void light_tile(Map *map, INodeDefManager *nodemgr, LightingTile &tile,
+		const unordered_map_v3POS<int> &processed, u32 end_ms, u32 spread_end_ms)
+{
+	for (const auto &top : tile.columns) {
+		if (end_ms && porting::getTimeMs() > end_ms) {
+			tile.timeout = true;
+			break;
+		}
 
-	//std::unordered_set<v3POS, v3POSHash, v3POSEqual> light_sources;
-	//std::unordered_map<v3POS, u8, v3POSHash, v3POSEqual> unlight_from_day, unlight_from_night;
-	std::set<v3POS> light_sources;
-	std::map<v3POS, u8> unlight_from_day, unlight_from_night;
-	//unordered_map_v3POS<int> processed;
+		auto block = map->getBlockNoCreateNoEx(top);
+		for(;;) {
+			// Don't bother with dummy blocks.
+			if(!block || block->isDummy() || !block->isGenerated()) {
+				tile.dropped.push_back(top);
+				break;
+			}
+			auto lock = block->try_lock_unique_rec();
+			if (!lock->owns_lock()) {
+				break; // may cause dark areas
+			}
+			v3POS pos = block->getPos();
 
+			auto it = processed.find(pos);
+			if (it != processed.end() && it->second >= top.Y)
+				break;
+			it = tile.processed.find(pos);
+			if (it != tile.processed.end() && it->second >= top.Y)
+				break;
+			++tile.loopcount;
+			tile.processed[pos] = top.Y;
+			v3POS posnodes = block->getPosRelative();
 
-	int num_bottom_invalid = 0;
+			block->setLightingExpired(true);
+			++block->lighting_broken;
 
-	//MutexAutoLock lock2(m_update_lighting_mutex);
+			/*
+				Clear all light from block
+			*/
+			for(s16 z = 0; z < MAP_BLOCKSIZE; z++)
+				for(s16 x = 0; x < MAP_BLOCKSIZE; x++)
+					for(s16 y = 0; y < MAP_BLOCKSIZE; y++) {
+						v3POS p(x, y, z);
+						bool is_valid_position;
+						MapNode n = block->getNode(p, &is_valid_position);
+						if (!is_valid_position) {
+							/* This would happen when dealing with a
+							   dummy block.
+							*/
+							infostream << "updateLighting(): InvalidPositionException"
+							           << std::endl;
+							continue;
+						}
+						u8 oldlight_day = n.getLight(LIGHTBANK_DAY, nodemgr);
+						u8 oldlight_night = n.getLight(LIGHTBANK_NIGHT, nodemgr);
+						n.setLight(LIGHTBANK_DAY, 0, nodemgr);
+						n.setLight(LIGHTBANK_NIGHT, 0, nodemgr);
+						block->setNode(p, n);
+
+						// If node sources light, add to list
+						if(nodemgr->get(n).light_source)
+							tile.light.addSource(p + posnodes);
+
+						v3POS p_map = p + posnodes;
+						// Collect borders for unlighting
+						if(x == 0 || x == MAP_BLOCKSIZE - 1
+						        || y == 0 || y == MAP_BLOCKSIZE - 1
+						        || z == 0 || z == MAP_BLOCKSIZE - 1) {
+							if(oldlight_day)
+								tile.light.addUnlight(LIGHTBANK_DAY, p_map, oldlight_day);
+							if(oldlight_night)
+								tile.light.addUnlight(LIGHTBANK_NIGHT, p_map, oldlight_night);
+						}
+					}
 
-	MAP_NOTHREAD_LOCK(this);
+			lock->unlock();
 
-	{
-		//TimeTaker t("updateLighting: first stuff");
+			map->propagateSunlight(pos, tile.light);
 
-		u32 end_ms = porting::getTimeMs() + max_cycle_ms;
-		for(auto i = a_blocks.begin();
-		        i != a_blocks.end();) {
+			pos.Y--;
+			block = map->getBlockNoCreateNoEx(pos);
+		}
+	}
 
-			//processed[i->first] = //1000000;
-			//infostream<<"Light: start col if=" << i->first << std::endl;
-			auto block = getBlockNoCreateNoEx(i->first);
+	tile.light.unspread(tile.modified_blocks);
+	if (!tile.light.spread(tile.modified_blocks, spread_end_ms))
+		tile.timeout = true;
+}
 
-			for(;;) {
-				// Don't bother with dummy blocks.
-				if(!block || block->isDummy() || !block->isGenerated()) {
-					i = a_blocks.erase(i);
-					goto ablocks_end;
-				}
-				auto lock = block->try_lock_unique_rec();
-				if (!lock->owns_lock()) {
-					break; // may cause dark areas
-				}
-				v3POS pos = block->getPos();
-				//if (processed.count(pos)) infostream<<"Light: test pos" << pos << " pps="<<processed[pos] << " >= if="<< i->first.Y <<std::endl;
+u32 Map::updateLighting(Map::lighting_map_t & a_blocks, unordered_map_v3POS<int> & processed, unsigned int max_cycle_ms) {
 
-				if (processed.count(pos) && processed[pos] >= i->first.Y ) {
-					//infostream<<"Light: skipping pos" << pos << " pps="<<processed[pos] << " >= if="<< i->first.Y <<std::endl;
-					break;
-				}
-				++loopcount;
-				processed[pos] = i->first.Y;
-				v3POS posnodes = block->getPosRelative();
-				//modified_blocks[pos] = block;
-
-				block->setLightingExpired(true);
-				++block->lighting_broken;
-
-				/*
-					Clear all light from block
-				*/
-				for(s16 z = 0; z < MAP_BLOCKSIZE; z++)
-					for(s16 x = 0; x < MAP_BLOCKSIZE; x++)
-						for(s16 y = 0; y < MAP_BLOCKSIZE; y++) {
-							v3POS p(x, y, z);
-							bool is_valid_position;
-							MapNode n = block->getNode(p, &is_valid_position);
-							if (!is_valid_position) {
-								/* This would happen when dealing with a
-								   dummy block.
-								*/
-								infostream << "updateLighting(): InvalidPositionException"
-								           << std::endl;
-								continue;
-							}
-							u8 oldlight_day = n.getLight(LIGHTBANK_DAY, nodemgr);
-							u8 oldlight_night = n.getLight(LIGHTBANK_NIGHT, nodemgr);
-							n.setLight(LIGHTBANK_DAY, 0, nodemgr);
-							n.setLight(LIGHTBANK_NIGHT, 0, nodemgr);
-							block->setNode(p, n);
-
-							// If node sources light, add to list
-							//u8 source = nodemgr->get(n).light_source;
-							if(nodemgr->get(n).light_source)
-								light_sources.insert(p + posnodes);
-
-							v3POS p_map = p + posnodes;
-							// Collect borders for unlighting
-							if(x == 0 || x == MAP_BLOCKSIZE - 1
-							        || y == 0 || y == MAP_BLOCKSIZE - 1
-							        || z == 0 || z == MAP_BLOCKSIZE - 1) {
-								if(oldlight_day)
-									unlight_from_day[p_map] = oldlight_day;
-								if(oldlight_night)
-									unlight_from_night[p_map] = oldlight_night;
-							}
+	std::map<v3POS, MapBlock*> modified_blocks;
 
+	INodeDefManager *nodemgr = m_gamedef->ndef();
 
-						}
+	int ret = 0;
+	int loopcount = 0;
 
-				lock->unlock();
+	TimeTaker timer("updateLighting");
 
-				bool bottom_valid = propagateSunlight(pos, light_sources);
+	MAP_NOTHREAD_LOCK(this);
 
-				if(!bottom_valid)
-					num_bottom_invalid++;
+	// 0: no limit
+	u32 now = porting::getTimeMs();
+	u32 end_ms = max_cycle_ms ? now + max_cycle_ms : 0;
+	u32 spread_end_ms = max_cycle_ms ? now + max_cycle_ms * 10 : 0;
 
-				pos.Y--;
-				block = getBlockNoCreateNoEx(pos);
-			}
+	{
+		// Spreading left from the last call goes first
+		MutexAutoLock lock(m_light_pending_mutex);
+		if (m_light_pending && !m_light_pending->empty() &&
+				!m_light_pending->spread(modified_blocks, spread_end_ms))
+			++ret;
+	}
 
+	std::vector<std::unique_ptr<LightingTile>> tiles;
+	{
+		unordered_map_v2POS<size_t> tile_index;
+		for (const auto & i : a_blocks) {
+			v2POS tpos = getContainerPos(v2POS(i.first.X, i.first.Z), LIGHTING_TILE);
+			auto res = tile_index.insert(std::make_pair(tpos, tiles.size()));
+			if (res.second)
+				tiles.emplace_back(new LightingTile(tpos, this, nodemgr));
+			tiles[res.first->second]->columns.push_back(i.first);
+		}
+	}
 
-			// magic for erase:
-			++i; 
-			ablocks_end:
+	task_pool *pool = getTaskPool();
+	for (int parity = 0; parity < 4; ++parity) {
+		std::vector<LightingTile *> pass;
+		for (auto & tile : tiles)
+			if (((tile->pos.X & 1) | ((tile->pos.Y & 1) << 1)) == parity)
+				pass.push_back(tile.get());
+		if (pass.empty())
+			continue;
 
+		task_graph graph(pass.size() > 1 ? pool : nullptr);
+		for (auto tile : pass)
+			graph.add([=, &processed] {
+				light_tile(this, nodemgr, *tile, processed, end_ms, spread_end_ms);
+			});
+		graph.run();
 
-			if (porting::getTimeMs() > end_ms) {
+		for (auto tile : pass) {
+			loopcount += tile->loopcount;
+			if (tile->timeout)
 				++ret;
-				break;
+			for (auto & i : tile->processed)
+				processed[i.first] = i.second;
+			modified_blocks.insert(tile->modified_blocks.begin(), tile->modified_blocks.end());
+			for (auto & p : tile->dropped)
+				a_blocks.erase(p);
+			if (!tile->light.empty()) {
+				MutexAutoLock lock(m_light_pending_mutex);
+				if (!m_light_pending)
+					m_light_pending.reset(new LightPropagator(this, nodemgr));
+				m_light_pending->merge(tile->light);
 			}
 		}
-
-	}
-
-	{
-		//TimeTaker timer("updateLighting: unspreadLight");
-		unspreadLight(LIGHTBANK_DAY, unlight_from_day, light_sources, modified_blocks);
-		unspreadLight(LIGHTBANK_NIGHT, unlight_from_night, light_sources, modified_blocks);
-	}
-
-	{
-		//TimeTaker timer("updateLighting: spreadLight");
-		spreadLight(LIGHTBANK_DAY, light_sources, modified_blocks, porting::getTimeMs() + max_cycle_ms * 10);
-		spreadLight(LIGHTBANK_NIGHT, light_sources, modified_blocks, porting::getTimeMs() + max_cycle_ms * 10);
 	}
 
 	//infostream<<"light: processed="<<processed.size()<< " loopcount="<<loopcount<< " ablocks_bef="<<a_blocks.size();
@@ -642,7 +710,7 @@ u32 Map::updateLighting(Map::lighting_map_t & a_blocks, unordered_map_v3POS<int>
 }
 
 
-bool Map::propagateSunlight(v3POS pos, std::set<v3POS> & light_sources,
+bool Map::propagateSunlight(v3POS pos, LightPropagator & light,
                             bool remove_light) {
 	MapBlock *block = getBlockNoCreateNoEx(pos);
 
@@ -716,7 +784,7 @@ bool Map::propagateSunlight(v3POS pos, std::set<v3POS> & light_sources,
 				}
 
 				if(diminish_light(current_light) != 0) {
-					light_sources.insert(pos_relative + pos);
+					light.addSource(pos_relative + pos);
 				}
 
 			}
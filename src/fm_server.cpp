@@ -1,3 +1,27 @@
+// Handles the exception being thrown in the loops of ServerThread and
+// ReceiveThread, rethrows the ones left to the debug handler
+static void handleServerThreadException(Server *server, const std::string &name)
+{
+	try {
+		throw;
+	} catch (con::NoIncomingDataException &e) {
+		//std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	} catch (con::PeerNotFoundException &e) {
+		infostream<<"Server: PeerNotFoundException"<<std::endl;
+	} catch (ClientNotFoundException &e) {
+	} catch (con::ConnectionBindFailed &e) {
+		server->setAsyncFatalError(e.what());
+#if !EXEPTION_DEBUG
+	} catch (LuaError &e) {
+		server->setAsyncFatalError("Lua: " + std::string(e.what()));
+	} catch (std::exception &e) {
+		errorstream << name << ": exception: "<<e.what()<<std::endl;
+	} catch (...) {
+		errorstream << name << ": Ooops..."<<std::endl;
+#endif
+	}
+}
+
 class ServerThread : public thread_pool
 {
 public:
@@ -65,21 +89,8 @@ void *ServerThread::run()
 					errorstream<<"Server: Disabling overload mode queue=" << events << "\n";
 				m_server->overload = 0;
 			}
-		} catch (con::NoIncomingDataException &e) {
-			//std::this_thread::sleep_for(std::chrono::milliseconds(10));
-		} catch (con::PeerNotFoundException &e) {
-			infostream<<"Server: PeerNotFoundException"<<std::endl;
-		} catch (ClientNotFoundException &e) {
-		} catch (con::ConnectionBindFailed &e) {
-			m_server->setAsyncFatalError(e.what());
-#if !EXEPTION_DEBUG
-		} catch (LuaError &e) {
-			m_server->setAsyncFatalError("Lua: " + std::string(e.what()));
-		} catch (std::exception &e) {
-			errorstream << m_name << ": exception: "<<e.what()<<std::endl;
 		} catch (...) {
-			errorstream << m_name << ": Ooops..."<<std::endl;
-#endif
+			handleServerThreadException(m_server, m_name);
 		}
 	}
 
@@ -90,6 +101,35 @@ void *ServerThread::run()
 
 
 
+// Packets of the peers in one connection receive queue, queue 0 is
+// handled by ServerThread
+class ReceiveThread : public thread_pool {
+	Server *m_server;
+	u8 m_queue;
+public:
+
+	ReceiveThread(Server *server, u8 queue):
+		thread_pool("Receive", 40),
+		m_server(server),
+		m_queue(queue)
+	{}
+
+	void * run() {
+		DSTACK(FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while(!stopRequested()) {
+			try {
+				m_server->Receive(100, m_queue);
+			} catch (...) {
+				handleServerThreadException(m_server, m_name);
+			}
+		}
+		END_DEBUG_EXCEPTION_HANDLER
+		return nullptr;
+	}
+};
+
 class MapThread : public thread_pool {
 	Server *m_server;
 public:
@@ -371,6 +411,7 @@ void Server::maintenance_start() {
 	infostream << "Server: Starting maintenance: saving..." << std::endl;
 	m_emerge->stopThreads();
 	save(0.1);
+	m_env->getServerMap().flushSave();
 	m_env->getServerMap().m_map_saving_enabled = false;
 	m_env->getServerMap().m_map_loading_enabled = false;
 	m_env->getServerMap().dbase->close();
@@ -21,9 +21,17 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "genericobject.h"
+#include <cmath>
 #include <sstream>
+#include "constants.h" // BS
 #include "util/serialize.h"
 
+// Movement quantization: a hundredth of a node, per second for speeds
+#define MOVEMENT_UNIT (BS / 100.0f)
+#define MOVEMENT_FLAG_INTERPOLATE 0x01
+#define MOVEMENT_FLAG_END 0x02
+#define MOVEMENT_FLAG_KEYFRAME 0x04
+
 std::string gob_cmd_set_properties(const ObjectProperties &prop)
 {
 	std::ostringstream os(std::ios::binary);
@@ -68,6 +76,86 @@ std::string gob_cmd_update_position(
 	return os.str();
 }
 
+static bool quantizeMovement(v3f v, v3s16 &q)
+{
+	v /= MOVEMENT_UNIT;
+	if (std::fabs(v.X) > S16_MAX || std::fabs(v.Y) > S16_MAX || std::fabs(v.Z) > S16_MAX)
+		return false;
+	q = v3s16(std::round(v.X), std::round(v.Y), std::round(v.Z));
+	return true;
+}
+
+static v3f unquantizeMovement(v3s16 q)
+{
+	return v3f(q.X, q.Y, q.Z) * MOVEMENT_UNIT;
+}
+
+std::string gob_cmd_update_movement(
+	bool keyframe,
+	u8 keyframe_seq,
+	v3f position,
+	v3f keyframe_position,
+	v3f velocity,
+	v3f acceleration,
+	f32 yaw,
+	bool do_interpolate,
+	bool is_movement_end,
+	f32 update_interval
+){
+	v3s16 delta, velocity_q, acceleration_q;
+	if ((!keyframe && !quantizeMovement(position - keyframe_position, delta)) ||
+			!quantizeMovement(velocity, velocity_q) ||
+			!quantizeMovement(acceleration, acceleration_q) ||
+			update_interval < 0 || update_interval * 1000 > U16_MAX)
+		return "";
+
+	std::ostringstream os(std::ios::binary);
+	// command
+	writeU8(os, GENERIC_CMD_UPDATE_MOVEMENT);
+	u8 flags = 0;
+	if (do_interpolate)
+		flags |= MOVEMENT_FLAG_INTERPOLATE;
+	if (is_movement_end)
+		flags |= MOVEMENT_FLAG_END;
+	if (keyframe)
+		flags |= MOVEMENT_FLAG_KEYFRAME;
+	writeU8(os, flags);
+	writeU8(os, keyframe_seq);
+	// pos
+	if (keyframe)
+		writeV3F1000(os, position);
+	else
+		writeV3S16(os, delta);
+	// velocity, acceleration
+	writeV3S16(os, velocity_q);
+	writeV3S16(os, acceleration_q);
+	// yaw, 65536 steps a turn
+	f32 turns = yaw / 360;
+	writeU16(os, (u16)(s32)std::round((turns - std::floor(turns)) * 65536));
+	// update_interval in ms
+	writeU16(os, std::round(update_interval * 1000));
+	return os.str();
+}
+
+GenericMovement gob_read_update_movement(std::istream &is)
+{
+	GenericMovement m;
+	u8 flags = readU8(is);
+	m.do_interpolate = flags & MOVEMENT_FLAG_INTERPOLATE;
+	m.is_movement_end = flags & MOVEMENT_FLAG_END;
+	m.keyframe = flags & MOVEMENT_FLAG_KEYFRAME;
+	m.keyframe_seq = readU8(is);
+	if (m.keyframe)
+		m.position = readV3F1000(is);
+	else
+		m.position = unquantizeMovement(readV3S16(is));
+	m.velocity = unquantizeMovement(readV3S16(is));
+	m.acceleration = unquantizeMovement(readV3S16(is));
+	m.yaw = readU16(is) * 360.0f / 65536;
+	m.update_interval = readU16(is) / 1000.0f;
+	return m;
+}
+
 std::string gob_cmd_set_texture_mod(const std::string &mod)
 {
 	std::ostringstream os(std::ios::binary);
@@ -39,7 +39,8 @@ enum GenericCMD {
 	GENERIC_CMD_ATTACH_TO,
 	GENERIC_CMD_SET_PHYSICS_OVERRIDE,
 	GENERIC_CMD_UPDATE_NAMETAG_ATTRIBUTES,
-	GENERIC_CMD_SPAWN_INFANT
+	GENERIC_CMD_SPAWN_INFANT,
+	GENERIC_CMD_UPDATE_MOVEMENT
 };
 
 #include "object_properties.h"
@@ -56,6 +57,40 @@ std::string gob_cmd_update_position(
 	f32 update_interval
 );
 
+/*
+	Compact GENERIC_CMD_UPDATE_POSITION: velocity, acceleration, yaw and
+	update interval quantized, the position absolute in a keyframe (sent
+	reliably) or else relative to the keyframe with the same number.
+	Returns "" if a value does not fit, send gob_cmd_update_position then.
+*/
+std::string gob_cmd_update_movement(
+	bool keyframe,
+	u8 keyframe_seq,
+	v3f position,
+	v3f keyframe_position,
+	v3f velocity,
+	v3f acceleration,
+	f32 yaw,
+	bool do_interpolate,
+	bool is_movement_end,
+	f32 update_interval
+);
+
+struct GenericMovement {
+	bool keyframe;
+	u8 keyframe_seq;
+	// Relative to the keyframe position unless keyframe
+	v3f position;
+	v3f velocity;
+	v3f acceleration;
+	f32 yaw;
+	bool do_interpolate;
+	bool is_movement_end;
+	f32 update_interval;
+};
+// Reads the data after the command byte
+GenericMovement gob_read_update_movement(std::istream &is);
+
 std::string gob_cmd_set_texture_mod(const std::string &mod);
 
 std::string gob_cmd_set_sprite(
@@ -0,0 +1,284 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "light_propagator.h"
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "porting.h"
+
+void LightPropagator::Ring::push(const LightNode &node)
+{
+	if (m_size == m_data.size()) {
+		// Grow by doubling, unwrapped
+		std::vector<LightNode> data(m_data.empty() ? 64 : m_data.size() * 2);
+		for (size_t i = 0; i < m_size; ++i)
+			data[i] = m_data[(m_head + i) & (m_data.size() - 1)];
+		m_data.swap(data);
+		m_head = 0;
+	}
+	m_data[(m_head + m_size) & (m_data.size() - 1)] = node;
+	++m_size;
+}
+
+LightPropagator::LightNode LightPropagator::Ring::pop()
+{
+	LightNode node = m_data[m_head];
+	m_head = (m_head + 1) & (m_data.size() - 1);
+	--m_size;
+	return node;
+}
+
+void LightPropagator::Buckets::push(u8 light, const LightNode &node)
+{
+	if (light > LIGHT_SUN)
+		light = LIGHT_SUN;
+	level[light].push(node);
+	mask |= 1 << light;
+}
+
+bool LightPropagator::Buckets::pop(u8 *light, LightNode *node)
+{
+	if (!mask)
+		return false;
+	u8 l = 31 - __builtin_clz(mask);
+	*node = level[l].pop();
+	if (level[l].empty())
+		mask &= ~(1 << l);
+	*light = l;
+	return true;
+}
+
+LightPropagator::LightPropagator(Map *map, INodeDefManager *ndef) :
+	m_map(map),
+	m_ndef(ndef)
+{
+	clearBlockCache();
+}
+
+void LightPropagator::addUnlight(LightBank bank, v3POS p, u8 oldlight)
+{
+	m_unlight[bank].push(oldlight, toLightNode(p));
+}
+
+void LightPropagator::addSource(v3POS p)
+{
+	m_sources.push(toLightNode(p));
+}
+
+bool LightPropagator::empty() const
+{
+	return m_sources.empty() &&
+		!m_unlight[0].mask && !m_unlight[1].mask &&
+		!m_spread[0].mask && !m_spread[1].mask;
+}
+
+void LightPropagator::merge(LightPropagator &other)
+{
+	while (!other.m_sources.empty())
+		m_sources.push(other.m_sources.pop());
+	for (int bank = 0; bank < 2; ++bank) {
+		u8 light;
+		LightNode node;
+		while (other.m_unlight[bank].pop(&light, &node))
+			m_unlight[bank].push(light, node);
+		while (other.m_spread[bank].pop(&light, &node))
+			m_spread[bank].push(light, node);
+	}
+}
+
+void LightPropagator::clearBlockCache()
+{
+	for (auto &cached : m_block_cache)
+		cached.valid = false;
+}
+
+MapBlock *LightPropagator::getBlock(v3POS pos)
+{
+	size_t h = ((u16)pos.X ^ ((u16)pos.Y << 2) ^ ((u16)pos.Z << 4)) % BLOCK_CACHE_SIZE;
+	CachedBlock &cached = m_block_cache[h];
+	if (!cached.valid || cached.pos != pos) {
+		cached.pos = pos;
+		cached.block = m_map->getBlockNoCreateNoEx(pos);
+		if (cached.block && cached.block->isDummy())
+			cached.block = NULL;
+		cached.valid = true;
+	}
+	return cached.block;
+}
+
+LightPropagator::LightNode LightPropagator::toLightNode(v3POS p)
+{
+	LightNode node;
+	v3POS relpos;
+	getNodeBlockPosWithOffset(p, node.block, relpos);
+	node.index = relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+		relpos.Y * MAP_BLOCKSIZE + relpos.X;
+	return node;
+}
+
+v3POS LightPropagator::relPos(const LightNode &node)
+{
+	return v3POS(node.index % MAP_BLOCKSIZE,
+		(node.index / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+		node.index / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+}
+
+LightPropagator::LightNode LightPropagator::neighbor(const LightNode &node, int dir)
+{
+	// back, top, right, front, bottom, left
+	static const u8 axes[6] = {2, 1, 0, 2, 1, 0};
+	static const u16 strides[3] = {1, MAP_BLOCKSIZE, MAP_BLOCKSIZE * MAP_BLOCKSIZE};
+
+	u8 axis = axes[dir];
+	u16 stride = strides[axis];
+	u16 c = (node.index / stride) % MAP_BLOCKSIZE;
+	LightNode n = node;
+	POS &b = axis == 0 ? n.block.X : axis == 1 ? n.block.Y : n.block.Z;
+	if (dir < 3) {
+		if (c == MAP_BLOCKSIZE - 1) {
+			n.index -= stride * (MAP_BLOCKSIZE - 1);
+			++b;
+		} else {
+			n.index += stride;
+		}
+	} else {
+		if (c == 0) {
+			n.index += stride * (MAP_BLOCKSIZE - 1);
+			--b;
+		} else {
+			n.index -= stride;
+		}
+	}
+	return n;
+}
+
+/*
+	A neighbour dimmer than the light the node had was lit by it: darken
+	it and go on from there. A brighter one has its own light and lights
+	the darkened area again.
+*/
+void LightPropagator::unspread(std::map<v3POS, MapBlock *> &modified_blocks)
+{
+	clearBlockCache();
+
+	for (int b = 0; b < 2; ++b) {
+		LightBank bank = (LightBank)b;
+		u8 oldlight;
+		LightNode node;
+		while (m_unlight[b].pop(&oldlight, &node)) {
+			for (int dir = 0; dir < 6; ++dir) {
+				LightNode n2 = neighbor(node, dir);
+				MapBlock *block = getBlock(n2.block);
+				if (!block)
+					continue;
+
+				v3POS relpos = relPos(n2);
+				bool is_valid_position;
+				MapNode n = block->getNode(relpos, &is_valid_position);
+				if (!is_valid_position)
+					continue;
+
+				u8 light = n.getLight(bank, m_ndef);
+				if (light >= oldlight) {
+					m_sources.push(n2);
+					continue;
+				}
+				if (!light || !m_ndef->get(n).light_propagates)
+					continue;
+
+				n.setLight(bank, 0, m_ndef);
+				block->setNode(relpos, n);
+				m_unlight[b].push(light, n2);
+
+				if (modified_blocks.insert(std::make_pair(n2.block, block)).second)
+					++block->lighting_broken;
+			}
+		}
+	}
+}
+
+/*
+	Brightest first: light reaching a node later is dimmer, so a node is
+	set once unless a brighter neighbour outside of the queued area is
+	found. That one spreads its own light again.
+*/
+bool LightPropagator::spread(std::map<v3POS, MapBlock *> &modified_blocks, u32 end_ms)
+{
+	clearBlockCache();
+
+	while (!m_sources.empty()) {
+		LightNode node = m_sources.pop();
+		MapBlock *block = getBlock(node.block);
+		if (!block)
+			continue;
+		bool is_valid_position;
+		MapNode n = block->getNode(relPos(node), &is_valid_position);
+		if (!is_valid_position || n.getContent() == CONTENT_IGNORE)
+			continue;
+		m_spread[LIGHTBANK_DAY].push(n.getLight(LIGHTBANK_DAY, m_ndef), node);
+		m_spread[LIGHTBANK_NIGHT].push(n.getLight(LIGHTBANK_NIGHT, m_ndef), node);
+	}
+
+	u32 count = 0;
+	for (int b = 0; b < 2; ++b) {
+		LightBank bank = (LightBank)b;
+		u8 level;
+		LightNode node;
+		while (m_spread[b].pop(&level, &node)) {
+			if (end_ms && !(++count % 1024) && porting::getTimeMs() > end_ms) {
+				m_spread[b].push(level, node);
+				return false;
+			}
+
+			MapBlock *block = getBlock(node.block);
+			if (!block)
+				continue;
+			bool is_valid_position;
+			MapNode n = block->getNode(relPos(node), &is_valid_position);
+			if (!is_valid_position || n.getContent() == CONTENT_IGNORE)
+				continue;
+
+			u8 oldlight = n.getLight(bank, m_ndef);
+			u8 newlight = diminish_light(oldlight);
+
+			for (int dir = 0; dir < 6; ++dir) {
+				LightNode n2 = neighbor(node, dir);
+				MapBlock *block2 = getBlock(n2.block);
+				if (!block2)
+					continue;
+
+				v3POS relpos = relPos(n2);
+				MapNode nn = block2->getNode(relpos, &is_valid_position);
+				if (!is_valid_position)
+					continue;
+
+				u8 light = nn.getLight(bank, m_ndef);
+				if (light > undiminish_light(oldlight)) {
+					m_spread[b].push(light, n2);
+				} else if (light < newlight && m_ndef->get(nn).light_propagates) {
+					nn.setLight(bank, newlight, m_ndef);
+					block2->setNode(relpos, nn);
+					m_spread[b].push(newlight, n2);
+					modified_blocks[n2.block] = block2;
+				}
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,116 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHT_PROPAGATOR_HEADER
+#define LIGHT_PROPAGATOR_HEADER
+
+#include <map>
+#include <vector>
+#include "irr_v3d.h"
+#include "light.h"
+#include "mapnode.h"
+
+class Map;
+class MapBlock;
+class INodeDefManager;
+
+/*
+	Light spreading and unspreading over map blocks as breadth first
+	search in buckets of one light level, brightest first, so a node is
+	lit once with its final light instead of once per path reaching it.
+	Queued nodes are a block position with the index in that block, the
+	buckets are ring buffers kept between runs: no allocation per node.
+	Spreading can stop at a time limit and go on in a later run, queued
+	nodes stay valid if blocks are unloaded meanwhile.
+*/
+
+class LightPropagator {
+public:
+	LightPropagator(Map *map, INodeDefManager *ndef);
+
+	// Node had oldlight, which the caller already set to 0
+	void addUnlight(LightBank bank, v3POS p, u8 oldlight);
+	// Node spreads its light of both banks to the neighbours
+	void addSource(v3POS p);
+
+	// Darken what was lit by the unlight nodes. Brighter nodes met at the
+	// border become sources.
+	void unspread(std::map<v3POS, MapBlock *> &modified_blocks);
+
+	// Spread the light of the sources, false if end_ms came first. The
+	// rest stays queued for the next call. end_ms 0: no limit
+	bool spread(std::map<v3POS, MapBlock *> &modified_blocks, u32 end_ms = 0);
+
+	bool empty() const;
+
+	// Take over everything queued in other
+	void merge(LightPropagator &other);
+
+private:
+	struct LightNode {
+		v3POS block;
+		u16 index; // z * 256 + y * 16 + x
+	};
+
+	class Ring {
+	public:
+		void push(const LightNode &node);
+		LightNode pop();
+		size_t size() const { return m_size; }
+		bool empty() const { return !m_size; }
+
+	private:
+		std::vector<LightNode> m_data;
+		size_t m_head = 0;
+		size_t m_size = 0;
+	};
+
+	// One bucket per light level, bit set in mask when not empty
+	struct Buckets {
+		Ring level[LIGHT_SUN + 1];
+		u32 mask = 0;
+
+		void push(u8 light, const LightNode &node);
+		// Brightest first, false if empty
+		bool pop(u8 *light, LightNode *node);
+	};
+
+	Map *m_map;
+	INodeDefManager *m_ndef;
+
+	Buckets m_unlight[2];
+	Buckets m_spread[2];
+	Ring m_sources;
+
+	// Direct mapped, valid for one run
+	static const size_t BLOCK_CACHE_SIZE = 64;
+	struct CachedBlock {
+		v3POS pos;
+		MapBlock *block;
+		bool valid;
+	};
+	CachedBlock m_block_cache[BLOCK_CACHE_SIZE];
+
+	void clearBlockCache();
+	MapBlock *getBlock(v3POS pos);
+
+	static LightNode toLightNode(v3POS p);
+	static LightNode neighbor(const LightNode &node, int dir);
+	static v3POS relPos(const LightNode &node);
+};
+
+#endif
@@ -24,6 +24,9 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 // This would get rid of the console window
 //#pragma comment(linker, "/subsystem:windows /ENTRY:mainCRTStartup")
 
+#include <algorithm>
+#include <tuple>
+
 #include "irrlicht.h" // createDevice
 
 #include "mainmenumanager.h"
@@ -47,6 +50,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "fontengine.h"
 #include "gameparams.h"
 #include "database.h"
+#include "database-leveldb.h"
 #include "config.h"
 #if USE_CURSES
 	#include "terminal_chat_console.h"
@@ -116,6 +120,7 @@ static bool determine_subgame(GameParams *game_params);
 
 static bool run_dedicated_server(const GameParams &game_params, const Settings &cmd_args);
 static bool migrate_database(const GameParams &game_params, const Settings &cmd_args);
+static bool migrate_keys(const GameParams &game_params, const Settings &cmd_args);
 
 /**********************************************************************/
 
@@ -325,6 +330,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Set gameid (\"--gameid list\" prints available ones)"))));
 	allowed_options->insert(std::make_pair("migrate", ValueSpec(VALUETYPE_STRING,
 			_("Migrate from current map backend to another (Only works when using minetestserver or with --server)"))));
+	allowed_options->insert(std::make_pair("migrate-keys", ValueSpec(VALUETYPE_STRING,
+			_("Convert leveldb map keys to 'morton' (spatially ordered) or 'string' format"))));
 
 	allowed_options->insert(std::make_pair("autoexit", ValueSpec(VALUETYPE_STRING,
 			_("Exit after X seconds"))));
@@ -898,6 +905,9 @@ static bool run_dedicated_server(const GameParams &game_params, const Settings &
 	if (cmd_args.exists("migrate"))
 		return migrate_database(game_params, cmd_args);
 
+	if (cmd_args.exists("migrate-keys"))
+		return migrate_keys(game_params, cmd_args);
+
 	if (cmd_args.exists("terminal")) {
 #if USE_CURSES
 		bool name_ok = true;
@@ -997,7 +1007,7 @@ static bool migrate_database(const GameParams &game_params, const Settings &cmd_
 	if (!world_mt.exists("backend")) {
 		errorstream << "Please specify your current backend in world.mt:"
 			<< std::endl
-			<< "	backend = {sqlite3|leveldb|redis|dummy}"
+			<< "	backend = {sqlite3|leveldb|redis|region|dummy}"
 			<< std::endl;
 		return false;
 	}
@@ -1062,3 +1072,73 @@ static bool migrate_database(const GameParams &game_params, const Settings &cmd_
 	return true;
 }
 
+static bool migrate_keys(const GameParams &game_params, const Settings &cmd_args)
+{
+#if USE_LEVELDB
+	std::string format = cmd_args.get("migrate-keys");
+	if (format != "morton" && format != "string") {
+		errorstream << "Unknown key format '" << format
+			<< "', use morton or string" << std::endl;
+		return false;
+	}
+	Settings world_mt;
+	std::string world_mt_path = game_params.world_path + DIR_DELIM + "world.mt";
+	if (!world_mt.readConfigFile(world_mt_path.c_str())) {
+		errorstream << "Cannot read world.mt!" << std::endl;
+		return false;
+	}
+	if (!world_mt.exists("backend") || world_mt.get("backend") != "leveldb") {
+		errorstream << "Key formats are only supported by leveldb backend" << std::endl;
+		return false;
+	}
+
+	Database_LevelDB db(game_params.world_path);
+	if (!db.isOpen()) {
+		errorstream << "Cannot open map database (is a server running?)" << std::endl;
+		return false;
+	}
+	bool &kill = *porting::signal_handler_killstatus();
+
+	/*
+		Switch world.mt first: blocks are read with any key format, so a
+		world with part of its keys converted is complete. After a kill
+		running --migrate-keys again converts the rest.
+	*/
+	world_mt.set("leveldb_keys", format);
+	if (!world_mt.updateConfigFile(world_mt_path.c_str())) {
+		errorstream << "Failed to update world.mt!" << std::endl;
+		return false;
+	}
+	actionstream << "world.mt updated" << std::endl;
+
+	std::vector<v3s16> blocks;
+	db.listAllLoadableBlocks(blocks);
+	// Same block can be listed in several formats
+	std::sort(blocks.begin(), blocks.end(), [](const v3s16 &a, const v3s16 &b) {
+		return std::tie(a.X, a.Y, a.Z) < std::tie(b.X, b.Y, b.Z);
+	});
+	blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+
+	size_t count = 0;
+	const size_t batch = 1000;
+	for (size_t i = 0; i < blocks.size(); i += batch) {
+		if (kill) {
+			errorstream << "Key conversion interrupted, run it again to convert the rest"
+				<< std::endl;
+			return false;
+		}
+		std::vector<v3s16> part(blocks.begin() + i,
+			blocks.begin() + std::min(i + batch, blocks.size()));
+		count += db.convertKeys(part, format == "morton");
+		std::cerr << " Converted " << count << " blocks, "
+			<< (100.0 * (i + part.size()) / blocks.size()) << "% completed.\r";
+	}
+	std::cerr << std::endl;
+
+	actionstream << "Successfully converted " << count << " blocks" << std::endl;
+	return true;
+#else
+	errorstream << "Built without leveldb" << std::endl;
+	return false;
+#endif
+}
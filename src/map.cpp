@@ -26,6 +26,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 	#include "mapblock_mesh.h"
 #endif
 #include "filesys.h"
+#include "light_propagator.h"
 #include "voxel.h"
 #include "voxelalgorithms.h"
 #include "porting.h"
@@ -54,6 +55,8 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include <queue>
 #include "database-leveldb.h"
 #include "database-redis.h"
+#include "database-region.h"
+#include "map_saver.h"
 #if USE_POSTGRESQL
 #include "database-postgresql.h"
 #endif
@@ -74,6 +77,8 @@ Map::Map(IGameDef *gamedef):
 	m_blocks_save_last(0)
 {
 	m_liquid_step_flow = 1000;
+	m_liquid_pass = 0;
+	m_transforming_liquid_size = 0;
 	time_life = 0;
 	getBlockCacheFlush();
 }
@@ -202,366 +207,6 @@ void Map::setNode(v3s16 p, MapNode & n, bool no_light_check)
 		block->setNode(relpos, n);
 }
 
-/*
-	Goes recursively through the neighbours of the node.
-
-	Alters only transparent nodes.
-
-	If the lighting of the neighbour is lower than the lighting of
-	the node was (before changing it to 0 at the step before), the
-	lighting of the neighbour is set to 0 and then the same stuff
-	repeats for the neighbour.
-
-	The ending nodes of the routine are stored in light_sources.
-	This is useful when a light is removed. In such case, this
-	routine can be called for the light node and then again for
-	light_sources to re-light the area without the removed light.
-
-	values of from_nodes are lighting values.
-*/
-void Map::unspreadLight(enum LightBank bank,
-		std::map<v3s16, u8> & from_nodes,
-		std::set<v3s16> & light_sources,
-		std::map<v3s16, MapBlock*>  & modified_blocks)
-{
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
-	v3s16 dirs[6] = {
-		v3s16(0,0,1), // back
-		v3s16(0,1,0), // top
-		v3s16(1,0,0), // right
-		v3s16(0,0,-1), // front
-		v3s16(0,-1,0), // bottom
-		v3s16(-1,0,0), // left
-	};
-
-	if(from_nodes.empty())
-		return;
-
-	u32 blockchangecount = 0;
-
-	std::map<v3s16, u8> unlighted_nodes;
-
-	/*
-		Initialize block cache
-	*/
-	v3s16 blockpos_last;
-	MapBlock *block = NULL;
-	// Cache this a bit, too
-	bool block_checked_in_modified = false;
-
-	for(std::map<v3s16, u8>::iterator j = from_nodes.begin();
-		j != from_nodes.end(); ++j)
-	{
-		v3s16 pos = j->first;
-		v3s16 blockpos = getNodeBlockPos(pos);
-
-		// Only fetch a new block if the block position has changed
-/*
-		try{
-*/
-			if(block == NULL || blockpos != blockpos_last){
-				block = getBlockNoCreateNoEx(blockpos);
-				blockpos_last = blockpos;
-
-				block_checked_in_modified = false;
-				blockchangecount++;
-			}
-/*
-		}
-		catch(InvalidPositionException &e)
-		{
-			continue;
-		}
-*/
-
-		if(!block || block->isDummy())
-			continue;
-
-		// Calculate relative position in block
-		//v3s16 relpos = pos - blockpos_last * MAP_BLOCKSIZE;
-
-		// Get node straight from the block
-		//MapNode n = block->getNode(relpos);
-
-		u8 oldlight = j->second;
-
-		// Loop through 6 neighbors
-		for(u16 i=0; i<6; i++)
-		{
-			// Get the position of the neighbor node
-			v3s16 n2pos = pos + dirs[i];
-
-			// Get the block where the node is located
-			v3s16 blockpos, relpos;
-			getNodeBlockPosWithOffset(n2pos, blockpos, relpos);
-
-			// Only fetch a new block if the block position has changed
-/*
-			try {
-*/
-				if(block == NULL || blockpos != blockpos_last){
-					block = getBlockNoCreateNoEx(blockpos);
-
-					if (!block || block->isDummy())
-						continue;
-
-					blockpos_last = blockpos;
-
-					block_checked_in_modified = false;
-					blockchangecount++;
-				}
-/*
-			}
-			catch(InvalidPositionException &e) {
-				continue;
-			}
-*/
-
-			// Get node straight from the block
-			bool is_valid_position;
-			MapNode n2 = block->getNode(relpos, &is_valid_position);
-			if (!is_valid_position)
-				continue;
-
-			bool changed = false;
-
-			//TODO: Optimize output by optimizing light_sources?
-
-			/*
-				If the neighbor is dimmer than what was specified
-				as oldlight (the light of the previous node)
-			*/
-			if(n2.getLight(bank, nodemgr) < oldlight)
-			{
-				/*
-					And the neighbor is transparent and it has some light
-				*/
-				if(nodemgr->get(n2).light_propagates
-						&& n2.getLight(bank, nodemgr) != 0)
-				{
-					/*
-						Set light to 0 and add to queue
-					*/
-
-					u8 current_light = n2.getLight(bank, nodemgr);
-					n2.setLight(bank, 0, nodemgr);
-					block->setNode(relpos, n2);
-
-					unlighted_nodes[n2pos] = current_light;
-					changed = true;
-
-					/*
-						Remove from light_sources if it is there
-						NOTE: This doesn't happen nearly at all
-					*/
-					/*if(light_sources.find(n2pos))
-					{
-						infostream<<"Removed from light_sources"<<std::endl;
-						light_sources.remove(n2pos);
-					}*/
-				}
-
-				/*// DEBUG
-				if(light_sources.find(n2pos) != NULL)
-					light_sources.remove(n2pos);*/
-			}
-			else{
-				light_sources.insert(n2pos);
-			}
-
-			// Add to modified_blocks
-			if(changed == true && block_checked_in_modified == false)
-			{
-				// If the block is not found in modified_blocks, add.
-/*
-				if(modified_blocks.find(blockpos) == modified_blocks.end())
-				{
-*/
-					++block->lighting_broken;
-					modified_blocks[blockpos] = block;
-/*
-				}
-*/
-				block_checked_in_modified = true;
-			}
-		}
-	}
-
-	/*infostream<<"unspreadLight(): Changed block "
-	<<blockchangecount<<" times"
-	<<" for "<<from_nodes.size()<<" nodes"
-	<<std::endl;*/
-
-	if(!unlighted_nodes.empty())
-		unspreadLight(bank, unlighted_nodes, light_sources, modified_blocks);
-}
-
-/*
-	Lights neighbors of from_nodes, collects all them and then
-	goes on recursively.
-*/
-void Map::spreadLight(enum LightBank bank,
-		std::set<v3s16> & from_nodes,
-		std::map<v3s16, MapBlock*> & modified_blocks, u32 end_ms)
-{
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
-	const v3s16 dirs[6] = {
-		v3s16(0,0,1), // back
-		v3s16(0,1,0), // top
-		v3s16(1,0,0), // right
-		v3s16(0,0,-1), // front
-		v3s16(0,-1,0), // bottom
-		v3s16(-1,0,0), // left
-	};
-
-	if(from_nodes.empty())
-		return;
-
-	u32 blockchangecount = 0;
-
-	std::set<v3s16> lighted_nodes;
-
-	/*
-		Initialize block cache
-	*/
-	v3s16 blockpos_last;
-	MapBlock *block = NULL;
-		// Cache this a bit, too
-	bool block_checked_in_modified = false;
-
-	for(std::set<v3s16>::iterator j = from_nodes.begin();
-		j != from_nodes.end(); ++j)
-	{
-		v3s16 pos = *j;
-		v3s16 blockpos, relpos;
-
-		getNodeBlockPosWithOffset(pos, blockpos, relpos);
-
-		// Only fetch a new block if the block position has changed
-			if(block == NULL || blockpos != blockpos_last){
-#if !ENABLE_THREADS
-				auto lock = m_nothread_locker.try_lock_shared_rec();
-				if (!lock->owns_lock())
-					continue;
-#endif
-				block = getBlockNoCreateNoEx(blockpos);
-				if (!block)
-					continue;
-				blockpos_last = blockpos;
-
-				block_checked_in_modified = false;
-				blockchangecount++;
-			}
-
-		if(block->isDummy())
-			continue;
-
-		//auto lock = block->try_lock_unique_rec();
-		//if (!lock->owns_lock())
-		//	continue;
-
-		// Get node straight from the block
-		bool is_valid_position;
-		MapNode n = block->getNode(relpos, &is_valid_position);
-		if (n.getContent() == CONTENT_IGNORE)
-			continue;
-
-		u8 oldlight = is_valid_position ? n.getLight(bank, nodemgr) : 0;
-		u8 newlight = diminish_light(oldlight);
-
-		// Loop through 6 neighbors
-		for(u16 i=0; i<6; i++){
-			// Get the position of the neighbor node
-			v3s16 n2pos = pos + dirs[i];
-
-			// Get the block where the node is located
-			v3s16 blockpos, relpos;
-			getNodeBlockPosWithOffset(n2pos, blockpos, relpos);
-
-			// Only fetch a new block if the block position has changed
-			//try {
-				if(block == NULL || blockpos != blockpos_last){
-					block = getBlockNoCreateNoEx(blockpos);
-					if (!block)
-						continue;
-					blockpos_last = blockpos;
-
-					block_checked_in_modified = false;
-					blockchangecount++;
-				}
-/*
-			}
-			catch(InvalidPositionException &e) {
-				continue;
-			}
-*/
-
-			// Get node straight from the block
-			MapNode n2 = block->getNode(relpos, &is_valid_position);
-			if (!is_valid_position)
-				continue;
-
-			bool changed = false;
-			/*
-				If the neighbor is brighter than the current node,
-				add to list (it will light up this node on its turn)
-			*/
-			if(n2.getLight(bank, nodemgr) > undiminish_light(oldlight))
-			{
-				lighted_nodes.insert(n2pos);
-				changed = true;
-			}
-			/*
-				If the neighbor is dimmer than how much light this node
-				would spread on it, add to list
-			*/
-			if(n2.getLight(bank, nodemgr) < newlight)
-			{
-				if(nodemgr->get(n2).light_propagates)
-				{
-					n2.setLight(bank, newlight, nodemgr);
-					block->setNode(relpos, n2);
-					lighted_nodes.insert(n2pos);
-					changed = true;
-				}
-			}
-
-			// Add to modified_blocks
-			if(changed == true && block_checked_in_modified == false)
-			{
-				// If the block is not found in modified_blocks, add.
-/*
-				if(modified_blocks.find(blockpos) == modified_blocks.end())
-				{
-*/
-					modified_blocks[blockpos] = block;
-/*
-				}
-*/
-				block_checked_in_modified = true;
-			}
-		}
-	}
-
-	/*infostream<<"spreadLight(): Changed block "
-			<<blockchangecount<<" times"
-			<<" for "<<from_nodes.size()<<" nodes"
-			<<std::endl;*/
-
-	if(!lighted_nodes.empty() && (!end_ms || porting::getTimeMs() <= end_ms)) { // maybe 32 too small
-/*
-		infostream<<"spreadLight(): recursive("<<recursive<<"): changed=" <<blockchangecount
-			<<" from="<<from_nodes.size()
-			<<" lighted="<<lighted_nodes.size()
-			<<" modifiedB="<<modified_blocks.size()
-			<<std::endl;
-*/
-		spreadLight(bank, lighted_nodes, modified_blocks, end_ms);
-	}
-}
-
 #if 0
 
 u32 Map::updateLighting(enum LightBank bank,
@@ -1274,12 +919,16 @@ struct NodeNeighbor {
 void Map::transforming_liquid_add(v3POS p) {
 	std::lock_guard<Mutex> lock(m_transforming_liquid_mutex);
 	//m_transforming_liquid.set(p, 1);
-	m_transforming_liquid.push_back(p);
+	transforming_liquid_add_nolock(p);
+}
+
+void Map::transforming_liquid_add_nolock(v3POS p) {
+	if (m_transforming_liquid[getContainerPos(p, LIQUID_REGION_SIZE)].push_back(p))
+		++m_transforming_liquid_size;
 }
 
 u32 Map::transforming_liquid_size() {
-	std::lock_guard<Mutex> lock(m_transforming_liquid_mutex);
-	return m_transforming_liquid.size();
+	return m_transforming_liquid_size;
 }
 
 #define WATER_DROP_BOOST 4
@@ -1340,7 +989,9 @@ u32 Map::transformLiquids(Server *m_server, unsigned int max_cycle_ms)
 		/*
 			Get a queued transforming liquid node
 		*/
-		v3POS p0 = transforming_liquid_pop();
+		v3POS p0;
+		if (!transforming_liquid_pop(p0))
+			break;
 
 		MapNode n0 = getNodeNoEx(p0);
 
@@ -1681,8 +1332,9 @@ u32 Map::transformLiquids(Server *m_server, unsigned int max_cycle_ms)
 		infostream << "transformLiquids(): DUMPING " << dump_qty
 		           << " blocks from the queue" << std::endl;
 
-		while (dump_qty--)
-			transforming_liquid_pop();
+		v3POS p;
+		while (dump_qty-- && transforming_liquid_pop(p))
+			;
 
 		m_queue_size_timer_started = false; // optimistically assume we can keep up now
 		m_unprocessed_count = transforming_liquid_size();
@@ -1769,6 +1421,7 @@ bool Map::setNodeMetadata(v3s16 p, NodeMetadata *meta)
 		return false;
 	}
 	block->m_node_metadata.set(p_rel, meta);
+	block->expireNodeChanges();
 	return true;
 }
 
@@ -1783,6 +1436,8 @@ void Map::removeNodeMetadata(v3s16 p)
 				<<std::endl;
 		return;
 	}
+	if (block->m_node_metadata.get(p_rel))
+		block->expireNodeChanges();
 	block->m_node_metadata.remove(p_rel);
 }
 
@@ -1875,6 +1530,10 @@ ServerMap::ServerMap(std::string savedir, IGameDef *gamedef, EmergeManager *emer
 	std::string backend = conf.get("backend");
 	dbase = createDatabase(backend, savedir, conf);
 
+	int save_threads = g_settings->getS32("map_save_threads");
+	if (save_threads > 0)
+		m_saver.reset(new MapSaver(dbase, m_gamedef->ndef(), save_threads));
+
 	if (!conf.updateConfigFile(conf_path.c_str()))
 		errorstream << "ServerMap::ServerMap(): Failed to update world.mt!" << std::endl;
 
@@ -1938,6 +1597,8 @@ ServerMap::~ServerMap()
 	{
 			// Save only changed parts
 			save(MOD_STATE_WRITE_AT_UNLOAD);
+			if (m_saver)
+				m_saver->stop();
 	}
 	catch(std::exception &e)
 	{
@@ -1945,6 +1606,8 @@ ServerMap::~ServerMap()
 				<<", exception: "<<e.what()<<std::endl;
 	}
 
+	m_saver.reset();
+
 	/*
 		Close database if it was opened
 	*/
@@ -2397,6 +2060,11 @@ MapBlock *ServerMap::getBlockOrEmerge(v3s16 p3d)
 	return block;
 }
 
+task_pool *ServerMap::getTaskPool()
+{
+	return m_emerge ? m_emerge->getTaskPool() : nullptr;
+}
+
 void ServerMap::prepareBlock(MapBlock *block) {
 	ServerEnvironment *senv = &((Server *)m_gamedef)->getEnv();
 
@@ -2801,9 +2469,14 @@ Database *ServerMap::createDatabase(
 	#endif
 	else if (name == "dummy")
 		return new Database_Dummy();
+	#if USE_REGION
+	else if (name == "region")
+		return new Database_Region(savedir);
+	#endif
 	#if USE_LEVELDB
 	else if (name == "leveldb")
-		return new Database_LevelDB(savedir);
+		return new Database_LevelDB(savedir,
+				conf.exists("leveldb_keys") && conf.get("leveldb_keys") == "morton");
 	#endif
 	#if USE_REDIS
 	else if (name == "redis")
@@ -2820,17 +2493,41 @@ Database *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
+	// Saver thread batches by itself
+	if (m_saver)
+		return;
 	dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
+	if (m_saver)
+		return;
 	dbase->endSave();
 }
 
+void ServerMap::flushSave()
+{
+	if (m_saver)
+		m_saver->flush();
+}
+
 bool ServerMap::saveBlock(MapBlock *block)
 {
-	return saveBlock(block, dbase);
+	if (!m_saver)
+		return saveBlock(block, dbase);
+
+	if (!block->isGenerated())
+		return true;
+
+	// Same format as saveBlock(block, db)
+	static const u8 codec = blockCodecFromString(g_settings->get("map_compression"));
+	u8 version = codec == BLOCK_CODEC_ZLIB ? SER_FMT_VER_HIGHEST_WRITE : SER_FMT_VER_PALETTE;
+
+	m_saver->push(block, version, codec);
+	// Saver owns the copy now
+	block->resetModified();
+	return true;
 }
 
 bool ServerMap::saveBlock(MapBlock *block, Database *db)
@@ -2842,8 +2539,9 @@ bool ServerMap::saveBlock(MapBlock *block, Database *db)
 		return true;
 	}
 
-	// Format used for writing
-	u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	// Format used for writing, old format while blocks are zlib compressed
+	static const u8 codec = blockCodecFromString(g_settings->get("map_compression"));
+	u8 version = codec == BLOCK_CODEC_ZLIB ? SER_FMT_VER_HIGHEST_WRITE : SER_FMT_VER_PALETTE;
 
 	/*
 		[0] u8 serialization version
@@ -2851,7 +2549,7 @@ bool ServerMap::saveBlock(MapBlock *block, Database *db)
 	*/
 	std::ostringstream o(std::ios_base::binary);
 	o.write((char*) &version, 1);
-	block->serialize(o, version, true);
+	block->serialize(o, version, true, false, codec);
 
 	std::string data = o.str();
 	bool ret = db->saveBlock(p3d, data);
@@ -2862,7 +2560,13 @@ bool ServerMap::saveBlock(MapBlock *block, Database *db)
 	return ret;
 }
 
-MapBlock * ServerMap::loadBlock(v3s16 p3d)
+void ServerMap::loadBlocksData(const std::vector<v3s16> &pos, std::vector<std::string> &blobs)
+{
+	ScopeProfiler sp(g_profiler, "ServerMap::loadBlocksData");
+	dbase->loadBlocks(pos, blobs);
+}
+
+MapBlock * ServerMap::loadBlock(v3s16 p3d, std::string *blob_loaded)
 {
 	DSTACK(FUNCTION_NAME);
 	ScopeProfiler sp(g_profiler, "ServerMap::loadBlock");
@@ -2870,7 +2574,12 @@ MapBlock * ServerMap::loadBlock(v3s16 p3d)
 	MapBlock *block = nullptr;
 	try {
 		std::string blob;
-		dbase->loadBlock(p3d, &blob);
+		if (m_saver && m_saver->getPending(p3d, blob))
+			; // newer than database
+		else if (blob_loaded)
+			blob.swap(*blob_loaded);
+		else
+			dbase->loadBlock(p3d, &blob);
 	if(!blob.length()) {
 		m_db_miss.set(p3d, 1);
 		return nullptr;
@@ -3129,6 +2838,8 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
+	if (m_saver)
+		m_saver->cancel(blockpos);
 	if (!dbase->deleteBlock(blockpos))
 		return false;
 
@@ -29,7 +29,9 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include <map>
 #include "util/unordered_map_hash.h"
 #include "threading/concurrent_unordered_map.h"
+#include "threading/concurrent_sharded_map.h"
 #include <list>
+#include <memory>
 
 #include "irrlichttypes_bloated.h"
 #include "mapnode.h"
@@ -50,14 +52,19 @@ class Database;
 class ClientMap;
 class MapSector;
 class ServerMapSector;
+class MapSaver;
 class MapBlock;
 class NodeMetadata;
 class IGameDef;
 class IRollbackManager;
 class EmergeManager;
+struct LiquidStep;
+struct LiquidRegionWork;
 class ServerEnvironment;
 struct BlockMakeData;
 class Server;
+class LightPropagator;
+class task_pool;
 
 /*
 	MapEditEvent
@@ -67,6 +74,9 @@ class Server;
 #define MAPTYPE_SERVER 1
 #define MAPTYPE_CLIENT 2
 
+// Side of liquid queue region in nodes
+#define LIQUID_REGION_SIZE (MAP_BLOCKSIZE * 2)
+
 enum MapEditEventType{
 	// Node added (changed from air or something else to something)
 	MEET_ADDNODE,
@@ -187,6 +197,10 @@ class Map /*: public NodeContainer*/
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=false)
 	{ return getBlockNoCreateNoEx(p); }
 
+	// Threads for parallel work, nullptr: run in the caller
+	virtual task_pool *getTaskPool()
+	{ return nullptr; }
+
 	// Returns InvalidPositionException if not found
 	bool isNodeUnderground(v3s16 p);
 
@@ -205,15 +219,6 @@ class Map /*: public NodeContainer*/
 	//MapNode getNodeLog(v3POS p);
 	MapNode getNodeNoEx(v3POS p);
 
-	void unspreadLight(enum LightBank bank,
-			std::map<v3s16, u8> & from_nodes,
-			std::set<v3s16> & light_sources,
-			std::map<v3s16, MapBlock*> & modified_blocks);
-
-	void spreadLight(enum LightBank bank,
-			std::set<v3s16> & from_nodes,
-			std::map<v3s16, MapBlock*> & modified_blocks, u32 end_ms = 0);
-
 /*
 	void updateLighting(enum LightBank bank,
 			std::map<v3s16, MapBlock*>  & a_blocks,
@@ -280,6 +285,7 @@ class Map /*: public NodeContainer*/
 
 	u32 transformLiquids(Server *m_server, unsigned int max_cycle_ms);
 	u32 transformLiquidsReal(Server *m_server, unsigned int max_cycle_ms);
+	void transformLiquidsRealRegion(Server *m_server, LiquidRegionWork & work, const LiquidStep & step);
 	/*
 		Node metadata
 		These are basically coordinate wrappers to MapBlock
@@ -323,9 +329,11 @@ class Map /*: public NodeContainer*/
 	*/
 
 	void transforming_liquid_add(v3s16 p);
-	v3s16 transforming_liquid_pop();
+	// false when the queue is empty
+	bool transforming_liquid_pop(v3POS &p);
 	u32 transforming_liquid_size();
 	std::atomic_uint m_liquid_step_flow;
+	unsigned int m_liquid_pass;
 
 	virtual s16 getHeat(v3s16 p, bool no_random = 0);
 	virtual s16 getHumidity(v3s16 p, bool no_random = 0);
@@ -338,7 +346,7 @@ class Map /*: public NodeContainer*/
 
 
 // from old mapsector:
-	typedef maybe_concurrent_unordered_map<v3POS, MapBlockP, v3POSHash, v3POSEqual> m_blocks_type;
+	typedef concurrent_sharded_map<v3POS, MapBlockP, v3POSHash, v3POSEqual> m_blocks_type;
 	m_blocks_type m_blocks;
 	//MapBlock * getBlockNoCreateNoEx(v3s16 & p);
 	MapBlock * createBlankBlockNoInsert(v3s16 & p);
@@ -363,7 +371,7 @@ class Map /*: public NodeContainer*/
 #endif
 	void copy_27_blocks_to_vm(MapBlock * block, VoxelManipulator & vmanip);
 
-	bool propagateSunlight(v3POS pos, std::set<v3POS> & light_sources, bool remove_light=false);
+	bool propagateSunlight(v3POS pos, LightPropagator & light, bool remove_light=false);
 
 protected:
 	friend class LuaVoxelManip;
@@ -386,8 +394,11 @@ class Map /*: public NodeContainer*/
 
 public:
 	//concurrent_unordered_map<v3POS, bool, v3POSHash, v3POSEqual> m_transforming_liquid;
+	// Queue is split by LIQUID_REGION_SIZE regions, so transformLiquidsReal can solve them in parallel
 	Mutex m_transforming_liquid_mutex;
-	UniqueQueue<v3POS> m_transforming_liquid;
+	unordered_map_v3POS<UniqueQueue<v3POS>> m_transforming_liquid;
+	std::atomic_uint m_transforming_liquid_size;
+	void transforming_liquid_add_nolock(v3POS p);
 	typedef unordered_map_v3POS<int> lighting_map_t;
 	Mutex m_lighting_modified_mutex;
 	std::map<v3POS, int> m_lighting_modified_blocks;
@@ -396,6 +407,9 @@ class Map /*: public NodeContainer*/
 	std::atomic_uint time_life;
 	u32 updateLighting(lighting_map_t & a_blocks, unordered_map_v3POS<int> & processed, unsigned int max_cycle_ms = 0);
 	unsigned int updateLightingQueue(unsigned int max_cycle_ms, int & loopcount);
+	// Spreading stopped by the time limit, continued by next updateLighting
+	Mutex m_light_pending_mutex;
+	std::unique_ptr<LightPropagator> m_light_pending;
 
 
 private:
@@ -403,6 +417,65 @@ class Map /*: public NodeContainer*/
 	DISABLE_CLASS_COPY(Map);
 };
 
+/*
+	MapBlockNeighborhood
+
+	Non-copying view of the 3x3x3 blocks around a center block, like
+	Map::copy_27_blocks_to_vm but without the copy.
+	Blocks are looked up lazily once and kept in a flat array, so node
+	access is an index computation instead of a m_blocks lookup per node.
+	Asking for a node outside of the view moves the center there.
+	Nodes are read without block lock like MapBlock::getNodeNoLock; blocks
+	stay valid while the view lives because Map deletes unloaded blocks
+	only after block_delete_time. The view holds one epoch_read_guard for
+	all its reads, keep it short lived.
+*/
+
+class MapBlockNeighborhood
+{
+public:
+	MapBlockNeighborhood(Map *map, v3POS blockpos = v3POS(0, 0, 0));
+
+	void setCenter(v3POS blockpos);
+
+	// Returns NULL if not loaded
+	MapBlock * getBlock(v3POS blockpos);
+
+	// Returns a CONTENT_IGNORE node if not loaded
+	inline MapNode getNodeTry(v3POS p)
+	{
+		v3POS rel = p - m_origin;
+		if ((u16)rel.X >= MAP_BLOCKSIZE * 3 || (u16)rel.Y >= MAP_BLOCKSIZE * 3
+				|| (u16)rel.Z >= MAP_BLOCKSIZE * 3) {
+			setCenter(getNodeBlockPos(p));
+			rel = p - m_origin;
+		}
+		MapBlock *block = getBlockIndex((rel.Z / MAP_BLOCKSIZE) * 9
+				+ (rel.Y / MAP_BLOCKSIZE) * 3 + rel.X / MAP_BLOCKSIZE);
+		if (!block)
+			return MapNode(CONTENT_IGNORE);
+		return block->getNodeNoGuard(v3POS(rel.X % MAP_BLOCKSIZE,
+				rel.Y % MAP_BLOCKSIZE, rel.Z % MAP_BLOCKSIZE));
+	}
+
+private:
+	inline MapBlock * getBlockIndex(u8 i)
+	{
+		if (!(m_resolved & (1 << i)))
+			resolveBlock(i);
+		return m_blocks[i];
+	}
+	void resolveBlock(u8 i);
+
+	Map *m_map;
+	v3POS m_center;
+	// Node position of the lowest corner of the view
+	v3POS m_origin;
+	MapBlock *m_blocks[27];
+	u32 m_resolved;
+	epoch_read_guard m_guard;
+};
+
 /*
 	ServerMap
 
@@ -454,6 +527,8 @@ class ServerMap : public Map
 	*/
 	MapBlock *getBlockOrEmerge(v3s16 p3d);
 
+	task_pool *getTaskPool();
+
 	// Carries out any initialization necessary before block is sent
 	void prepareBlock(MapBlock *block);
 
@@ -477,6 +552,8 @@ class ServerMap : public Map
 	// Call these before and after saving of blocks
 	void beginSave();
 	void endSave();
+	// Wait until asynchronously saved blocks are written
+	void flushSave();
 
 	s32 save(ModifiedState save_level, float dedicated_server_step = 0.1, bool breakable = 0);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
@@ -486,7 +563,10 @@ class ServerMap : public Map
 
 	bool saveBlock(MapBlock *block);
 	static bool saveBlock(MapBlock *block, Database *db);
-	MapBlock* loadBlock(v3s16 p);
+	// blob: data already read from database by loadBlocksData()
+	MapBlock* loadBlock(v3s16 p, std::string *blob = nullptr);
+	// Multi-get of serialized blocks, empty when block is not saved
+	void loadBlocksData(const std::vector<v3s16> &pos, std::vector<std::string> &blobs);
 
 	bool deleteBlock(v3s16 blockpos);
 
@@ -537,6 +617,8 @@ class ServerMap : public Map
 		This is reset to false when written on disk.
 	*/
 	bool m_map_metadata_changed;
+	// Write-behind saving, null when map_save_threads is 0
+	std::unique_ptr<MapSaver> m_saver;
 public:
 	Database *dbase;
 private:
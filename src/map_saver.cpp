@@ -0,0 +1,311 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "map_saver.h"
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+#include "database.h"
+#include "log_types.h"
+#include "porting.h"
+#include "profiler.h"
+#include "threading/thread_pool.h"
+#include "util/string_stream.h"
+
+// Blocks written in one database batch
+#define MAP_SAVER_BATCH 1024
+// Retry delay after a failed batch write, doubled every try
+#define MAP_SAVER_RETRY_MS 1000
+#define MAP_SAVER_RETRY_MAX_MS 60000
+// Failed writes of a block after which flush() gives up on it
+#define MAP_SAVER_FLUSH_TRIES 5
+
+class MapSaverThread : public thread_pool {
+	MapSaver *m_saver;
+	bool m_write;
+public:
+	MapSaverThread(MapSaver *saver, bool write):
+		thread_pool(write ? "MapSaveWrite" : "MapSaveSerialize"),
+		m_saver(saver),
+		m_write(write)
+	{}
+
+	void * run() {
+		while (!stopRequested()) {
+			try {
+				if (m_write)
+					m_saver->writeStep();
+				else
+					m_saver->serializeStep();
+			} catch (std::exception &e) {
+				errorstream << m_name << ": exception: " << e.what() << std::endl;
+			}
+		}
+		return nullptr;
+	}
+};
+
+MapSaver::MapSaver(Database *db, INodeDefManager *ndef, int threads):
+	m_db(db),
+	m_ndef(ndef),
+	m_stop(false),
+	m_serializers(new MapSaverThread(this, false)),
+	m_writer(new MapSaverThread(this, true))
+{
+	m_serializers->start(threads);
+	m_writer->start(1);
+}
+
+MapSaver::~MapSaver()
+{
+	stop();
+}
+
+void MapSaver::push(MapBlock *block, u8 version, u8 codec)
+{
+	auto item = std::make_shared<item_type>();
+	block->snapshotDisk(item->snapshot, version, codec);
+	size_t queue;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto &slot = m_pending[item->snapshot.pos];
+		item->seq = slot ? slot->seq : ++m_push_seq;
+		slot = item;
+		m_queue.push_back(item);
+		queue = m_pending.size();
+	}
+	m_queue_cv.notify_one();
+	g_profiler->avg("Map saver: pending", queue);
+}
+
+bool MapSaver::isPending(const item_ptr &item)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_pending.find(item->snapshot.pos);
+	return it != m_pending.end() && it->second == item;
+}
+
+void MapSaver::serialize(item_type &item)
+{
+	std::lock_guard<std::mutex> lock(item.mutex);
+	if (item.ready)
+		return;
+	string_ostream os(item.data);
+	os.write((char*) &item.snapshot.version, 1);
+	MapBlock::serializeDisk(os, item.snapshot, m_ndef);
+	item.ready = true;
+	// free nodes, keep pos for isPending
+	item.snapshot.nodes.clear();
+	item.snapshot.metadata.clear();
+	item.snapshot.objects.clear();
+	item.snapshot.timers.clear();
+}
+
+bool MapSaver::serializeStep()
+{
+	item_ptr item;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_queue_cv.wait_for(lock, std::chrono::seconds(1),
+				[this] { return !m_queue.empty() || m_stop; });
+		if (m_queue.empty())
+			return false;
+		item = m_queue.front();
+		m_queue.pop_front();
+	}
+
+	// Already replaced by newer copy or cancelled
+	if (!isPending(item))
+		return true;
+
+	try {
+		serialize(*item);
+	} catch (std::exception &e) {
+		errorstream << "MapSaver: Failed to serialize block "
+			<< item->snapshot.pos << ": " << e.what() << std::endl;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_pending.find(item->snapshot.pos);
+		if (it != m_pending.end() && it->second == item)
+			m_pending.erase(it);
+		m_written_cv.notify_all();
+		return true;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_ready.push_back(item);
+	}
+	m_ready_cv.notify_one();
+	return true;
+}
+
+bool MapSaver::writeStep()
+{
+	std::vector<item_ptr> items;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_ready_cv.wait_for(lock, std::chrono::seconds(1),
+				[this] { return !m_ready.empty() || m_stop; });
+		u32 now = porting::getTimeMs();
+		for (auto it = m_retry.begin(); it != m_retry.end(); ) {
+			if ((s32)(now - (*it)->retry_ms) < 0) {
+				++it;
+				continue;
+			}
+			m_ready.push_front(*it);
+			it = m_retry.erase(it);
+		}
+		while (!m_ready.empty() && items.size() < MAP_SAVER_BATCH) {
+			items.push_back(m_ready.front());
+			m_ready.pop_front();
+		}
+	}
+	if (items.empty())
+		return false;
+
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+
+	std::vector<std::pair<v3s16, std::string>> blocks;
+	std::vector<item_ptr> written;
+	blocks.reserve(items.size());
+	written.reserve(items.size());
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto &item : items) {
+			auto it = m_pending.find(item->snapshot.pos);
+			if (it == m_pending.end() || it->second != item)
+				continue;
+			blocks.emplace_back(item->snapshot.pos, item->data);
+			written.push_back(item);
+		}
+	}
+	if (blocks.empty())
+		return true;
+
+	bool ok = m_db->saveBlocks(blocks);
+	g_profiler->avg("Map saver: batch blocks", blocks.size());
+
+	if (!ok) {
+		// Not dropped: the blocks stay pending, loads still find them
+		unsigned int tries = 0;
+		u32 delay = MAP_SAVER_RETRY_MAX_MS;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto &item : written)
+				tries = std::max(tries, ++item->tries);
+			if (tries < 7)
+				delay = std::min<u32>(delay, MAP_SAVER_RETRY_MS << (tries - 1));
+			u32 retry_ms = porting::getTimeMs() + delay;
+			for (auto &item : written)
+				item->retry_ms = retry_ms;
+			m_retry.insert(m_retry.end(), written.begin(), written.end());
+		}
+		errorstream << "MapSaver: Failed to write " << blocks.size()
+			<< " blocks (try " << tries << "), retrying in " << delay
+			<< "ms" << std::endl;
+		// flush() counts the tries
+		m_written_cv.notify_all();
+		return true;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto &item : written) {
+			auto it = m_pending.find(item->snapshot.pos);
+			if (it != m_pending.end() && it->second == item)
+				m_pending.erase(it);
+		}
+	}
+	m_written_cv.notify_all();
+	return true;
+}
+
+bool MapSaver::getPending(v3POS pos, std::string &data)
+{
+	item_ptr item;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_pending.find(pos);
+		if (it == m_pending.end())
+			return false;
+		item = it->second;
+	}
+	serialize(*item);
+	data = item->data;
+	return true;
+}
+
+void MapSaver::cancel(v3POS pos)
+{
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_pending.erase(pos);
+	m_written_cv.notify_all();
+}
+
+bool MapSaver::flush()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	// Blocks pushed later are not waited for
+	const u64 seq = m_push_seq;
+	bool failed = false;
+	m_written_cv.wait(lock, [this, seq, &failed] {
+		failed = false;
+		for (const auto &pending : m_pending) {
+			if (pending.second->seq > seq)
+				continue;
+			if (pending.second->tries >= MAP_SAVER_FLUSH_TRIES)
+				failed = true;
+			else
+				return false;
+		}
+		return true;
+	});
+	if (failed)
+		errorstream << "MapSaver: flush: some blocks failed "
+			<< MAP_SAVER_FLUSH_TRIES << " writes, left pending" << std::endl;
+	return !failed;
+}
+
+void MapSaver::stop()
+{
+	if (m_stop)
+		return;
+	if (!flush()) {
+		std::lock_guard<std::mutex> write_lock(m_write_mutex);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		errorstream << "MapSaver: Dropping " << m_pending.size()
+			<< " unsaved blocks:";
+		for (const auto &pending : m_pending)
+			errorstream << " " << pending.first;
+		errorstream << std::endl;
+		m_pending.clear();
+		m_retry.clear();
+	}
+	m_stop = true;
+	m_queue_cv.notify_all();
+	m_ready_cv.notify_all();
+	m_serializers->join();
+	m_writer->join();
+}
+
+size_t MapSaver::size()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_pending.size();
+}
@@ -0,0 +1,107 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAP_SAVER_HEADER
+#define MAP_SAVER_HEADER
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "mapblock.h"
+#include "util/unordered_map_hash.h"
+
+class Database;
+class INodeDefManager;
+class thread_pool;
+
+/*
+	Write-behind block saving.
+	push() only copies the block, compression runs in serializer threads and
+	a single writer thread stores everything ready in one database batch.
+	Until written a block stays in the pending map, newest copy wins, and
+	loads must look there first (getPending) to never read a stale version.
+	Blocks of a failed batch stay pending and are retried with backoff.
+*/
+
+class MapSaver {
+public:
+	MapSaver(Database *db, INodeDefManager *ndef, int threads);
+	~MapSaver();
+
+	void push(MapBlock *block, u8 version, u8 codec);
+
+	// Version byte + serialized block, same as stored in database
+	bool getPending(v3POS pos, std::string &data);
+
+	// Forget not yet written copy of a deleted block
+	void cancel(v3POS pos);
+
+	// Wait until everything pushed before is in database, false if a
+	// block of it failed MAP_SAVER_FLUSH_TRIES writes, it stays pending
+	bool flush();
+	// Flush, drop what could not be written and stop the threads
+	void stop();
+
+	size_t size();
+
+	// Called from threads
+	bool serializeStep();
+	bool writeStep();
+
+private:
+	struct item_type {
+		MapBlock::DiskSnapshot snapshot;
+		std::string data;
+		bool ready = false;
+		std::mutex mutex;
+		// Order of the first push not written yet, kept by newer copies
+		u64 seq = 0;
+		// Failed batch writes, next try not before retry_ms
+		unsigned int tries = 0;
+		u32 retry_ms = 0;
+	};
+	typedef std::shared_ptr<item_type> item_ptr;
+
+	void serialize(item_type &item);
+	bool isPending(const item_ptr &item);
+
+	Database *m_db;
+	INodeDefManager *m_ndef;
+
+	std::mutex m_mutex;
+	std::condition_variable m_queue_cv;
+	std::condition_variable m_ready_cv;
+	std::condition_variable m_written_cv;
+	std::unordered_map<v3POS, item_ptr, v3POSHash, v3POSEqual> m_pending;
+	std::deque<item_ptr> m_queue; // not serialized
+	std::deque<item_ptr> m_ready; // serialized, not written
+	std::deque<item_ptr> m_retry; // write failed, waiting for retry_ms
+	u64 m_push_seq = 0;
+	std::atomic_bool m_stop;
+
+	// Held by writer during whole batch
+	std::mutex m_write_mutex;
+
+	std::unique_ptr<thread_pool> m_serializers;
+	std::unique_ptr<thread_pool> m_writer;
+};
+
+#endif
@@ -23,6 +23,8 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "mapblock.h"
 
 #include <sstream>
+#include <algorithm>
+#include <unordered_map>
 #include "map.h"
 #include "light.h"
 #include "nodedef.h"
@@ -38,6 +40,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 #include "util/string.h"
 #include "util/serialize.h"
+#include "util/string_stream.h"
 #include "util/basic_macros.h"
 
 #include "circuit.h"
@@ -92,10 +95,13 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 	humidity_add = 0;
 	m_timestamp = BLOCK_TIMESTAMP_UNDEFINED;
 	m_changed_timestamp = 0;
+	static std::atomic_uint instances(0);
+	m_modified_counter = (u64)++instances << 32;
+	m_node_changes_since = (u64)m_modified_counter;
 	m_day_night_differs_expired = true;
 	m_lighting_expired = true;
 	m_refcount = 0;
-	data = NULL;
+	m_content_counts_expired = true;
 	heat_last_update = 0;
 	humidity_last_update = 0;
 	//if(dummy == false)
@@ -130,9 +136,6 @@ MapBlock::~MapBlock()
 		abm_triggers.reset();
 		break;
 	}
-
-	delete data;
-	data = nullptr;
 }
 
 bool MapBlock::isValidPositionParent(v3s16 p)
@@ -151,16 +154,11 @@ MapNode MapBlock::getNodeParent(v3s16 p, bool *is_valid_position)
 	if (isValidPosition(p) == false)
 		return m_parent->getNodeNoEx(getPosRelative() + p);
 
-	if (data == NULL) {
-		if (is_valid_position)
-			*is_valid_position = false;
-		return MapNode(CONTENT_IGNORE);
-	}
 	auto lock = lock_shared_rec();
 
 	if (is_valid_position)
 		*is_valid_position = true;
-	return data[p.Z * zstride + p.Y * ystride + p.X];
+	return getNodeNoGuard(p);
 }
 
 std::string MapBlock::getModifiedReasonString()
@@ -292,7 +290,7 @@ bool MapBlock::propagateSunlight(std::set<v3s16> & light_sources,
 			for(; y >= 0; y--)
 			{
 				v3s16 pos(x, y, z);
-				MapNode &n = getNodeRef(pos);
+				MapNode n = getNodeNoGuard(pos);
 
 				if(current_light == 0)
 				{
@@ -321,6 +319,8 @@ bool MapBlock::propagateSunlight(std::set<v3s16> & light_sources,
 				if(current_light > old_light || remove_light)
 				{
 					n.setLight(LIGHTBANK_DAY, current_light, nodemgr);
+					// n is a copy, nodes are not addressable in the palette
+					data.set(pos.Z*zstride + pos.Y*ystride + pos.X, n);
 				}
 
 				if(diminish_light(current_light) != 0)
@@ -384,20 +384,52 @@ void MapBlock::copyTo(VoxelManipulator &dst)
 	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
+	SCRATCH_BUFFER(std::vector<MapNode>, nodes);
+	nodes.resize(nodecount);
+	data.copyTo(&nodes[0]);
+
 	// Copy from data to VoxelManipulator
-	dst.copyFrom(data, data_area, v3s16(0,0,0),
+	dst.copyFrom(&nodes[0], data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
 }
 
+// Longest change log of a block, 0: no delta updates
+static size_t blockDeltaMax()
+{
+	static const size_t max = g_settings->getU16("block_delta_max");
+	return max;
+}
+
 void MapBlock::copyFrom(VoxelManipulator &dst)
 {
 	auto lock = lock_unique_rec();
 	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
+	SCRATCH_BUFFER(std::vector<MapNode>, old);
+	old.resize(nodecount);
+	data.copyTo(&old[0]);
+	SCRATCH_BUFFER(std::vector<MapNode>, nodes);
+	nodes = old;
+
 	// Copy from VoxelManipulator to data
-	dst.copyTo(data, data_area, v3s16(0,0,0),
+	dst.copyTo(&nodes[0], data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+	data.assign(&nodes[0]);
+	expireContentCounts();
+
+	// Bulk writes larger than the log send the whole block
+	SCRATCH_BUFFER(std::vector<u16>, changed);
+	const size_t max = blockDeltaMax();
+	for (u32 i = 0; i < nodecount && changed.size() <= max; ++i)
+		if (!(old[i] == nodes[i]))
+			changed.push_back(i);
+	if (changed.size() > max) {
+		expireNodeChanges();
+		return;
+	}
+	for (auto i : changed)
+		logNodeChange(i, nodes[i]);
 }
 
 void MapBlock::actuallyUpdateDayNightDiff()
@@ -407,24 +439,28 @@ void MapBlock::actuallyUpdateDayNightDiff()
 	// Running this function un-expires m_day_night_differs
 	m_day_night_differs_expired = false;
 
-	if (data == NULL) {
-		m_day_night_differs = false;
-		return;
-	}
-
-	bool differs;
+	bool differs = false;
 
 	/*
-		Check if any lighting value differs
+		Check if any lighting value differs, every node is one of the
+		palette entries
 	*/
 	auto lock = lock_shared_rec();
-	for (u32 i = 0; i < nodecount; i++) {
-		MapNode &n = data[i];
-
-		differs = !n.isLightDayNightEq(nodemgr);
+	u16 palette_size = data.getPaletteSize();
+	for (u16 i = 0; i < palette_size; i++) {
+		differs = !data.getPaletteEntry(i).isLightDayNightEq(nodemgr);
 		if (differs)
 			break;
 	}
+	if (differs || !palette_size) {
+		for (u32 i = 0; i < nodecount; i++) {
+			MapNode n = data.getNoGuard(i);
+
+			differs = !n.isLightDayNightEq(nodemgr);
+			if (differs)
+				break;
+		}
+	}
 
 	/*
 		If some lighting values differ, check if the whole thing is
@@ -433,7 +469,7 @@ void MapBlock::actuallyUpdateDayNightDiff()
 	if (differs) {
 		bool only_air = true;
 		for (u32 i = 0; i < nodecount; i++) {
-			MapNode &n = data[i];
+			MapNode n = data.getNoGuard(i);
 			if (n.getContent() != CONTENT_AIR) {
 				only_air = false;
 				break;
@@ -451,26 +487,20 @@ void MapBlock::expireDayNightDiff()
 {
 	//INodeDefManager *nodemgr = m_gamedef->ndef();
 
-	if(data == NULL){
-		m_day_night_differs = false;
-		m_day_night_differs_expired = false;
-		return;
-	}
-
 	m_day_night_differs_expired = true;
 }
 
 s16 MapBlock::getGroundLevel(v2s16 p2d)
 {
 	auto lock = lock_shared_rec();
-	if(isDummy())
+	if(isDummy() || !isValidPosition(p2d.X, 0, p2d.Y))
 		return -3;
 	try
 	{
 		s16 y = MAP_BLOCKSIZE-1;
 		for(; y>=0; y--)
 		{
-			MapNode n = getNodeRef(p2d.X, y, p2d.Y);
+			MapNode n = getNodeNoGuard(v3POS(p2d.X, y, p2d.Y));
 			if(m_gamedef->ndef()->get(n).walkable)
 			{
 				if(y == MAP_BLOCKSIZE-1)
@@ -496,16 +526,17 @@ s16 MapBlock::getGroundLevel(v2s16 p2d)
 // sure we can handle all content ids. But it's absolutely worth it as it's
 // a speedup of 4 for one of the major time consuming functions on storing
 // mapblocks.
-static content_t getBlockNodeIdMapping_mapping[USHRT_MAX + 1];
-static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
+// Per thread, blocks are saved from map and save threads at once.
+// Only palette entries are renumbered when the nodes have a palette.
+static void getBlockNodeIdMapping(NameIdMapping *nimap, NodePalette &nodes,
 		INodeDefManager *nodedef)
 {
-	memset(getBlockNodeIdMapping_mapping, 0xFF, (USHRT_MAX + 1) * sizeof(content_t));
+	SCRATCH_BUFFER(std::vector<content_t>, getBlockNodeIdMapping_mapping);
+	getBlockNodeIdMapping_mapping.resize(USHRT_MAX + 1, 0xFFFF);
 
 	std::set<content_t> unknown_contents;
 	content_t id_counter = 0;
-	for (u32 i = 0; i < MapBlock::nodecount; i++) {
-		content_t global_id = nodes[i].getContent();
+	nodes.mapContent([&](content_t global_id) -> content_t {
 		content_t id = CONTENT_IGNORE;
 
 		// Try to find an existing mapping
@@ -527,8 +558,8 @@ static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 		}
 
 		// Update the MapNode
-		nodes[i].setContent(id);
-	}
+		return id;
+	});
 	for(std::set<content_t>::const_iterator
 			i = unknown_contents.begin();
 			i != unknown_contents.end(); ++i){
@@ -540,7 +571,7 @@ static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 // Unknown ones are added to nodedef.
 // Will not update itself to match id-name pairs in nodedef.
 static Mutex correctBlockNodeIds_mutex;
-static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
+static void correctBlockNodeIds(const NameIdMapping *nimap, NodePalette &nodes,
 		IGameDef *gamedef)
 {
 	INodeDefManager *nodedef = gamedef->ndef();
@@ -551,13 +582,12 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	std::set<content_t> unnamed_contents;
 	std::set<std::string> unallocatable_contents;
 	std::lock_guard<Mutex> lock(correctBlockNodeIds_mutex);
-	for (u32 i = 0; i < MapBlock::nodecount; i++) {
-		content_t local_id = nodes[i].getContent();
+	nodes.mapContent([&](content_t local_id) -> content_t {
 		std::string name;
 		bool found = nimap->getName(local_id, name);
 		if(!found){
 			unnamed_contents.insert(local_id);
-			continue;
+			return local_id;
 		}
 		content_t global_id;
 		found = nodedef->getId(name, global_id);
@@ -565,11 +595,11 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 			global_id = gamedef->allocateUnknownNodeId(name);
 			if(global_id == CONTENT_IGNORE){
 				unallocatable_contents.insert(name);
-				continue;
+				return local_id;
 			}
 		}
-		nodes[i].setContent(global_id);
-	}
+		return global_id;
+	});
 	for(std::set<content_t>::const_iterator
 			i = unnamed_contents.begin();
 			i != unnamed_contents.end(); ++i){
@@ -586,108 +616,153 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	}
 }
 
-void MapBlock::serialize(std::ostream &os, u8 version, bool disk, bool use_content_only)
+void MapBlock::serialize(std::ostream &os, u8 version, bool disk, bool use_content_only, u8 codec)
 {
 	auto lock = lock_shared_rec();
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
-	if(data == NULL)
-	{
-		throw SerializationError("ERROR: Not writing dummy block.");
-	}
-
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialisation version error");
 
+	if (disk) {
+		DiskSnapshot snapshot;
+		snapshotDisk(snapshot, version, codec);
+		serializeDisk(os, snapshot, m_gamedef->ndef());
+		return;
+	}
+
 	// First byte
-	u8 flags = 0;
-	if(is_underground)
-		flags |= 0x01;
-	if(getDayNightDiff())
-		flags |= 0x02;
-	if(m_lighting_expired)
-		flags |= 0x04;
-	if(m_generated == false)
-	{
-		flags |= 0x08;
+	u8 flags = getSerializeFlags();
+	if (flags & 0x08)
 		infostream<<" serialize not generated block"<<std::endl;
-	}
 
 	writeU8(os, flags);
 
+	if (version >= SER_FMT_VER_CODEC) {
+		if (!blockCodecSupported(codec))
+			codec = BLOCK_CODEC_ZLIB;
+		writeU8(os, codec);
+	} else {
+		codec = BLOCK_CODEC_ZLIB;
+	}
+
 	// fmtodo: check version and dont pack data if more than 20150427 or 0.4.12.7+
-	if (!disk && use_content_only && content_only != CONTENT_IGNORE)
+	if (use_content_only && content_only != CONTENT_IGNORE)
 		return;
 
 	/*
 		Bulk node data
 	*/
-	NameIdMapping nimap;
-	if(disk)
-	{
-		MapNode *tmp_nodes = new MapNode[nodecount];
-		for(u32 i=0; i<nodecount; i++)
-			tmp_nodes[i] = data[i];
-		getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
-
+	if (version >= SER_FMT_VER_PALETTE) {
+		SCRATCH_BUFFER(std::string, nodes);
+		data.serialize(nodes);
+		compressCodec(nodes, os, codec);
+	} else {
+		SCRATCH_BUFFER(std::vector<MapNode>, nodes);
+		nodes.resize(nodecount);
+		data.copyTo(&nodes[0]);
 		u8 content_width = 2;
 		u8 params_width = 2;
 		writeU8(os, content_width);
 		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, tmp_nodes, nodecount,
-				content_width, params_width, true);
-		delete[] tmp_nodes;
+		MapNode::serializeBulk(os, version, &nodes[0], nodecount,
+				content_width, params_width, true, codec);
 	}
-	else
+
+	/*
+		Node metadata
+	*/
+	SCRATCH_BUFFER(std::string, metadata);
 	{
+		string_ostream oss(metadata);
+		m_node_metadata.serialize(oss);
+	}
+	compressCodec(metadata, os, codec);
+}
+
+void MapBlock::snapshotDisk(DiskSnapshot & snapshot, u8 version, u8 codec)
+{
+	auto lock = lock_shared_rec();
+
+	if (version < SER_FMT_VER_CODEC || !blockCodecSupported(codec))
+		codec = BLOCK_CODEC_ZLIB;
+
+	snapshot.pos = m_pos;
+	snapshot.version = version;
+	snapshot.codec = codec;
+	snapshot.flags = getSerializeFlags();
+	// Compacted copy
+	snapshot.nodes = data;
+
+	snapshot.metadata.clear();
+	string_ostream metadata(snapshot.metadata);
+	m_node_metadata.serialize(metadata);
+
+	snapshot.objects.clear();
+	string_ostream objects(snapshot.objects);
+	m_static_objects.serialize(objects);
+	writeU32(objects, getTimestamp());
+
+	snapshot.timers.clear();
+	string_ostream timers(snapshot.timers);
+	m_node_timers.serialize(timers, version);
+}
+
+void MapBlock::serializeDisk(std::ostream & os, DiskSnapshot & snapshot, INodeDefManager * nodedef)
+{
+	u8 version = snapshot.version;
+	writeU8(os, snapshot.flags);
+	if (version >= SER_FMT_VER_CODEC)
+		writeU8(os, snapshot.codec);
+
+	/*
+		Bulk node data, ids renumbered in snapshot
+	*/
+	NameIdMapping nimap;
+	getBlockNodeIdMapping(&nimap, snapshot.nodes, nodedef);
+	if (version >= SER_FMT_VER_PALETTE) {
+		SCRATCH_BUFFER(std::string, nodes);
+		snapshot.nodes.serialize(nodes);
+		compressCodec(nodes, os, snapshot.codec, true);
+	} else {
+		SCRATCH_BUFFER(std::vector<MapNode>, nodes);
+		nodes.resize(nodecount);
+		snapshot.nodes.copyTo(&nodes[0]);
 		u8 content_width = 2;
 		u8 params_width = 2;
 		writeU8(os, content_width);
 		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, data, nodecount,
-				content_width, params_width, true);
+		MapNode::serializeBulk(os, version, &nodes[0], nodecount,
+				content_width, params_width, true, snapshot.codec, true);
 	}
 
 	/*
 		Node metadata
 	*/
-	std::ostringstream oss(std::ios_base::binary);
-	m_node_metadata.serialize(oss);
-	compressZlib(oss.str(), os);
+	compressCodec(snapshot.metadata, os, snapshot.codec);
 
 	/*
 		Data that goes to disk, but not the network
 	*/
-	if(disk)
-	{
-		if(version <= 24){
-			// Node timers
-			m_node_timers.serialize(os, version);
-		}
-
-		// Static objects
-		m_static_objects.serialize(os);
+	if(version <= 24){
+		// Node timers
+		os.write(snapshot.timers.data(), snapshot.timers.size());
+	}
 
-		// Timestamp
-		writeU32(os, getTimestamp());
+	// Static objects, timestamp
+	os.write(snapshot.objects.data(), snapshot.objects.size());
 
-		// Write block-specific node definition id mapping
-		nimap.serialize(os);
+	// Write block-specific node definition id mapping
+	nimap.serialize(os);
 
-		if(version >= 25){
-			// Node timers
-			m_node_timers.serialize(os, version);
-		}
+	if(version >= 25){
+		// Node timers
+		os.write(snapshot.timers.data(), snapshot.timers.size());
 	}
 }
 
 void MapBlock::serializeNetworkSpecific(std::ostream &os, u16 net_proto_version)
 {
-	if(data == NULL)
-	{
-		throw SerializationError("ERROR: Not writing dummy block.");
-	}
-
 	if(net_proto_version >= 21){
 		int version = 1;
 		writeU8(os, version);
@@ -696,6 +771,77 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os, u16 net_proto_version)
 	}
 }
 
+u8 MapBlock::getSerializeFlags()
+{
+	u8 flags = 0;
+	if(is_underground)
+		flags |= 0x01;
+	if(getDayNightDiff())
+		flags |= 0x02;
+	if(m_lighting_expired)
+		flags |= 0x04;
+	if(m_generated == false)
+		flags |= 0x08;
+	return flags;
+}
+
+void MapBlock::logNodeChange(u32 index, const MapNode & n)
+{
+	const size_t max = blockDeltaMax();
+	u64 counter = ++m_modified_counter;
+	if (!max) {
+		m_node_changes_since = counter;
+		return;
+	}
+	u64 since = m_node_changes_since;
+	size_t drop = 0;
+	while (drop < m_node_changes.size() && m_node_changes[drop].modified_counter <= since)
+		++drop;
+	if (m_node_changes.size() - drop >= max) {
+		// keep recent half, older versions get a full block
+		drop += (m_node_changes.size() - drop) / 2 + 1;
+		m_node_changes_since = m_node_changes[drop - 1].modified_counter;
+	}
+	if (drop)
+		m_node_changes.erase(m_node_changes.begin(), m_node_changes.begin() + drop);
+	m_node_changes.push_back({counter, (u16)index, n});
+}
+
+void MapBlock::expireNodeChanges()
+{
+	m_node_changes_since = ++m_modified_counter;
+}
+
+bool MapBlock::getNodeChanges(u64 version, std::string & out)
+{
+	auto lock = lock_shared_rec();
+	if (version < m_node_changes_since || version > m_modified_counter)
+		return false;
+	std::unordered_map<u16, MapNode> last;
+	std::vector<u16> order;
+	for (auto it = m_node_changes.rbegin(); it != m_node_changes.rend() && it->modified_counter > version; ++it) {
+		if (last.emplace(it->index, it->node).second)
+			order.push_back(it->index);
+	}
+	out.clear();
+	out.reserve(order.size() * 6);
+	string_ostream os(out);
+	for (auto i = order.rbegin(); i != order.rend(); ++i) {
+		const auto & n = last[*i];
+		writeU16(os, *i);
+		writeU16(os, n.param0);
+		writeU8(os, n.param1);
+		writeU8(os, n.param2);
+	}
+	return true;
+}
+
+void MapBlock::serializeNetwork(std::string &out, u8 version, bool use_content_only, u8 codec)
+{
+	out.clear();
+	string_ostream os(out);
+	serialize(os, version, false, use_content_only, codec);
+}
 
 bool MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 {
@@ -706,6 +852,8 @@ bool MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
 	m_day_night_differs_expired = false;
+	expireContentCounts();
+	expireNodeChanges();
 
 	if(version <= 21)
 	{
@@ -719,6 +867,10 @@ bool MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	m_lighting_expired = (flags & 0x04) ? true : false;
 	m_generated = (flags & 0x08) ? false : true;
 
+	u8 codec = BLOCK_CODEC_ZLIB;
+	if (version >= SER_FMT_VER_CODEC)
+		codec = readU8(is);
+
 	if (!m_generated) {
 		verbosestream<<"MapBlock::deSerialize(): deserialize not generated block "<<getPos()<<std::endl;
 		//if (disk) m_generated = false; else // uncomment if you want convert old buggy map
@@ -726,9 +878,8 @@ bool MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	}
 
 	if (!disk && content_only != CONTENT_IGNORE) {
-		auto n = MapNode(content_only, content_only_param1, content_only_param2);
-		for (u32 i = 0; i < MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE; i++)
-			data[i] = n;
+		data.fill(MapNode(content_only, content_only_param1, content_only_param2));
+		expireContentCounts();
 		return true;
 	}
 
@@ -737,14 +888,24 @@ bool MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	*/
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())
 			<<": Bulk node data"<<std::endl);
-	u8 content_width = readU8(is);
-	u8 params_width = readU8(is);
-	if(content_width != 1 && content_width != 2)
-		throw SerializationError("MapBlock::deSerialize(): invalid content_width");
-	if(params_width != 2)
-		throw SerializationError("MapBlock::deSerialize(): invalid params_width");
-	MapNode::deSerializeBulk(is, version, data, nodecount,
-			content_width, params_width, true);
+	if (version >= SER_FMT_VER_PALETTE) {
+		std::ostringstream oss(std::ios_base::binary);
+		decompressCodec(is, oss, codec, NodePalette::SERIALIZED_MAX);
+		data.deSerialize(oss.str());
+	} else {
+		u8 content_width = readU8(is);
+		u8 params_width = readU8(is);
+		if(content_width != 1 && content_width != 2)
+			throw SerializationError("MapBlock::deSerialize(): invalid content_width");
+		if(params_width != 2)
+			throw SerializationError("MapBlock::deSerialize(): invalid params_width");
+		SCRATCH_BUFFER(std::vector<MapNode>, nodes);
+		nodes.resize(nodecount);
+		MapNode::deSerializeBulk(is, version, &nodes[0], nodecount,
+				content_width, params_width, true, codec);
+		data.assign(&nodes[0]);
+	}
+	expireContentCounts();
 
 	/*
 		NodeMetadata
@@ -754,7 +915,7 @@ bool MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	// Ignore errors
 	try {
 		std::ostringstream oss(std::ios_base::binary);
-		decompressZlib(is, oss);
+		decompressCodec(is, oss, codec, MAPBLOCK_METADATA_MAX);
 		std::istringstream iss(oss.str(), std::ios_base::binary);
 		if (version >= 23)
 			m_node_metadata.deSerialize(iss, m_gamedef->idef());
@@ -840,7 +1001,7 @@ void MapBlock::deSerializeNetworkSpecific(std::istream &is)
 		ScopeProfiler sp(g_profiler, "Map: getNodeNoEx");
 #endif
 		auto lock = lock_shared_rec();
-		return getNodeNoLock(p);
+		return getNodeNoGuard(p);
 	}
 
 	void MapBlock::setNode(v3POS p, MapNode & n)
@@ -857,9 +1018,11 @@ void MapBlock::deSerializeNetworkSpecific(std::istream &is)
 
 		auto lock = lock_unique_rec();
 
-		const auto &f0 = nodedef->get(data[index].getContent());
+		MapNode old = data.set(index, n);
+		const auto &f0 = nodedef->get(old.getContent());
 
-		data[index] = n;
+		changeContentCounts(old.getContent(), n.getContent());
+		logNodeChange(index, n);
 
 		modified_light light = modified_light_no;
 		if (f0.light_propagates != f1.light_propagates || f0.solidness != f1.solidness || f0.light_source != f1.light_source) /*|| f0.drawtype != f1.drawtype*/
@@ -889,18 +1052,103 @@ void MapBlock::pushElementsToCircuit(Circuit* circuit)
 		auto lock = try_lock_shared_rec();
 		if (!lock->owns_lock())
 			return false;
-		content_only = data[0].param0;
-		content_only_param1 = data[0].param1;
-		content_only_param2 = data[0].param2;
-		for (int i = 1; i<MAP_BLOCKSIZE*MAP_BLOCKSIZE*MAP_BLOCKSIZE; ++i) {
-			if (data[i].param0 != content_only || data[i].param1 != content_only_param1 || data[i].param2 != content_only_param2) {
+		content_t was = content_only;
+		u8 was_param1 = content_only_param1, was_param2 = content_only_param2;
+		analyzeContentNolock();
+		// content_only is sent to clients
+		if (content_only != was || content_only_param1 != was_param1 || content_only_param2 != was_param2)
+			++m_modified_counter;
+		return true;
+	}
+
+	void MapBlock::analyzeContentNolock() {
+		{
+			std::lock_guard<Mutex> lock_counts(m_content_counts_mutex);
+			if (m_content_counts_expired)
+				updateContentCounts();
+			if (m_content_counts.size() > 1) {
+				content_only = CONTENT_IGNORE;
+				return;
+			}
+		}
+		MapNode first = data.getNoGuard(0);
+		content_only = first.param0;
+		content_only_param1 = first.param1;
+		content_only_param2 = first.param2;
+		// One palette entry: uniform without looking at the nodes
+		if (!data.getBitsNoGuard())
+			return;
+		for (u32 i = 1; i < nodecount; ++i) {
+			MapNode n = data.getNoGuard(i);
+			if (n.param0 != content_only || n.param1 != content_only_param1 || n.param2 != content_only_param2) {
 				content_only = CONTENT_IGNORE;
 				break;
 			}
 		}
+	}
+
+	bool MapBlock::getContentCounts(content_counts_type & counts) {
+		auto lock = try_lock_shared_rec();
+		if (!lock->owns_lock())
+			return false;
+		std::lock_guard<Mutex> lock_counts(m_content_counts_mutex);
+		if (m_content_counts_expired)
+			updateContentCounts();
+		counts = m_content_counts;
 		return true;
 	}
 
+	void MapBlock::expireContentCounts() {
+		std::lock_guard<Mutex> lock(m_content_counts_mutex);
+		m_content_counts_expired = true;
+		m_content_counts.clear();
+	}
+
+	// Must be called with data locked and m_content_counts_mutex held
+	void MapBlock::updateContentCounts() {
+		m_content_counts.clear();
+		m_content_counts_expired = false;
+		std::unordered_map<content_t, u16> counts;
+		content_t last = data.getNoGuard(0).getContent();
+		u16 run = 0;
+		for (u32 i = 0; i < nodecount; ++i) {
+			content_t c = data.getNoGuard(i).getContent();
+			if (c != last) {
+				counts[last] += run;
+				last = c;
+				run = 0;
+			}
+			++run;
+		}
+		counts[last] += run;
+		m_content_counts.assign(counts.begin(), counts.end());
+		std::sort(m_content_counts.begin(), m_content_counts.end());
+	}
+
+	// Called with data locked
+	void MapBlock::changeContentCounts(content_t from, content_t to) {
+		if (from == to)
+			return;
+		std::lock_guard<Mutex> lock(m_content_counts_mutex);
+		if (m_content_counts_expired)
+			return;
+		auto less = [](const std::pair<content_t, u16> & a, content_t c) { return a.first < c; };
+		auto it = std::lower_bound(m_content_counts.begin(), m_content_counts.end(), from, less);
+		if (it == m_content_counts.end() || it->first != from) {
+			// Out of sync, rebuild on next use
+			m_content_counts_expired = true;
+			m_content_counts.clear();
+			return;
+		}
+		if (!--it->second)
+			m_content_counts.erase(it);
+		it = std::lower_bound(m_content_counts.begin(), m_content_counts.end(), to, less);
+		if (it != m_content_counts.end() && it->first == to)
+			++it->second;
+		else
+			m_content_counts.emplace(it, to, 1);
+	}
+
 
 #ifndef SERVER
 MapBlock::mesh_type MapBlock::getMesh(int step) {
@@ -1061,9 +1309,12 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 	}
 
 	// Deserialize node data
+	SCRATCH_BUFFER(std::vector<MapNode>, nodes);
+	nodes.resize(nodecount);
 	for (u32 i = 0; i < nodecount; i++) {
-		data[i].deSerialize(&databuf_nodelist[i * ser_length], version);
+		nodes[i].deSerialize(&databuf_nodelist[i * ser_length], version);
 	}
+	data.assign(&nodes[0]);
 
 	if (disk) {
 		/*
@@ -1103,6 +1354,7 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 			content_mapnode_get_name_id_mapping(&nimap);
 		}
 		correctBlockNodeIds(&nimap, data, m_gamedef);
+		data.copyTo(&nodes[0]);
 	}
 
 
@@ -1111,31 +1363,31 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 	INodeDefManager *nodedef = m_gamedef->ndef();
 	for(u32 i=0; i<nodecount; i++)
 	{
-		const ContentFeatures &f = nodedef->get(data[i].getContent());
+		const ContentFeatures &f = nodedef->get(nodes[i].getContent());
 		// Mineral
-		if(nodedef->getId("default:stone") == data[i].getContent()
-				&& data[i].getParam1() == 1)
+		if(nodedef->getId("default:stone") == nodes[i].getContent()
+				&& nodes[i].getParam1() == 1)
 		{
-			data[i].setContent(nodedef->getId("default:stone_with_coal"));
-			data[i].setParam1(0);
+			nodes[i].setContent(nodedef->getId("default:stone_with_coal"));
+			nodes[i].setParam1(0);
 		}
-		else if(nodedef->getId("default:stone") == data[i].getContent()
-				&& data[i].getParam1() == 2)
+		else if(nodedef->getId("default:stone") == nodes[i].getContent()
+				&& nodes[i].getParam1() == 2)
 		{
-			data[i].setContent(nodedef->getId("default:stone_with_iron"));
-			data[i].setParam1(0);
+			nodes[i].setContent(nodedef->getId("default:stone_with_iron"));
+			nodes[i].setParam1(0);
 		}
 		// facedir_simple
 		if(f.legacy_facedir_simple)
 		{
-			data[i].setParam2(data[i].getParam1());
-			data[i].setParam1(0);
+			nodes[i].setParam2(nodes[i].getParam1());
+			nodes[i].setParam1(0);
 		}
 		// wall_mounted
 		if(f.legacy_wallmounted)
 		{
 			u8 wallmounted_new_to_old[8] = {0x04, 0x08, 0x01, 0x02, 0x10, 0x20, 0, 0};
-			u8 dir_old_format = data[i].getParam2();
+			u8 dir_old_format = nodes[i].getParam2();
 			u8 dir_new_format = 0;
 			for(u8 j=0; j<8; j++)
 			{
@@ -1145,10 +1397,10 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 					break;
 				}
 			}
-			data[i].setParam2(dir_new_format);
+			nodes[i].setParam2(dir_new_format);
 		}
 	}
-
+	data.assign(&nodes[0]);
 }
 
 void MapBlock::incrementUsageTimer(float dtime)
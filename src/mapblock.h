@@ -24,9 +24,11 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #define MAPBLOCK_HEADER
 
 #include <set>
+#include <memory>
 #include "debug.h"
 #include "irr_v3d.h"
 #include "mapnode.h"
+#include "node_palette.h"
 #include "exceptions.h"
 #include "constants.h"
 #include "staticobject.h"
@@ -36,6 +38,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "util/numeric.h" // getContainerPos
 #include "threading/lock.h"
 #include "settings.h"
+#include "serialization.h" // BlockCodec
 
 class Map;
 class NodeMetadataList;
@@ -48,6 +51,9 @@ struct ActiveABM;
 
 #define BLOCK_TIMESTAMP_UNDEFINED 0xffffffff
 
+// Largest decompressed node metadata accepted when deserializing a block
+#define MAPBLOCK_METADATA_MAX (16 * 1024 * 1024)
+
 /*// Named by looking towards z+
 enum{
 	FACE_BACK=0,
@@ -141,6 +147,16 @@ struct abm_trigger_one {
 #define MOD_REASON_EXPIRE_DAYNIGHTDIFF       (1 << 18)
 #define MOD_REASON_UNKNOWN                   (1 << 19)
 
+// Reasons which do not change the network form of the block
+#define MOD_REASON_NOT_SENT (MOD_REASON_SET_TIMESTAMP | MOD_REASON_CLEAR_ALL_OBJECTS | \
+		MOD_REASON_BLOCK_EXPIRED | MOD_REASON_ADD_ACTIVE_OBJECT_RAW | \
+		MOD_REASON_REMOVE_OBJECTS_REMOVE | MOD_REASON_REMOVE_OBJECTS_DEACTIVATE | \
+		MOD_REASON_TOO_MANY_OBJECTS | MOD_REASON_STATIC_DATA_ADDED | \
+		MOD_REASON_STATIC_DATA_REMOVED | MOD_REASON_STATIC_DATA_CHANGED)
+// Reasons which change only the flags byte, delta updates still possible
+#define MOD_REASON_FLAGS (MOD_REASON_SET_IS_UNDERGROUND | MOD_REASON_SET_LIGHTING_EXPIRED | \
+		MOD_REASON_SET_GENERATED | MOD_REASON_EXPIRE_DAYNIGHTDIFF)
+
 ////
 //// MapBlock itself
 ////
@@ -165,14 +181,9 @@ class MapBlock /*: public NodeContainer*/
 	void reallocate()
 	{
 		auto lock = lock_unique_rec();
-		if(data != NULL)
-			delete data;
-		data = reinterpret_cast<MapNode*>( ::operator new(nodecount * sizeof(MapNode)));
-		if (!CONTENT_IGNORE)
-			memset(data, 0, nodecount * sizeof(MapNode));
-		else
-		for (u32 i = 0; i < nodecount; i++)
-			data[i] = ignoreNode;
+		data.fill(ignoreNode);
+		expireContentCounts();
+		expireNodeChanges();
 	}
 
 	/*
@@ -187,6 +198,10 @@ class MapBlock /*: public NodeContainer*/
 	////
 	void raiseModified(u32 mod, u32 reason)
 	{
+		if (reason & MOD_REASON_FLAGS)
+			++m_modified_counter;
+		else if (!(reason & MOD_REASON_NOT_SENT))
+			expireNodeChanges();
 		raiseModified(mod, modified_light_no);
 #ifdef WTFdebug
 		if (mod > m_modified) {
@@ -237,6 +252,8 @@ class MapBlock /*: public NodeContainer*/
 
 	inline void setIsUnderground(bool a_is_underground)
 	{
+		if (is_underground != a_is_underground)
+			++m_modified_counter;
 		is_underground = a_is_underground;
 /*
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_IS_UNDERGROUND);
@@ -248,6 +265,8 @@ class MapBlock /*: public NodeContainer*/
 /*
 		if (expired != m_lighting_expired){
 */
+			if (m_lighting_expired != expired)
+				++m_modified_counter;
 			m_lighting_expired = expired;
 
 /*
@@ -269,6 +288,7 @@ class MapBlock /*: public NodeContainer*/
 	inline void setGenerated(bool b)
 	{
 		if (b != m_generated) {
+			++m_modified_counter;
 /*
 			raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_GENERATED);
 */
@@ -282,8 +302,6 @@ class MapBlock /*: public NodeContainer*/
 		if (m_lighting_expired)
 			return false;
 */
-		if (data == NULL)
-			return false;
 		return true;
 	}
 
@@ -315,8 +333,7 @@ class MapBlock /*: public NodeContainer*/
 
 	inline bool isValidPosition(s16 x, s16 y, s16 z)
 	{
-		return data != NULL
-			&& x >= 0 && x < MAP_BLOCKSIZE
+		return x >= 0 && x < MAP_BLOCKSIZE
 			&& y >= 0 && y < MAP_BLOCKSIZE
 			&& z >= 0 && z < MAP_BLOCKSIZE;
 	}
@@ -334,7 +351,7 @@ class MapBlock /*: public NodeContainer*/
 			return ignoreNode;
 
 		auto lock = lock_shared_rec();
-		return data[p.Z * zstride + p.Y * ystride + p.X];
+		return getNodeNoGuard(p);
 	}
 
 	MapNode getNodeNoEx(v3POS p);
@@ -367,9 +384,13 @@ class MapBlock /*: public NodeContainer*/
 
 	MapNode getNodeNoLock(v3POS p)
 	{
-		if (!data)
-			return ignoreNode;
-		return data[p.Z*zstride + p.Y*ystride + p.X];
+		return data.get(p.Z*zstride + p.Y*ystride + p.X);
+	}
+
+	// Block locked, or an epoch_read_guard held over a loop of reads
+	MapNode getNodeNoGuard(v3POS p)
+	{
+		return data.getNoGuard(p.Z*zstride + p.Y*ystride + p.X);
 	}
 
 	////
@@ -378,12 +399,10 @@ class MapBlock /*: public NodeContainer*/
 
 	inline MapNode getNodeNoCheck(s16 x, s16 y, s16 z, bool *valid_position)
 	{
-		*valid_position = data != NULL;
-		if (!valid_position)
-			return ignoreNode;
+		*valid_position = true;
 
 		auto lock = lock_shared_rec();
-		return data[z * zstride + y * ystride + x];
+		return data.getNoGuard(z * zstride + y * ystride + x);
 	}
 
 	inline MapNode getNodeNoCheck(v3s16 p, bool *valid_position)
@@ -398,8 +417,11 @@ class MapBlock /*: public NodeContainer*/
 
 		auto lock = lock_unique_rec();
 
-		data[p.Z * zstride + p.Y * ystride + p.X] = n;
-		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
+		auto index = p.Z * zstride + p.Y * ystride + p.X;
+		MapNode old = data.set(index, n);
+		changeContentCounts(old.getContent(), n.getContent());
+		logNodeChange(index, n);
+		raiseModified(MOD_STATE_WRITE_NEEDED, modified_light_no);
 	}
 
 	// These functions consult the parent container if the position
@@ -553,12 +575,46 @@ class MapBlock /*: public NodeContainer*/
 	// These don't write or read version by itself
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
-	void serialize(std::ostream &os, u8 version, bool disk, bool use_content_only = false);
+	// codec (BlockCodec) is written and used only if version >= SER_FMT_VER_CODEC
+	void serialize(std::ostream &os, u8 version, bool disk, bool use_content_only = false, u8 codec = BLOCK_CODEC_ZLIB);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
 	bool deSerialize(std::istream &is, u8 version, bool disk);
 
 	void serializeNetworkSpecific(std::ostream &os, u16 net_proto_version);
+	// Network form of serialize() into out, reused buffers keep their
+	// capacity; whole packets are shared by clients in BlockSendCache
+	void serializeNetwork(std::string &out, u8 version, bool use_content_only, u8 codec);
+	// First byte of serialize()
+	u8 getSerializeFlags();
+
+	/*
+		Copy of everything serialize() writes to disk, taken with the block
+		locked, so compression and database writes can run in another thread
+	*/
+	struct DiskSnapshot {
+		v3POS pos;
+		u8 version;
+		u8 codec;
+		u8 flags;
+		NodePalette nodes;
+		std::string metadata; // uncompressed
+		std::string objects; // static objects and timestamp
+		std::string timers;
+	};
+	void snapshotDisk(DiskSnapshot & snapshot, u8 version, u8 codec);
+	// Same output as serialize(os, snapshot.version, true), renumbers snapshot.nodes
+	static void serializeDisk(std::ostream & os, DiskSnapshot & snapshot, INodeDefManager * nodedef);
+
+	/*
+		Delta updates: nodes set since a m_modified_counter value, packed
+		as u16 index, u16 content, u8 param1, u8 param2, last change of a
+		node only. Returns false if the change log does not reach back to
+		version, then the whole block must be sent.
+	*/
+	bool getNodeChanges(u64 version, std::string & out);
+	// Call after changes a delta can not carry (metadata, bulk writes)
+	void expireNodeChanges();
 	void deSerializeNetworkSpecific(std::istream &is);
 
 	void pushElementsToCircuit(Circuit* circuit);
@@ -577,23 +633,6 @@ class MapBlock /*: public NodeContainer*/
 
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
 
-	/*
-		Used only internally, because changes can't be tracked
-	*/
-
-	inline MapNode &getNodeRef(s16 x, s16 y, s16 z)
-	{
-		if (!isValidPosition(x, y, z))
-			throw InvalidPositionException("getNodeRef InvalidPosition");
-
-		return data[z * zstride + y * ystride + x];
-	}
-
-	inline MapNode &getNodeRef(v3s16 &p)
-	{
-		return getNodeRef(p.X, p.Y, p.Z);
-	}
-
 public:
 	/*
 		Public member variables
@@ -620,6 +659,9 @@ class MapBlock /*: public NodeContainer*/
 
 	// Last really changed time (need send to client)
 	std::atomic_uint m_changed_timestamp;
+	// Incremented on every change of serialized data, high 32 bits are
+	// unique per MapBlock instance so a reloaded block never repeats a value
+	std::atomic<u64> m_modified_counter;
 	u32 m_next_analyze_timestamp;
 	typedef std::list<abm_trigger_one> abm_triggers_type;
 	std::unique_ptr<abm_triggers_type> abm_triggers;
@@ -641,6 +683,12 @@ class MapBlock /*: public NodeContainer*/
 	content_t content_only;
 	u8 content_only_param1, content_only_param2;
 	bool analyzeContent();
+
+	// Number of nodes of every content type in block, sorted by content
+	typedef std::vector<std::pair<content_t, u16>> content_counts_type;
+	// Returns false if block is busy
+	bool getContentCounts(content_counts_type & counts);
+	void expireContentCounts();
 	std::atomic_short lighting_broken;
 
 	static const u32 ystride = MAP_BLOCKSIZE;
@@ -669,10 +717,9 @@ class MapBlock /*: public NodeContainer*/
 	IGameDef *m_gamedef;
 
 	/*
-		If NULL, block is a dummy block.
-		Dummy blocks are used for caching not-found-on-disk blocks.
+		Nodes as palette and packed indices, see node_palette.h
 	*/
-	MapNode *data;
+	NodePalette data;
 
 	/*
 		- On the server, this is used for telling whether the
@@ -727,6 +774,31 @@ class MapBlock /*: public NodeContainer*/
 		the list of blocks to be drawn.
 	*/
 	std::atomic_int m_refcount;
+
+	/*
+		Kept up to date by setNode, rebuilt on next use after bulk
+		writes (deSerialize, copyFrom) which only expire it.
+	*/
+	void changeContentCounts(content_t from, content_t to);
+	void updateContentCounts();
+	content_counts_type m_content_counts;
+	bool m_content_counts_expired;
+	Mutex m_content_counts_mutex;
+	void analyzeContentNolock();
+
+	/*
+		Bounded log of setNode changes for delta updates, sorted by
+		counter. Complete for versions >= m_node_changes_since.
+		Written with the block locked unique.
+	*/
+	struct node_change {
+		u64 modified_counter;
+		u16 index;
+		MapNode node;
+	};
+	std::vector<node_change> m_node_changes;
+	std::atomic<u64> m_node_changes_since;
+	void logNodeChange(u32 index, const MapNode & n);
 };
 
 typedef std::vector<MapBlock*> MapBlockVect;
@@ -42,6 +42,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "util/serialize.h"
 #include "util/numeric.h"
 #include "filesys.h"
+#include "threading/task_graph.h"
 
 #include "log_types.h"
 #include "mapgen_indev.h"
@@ -120,6 +121,7 @@ Mapgen::Mapgen()
 
 	vm        = NULL;
 	ndef      = NULL;
+	m_emerge  = NULL;
 	biomegen  = NULL;
 	biomemap  = NULL;
 	heightmap = NULL;
@@ -450,56 +452,32 @@ void Mapgen::setLighting(u8 light, v3s16 nmin, v3s16 nmax)
 	}
 }
 
-void Mapgen::lightSpread(VoxelArea &a, v3s16 p, u8 light,
-		unordered_map_v3POS<u8> & skip, int r)
-{
-	if (light <= 1 || !a.contains(p))
-		return;
-
-	u32 vi = vm->m_area.index(p);
-	MapNode &n = vm->m_data[vi];
-
-	// Decay light in each of the banks separately
-	u8 light_day = light & 0x0F;
-	if (light_day > 0)
-		light_day -= 0x01;
-
-	u8 light_night = light & 0xF0;
-	if (light_night > 0x10)
-		light_night -= 0x10;
-
-	// Bail out only if we have no more light from either bank to propogate, or
-	// we hit a solid block that light cannot pass through.
-	if ((light_day  <= (n.param1 & 0x0F) &&
-		light_night <= (n.param1 & 0xF0)) ||
-		!ndef->get(n).light_propagates)
-		return;
-
-	// Since this recursive function only terminates when there is no light from
-	// either bank left, we need to take the max of both banks into account for
-	// the case where spreading has stopped for one light bank but not the other.
-	light = MYMAX(light_day, n.param1 & 0x0F) |
-			MYMAX(light_night, n.param1 & 0xF0);
+enum {
+	LIGHTFLAG_SUNLIGHT = 0x01,
+	LIGHTFLAG_PROPAGATES = 0x02,
+};
 
-	n.param1 = light;
+// Nodes of a chunk lit by one task at once; light reaches 14 nodes, so tiles
+// of the same parity (64 apart) never touch the same nodes
+#define LIGHT_TILE_SIZE (MAP_BLOCKSIZE * 2)
 
-	if (++r > 100) {
-		//errorstream<<"mapgen light recursion stop r="<<r << " p=" << p << " lwas=" << (int)n.param1 << " lnow="<< (int )light << " day="<<(int)light_day << " ni="<<(int)light_night<<" skip="<<skip.size() << "\n";
-		return;
+const u8 *Mapgen::getLightFlags()
+{
+	if (m_light_flags.empty()) {
+		m_light_flags.resize(CONTENT_ID_CAPACITY);
+		for (u32 c = 0; c < CONTENT_ID_CAPACITY; ++c) {
+			const ContentFeatures &f = ndef->get((content_t)c);
+			m_light_flags[c] = (f.sunlight_propagates ? LIGHTFLAG_SUNLIGHT : 0) |
+				(f.light_propagates ? LIGHTFLAG_PROPAGATES : 0) |
+				(MYMIN(f.light_source, LIGHT_MAX) << 4);
+		}
+		// Never lit, whatever the definition says
+		m_light_flags[CONTENT_IGNORE] = 0;
 	}
-
-	if (skip.count(p))
-		return;
-	skip.emplace(p, 1);
-
-	lightSpread(a, p + v3s16(0, 0, 1), light, skip, r);
-	lightSpread(a, p + v3s16(0, 1, 0), light, skip, r);
-	lightSpread(a, p + v3s16(1, 0, 0), light, skip, r);
-	lightSpread(a, p - v3s16(0, 0, 1), light, skip, r);
-	lightSpread(a, p - v3s16(0, 1, 0), light, skip, r);
-	lightSpread(a, p - v3s16(1, 0, 0), light, skip, r);
+	return m_light_flags.data();
 }
 
+
 void Mapgen::calcLighting(v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nmax,
 	bool propagate_shadow)
 {
@@ -513,50 +491,67 @@ void Mapgen::calcLighting(v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nm
 }
 
 
+bool Mapgen::sunlightFromAbove(const VoxelArea &a, s16 x, s16 z,
+	bool block_is_underground, bool propagate_shadow)
+{
+	// see if we can get a light value from the overtop
+	const MapNode &n = vm->m_data[vm->m_area.index(x, a.MaxEdge.Y + 1, z)];
+	if (n.getContent() == CONTENT_IGNORE)
+		return !block_is_underground;
+	if ((n.param1 & 0x0F) == LIGHT_SUN || !propagate_shadow)
+		return true;
+
+	// Shadow is cast, unless sunlight comes in from the side
+	static const v2s16 dirs[4] = {v2s16(1, 0), v2s16(-1, 0), v2s16(0, -1), v2s16(0, 1)};
+	for (const auto &dir : dirs) {
+		s16 x2 = x + dir.X, z2 = z + dir.Y;
+		if (x2 < a.MinEdge.X || x2 > a.MaxEdge.X ||
+				z2 < a.MinEdge.Z || z2 > a.MaxEdge.Z)
+			continue;
+		const MapNode &n2 = vm->m_data[vm->m_area.index(x2, a.MaxEdge.Y + 1, z2)];
+		if (n2.getContent() != CONTENT_IGNORE && (n2.param1 & 0x0F) == LIGHT_SUN)
+			return true;
+	}
+	return false;
+}
+
+
+/*
+	Columns are handled in rows of 16 along X: a bit per column tells
+	whether sunlight still goes down, and every row below is one table
+	lookup per node ANDed into it, so a row stops as soon as all of its
+	columns hit something solid.
+*/
 void Mapgen::propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow)
 {
 	//TimeTaker t("propagateSunlight");
 	VoxelArea a(nmin, nmax);
 	bool block_is_underground = (water_level >= nmax.Y);
 	v3s16 em = vm->m_area.getExtent();
+	const u8 *flags = getLightFlags();
 
 	// NOTE: Direct access to the low 4 bits of param1 is okay here because,
 	// by definition, sunlight will never be in the night lightbank.
 
 	for (int z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++) {
-		for (int x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
-			// see if we can get a light value from the overtop
-			u32 i = vm->m_area.index(x, a.MaxEdge.Y + 1, z);
-			if (vm->m_data[i].getContent() == CONTENT_IGNORE) {
-				if (block_is_underground)
-					continue;
-			} else if ((vm->m_data[i].param1 & 0x0F) != LIGHT_SUN &&
-					propagate_shadow) {
-				u32 ii = 0;
-				if (
-				(x < a.MaxEdge.X && (ii = vm->m_area.index(x + 1, a.MaxEdge.Y + 1, z    )) &&
-				(vm->m_data[ii].getContent() != CONTENT_IGNORE) &&
-				((vm->m_data[ii].param1 & 0x0F) == LIGHT_SUN))||
-				(x > a.MinEdge.X && (ii = vm->m_area.index(x - 1, a.MaxEdge.Y + 1, z    )) &&
-				(vm->m_data[ii].getContent() != CONTENT_IGNORE) &&
-				((vm->m_data[ii].param1 & 0x0F) == LIGHT_SUN))||
-				(z > a.MinEdge.Z && (ii = vm->m_area.index(x    , a.MaxEdge.Y + 1, z - 1)) &&
-				(vm->m_data[ii].getContent() != CONTENT_IGNORE) &&
-				((vm->m_data[ii].param1 & 0x0F) == LIGHT_SUN))||
-				(z < a.MaxEdge.Z && (ii = vm->m_area.index(x    , a.MaxEdge.Y + 1, z + 1)) &&
-				(vm->m_data[ii].getContent() != CONTENT_IGNORE) &&
-				((vm->m_data[ii].param1 & 0x0F) == LIGHT_SUN))
-				) {
-				} else
-				continue;
-			}
-			vm->m_area.add_y(em, i, -1);
-
-			for (int y = a.MaxEdge.Y; y >= a.MinEdge.Y; y--) {
-				MapNode &n = vm->m_data[i];
-				if (!ndef->get(n).sunlight_propagates)
-					break;
-				n.param1 = LIGHT_SUN;
+		for (int x0 = a.MinEdge.X; x0 <= a.MaxEdge.X; x0 += 16) {
+			int width = MYMIN(16, a.MaxEdge.X - x0 + 1);
+
+			u16 lit = 0;
+			for (int k = 0; k < width; k++)
+				if (sunlightFromAbove(a, x0 + k, z, block_is_underground, propagate_shadow))
+					lit |= 1 << k;
+
+			u32 i = vm->m_area.index(x0, a.MaxEdge.Y, z);
+			for (int y = a.MaxEdge.Y; lit && y >= a.MinEdge.Y; y--) {
+				MapNode *row = &vm->m_data[i];
+				u16 passes = 0;
+				for (int k = 0; k < width; k++)
+					passes |= (flags[row[k].getContent()] & LIGHTFLAG_SUNLIGHT) << k;
+				lit &= passes;
+				for (int k = 0; k < width; k++)
+					if (lit & (1 << k))
+						row[k].param1 = LIGHT_SUN;
 				vm->m_area.add_y(em, i, -1);
 			}
 		}
@@ -565,42 +560,125 @@ void Mapgen::propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow)
 }
 
 
+/*
+	Sources and lit nodes of the tile are spread breadth first within a,
+	brightest first: one bucket per light level of the brighter bank, so
+	most nodes are set once. Both banks go together in param1.
+*/
+void Mapgen::spreadLightTile(const VoxelArea &a, const VoxelArea &tile)
+{
+	struct Queued {
+		v3s16 p;
+		u32 i;
+	};
+	std::vector<Queued> buckets[LIGHT_SUN + 1];
+	u32 mask = 0;
+	const u8 *flags = getLightFlags();
+	v3s16 em = vm->m_area.getExtent();
+	s32 ystride = em.X, zstride = em.X * em.Y;
+
+	auto push = [&](const v3s16 &p, u32 i, u8 light) {
+		u8 level = MYMAX(light & 0x0F, light >> 4);
+		if (level <= 1)
+			return;
+		buckets[level].push_back({p, i});
+		mask |= 1 << level;
+	};
+
+	for (s16 z = tile.MinEdge.Z; z <= tile.MaxEdge.Z; z++)
+	for (s16 y = tile.MinEdge.Y; y <= tile.MaxEdge.Y; y++) {
+		u32 i = vm->m_area.index(tile.MinEdge.X, y, z);
+		for (s16 x = tile.MinEdge.X; x <= tile.MaxEdge.X; x++, i++) {
+			MapNode &n = vm->m_data[i];
+			u8 f = flags[n.getContent()];
+			if (!(f & LIGHTFLAG_PROPAGATES))
+				continue;
+
+			// TODO(hmmmmm): Abstract away direct param1 accesses with a
+			// wrapper, but something lighter than MapNode::get/setLight
+			u8 light_produced = f >> 4;
+			if (light_produced)
+				n.param1 = MYMAX(n.param1 & 0x0F, light_produced) |
+					MYMAX(n.param1 & 0xF0, light_produced << 4);
+			push(v3s16(x, y, z), i, n.param1);
+		}
+	}
+
+	static const v3s16 dirs[6] = {
+		v3s16(0, 0, 1), v3s16(0, 1, 0), v3s16(1, 0, 0),
+		v3s16(0, 0, -1), v3s16(0, -1, 0), v3s16(-1, 0, 0)};
+	const s32 offsets[6] = {zstride, ystride, 1, -zstride, -ystride, -1};
+
+	while (mask) {
+		u8 level = 31 - __builtin_clz(mask);
+		Queued q = buckets[level].back();
+		buckets[level].pop_back();
+		if (buckets[level].empty())
+			mask &= ~(1 << level);
+
+		// Decay light in each of the banks separately
+		u8 light = vm->m_data[q.i].param1;
+		u8 light_day = light & 0x0F;
+		if (light_day > 0)
+			light_day -= 0x01;
+		u8 light_night = light & 0xF0;
+		if (light_night > 0x10)
+			light_night -= 0x10;
+		else
+			light_night = 0;
+
+		for (int d = 0; d < 6; d++) {
+			v3s16 p2 = q.p + dirs[d];
+			if (!a.contains(p2))
+				continue;
+			u32 i2 = q.i + offsets[d];
+			MapNode &n2 = vm->m_data[i2];
+			if (!(flags[n2.getContent()] & LIGHTFLAG_PROPAGATES))
+				continue;
+			if (light_day <= (n2.param1 & 0x0F) && light_night <= (n2.param1 & 0xF0))
+				continue;
+			n2.param1 = MYMAX(light_day, n2.param1 & 0x0F) |
+				MYMAX(light_night, n2.param1 & 0xF0);
+			push(p2, i2, n2.param1);
+		}
+	}
+}
+
+
+/*
+	Tiles of LIGHT_TILE_SIZE nodes in X and Z, full height, are spread in
+	four passes by the parity of their tile position. Tiles of one pass
+	run in parallel on the mapgen task pool, a later pass carries on from
+	the light the earlier ones spilled into its tiles.
+*/
 void Mapgen::spreadLight(v3s16 nmin, v3s16 nmax)
 {
 	//TimeTaker t("spreadLight");
 	VoxelArea a(nmin, nmax);
-
-	for (int z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++) {
-		for (int y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++) {
-			u32 i = vm->m_area.index(a.MinEdge.X, y, z);
-			for (int x = a.MinEdge.X; x <= a.MaxEdge.X; x++, i++) {
-				MapNode &n = vm->m_data[i];
-				if (n.getContent() == CONTENT_IGNORE)
-					continue;
-
-				const ContentFeatures &cf = ndef->get(n);
-				if (!cf.light_propagates)
-					continue;
-
-				// TODO(hmmmmm): Abstract away direct param1 accesses with a
-				// wrapper, but something lighter than MapNode::get/setLight
-
-				u8 light_produced = cf.light_source;
-				if (light_produced)
-					n.param1 = light_produced | (light_produced << 4);
-
-				u8 light = n.param1;
-				if (light) {
-					unordered_map_v3POS<u8> skip;
-					lightSpread(a, v3s16(x,     y,     z + 1), light, skip);
-					lightSpread(a, v3s16(x,     y + 1, z    ), light, skip);
-					lightSpread(a, v3s16(x + 1, y,     z    ), light, skip);
-					lightSpread(a, v3s16(x,     y,     z - 1), light, skip);
-					lightSpread(a, v3s16(x,     y - 1, z    ), light, skip);
-					lightSpread(a, v3s16(x - 1, y,     z    ), light, skip);
-				}
-			}
+	getLightFlags();
+
+	v3s16 extent = a.getExtent();
+	s16 tiles_x = (extent.X + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	s16 tiles_z = (extent.Z + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	task_pool *pool = m_emerge ? m_emerge->getTaskPool() : nullptr;
+
+	for (int pass = 0; pass < 4; pass++) {
+		std::vector<VoxelArea> tiles;
+		for (s16 tz = pass / 2; tz < tiles_z; tz += 2)
+		for (s16 tx = pass % 2; tx < tiles_x; tx += 2) {
+			v3s16 tmin(a.MinEdge.X + tx * LIGHT_TILE_SIZE, a.MinEdge.Y,
+				a.MinEdge.Z + tz * LIGHT_TILE_SIZE);
+			v3s16 tmax(MYMIN(tmin.X + LIGHT_TILE_SIZE - 1, a.MaxEdge.X), a.MaxEdge.Y,
+				MYMIN(tmin.Z + LIGHT_TILE_SIZE - 1, a.MaxEdge.Z));
+			tiles.push_back(VoxelArea(tmin, tmax));
 		}
+		if (tiles.empty())
+			continue;
+
+		task_graph graph(tiles.size() > 1 ? pool : nullptr);
+		for (const auto &tile : tiles)
+			graph.add([this, &a, &tile] { spreadLightTile(a, tile); });
+		graph.run();
 	}
 
 	//printf("spreadLight: %dms\n", t.stop());
@@ -198,7 +198,6 @@ class Mapgen {
 	void updateLiquid(v3s16 nmin, v3s16 nmax);
 
 	void setLighting(u8 light, v3s16 nmin, v3s16 nmax);
-	void lightSpread(VoxelArea &a, v3s16 p, u8 light, unordered_map_v3POS<u8> & skip, int r = 0);
 	void calcLighting(v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nmax,
 		bool propagate_shadow = true);
 	void propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow);
@@ -213,6 +212,9 @@ class Mapgen {
 	unordered_map_v3POS<s16> heat_cache;
 	unordered_map_v3POS<s16> humidity_cache;
 
+	// Light flags of every content id, built on first use
+	const u8 *getLightFlags();
+
 	// getSpawnLevelAtPoint() is a function within each mapgen that returns a
 	// suitable y co-ordinate for player spawn ('suitable' usually meaning
 	// within 16 nodes of water_level). If a suitable spawn level cannot be
@@ -233,6 +235,12 @@ class Mapgen {
 	// that checks whether there are floodable nodes without liquid beneath
 	// the node at index vi.
 	inline bool isLiquidHorizontallyFlowable(u32 vi, v3s16 em);
+
+	// LIGHTFLAG_* in the low bits, light_source in the high nibble
+	std::vector<u8> m_light_flags;
+	bool sunlightFromAbove(const VoxelArea &a, s16 x, s16 z,
+		bool block_is_underground, bool propagate_shadow);
+	void spreadLightTile(const VoxelArea &a, const VoxelArea &tile);
 	DISABLE_CLASS_COPY(Mapgen);
 };
 
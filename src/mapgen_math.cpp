@@ -618,6 +618,12 @@ int MapgenMath::generateTerrain() {
 
 void MapgenMath::generateRidgeTerrain() { }
 
+void MapgenMath::addTerrainTasks(task_graph &graph,
+	const std::vector<task_graph::task_id> &deps, s16 &stone_surface_max_y) {
+	// fractal is placed by one generateTerrain call
+	graph.add([this, &stone_surface_max_y] { stone_surface_max_y = generateTerrain(); }, deps);
+}
+
 void MapgenMath::calculateNoise() {
 //delete after merge?
 #if 0
@@ -61,6 +61,8 @@ class MapgenMath : public MapgenV7 {
 	virtual void calculateNoise();
 	virtual int generateTerrain();
 	virtual void generateRidgeTerrain();
+	virtual void addTerrainTasks(task_graph &graph,
+		const std::vector<task_graph::task_id> &deps, s16 &stone_surface_max_y);
 	//int getGroundLevelAtPoint(v2POS p);
 
 	bool internal;
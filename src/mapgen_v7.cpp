@@ -295,23 +295,28 @@ void MapgenV7::makeChunk(BlockMakeData *data)
 	//	float_islands_prepare(node_min, node_max, float_islands);
 	//}
 
-	layers_prepare(node_min, node_max);
-	cave_prepare(node_min, node_max, sp->paramsj.get("cave_indev", -100).asInt());
+	// Independent noises and Y slabs of terrain run as tasks
+	int cave_indev = sp->paramsj.get("cave_indev", -100).asInt();
+	task_graph graph(m_emerge->getTaskPool());
+	std::vector<task_graph::task_id> prepare = {
+		graph.add([&] { layers_prepare(node_min, node_max); }),
+		graph.add([&] { cave_prepare(node_min, node_max, cave_indev); }),
+	};
 	//==========
 
-	// Generate base and mountain terrain
-	// An initial heightmap is no longer created here for use in generateRidgeTerrain()
-	s16 stone_surface_max_y = generateTerrain();
+	// Biome noise does not depend on terrain
+	graph.add([&] { biomegen->calcBiomeNoise(node_min); });
 
-	// Generate rivers
-	if (spflags & MGV7_RIDGES)
-		generateRidgeTerrain();
+	// Generate base and mountain terrain, and rivers
+	// An initial heightmap is no longer created here for use in generateRidgeTerrain()
+	s16 stone_surface_max_y = -MAX_MAP_GENERATION_LIMIT;
+	addTerrainTasks(graph, prepare, stone_surface_max_y);
+	graph.run();
 
 	// Create heightmap
 	updateHeightmap(node_min, node_max);
 
-	// Init biome generator, place biome-specific nodes, and build biomemap
-	biomegen->calcBiomeNoise(node_min);
+	// Place biome-specific nodes, and build biomemap
 	MgStoneType stone_type = generateBiomes();
 
 	//generateExperimental();
@@ -451,13 +456,102 @@ void MapgenV7::floatBaseExtentFromMap(s16 *float_base_min, s16 *float_base_max,
 }
 
 
-int MapgenV7::generateTerrain()
+void MapgenV7::addTerrainTasks(task_graph &graph,
+	const std::vector<task_graph::task_id> &deps, s16 &stone_surface_max_y)
 {
-	MapNode n_air(CONTENT_AIR);
-	MapNode n_stone(c_stone);
-	MapNode n_water(c_water_source);
-	MapNode n_ice(c_ice);
+	typedef task_graph::task_id task_id;
 
+	//// Calculate noise for terrain generation
+	std::vector<task_id> terrain_deps = deps;
+	task_id persist = graph.add([this] {
+		noise_terrain_persist->perlinMap2D(node_min.X, node_min.Z);
+	});
+	terrain_deps.push_back(graph.add([this] {
+		noise_terrain_base->perlinMap2D(node_min.X, node_min.Z, noise_terrain_persist->result);
+	}, {persist}));
+	terrain_deps.push_back(graph.add([this] {
+		noise_terrain_alt->perlinMap2D(node_min.X, node_min.Z, noise_terrain_persist->result);
+	}, {persist}));
+	terrain_deps.push_back(graph.add([this] {
+		noise_height_select->perlinMap2D(node_min.X, node_min.Z);
+	}));
+
+	if ((spflags & MGV7_MOUNTAINS) || (spflags & MGV7_FLOATLANDS)) {
+		terrain_deps.push_back(graph.add([this] {
+			noise_mountain->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+		}));
+	}
+
+	if (spflags & MGV7_MOUNTAINS) {
+		terrain_deps.push_back(graph.add([this] {
+			noise_mount_height->perlinMap2D(node_min.X, node_min.Z);
+		}));
+	}
+
+	if (spflags & MGV7_FLOATLANDS) {
+		terrain_deps.push_back(graph.add([this] {
+			noise_floatland_base->perlinMap2D(node_min.X, node_min.Z);
+		}));
+		terrain_deps.push_back(graph.add([this] {
+			noise_float_base_height->perlinMap2D(node_min.X, node_min.Z);
+		}));
+	}
+
+	terrain_deps.push_back(graph.add([this] { calcColumnHeat(); }));
+
+	bool ridges = ridgeTerrainEnabled();
+	std::vector<task_id> ridge_deps;
+	if (ridges) {
+		ridge_deps.push_back(graph.add([this] {
+			noise_ridge->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+		}));
+		ridge_deps.push_back(graph.add([this] {
+			noise_ridge_uwater->perlinMap2D(node_min.X, node_min.Z);
+		}));
+	}
+
+	//// Place nodes by Y slabs, rivers of a slab go after its terrain
+	s16 y_min = node_min.Y - 1;
+	s16 y_max = node_max.Y + 1;
+	size_t slabs = (y_max - y_min) / MAP_BLOCKSIZE + 1;
+	auto slab_max_y = std::make_shared<std::vector<s16>>(slabs);
+	std::vector<task_id> placed;
+	for (size_t i = 0; i < slabs; i++) {
+		s16 y0 = y_min + i * MAP_BLOCKSIZE;
+		s16 y1 = MYMIN(y0 + MAP_BLOCKSIZE - 1, y_max);
+		task_id terrain = graph.add([this, slab_max_y, i, y0, y1] {
+			(*slab_max_y)[i] = placeTerrain(y0, y1);
+		}, terrain_deps);
+		placed.push_back(terrain);
+		if (ridges) {
+			std::vector<task_id> slab_deps = ridge_deps;
+			slab_deps.push_back(terrain);
+			graph.add([this, y0, y1] { placeRidgeTerrain(y0, y1); }, slab_deps);
+		}
+	}
+
+	graph.add([slab_max_y, &stone_surface_max_y] {
+		for (auto y : *slab_max_y)
+			stone_surface_max_y = MYMAX(stone_surface_max_y, y);
+	}, placed);
+}
+
+
+void MapgenV7::calcColumnHeat()
+{
+	column_heat.assign(csize.X * csize.Z, 0);
+	if (!m_emerge->env->m_use_weather)
+		return;
+
+	u32 index2d = 0;
+	for (s16 z = node_min.Z; z <= node_max.Z; z++)
+	for (s16 x = node_min.X; x <= node_max.X; x++, index2d++)
+		column_heat[index2d] = m_emerge->env->getServerMap().updateBlockHeat(m_emerge->env, v3POS(x,node_max.Y,z), nullptr, &heat_cache);
+}
+
+
+int MapgenV7::generateTerrain()
+{
 	//// Calculate noise for terrain generation
 	noise_terrain_persist->perlinMap2D(node_min.X, node_min.Z);
 	float *persistmap = noise_terrain_persist->result;
@@ -479,6 +573,19 @@ int MapgenV7::generateTerrain()
 		noise_float_base_height->perlinMap2D(node_min.X, node_min.Z);
 	}
 
+	calcColumnHeat();
+
+	return placeTerrain(node_min.Y - 1, node_max.Y + 1);
+}
+
+
+s16 MapgenV7::placeTerrain(s16 y_min, s16 y_max)
+{
+	MapNode n_air(CONTENT_AIR);
+	MapNode n_stone(c_stone);
+	MapNode n_water(c_water_source);
+	MapNode n_ice(c_ice);
+
 	//// Place nodes
 	v3s16 em = vm->m_area.getExtent();
 	s16 stone_surface_max_y = -MAX_MAP_GENERATION_LIMIT;
@@ -490,7 +597,7 @@ int MapgenV7::generateTerrain()
 		if (surface_y > stone_surface_max_y)
 			stone_surface_max_y = surface_y;
 
-		s16 heat = m_emerge->env->m_use_weather ? m_emerge->env->getServerMap().updateBlockHeat(m_emerge->env, v3POS(x,node_max.Y,z), nullptr, &heat_cache) : 0;
+		s16 heat = column_heat[index2d];
 
 		// Get extent of floatland base terrain
 		// '+1' to avoid a layer of stone at y = MAX_MAP_GENERATION_LIMIT
@@ -499,10 +606,10 @@ int MapgenV7::generateTerrain()
 		if (spflags & MGV7_FLOATLANDS)
 			floatBaseExtentFromMap(&float_base_min, &float_base_max, index2d);
 
-		u32 vi = vm->m_area.index(x, node_min.Y - 1, z);
-		u32 index3d = (z - node_min.Z) * zstride_1u1d + (x - node_min.X);
+		u32 vi = vm->m_area.index(x, y_min, z);
+		u32 index3d = (z - node_min.Z) * zstride_1u1d + (y_min - node_min.Y + 1) * ystride + (x - node_min.X);
 
-		for (s16 y = node_min.Y - 1; y <= node_max.Y + 1; y++) {
+		for (s16 y = y_min; y <= y_max; y++) {
 			if (vm->m_data[vi].getContent() == CONTENT_IGNORE) {
 				if (y <= surface_y) {
 					//vm->m_data[vi] = layers_get(index3d);  // Base terrain
@@ -559,23 +666,36 @@ int MapgenV7::generateTerrain()
 }
 
 
+bool MapgenV7::ridgeTerrainEnabled()
+{
+	return (spflags & MGV7_RIDGES) &&
+		node_max.Y >= water_level - 16 && node_max.Y <= shadow_limit;
+}
+
+
 void MapgenV7::generateRidgeTerrain()
 {
-	if ((node_max.Y < water_level - 16) || (node_max.Y > shadow_limit))
+	if (!ridgeTerrainEnabled())
 		return;
 
 	noise_ridge->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
 	noise_ridge_uwater->perlinMap2D(node_min.X, node_min.Z);
 
+	placeRidgeTerrain(node_min.Y - 1, node_max.Y + 1);
+}
+
+
+void MapgenV7::placeRidgeTerrain(s16 y_min, s16 y_max)
+{
 	MapNode n_water(c_water_source);
 	MapNode n_ice(c_ice);
 	MapNode n_air(CONTENT_AIR);
-	u32 index = 0;
 	float width = 0.2;
 
 	for (s16 z = node_min.Z; z <= node_max.Z; z++)
-	for (s16 y = node_min.Y - 1; y <= node_max.Y + 1; y++) {
+	for (s16 y = y_min; y <= y_max; y++) {
 		u32 vi = vm->m_area.index(node_min.X, y, z);
+		u32 index = (z - node_min.Z) * zstride_1u1d + (y - node_min.Y + 1) * ystride;
 		for (s16 x = node_min.X; x <= node_max.X; x++, index++, vi++) {
 			int j = (z - node_min.Z) * csize.X + (x - node_min.X);
 
@@ -591,7 +711,7 @@ void MapgenV7::generateRidgeTerrain()
 			if (nridge + width_mod * height_mod < 0.6)
 				continue;
 
-			s16 heat = m_emerge->env->m_use_weather ? m_emerge->env->getServerMap().updateBlockHeat(m_emerge->env, v3POS(x,node_max.Y,z), NULL, &heat_cache) : 0;
+			s16 heat = column_heat[j];
 			MapNode n_water_or_ice = (heat < 0 && y > water_level + heat/4) ? n_ice : n_water;
 
 			vm->m_data[vi] = (y > water_level) ? n_air : n_water_or_ice;
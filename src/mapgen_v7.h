@@ -26,6 +26,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "mapgen.h"
 #include "mapgen_indev.h"
+#include "threading/task_graph.h"
 
 ////////////// Mapgen V7 flags
 #define MGV7_MOUNTAINS    0x01
@@ -96,6 +97,20 @@ class MapgenV7 : public MapgenBasic, public Mapgen_features {
 	virtual int generateTerrain();
 	virtual void generateRidgeTerrain();
 
+	// Same as generateTerrain and generateRidgeTerrain split into noise and
+	// Y slab tasks, stone_surface_max_y is set when graph has run
+	virtual void addTerrainTasks(task_graph &graph,
+		const std::vector<task_graph::task_id> &deps, s16 &stone_surface_max_y);
+
+protected:
+	void calcColumnHeat();
+	s16 placeTerrain(s16 y_min, s16 y_max);
+	bool ridgeTerrainEnabled();
+	void placeRidgeTerrain(s16 y_min, s16 y_max);
+
+	// Weather heat of every column of chunk
+	std::vector<s16> column_heat;
+
 private:
 	float float_mount_density;
 	float float_mount_height;
@@ -27,9 +27,11 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "content_mapnode.h" // For mapnode_translate_*_internal
 #include "serialization.h" // For ser_ver_supported
 #include "util/serialize.h"
+#include "util/string_stream.h"
 #include "log.h"
 #include "util/numeric.h"
 #include <string>
+#include <vector>
 #include <sstream>
 
 static const Rotation wallmounted_to_rot[] = {
@@ -659,7 +661,8 @@ void MapNode::deSerialize(u8 *source, u8 version)
 }
 void MapNode::serializeBulk(std::ostream &os, int version,
 		const MapNode *nodes, u32 nodecount,
-		u8 content_width, u8 params_width, bool compressed)
+		u8 content_width, u8 params_width, bool compressed,
+		u8 codec, bool dictionary)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapNode format not supported");
@@ -673,7 +676,8 @@ void MapNode::serializeBulk(std::ostream &os, int version,
 		throw SerializationError("MapNode::serializeBulk: serialization to "
 				"version < 24 not possible");
 
-	SharedBuffer<u8> databuf(nodecount * (content_width + params_width));
+	SCRATCH_BUFFER(std::vector<u8>, databuf);
+	databuf.resize(nodecount * (content_width + params_width));
 
 	// Serialize content
 	for(u32 i=0; i<nodecount; i++)
@@ -693,20 +697,25 @@ void MapNode::serializeBulk(std::ostream &os, int version,
 		Compress data to output stream
 	*/
 
-	if(compressed)
+	if(compressed && codec != BLOCK_CODEC_ZLIB)
+	{
+		compressCodec(&databuf[0], databuf.size(), os, codec, dictionary);
+	}
+	else if(compressed)
 	{
-		compressZlib(databuf, os);
+		compressZlib(&databuf[0], databuf.size(), os);
 	}
 	else
 	{
-		os.write((const char*) &databuf[0], databuf.getSize());
+		os.write((const char*) &databuf[0], databuf.size());
 	}
 }
 
 // Deserialize bulk node data
 void MapNode::deSerializeBulk(std::istream &is, int version,
 		MapNode *nodes, u32 nodecount,
-		u8 content_width, u8 params_width, bool compressed)
+		u8 content_width, u8 params_width, bool compressed,
+		u8 codec)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapNode format not supported");
@@ -722,7 +731,7 @@ void MapNode::deSerializeBulk(std::istream &is, int version,
 	if(compressed)
 	{
 		std::ostringstream os(std::ios_base::binary);
-		decompressZlib(is, os);
+		decompressCodec(is, os, codec, len);
 		std::string s = os.str();
 		if(s.size() != len)
 			throw SerializationError("deSerializeBulkNodes: "
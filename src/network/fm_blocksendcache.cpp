@@ -0,0 +1,83 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "network/fm_blocksendcache.h"
+
+BlockSendCache::value_type BlockSendCache::get(const BlockSendCacheKey & key)
+{
+	std::lock_guard<Mutex> lock(m_mutex);
+	auto it = m_map.find(key);
+	if (it == m_map.end())
+		return nullptr;
+	m_lru.splice(m_lru.begin(), m_lru, it->second);
+	return it->second->second;
+}
+
+void BlockSendCache::set(const BlockSendCacheKey & key, const value_type & data)
+{
+	if (!data || data->size() > m_limit)
+		return;
+	std::lock_guard<Mutex> lock(m_mutex);
+	auto it = m_map.find(key);
+	if (it != m_map.end()) {
+		m_bytes -= it->second->second->size();
+		it->second->second = data;
+		m_lru.splice(m_lru.begin(), m_lru, it->second);
+	} else {
+		m_lru.emplace_front(key, data);
+		m_map.emplace(key, m_lru.begin());
+	}
+	m_bytes += data->size();
+	evict_nolock();
+}
+
+void BlockSendCache::evict_nolock()
+{
+	while (m_bytes > m_limit && !m_lru.empty()) {
+		auto & last = m_lru.back();
+		m_bytes -= last.second->size();
+		m_map.erase(last.first);
+		m_lru.pop_back();
+	}
+}
+
+void BlockSendCache::setLimit(size_t limit)
+{
+	std::lock_guard<Mutex> lock(m_mutex);
+	m_limit = limit;
+	evict_nolock();
+}
+
+size_t BlockSendCache::bytes()
+{
+	std::lock_guard<Mutex> lock(m_mutex);
+	return m_bytes;
+}
+
+size_t BlockSendCache::size()
+{
+	std::lock_guard<Mutex> lock(m_mutex);
+	return m_map.size();
+}
+
+void BlockSendCache::clear()
+{
+	std::lock_guard<Mutex> lock(m_mutex);
+	m_map.clear();
+	m_lru.clear();
+	m_bytes = 0;
+}
@@ -0,0 +1,89 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NETWORK_FM_BLOCKSENDCACHE_HEADER
+#define NETWORK_FM_BLOCKSENDCACHE_HEADER
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "irr_v3d.h"
+#include "util/unordered_map_hash.h"
+#include "threading/mutex.h"
+
+/*
+	Server wide LRU of ready to send TOCLIENT_BLOCKDATA packets.
+	The key contains the block modification counter, so a changed block
+	never hits and its old packets just age out.
+	Bounded by total size of stored packets.
+*/
+
+struct BlockSendCacheKey {
+	v3POS pos;
+	u64 modified_counter;
+	u16 net_proto_version_fm;
+	u8 version;
+	u8 codec;
+	s16 heat;
+	s16 humidity;
+
+	bool operator==(const BlockSendCacheKey & other) const {
+		return pos == other.pos && modified_counter == other.modified_counter &&
+			net_proto_version_fm == other.net_proto_version_fm &&
+			version == other.version && codec == other.codec &&
+			heat == other.heat && humidity == other.humidity;
+	}
+};
+
+struct BlockSendCacheKeyHash {
+	std::size_t operator()(const BlockSendCacheKey & k) const {
+		return v3POSHash()(k.pos) ^ (std::hash<u64>()(k.modified_counter) << 1) ^
+			((std::size_t)k.net_proto_version_fm << 8 | k.version) ^ k.codec;
+	}
+};
+
+class BlockSendCache {
+public:
+	typedef std::shared_ptr<std::string> value_type;
+
+	BlockSendCache(size_t limit = 0) : m_limit(limit), m_bytes(0) {}
+
+	// nullptr on miss
+	value_type get(const BlockSendCacheKey & key);
+	void set(const BlockSendCacheKey & key, const value_type & data);
+
+	// Bytes, 0 disables cache
+	void setLimit(size_t limit);
+	size_t getLimit() { return m_limit; }
+	size_t bytes();
+	size_t size();
+	void clear();
+
+private:
+	void evict_nolock();
+
+	typedef std::pair<BlockSendCacheKey, value_type> entry_type;
+	typedef std::list<entry_type> list_type;
+	list_type m_lru; // most recently used first
+	std::unordered_map<BlockSendCacheKey, list_type::iterator, BlockSendCacheKeyHash> m_map;
+	size_t m_limit;
+	size_t m_bytes;
+	Mutex m_mutex;
+};
+
+#endif
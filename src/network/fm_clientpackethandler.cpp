@@ -97,6 +97,10 @@ void Client::handleCommand_InitLegacy(NetworkPacket* pkt)   {
 	if (packet.count(TOCLIENT_INIT_WEATHER))
 		packet[TOCLIENT_INIT_WEATHER].convert(use_weather);
 
+	u8 block_codec = BLOCK_CODEC_ZLIB;
+	packet.convert_safe(TOCLIENT_INIT_COMPRESSION, block_codec);
+	infostream << "Client: block compression: " << blockCodecName(block_codec) << std::endl;
+
 	//if (packet.count(TOCLIENT_INIT_PROTOCOL_VERSION_FM))
 	//	packet[TOCLIENT_INIT_PROTOCOL_VERSION_FM].convert( not used );
 
@@ -198,6 +202,55 @@ void Client::handleCommand_BlockData(NetworkPacket* pkt)    {
 		#endif
 		*/
 
+	} else if (step == 2) {
+		// Delta update of a block we already have
+		MapBlock *block = m_env.getMap().getBlockNoCreateNoEx(p);
+		if (!block)
+			return;
+
+		std::string delta;
+		packet.convert_safe(TOCLIENT_BLOCKDATA_DELTA, delta);
+		// Check the whole delta first, a bad one is not applied at all
+		bool valid = delta.size() % 6 == 0;
+		for (size_t i = 0; valid && i < delta.size(); i += 6)
+			valid = readU16((const u8 *)&delta[i]) < MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
+		if (!valid) {
+			errorstream << "Client: invalid block delta " << p << " size=" << delta.size()
+				<< ", requesting the whole block" << std::endl;
+			// Server forgets the sent version and sends the block again
+			std::vector<v3s16> resend{p};
+			sendDeletedBlocks(resend);
+			return;
+		}
+		for (size_t i = 0; i + 6 <= delta.size(); i += 6) {
+			const u8 *change = (const u8 *)&delta[i];
+			u16 index = readU16(&change[0]);
+			MapNode n(readU16(&change[2]), readU8(&change[4]), readU8(&change[5]));
+			v3POS rel(index % MAP_BLOCKSIZE, index / MAP_BLOCKSIZE % MAP_BLOCKSIZE,
+				index / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+			block->setNodeNoCheck(rel, n);
+		}
+
+		u8 flags = 0;
+		if (packet.convert_safe(TOCLIENT_BLOCKDATA_FLAGS, flags)) {
+			block->setIsUnderground(flags & 0x01);
+			block->setLightingExpired(flags & 0x04);
+			block->setGenerated(!(flags & 0x08));
+		}
+		block->expireDayNightDiff();
+
+		packet.convert_safe(TOCLIENT_BLOCKDATA_CONTENT_ONLY, block->content_only);
+		packet.convert_safe(TOCLIENT_BLOCKDATA_CONTENT_ONLY_PARAM1, block->content_only_param1);
+		packet.convert_safe(TOCLIENT_BLOCKDATA_CONTENT_ONLY_PARAM2, block->content_only_param2);
+		s32 h;
+		if (packet.convert_safe(TOCLIENT_BLOCKDATA_HEAT, h))
+			block->heat = h;
+		if (packet.convert_safe(TOCLIENT_BLOCKDATA_HUMIDITY, h))
+			block->humidity = h;
+
+		if (!delta.empty())
+			updateMeshTimestampWithEdge(p);
+
 	}//step
 
 }
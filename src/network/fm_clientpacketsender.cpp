@@ -80,13 +80,14 @@ void Client::sendLegacyInit(const std::string &playerName, const std::string &pl
 	// [23] u8[28] password (new in some version)
 	// [51] u16 minimum supported network protocol version (added sometime)
 	// [53] u16 maximum supported network protocol version (added later than the previous one)
-	MSGPACK_PACKET_INIT(TOSERVER_INIT_LEGACY, 6);
+	MSGPACK_PACKET_INIT(TOSERVER_INIT_LEGACY, 7);
 	PACK(TOSERVER_INIT_LEGACY_FMT, SER_FMT_VER_HIGHEST_READ);
 	PACK(TOSERVER_INIT_LEGACY_NAME, playerName);
 	PACK(TOSERVER_INIT_LEGACY_PASSWORD, playerPassword);
 	PACK(TOSERVER_INIT_LEGACY_PROTOCOL_VERSION_MIN, CLIENT_PROTOCOL_VERSION_MIN);
 	PACK(TOSERVER_INIT_LEGACY_PROTOCOL_VERSION_MAX, CLIENT_PROTOCOL_VERSION_MAX);
 	PACK(TOSERVER_INIT_LEGACY_PROTOCOL_VERSION_FM, CLIENT_PROTOCOL_VERSION_FM);
+	PACK(TOSERVER_INIT_LEGACY_COMPRESSION, blockCodecsSupported());
 
 	// Send as unreliable
 	Send(1, buffer, false);
@@ -103,12 +103,19 @@ Connection::Connection(u32 protocol_id, u32 max_packet_size, float timeout,
 	timeout_mul = g_settings->getU16("timeout_mul");
 	if (!timeout_mul)
 		timeout_mul = 1;
+	setReceiveQueues(1);
 	start();
 }
 
 
 Connection::~Connection() {
 	join();
+	// Packets of the commands never processed
+	while (!m_command_queue.empty()) {
+		ConnectionCommand c = m_command_queue.pop_frontNoEx();
+		if (c.packet)
+			enet_packet_destroy(c.packet);
+	}
 	if(m_enet_host)
 		enet_host_destroy(m_enet_host);
 	m_enet_host = nullptr;
@@ -132,9 +139,16 @@ void * Connection::run() {
 	return nullptr;
 }
 
+void Connection::setReceiveQueues(u8 count) {
+	// Not locked: only before Serve(), threads may wait on any queue
+	while (m_event_queues.size() < MYMAX(count, 1))
+		m_event_queues.emplace_back(new MutexedQueue<ConnectionEvent>);
+}
+
 void Connection::putEvent(ConnectionEvent &e) {
 	//if(e.type == CONNEVENT_NONE) return;
-	m_event_queue.push_back(e);
+	// Keep the events of a peer in order, in one queue
+	m_event_queues[e.peer_id % m_event_queues.size()]->push_back(e);
 }
 
 void Connection::processCommand(ConnectionCommand &c) {
@@ -172,6 +186,10 @@ void Connection::processCommand(ConnectionCommand &c) {
 		dout_con << getDesc() << " processing CONNCMD_DELETE_PEER" << std::endl;
 		deletePeer(c.peer_id, false);
 		return;
+	case CONNCMD_SEND_PACKET:
+		dout_con << getDesc() << " processing CONNCMD_SEND_PACKET" << std::endl;
+		sendPacket(c.peer_ids, c.channelnum, c.packet);
+		return;
 	}
 }
 
@@ -225,14 +243,11 @@ void Connection::receive() {
 		}
 		break;
 		case ENET_EVENT_TYPE_RECEIVE: {
+			// The event owns the packet now, no copy
 			ConnectionEvent e;
-			SharedBuffer<u8> resultdata(event.packet->data, event.packet->dataLength);
-			e.dataReceived(*(u16*)event.peer->data, resultdata);
+			e.dataReceived(*(u16*)event.peer->data, event.packet);
 			putEvent(e);
 		}
-
-			/* Clean up the packet now that we're done using it. */
-		enet_packet_destroy (event.packet);
 		break;
 		case ENET_EVENT_TYPE_DISCONNECT:
 			deletePeer(*((u16*)event.peer->data), false);
@@ -396,6 +411,23 @@ void Connection::send(u16 peer_id, u8 channelnum,
 	}
 }
 
+void Connection::sendPacket(const std::vector<u16> &peer_ids, u8 channelnum,
+                            ENetPacket *packet) {
+	assert(channelnum < CHANNEL_COUNT);
+
+	// enet counts the references of the peers and frees the packet once
+	// sent to all of them
+	for (auto peer_id : peer_ids) {
+		ENetPeer *peer = getPeer(peer_id);
+		if (!peer)
+			continue;
+		if (enet_peer_send(peer, channelnum, packet) < 0)
+			infostream << "enet_peer_send failed peer=" << peer_id << " size=" << packet->dataLength << std::endl;
+	}
+	if (!packet->referenceCount)
+		enet_packet_destroy(packet);
+}
+
 ENetPeer* Connection::getPeer(u16 peer_id) {
 	auto node = m_peers.find(peer_id);
 
@@ -423,22 +455,26 @@ bool Connection::deletePeer(u16 peer_id, bool timeout) {
 
 /* Interface */
 
-ConnectionEvent Connection::getEvent() {
-	if(m_event_queue.empty()) {
+ConnectionEvent Connection::getEvent(u8 queue) {
+	auto & event_queue = *m_event_queues[queue];
+	if(event_queue.empty()) {
 		ConnectionEvent e;
 		e.type = CONNEVENT_NONE;
 		return e;
 	}
-	return m_event_queue.pop_frontNoEx();
+	return event_queue.pop_frontNoEx();
 }
 
 size_t Connection::events_size() {
-	return m_event_queue.size();
+	size_t size = 0;
+	for (auto & event_queue : m_event_queues)
+		size += event_queue->size();
+	return size;
 }
 
-ConnectionEvent Connection::waitEvent(u32 timeout_ms) {
+ConnectionEvent Connection::waitEvent(u32 timeout_ms, u8 queue) {
 	try {
-		return m_event_queue.pop_front(timeout_ms);
+		return m_event_queues[queue]->pop_front(timeout_ms);
 	} catch(ItemNotFoundException &ex) {
 		ConnectionEvent e;
 		e.type = CONNEVENT_NONE;
@@ -485,9 +521,9 @@ void Connection::Disconnect() {
 	putCommand(c);
 }
 
-u32 Connection::Receive(NetworkPacket* pkt, int timeout) {
+u32 Connection::Receive(NetworkPacket* pkt, int timeout, u8 queue) {
 	for(;;) {
-		ConnectionEvent e = waitEvent(timeout);
+		ConnectionEvent e = waitEvent(timeout, queue);
 		if(e.type != CONNEVENT_NONE)
 			dout_con << getDesc() << ": Receive: got event: "
 			         << e.describe() << std::endl;
@@ -496,11 +532,11 @@ u32 Connection::Receive(NetworkPacket* pkt, int timeout) {
 			//throw NoIncomingDataException("No incoming data");
 			return 0;
 		case CONNEVENT_DATA_RECEIVED:
-			if (e.data.getSize() < 2) {
+			if (e.data->dataLength < 2) {
 				continue;
 			}
-			pkt->putRawPacket(*e.data, e.data.getSize(), e.peer_id);
-			return e.data.getSize();
+			pkt->putRawPacket(e.data->data, e.data->dataLength, e.peer_id);
+			return e.data->dataLength;
 		case CONNEVENT_PEER_ADDED: {
 			if(m_bc_peerhandler)
 				m_bc_peerhandler->peerAdded(e.peer_id);
@@ -540,8 +576,21 @@ void Connection::Send(u16 peer_id, u8 channelnum,
 }
 
 void Connection::Send(u16 peer_id, u8 channelnum, const msgpack::sbuffer &buffer, bool reliable) {
-	SharedBuffer<u8> data((unsigned char*)buffer.data(), buffer.size());
-	Send(peer_id, channelnum, data, reliable);
+	Send(std::vector<u16>{peer_id}, channelnum, buffer, reliable);
+}
+
+void Connection::Send(const std::vector<u16> &peer_ids, u8 channelnum, const msgpack::sbuffer &buffer, bool reliable) {
+	assert(channelnum < CHANNEL_COUNT);
+	if (peer_ids.empty())
+		return;
+
+	// The only copy of the data, handed over to the connection thread
+	ENetPacket *packet = enet_packet_create(buffer.data(), buffer.size(), reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
+	if (!packet)
+		return;
+	ConnectionCommand c;
+	c.sendPacket(peer_ids, channelnum, packet);
+	putCommand(c);
 }
 
 Address Connection::GetPeerAddress(u16 peer_id) {
@@ -35,6 +35,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include <fstream>
 #include <list>
 #include <map>
+#include <memory>
 
 #include "enet/enet.h"
 #include "../msgpack_fix.h"
@@ -168,14 +169,18 @@ enum ConnectionEventType {
 	CONNEVENT_CONNECT_FAILED,
 };
 
+// Received ENet packet, destroyed with the last reference
+typedef std::shared_ptr<ENetPacket> ReceivedPacket;
+
 struct ConnectionEvent {
 	enum ConnectionEventType type;
 	u16 peer_id;
-	Buffer<u8> data;
+	ReceivedPacket data;
 	bool timeout;
 	Address address;
 
-	ConnectionEvent(ConnectionEventType type_ = CONNEVENT_NONE): type(type_) {}
+	ConnectionEvent(ConnectionEventType type_ = CONNEVENT_NONE):
+		type(type_), peer_id(0), timeout(false) {}
 
 	std::string describe() {
 		switch(type) {
@@ -195,10 +200,10 @@ struct ConnectionEvent {
 		return "Invalid ConnectionEvent";
 	}
 
-	void dataReceived(u16 peer_id_, SharedBuffer<u8> data_) {
+	void dataReceived(u16 peer_id_, ENetPacket *packet) {
 		type = CONNEVENT_DATA_RECEIVED;
 		peer_id = peer_id_;
-		data = data_;
+		data = ReceivedPacket(packet, enet_packet_destroy);
 	}
 	void peerAdded(u16 peer_id_) {
 		type = CONNEVENT_PEER_ADDED;
@@ -225,6 +230,7 @@ enum ConnectionCommandType {
 	CONNCMD_SEND,
 	CONNCMD_SEND_TO_ALL,
 	CONNCMD_DELETE_PEER,
+	CONNCMD_SEND_PACKET,
 };
 
 struct ConnectionCommand {
@@ -234,8 +240,11 @@ struct ConnectionCommand {
 	u8 channelnum;
 	Buffer<u8> data;
 	bool reliable;
+	// CONNCMD_SEND_PACKET: encoded once, queued to every peer
+	ENetPacket *packet;
+	std::vector<u16> peer_ids;
 
-	ConnectionCommand(): type(CONNCMD_NONE) {}
+	ConnectionCommand(): type(CONNCMD_NONE), packet(nullptr) {}
 
 	void serve(Address address_) {
 		type = CONNCMD_SERVE;
@@ -262,6 +271,13 @@ struct ConnectionCommand {
 		data = data_;
 		reliable = reliable_;
 	}
+	void sendPacket(const std::vector<u16> &peer_ids_, u8 channelnum_,
+	                ENetPacket *packet_) {
+		type = CONNCMD_SEND_PACKET;
+		peer_ids = peer_ids_;
+		channelnum = channelnum_;
+		packet = packet_;
+	}
 	void deletePeer(u16 peer_id_) {
 		type = CONNCMD_DELETE_PEER;
 		peer_id = peer_id_;
@@ -281,18 +297,27 @@ class Connection: public thread_pool {
 
 	/* Interface */
 
-	ConnectionEvent getEvent();
-	ConnectionEvent waitEvent(u32 timeout_ms);
+	/*
+		Events of a peer go to receive queue peer_id % count, each queue
+		can be drained by its own thread. Set before Serve().
+	*/
+	void setReceiveQueues(u8 count);
+	u8 getReceiveQueues() { return m_event_queues.size(); }
+
+	ConnectionEvent getEvent(u8 queue = 0);
+	ConnectionEvent waitEvent(u32 timeout_ms, u8 queue = 0);
 	void putCommand(ConnectionCommand &c);
 
 	void Serve(Address bind_addr);
 	void Connect(Address address);
 	bool Connected();
 	void Disconnect();
-	u32 Receive(NetworkPacket* pkt, int timeout = 1);
+	u32 Receive(NetworkPacket* pkt, int timeout = 1, u8 queue = 0);
 	void SendToAll(u8 channelnum, SharedBuffer<u8> data, bool reliable);
 	void Send(u16 peer_id, u8 channelnum, SharedBuffer<u8> data, bool reliable);
 	void Send(u16 peer_id, u8 channelnum, const msgpack::sbuffer &buffer, bool reliable);
+	// One ENet packet shared by all the peers
+	void Send(const std::vector<u16> &peer_ids, u8 channelnum, const msgpack::sbuffer &buffer, bool reliable);
 	u16 GetPeerID() { return m_peer_id; }
 	void DeletePeer(u16 peer_id);
 	Address GetPeerAddress(u16 peer_id);
@@ -311,10 +336,11 @@ class Connection: public thread_pool {
 	void disconnect();
 	void sendToAll(u8 channelnum, SharedBuffer<u8> data, bool reliable);
 	void send(u16 peer_id, u8 channelnum, SharedBuffer<u8> data, bool reliable);
+	void sendPacket(const std::vector<u16> &peer_ids, u8 channelnum, ENetPacket *packet);
 	ENetPeer* getPeer(u16 peer_id);
 	bool deletePeer(u16 peer_id, bool timeout);
 
-	MutexedQueue<ConnectionEvent> m_event_queue;
+	std::vector<std::unique_ptr<MutexedQueue<ConnectionEvent>>> m_event_queues;
 	MutexedQueue<ConnectionCommand> m_command_queue;
 
 	u32 m_protocol_id;
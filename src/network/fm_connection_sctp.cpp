@@ -1108,6 +1108,12 @@ void Connection::Send(u16 peer_id, u8 channelnum, const msgpack::sbuffer &buffer
 	Send(peer_id, channelnum, data, reliable);
 }
 
+void Connection::Send(const std::vector<u16> &peer_ids, u8 channelnum, const msgpack::sbuffer &buffer, bool reliable) {
+	SharedBuffer<u8> data((unsigned char*)buffer.data(), buffer.size());
+	for (auto peer_id : peer_ids)
+		Send(peer_id, channelnum, data, reliable);
+}
+
 Address Connection::GetPeerAddress(u16 peer_id) {
 	if (!m_peers_address.count(peer_id))
 		return Address();
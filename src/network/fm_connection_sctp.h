@@ -301,6 +301,7 @@ class Connection : public thread_pool {
 	void SendToAll(u8 channelnum, SharedBuffer<u8> data, bool reliable);
 	void Send(u16 peer_id, u8 channelnum, SharedBuffer<u8> data, bool reliable);
 	void Send(u16 peer_id, u8 channelnum, const msgpack::sbuffer &buffer, bool reliable);
+	void Send(const std::vector<u16> &peer_ids, u8 channelnum, const msgpack::sbuffer &buffer, bool reliable);
 	u16 GetPeerID() { return m_peer_id; }
 	void DeletePeer(u16 peer_id);
 	Address GetPeerAddress(u16 peer_id);
@@ -123,6 +123,13 @@ void Server::handleCommand_Init_Legacy(NetworkPacket* pkt) {
 
 	client->setPendingSerializationVersion(deployed);
 
+	// Choose block compression from codecs known by both
+	u32 client_codecs = 1 << BLOCK_CODEC_ZLIB;
+	packet.convert_safe(TOSERVER_INIT_LEGACY_COMPRESSION, client_codecs);
+	client->block_codec = blockCodecFromString(g_settings->get("network_compression"));
+	if (deployed < SER_FMT_VER_CODEC || !(client_codecs & (1 << client->block_codec)))
+		client->block_codec = BLOCK_CODEC_ZLIB;
+
 	/*
 		Read and check network protocol version
 	*/
@@ -330,7 +337,7 @@ void Server::handleCommand_Init_Legacy(NetworkPacket* pkt) {
 		Answer with a TOCLIENT_INIT
 	*/
 	{
-		MSGPACK_PACKET_INIT(TOCLIENT_INIT_LEGACY, 6);
+		MSGPACK_PACKET_INIT(TOCLIENT_INIT_LEGACY, 7);
 		PACK(TOCLIENT_INIT_DEPLOYED, deployed);
 		PACK(TOCLIENT_INIT_SEED, m_env->getServerMap().getSeed());
 		PACK(TOCLIENT_INIT_STEP, g_settings->getFloat("dedicated_server_step"));
@@ -347,6 +354,8 @@ void Server::handleCommand_Init_Legacy(NetworkPacket* pkt) {
 
 		PACK(TOCLIENT_INIT_WEATHER, g_settings->getBool("weather"));
 
+		PACK(TOCLIENT_INIT_COMPRESSION, client->block_codec);
+
 		// Send as reliable
 		m_clients.send(peer_id, 0, buffer, true);
 		m_clients.event(peer_id, CSE_InitLegacy);
@@ -526,8 +535,11 @@ void Server::handleCommand_PlayerPos(NetworkPacket* pkt) {
 		player->control.LMB = (bool)(keyPressed & 128);
 		player->control.RMB = (bool)(keyPressed & 256);
 	}
+	// Runs without m_process_data_mutex, see isPeerLocalCommand; taken
+	// only where callbacks and the object step reach the whole server
 	auto old_pos = playersao->m_last_good_position;
 	if(playersao->checkMovementCheat()) {
+		MutexAutoLock process_data_lock(m_process_data_mutex);
 		// Call callbacks
 		m_script->on_cheat(playersao, "moved_too_fast");
 		SendMovePlayer(peer_id);
@@ -543,6 +555,7 @@ void Server::handleCommand_PlayerPos(NetworkPacket* pkt) {
 		if (!obj->m_uptime_last)  // not very good place, but minimum modifications
 			obj->m_uptime_last = uptime - 0.1;
 		if (uptime - obj->m_uptime_last > 0.5) {
+			MutexAutoLock process_data_lock(m_process_data_mutex);
 			obj->step(uptime - obj->m_uptime_last, true); //todo: maybe limit count per time
 			obj->m_uptime_last = uptime;
 		}
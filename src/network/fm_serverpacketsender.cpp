@@ -517,6 +517,17 @@ void Server::SendActiveObjectMessages(u16 peer_id, const ActiveObjectMessages &d
 	m_clients.send(peer_id, 0, buffer, reliable);
 }
 
+void Server::SendActiveObjectMessagesPacked(u16 peer_id, const std::string &packed,
+		u32 count, bool reliable)
+{
+	MSGPACK_PACKET_INIT(TOCLIENT_ACTIVE_OBJECT_MESSAGES, 1);
+	pk.pack((int)TOCLIENT_ACTIVE_OBJECT_MESSAGES_MESSAGES);
+	pk.pack_array(count);
+	buffer.write(packed.data(), packed.size());
+
+	m_clients.send(peer_id, 0, buffer, reliable);
+}
+
 
 s32 Server::playSound(const SimpleSoundSpec &spec,
 		const ServerSoundParams &params)
@@ -589,12 +600,8 @@ s32 Server::playSound(const SimpleSoundSpec &spec,
 	PACK(TOCLIENT_PLAY_SOUND_POS, pos);
 	PACK(TOCLIENT_PLAY_SOUND_OBJECT_ID, params.object);
 	PACK(TOCLIENT_PLAY_SOUND_LOOP, params.loop);
-	// Send
-	for(auto i = dst_clients.begin();
-			i != dst_clients.end(); i++){
-		// Send as reliable
-		m_clients.send(*i, 0, buffer, true);
-	}
+	// Send as reliable
+	m_clients.send(dst_clients, 0, buffer, true);
 	return id;
 }
 void Server::stopSound(s32 handle)
@@ -608,12 +615,9 @@ void Server::stopSound(s32 handle)
 	// Create packet
 	MSGPACK_PACKET_INIT(TOCLIENT_STOP_SOUND, 1);
 	PACK(TOCLIENT_STOP_SOUND_ID, handle);
-	// Send
-	for(auto i = psound.clients.begin();
-			i != psound.clients.end(); i++){
-		// Send as reliable
-		m_clients.send(*i, 0, buffer, true);
-	}
+	// Send as reliable
+	std::vector<u16> peer_ids(psound.clients.begin(), psound.clients.end());
+	m_clients.send(peer_ids, 0, buffer, true);
 	// Remove sound reference
 	m_playing_sounds.erase(i);
 }
@@ -629,6 +633,7 @@ void Server::sendRemoveNode(v3s16 p, u16 ignore_id,
 	MSGPACK_PACKET_INIT(TOCLIENT_REMOVENODE, 1);
 	PACK(TOCLIENT_REMOVENODE_POS, p);
 
+	std::vector<u16> peer_ids;
 	auto clients = m_clients.getClientIDs();
 	for(auto
 		i = clients.begin();
@@ -650,9 +655,11 @@ void Server::sendRemoveNode(v3s16 p, u16 ignore_id,
 			}
 		}
 
-		// Send as reliable
-		m_clients.send(*i, 0, buffer, true);
+		peer_ids.push_back(*i);
 	}
+
+	// Send as reliable, one packet for all
+	m_clients.send(peer_ids, 0, buffer, true);
 }
 
 void Server::sendAddNode(v3s16 p, MapNode n, u16 ignore_id,
@@ -662,6 +669,13 @@ void Server::sendAddNode(v3s16 p, MapNode n, u16 ignore_id,
 	float maxd = far_d_nodes*BS;
 	v3f p_f = intToFloat(p, BS);
 
+	// Create packet
+	MSGPACK_PACKET_INIT(TOCLIENT_ADDNODE, 3);
+	PACK(TOCLIENT_ADDNODE_POS, p);
+	PACK(TOCLIENT_ADDNODE_NODE, n);
+	PACK(TOCLIENT_ADDNODE_REMOVE_METADATA, remove_metadata);
+
+	std::vector<u16> peer_ids;
 	std::vector<u16> clients = m_clients.getClientIDs();
 	for(auto
 				i = clients.begin();
@@ -684,19 +698,13 @@ void Server::sendAddNode(v3s16 p, MapNode n, u16 ignore_id,
 				}
 			}
 		}
-		SharedBuffer<u8> reply(0);
 		RemoteClient* client = m_clients.lockedGetClientNoEx(*i);
 		if (client != 0)
-		{
-			// Create packet
-			MSGPACK_PACKET_INIT(TOCLIENT_ADDNODE, 3);
-			PACK(TOCLIENT_ADDNODE_POS, p);
-			PACK(TOCLIENT_ADDNODE_NODE, n);
-			PACK(TOCLIENT_ADDNODE_REMOVE_METADATA, remove_metadata);
-
-			m_clients.send(*i, 0, buffer, true);
-		}
+			peer_ids.push_back(*i);
 	}
+
+	// Send as reliable, one packet for all
+	m_clients.send(peer_ids, 0, buffer, true);
 }
 
 void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto_version)
@@ -706,24 +714,71 @@ void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto
 
 	g_profiler->add("Connection: blocks sent", 1);
 
-	MSGPACK_PACKET_INIT(TOCLIENT_BLOCKDATA, 8);
-	PACK(TOCLIENT_BLOCKDATA_POS, block->getPos());
-
-	std::ostringstream os(std::ios_base::binary);
-
 	auto client = m_clients.getClient(peer_id);
 	if (!client)
 		return;
-	block->serialize(os, ver, false, client->net_proto_version_fm >= 1);
-	PACK(TOCLIENT_BLOCKDATA_DATA, os.str());
 
-	PACK(TOCLIENT_BLOCKDATA_HEAT, (s16)(block->heat + block->heat_add));
-	PACK(TOCLIENT_BLOCKDATA_HUMIDITY, (s16)(block->humidity + block->humidity_add));
+	BlockSendCacheKey key;
+	key.pos = block->getPos();
+	key.modified_counter = block->m_modified_counter;
+	key.net_proto_version_fm = client->net_proto_version_fm;
+	key.version = ver;
+	key.codec = client->block_codec;
+	key.heat = block->heat + block->heat_add;
+	key.humidity = block->humidity + block->humidity_add;
+
+	u64 sent_version = 0;
+	{
+		auto lock = client->m_blocks_sent_version.lock_shared_rec();
+		auto it = client->m_blocks_sent_version.find(key.pos);
+		if (it != client->m_blocks_sent_version.end())
+			sent_version = it->second;
+	}
+	client->m_blocks_sent_version.set(key.pos, key.modified_counter);
+
+	// Also when nothing changed for client: resent because of objects or
+	// timestamp, empty delta still updates heat and humidity
+	std::string delta;
+	if (sent_version && client->net_proto_version_fm >= 3 && block->getNodeChanges(sent_version, delta)) {
+		g_profiler->add("Server: block send delta", 1);
+		MSGPACK_PACKET_INIT(TOCLIENT_BLOCKDATA, 9);
+		PACK(TOCLIENT_BLOCKDATA_POS, key.pos);
+		PACK(TOCLIENT_BLOCKDATA_STEP, (s8)2);
+		PACK(TOCLIENT_BLOCKDATA_DELTA, delta);
+		PACK(TOCLIENT_BLOCKDATA_FLAGS, block->getSerializeFlags());
+		PACK(TOCLIENT_BLOCKDATA_HEAT, key.heat);
+		PACK(TOCLIENT_BLOCKDATA_HUMIDITY, key.humidity);
+		PACK(TOCLIENT_BLOCKDATA_CONTENT_ONLY, block->content_only);
+		PACK(TOCLIENT_BLOCKDATA_CONTENT_ONLY_PARAM1, block->content_only_param1);
+		PACK(TOCLIENT_BLOCKDATA_CONTENT_ONLY_PARAM2, block->content_only_param2);
+		m_clients.send(peer_id, 2, buffer, reliable);
+		return;
+	}
+
+	if (auto cached = m_block_send_cache.get(key)) {
+		g_profiler->add("Server: block send cache hit", 1);
+		m_clients.send(peer_id, 2, SharedBuffer<u8>((const u8 *)cached->data(), cached->size()), reliable);
+		return;
+	}
+	g_profiler->add("Server: block send cache miss", 1);
+
+	MSGPACK_PACKET_INIT(TOCLIENT_BLOCKDATA, 8);
+	PACK(TOCLIENT_BLOCKDATA_POS, key.pos);
+
+	SCRATCH_BUFFER(std::string, data);
+	block->serializeNetwork(data, ver, client->net_proto_version_fm >= 1, client->block_codec);
+	PACK(TOCLIENT_BLOCKDATA_DATA, data);
+
+	PACK(TOCLIENT_BLOCKDATA_HEAT, key.heat);
+	PACK(TOCLIENT_BLOCKDATA_HUMIDITY, key.humidity);
 	PACK(TOCLIENT_BLOCKDATA_STEP, (s8)1);
 	PACK(TOCLIENT_BLOCKDATA_CONTENT_ONLY, block->content_only);
 	PACK(TOCLIENT_BLOCKDATA_CONTENT_ONLY_PARAM1, block->content_only_param1);
 	PACK(TOCLIENT_BLOCKDATA_CONTENT_ONLY_PARAM2, block->content_only_param2);
 
+	if (m_block_send_cache.getLimit())
+		m_block_send_cache.set(key, std::make_shared<std::string>(buffer.data(), buffer.size()));
+
 	//MutexAutoLock lock(m_env_mutex);
 	/*
 		Send packet
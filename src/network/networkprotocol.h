@@ -165,7 +165,9 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #define CLIENT_PROTOCOL_VERSION_MIN_LEGACY 13
 #define CLIENT_PROTOCOL_VERSION_MAX LATEST_PROTOCOL_VERSION
 
-#define CLIENT_PROTOCOL_VERSION_FM 2
+// 3: TOCLIENT_BLOCKDATA step 2 (delta)
+// 4: GENERIC_CMD_UPDATE_MOVEMENT
+#define CLIENT_PROTOCOL_VERSION_FM 4
 #define SERVER_PROTOCOL_VERSION_FM 0
 
 // Constant that differentiates the protocol from random data and other protocols
@@ -227,7 +229,9 @@ enum {
 	// json map params
 	TOCLIENT_INIT_MAP_PARAMS,
 	TOCLIENT_INIT_PROTOCOL_VERSION_FM,
-	TOCLIENT_INIT_WEATHER
+	TOCLIENT_INIT_WEATHER,
+	// u8 BlockCodec of TOCLIENT_BLOCKDATA
+	TOCLIENT_INIT_COMPRESSION
 };
 
 	/*
@@ -260,7 +264,11 @@ enum {
 	TOCLIENT_BLOCKDATA_STEP,
 	TOCLIENT_BLOCKDATA_CONTENT_ONLY,
 	TOCLIENT_BLOCKDATA_CONTENT_ONLY_PARAM1,
-	TOCLIENT_BLOCKDATA_CONTENT_ONLY_PARAM2
+	TOCLIENT_BLOCKDATA_CONTENT_ONLY_PARAM2,
+	// step 2: changed nodes instead of DATA, see MapBlock::getNodeChanges
+	TOCLIENT_BLOCKDATA_DELTA,
+	// step 2: u8 flags, first byte of MapBlock::serialize
+	TOCLIENT_BLOCKDATA_FLAGS
 };
 
 #define TOCLIENT_ADDNODE 0x21
@@ -906,7 +914,9 @@ enum {
 	TOSERVER_INIT_LEGACY_PASSWORD,
 	TOSERVER_INIT_LEGACY_PROTOCOL_VERSION_MIN,
 	TOSERVER_INIT_LEGACY_PROTOCOL_VERSION_MAX,
-	TOSERVER_INIT_LEGACY_PROTOCOL_VERSION_FM
+	TOSERVER_INIT_LEGACY_PROTOCOL_VERSION_FM,
+	// u32 supported BlockCodec bits (1 << codec)
+	TOSERVER_INIT_LEGACY_COMPRESSION
 };
 	/*
 		Sent first after connected.
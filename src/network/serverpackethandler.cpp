@@ -106,7 +106,8 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 	*pkt >> client_max >> supp_compr_modes >> min_net_proto_version
 			>> max_net_proto_version >> playerName;
 
-	u8 our_max = SER_FMT_VER_HIGHEST_READ;
+	// Minetest clients do not know the block codec byte
+	u8 our_max = SER_FMT_VER_CODEC - 1;
 	// Use the highest version supported by both
 	u8 depl_serial_v = std::min(client_max, our_max);
 	// If it's lower than the lowest supported, give up.
@@ -350,7 +351,8 @@ void Server::handleCommand_Init_Legacy(NetworkPacket* pkt)
 
 	*pkt >> client_max;
 
-	u8 our_max = SER_FMT_VER_HIGHEST_READ;
+	// Minetest clients do not know the block codec byte
+	u8 our_max = SER_FMT_VER_CODEC - 1;
 	// Use the highest version supported by both
 	int deployed = std::min(client_max, our_max);
 	// If it's lower than the lowest supported, give up.
@@ -845,9 +847,17 @@ void Server::process_PlayerPos(RemotePlayer *player, PlayerSAO *playersao,
 	player->control.RMB = (keyPressed & 256);
 	}
 
+	// ProcessData does not lock for TOSERVER_PLAYERPOS, see
+	// isPeerLocalCommand; callbacks and the object step reach the whole
+	// server and take m_process_data_mutex (INTERACT already holds it)
+	MutexAutoLock process_data_lock(m_process_data_mutex, std::defer_lock);
+	bool lock_process_data = isPeerLocalCommand(pkt->getCommand());
+
 	auto old_pos = playersao->m_last_good_position;
 
 	if (playersao->checkMovementCheat()) {
+		if (lock_process_data)
+			process_data_lock.lock();
 		// Call callbacks
 		m_script->on_cheat(playersao, "moved_too_fast");
 		SendMovePlayer(pkt->getPeerId());
@@ -865,6 +875,8 @@ void Server::process_PlayerPos(RemotePlayer *player, PlayerSAO *playersao,
 			if (!obj->m_uptime_last)  // not very good place, but minimum modifications
 				obj->m_uptime_last = uptime - 0.1;
 			if (uptime - obj->m_uptime_last > 0.5) {
+				if (lock_process_data && !process_data_lock.owns_lock())
+					process_data_lock.lock();
 				obj->step(uptime - obj->m_uptime_last, true); //todo: maybe limit count per time
 				obj->m_uptime_last = uptime;
 			}
@@ -0,0 +1,409 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "node_palette.h"
+#include <new>
+#include "exceptions.h"
+#include "util/serialize.h"
+
+static inline u32 nodeKey(const MapNode &n)
+{
+	return n.param0 | (n.param1 << 16) | ((u32)n.param2 << 24);
+}
+
+NodePalette::NodePalette(const MapNode &n)
+{
+	Layout *l = createLayout(0);
+	l->palette()[0] = n;
+	l->size = 1;
+	m_layout.store(l, std::memory_order_relaxed);
+}
+
+NodePalette::NodePalette(const NodePalette &other)
+{
+	// Not shared yet, nothing to retire
+	m_layout.store(rebuilt(other.m_layout.load(std::memory_order_acquire), 0, false),
+		std::memory_order_relaxed);
+}
+
+NodePalette &NodePalette::operator=(const NodePalette &other)
+{
+	if (this != &other)
+		publish(rebuilt(other.m_layout.load(std::memory_order_acquire), 0, false));
+	return *this;
+}
+
+NodePalette::~NodePalette()
+{
+	freeRetired(true);
+	::operator delete(m_layout.load(std::memory_order_relaxed));
+}
+
+NodePalette::Layout *NodePalette::createLayout(u8 bits)
+{
+	Layout header;
+	header.bits = bits;
+	header.mask = bits == BITS_PLAIN ? 0 : (1 << bits) - 1;
+	header.size = 0;
+	header.capacity = bits == BITS_PLAIN ? nodecount : 1 << bits;
+	header.padding = 0;
+	Layout *l = (Layout *)::operator new(layoutSize(&header));
+	*l = header;
+	for (u32 i = 0; i < l->capacity; ++i)
+		new (&l->palette()[i]) MapNode(CONTENT_IGNORE);
+	if (bits != BITS_PLAIN)
+		memset(l->indices(), 0, layoutSize(l) - ((u8 *)l->indices() - (u8 *)l));
+	return l;
+}
+
+size_t NodePalette::layoutSize(const Layout *l)
+{
+	size_t size = sizeof(Layout) + l->capacity * sizeof(MapNode);
+	if (l->bits != BITS_PLAIN)
+		size += l->bits ? nodecount * l->bits / 8 : 1;
+	return size;
+}
+
+u8 NodePalette::bitsFor(u32 entries)
+{
+	if (entries <= 1)
+		return 0;
+	if (entries <= 2)
+		return 1;
+	if (entries <= 4)
+		return 2;
+	if (entries <= 16)
+		return 4;
+	if (entries <= 256)
+		return 8;
+	return BITS_PLAIN;
+}
+
+int NodePalette::find(const Layout *l, const MapNode &n)
+{
+	u32 key = nodeKey(n);
+	const MapNode *palette = l->palette();
+	for (u16 i = 0; i < l->size; ++i)
+		if (nodeKey(palette[i]) == key)
+			return i;
+	return -1;
+}
+
+int NodePalette::findUnused(const Layout *l, u32 except)
+{
+	if (!l->bits)
+		return -1;
+	bool used[256] = {};
+	for (u32 i = 0; i < nodecount; ++i)
+		if (i != except)
+			used[index(l, i)] = true;
+	for (u16 i = 0; i < l->size; ++i)
+		if (!used[i])
+			return i;
+	return -1;
+}
+
+MapNode NodePalette::set(u32 i, const MapNode &n)
+{
+	Layout *l = m_layout.load(std::memory_order_relaxed);
+	if (l->bits == BITS_PLAIN) {
+		MapNode old = l->palette()[i];
+		l->palette()[i] = n;
+		return old;
+	}
+
+	u32 bit = i * l->bits;
+	u8 shift = bit & 7;
+	u8 &byte = l->indices()[bit >> 3];
+	MapNode old = l->palette()[(byte >> shift) & l->mask];
+	if (nodeKey(old) == nodeKey(n))
+		return old;
+
+	int index = find(l, n);
+	if (index < 0 && l->size < l->capacity) {
+		index = l->size;
+		l->palette()[index] = n;
+		++l->size;
+	} else if (index < 0) {
+		// Reuse an entry no node refers to, in place, or go wider
+		index = findUnused(l, i);
+		if (index < 0) {
+			publish(rebuilt(l, l->bits, true));
+			set(i, n);
+			return old;
+		}
+		l->palette()[index] = n;
+	}
+	byte = (byte & ~(l->mask << shift)) | (index << shift);
+	return old;
+}
+
+void NodePalette::fill(const MapNode &n)
+{
+	Layout *l = createLayout(0);
+	l->palette()[0] = n;
+	l->size = 1;
+	publish(l);
+}
+
+void NodePalette::assign(const MapNode *nodes)
+{
+	publish(build(nodes));
+}
+
+NodePalette::Layout *NodePalette::build(const MapNode *nodes)
+{
+	// Open addressing, palette index + 1 per slot
+	static const u32 HASH_SIZE = 512;
+	u16 slots[HASH_SIZE] = {};
+	MapNode entries[256];
+	u32 count = 0;
+	bool plain = false;
+	for (u32 i = 0; i < nodecount && !plain; ++i) {
+		u32 key = nodeKey(nodes[i]);
+		u32 h = (key * 2654435761U) >> 23;
+		for (;; h = (h + 1) & (HASH_SIZE - 1)) {
+			if (!slots[h]) {
+				if (count == 256) {
+					plain = true;
+					break;
+				}
+				entries[count] = nodes[i];
+				slots[h] = ++count;
+				break;
+			}
+			if (nodeKey(entries[slots[h] - 1]) == key)
+				break;
+		}
+	}
+
+	Layout *l = createLayout(plain ? BITS_PLAIN : bitsFor(count));
+	if (plain) {
+		std::copy(nodes, nodes + nodecount, l->palette());
+		return l;
+	}
+	std::copy(entries, entries + count, l->palette());
+	l->size = count;
+	if (l->bits) {
+		u8 *indices = l->indices();
+		for (u32 i = 0; i < nodecount; ++i) {
+			u32 key = nodeKey(nodes[i]);
+			u32 h = (key * 2654435761U) >> 23;
+			while (nodeKey(entries[slots[h] - 1]) != key)
+				h = (h + 1) & (HASH_SIZE - 1);
+			u32 bit = i * l->bits;
+			indices[bit >> 3] |= (slots[h] - 1) << (bit & 7);
+		}
+	}
+	return l;
+}
+
+void NodePalette::copyTo(MapNode *nodes) const
+{
+	epoch_read_guard guard;
+	const Layout *l = m_layout.load(std::memory_order_acquire);
+	const MapNode *palette = l->palette();
+	if (l->bits == BITS_PLAIN) {
+		std::copy(palette, palette + nodecount, nodes);
+		return;
+	}
+	if (!l->bits) {
+		std::fill(nodes, nodes + nodecount, palette[0]);
+		return;
+	}
+	const u8 *indices = l->indices();
+	u8 bits = l->bits, mask = l->mask, per_byte = 8 / bits;
+	for (u32 i = 0; i < nodecount; i += per_byte) {
+		u8 byte = indices[i / per_byte];
+		for (u8 k = 0; k < per_byte; ++k, byte >>= bits)
+			nodes[i + k] = palette[byte & mask];
+	}
+}
+
+NodePalette::Layout *NodePalette::rebuilt(const Layout *from, u8 bits, bool room)
+{
+	if (from->bits == BITS_PLAIN)
+		return build(from->palette());
+
+	// Used entries, renumbered
+	bool used[256] = {};
+	if (from->bits) {
+		for (u32 i = 0; i < nodecount; ++i)
+			used[index(from, i)] = true;
+	} else {
+		used[0] = true;
+	}
+	u16 remap[256];
+	MapNode entries[256];
+	u32 count = 0;
+	for (u16 i = 0; i < from->size; ++i) {
+		if (!used[i])
+			continue;
+		remap[i] = count;
+		entries[count++] = from->palette()[i];
+	}
+
+	u8 needed = bitsFor(room ? count + 1 : count);
+	if (needed > bits)
+		bits = needed;
+
+	Layout *l = createLayout(bits);
+	if (bits == BITS_PLAIN) {
+		for (u32 i = 0; i < nodecount; ++i)
+			l->palette()[i] = at(from, i);
+		return l;
+	}
+	std::copy(entries, entries + count, l->palette());
+	l->size = count;
+	if (bits) {
+		for (u32 i = 0; i < nodecount; ++i) {
+			u32 bit = i * bits;
+			l->indices()[bit >> 3] |= (from->bits ? remap[index(from, i)] : 0) << (bit & 7);
+		}
+	}
+	return l;
+}
+
+void NodePalette::compact()
+{
+	const Layout *l = m_layout.load(std::memory_order_relaxed);
+	if (l->bits)
+		publish(rebuilt(l, 0, false));
+	freeRetired(false);
+}
+
+void NodePalette::clear()
+{
+	fill(MapNode(CONTENT_IGNORE));
+	freeRetired(true);
+}
+
+u16 NodePalette::getPaletteSize() const
+{
+	epoch_read_guard guard;
+	const Layout *l = m_layout.load(std::memory_order_acquire);
+	return l->bits == BITS_PLAIN ? 0 : l->size;
+}
+
+MapNode NodePalette::getPaletteEntry(u16 i) const
+{
+	epoch_read_guard guard;
+	return m_layout.load(std::memory_order_acquire)->palette()[i];
+}
+
+size_t NodePalette::getMemoryUsage() const
+{
+	size_t size = sizeof(*this) + layoutSize(m_layout.load(std::memory_order_relaxed));
+	for (const auto &retired : m_retired)
+		size += layoutSize(retired.second);
+	return size;
+}
+
+void NodePalette::publish(Layout *l)
+{
+	Layout *old = m_layout.exchange(l, std::memory_order_acq_rel);
+	m_retired.emplace_back(epoch_retire(), old);
+	freeRetired(false);
+}
+
+void NodePalette::freeRetired(bool all)
+{
+	if (m_retired.empty())
+		return;
+	uint64_t oldest = all ? 0 : epoch_oldest_reader();
+	size_t kept = 0;
+	for (auto &retired : m_retired) {
+		if (all || retired.first <= oldest)
+			::operator delete(retired.second);
+		else
+			m_retired[kept++] = retired;
+	}
+	m_retired.resize(kept);
+}
+
+void NodePalette::serialize(std::string &out) const
+{
+	epoch_read_guard guard;
+	const Layout *l = m_layout.load(std::memory_order_acquire);
+	bool plain = l->bits == BITS_PLAIN;
+	u32 count = plain ? nodecount : l->size;
+	size_t start = out.size();
+	size_t index_bytes = plain || !l->bits ? 0 : nodecount * l->bits / 8;
+	out.resize(start + 2 + count * 4 + (plain ? 0 : 1) + index_bytes);
+	u8 *p = (u8 *)&out[start];
+
+	writeU16(p, plain ? 0 : count);
+	p += 2;
+	for (u32 i = 0; i < count; ++i, p += 4) {
+		const MapNode &n = l->palette()[i];
+		writeU16(p, n.param0);
+		writeU8(p + 2, n.param1);
+		writeU8(p + 3, n.param2);
+	}
+	if (plain)
+		return;
+	writeU8(p++, l->bits);
+	memcpy(p, l->indices(), index_bytes);
+}
+
+void NodePalette::deSerialize(const std::string &in)
+{
+	const u8 *p = (const u8 *)in.data();
+	size_t left = in.size();
+	if (left < 2)
+		throw SerializationError("NodePalette: truncated");
+	u32 count = readU16(p);
+	p += 2;
+	left -= 2;
+
+	bool plain = !count;
+	u8 bits = BITS_PLAIN;
+	if (plain) {
+		count = nodecount;
+	} else if (count > 256) {
+		throw SerializationError("NodePalette: invalid palette size");
+	}
+	if (left < count * 4 + (plain ? 0 : 1))
+		throw SerializationError("NodePalette: truncated");
+	if (!plain) {
+		bits = p[count * 4];
+		if ((bits != 0 && bits != 1 && bits != 2 && bits != 4 && bits != 8) ||
+				count > (1U << bits))
+			throw SerializationError("NodePalette: invalid index bits");
+	}
+	size_t index_bytes = plain || !bits ? 0 : nodecount * bits / 8;
+	if (left != count * 4 + (plain ? 0 : 1) + index_bytes)
+		throw SerializationError("NodePalette: invalid size");
+
+	Layout *l = createLayout(bits);
+	for (u32 i = 0; i < count; ++i, p += 4)
+		l->palette()[i] = MapNode(readU16(p), readU8(p + 2), readU8(p + 3));
+	if (!plain) {
+		l->size = count;
+		memcpy(l->indices(), p + 1, index_bytes);
+		// Entries past count are unset, no index may refer to them
+		if (bits && count < (1U << bits)) {
+			for (u32 i = 0; i < nodecount; ++i) {
+				if (index(l, i) >= count) {
+					::operator delete(l);
+					throw SerializationError("NodePalette: index out of palette");
+				}
+			}
+		}
+	}
+	publish(l);
+}
@@ -0,0 +1,160 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NODE_PALETTE_HEADER
+#define NODE_PALETTE_HEADER
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "constants.h"
+#include "mapnode.h"
+#include "threading/epoch.h"
+
+/*
+	Nodes of a MapBlock as a palette of the distinct nodes (content, param1
+	and param2) and a packed index per node of 0, 1, 2, 4 or 8 bits. A
+	uniform block is one palette entry, most blocks need 2-4 bits instead
+	of the 4 bytes of a MapNode. Writing a node missing from a full
+	palette reuses an entry no node refers to anymore, else widens the
+	indices; more than 256 distinct nodes are kept as plain nodes.
+
+	Writers must be serialized by the caller (MapBlock lock). Readers may
+	run without lock like MapBlock::getNodeNoLock: they hold an
+	epoch_read_guard, a layout replaced by widening or assign() is freed
+	when no reader that started before the replacement is left. Readers
+	holding the MapBlock lock, or one guard for a whole loop, use the
+	NoGuard accessors.
+*/
+
+class NodePalette {
+public:
+	static const u32 nodecount = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
+	// getBits() without palette
+	static const u8 BITS_PLAIN = 16;
+
+	NodePalette(const MapNode &n = MapNode(CONTENT_IGNORE));
+	// Compacted copy
+	NodePalette(const NodePalette &other);
+	NodePalette &operator=(const NodePalette &other);
+	~NodePalette();
+
+	inline MapNode get(u32 i) const
+	{
+		epoch_read_guard guard;
+		return getNoGuard(i);
+	}
+	// Caller holds the MapBlock lock or an epoch_read_guard
+	inline MapNode getNoGuard(u32 i) const
+	{
+		return at(m_layout.load(std::memory_order_acquire), i);
+	}
+
+	// Returns the node that was at i
+	MapNode set(u32 i, const MapNode &n);
+	void fill(const MapNode &n);
+	// nodecount nodes
+	void assign(const MapNode *nodes);
+	void copyTo(MapNode *nodes) const;
+
+	// Drop palette entries no node uses and narrow the indices
+	void compact();
+	// One ignore node, frees replaced layouts at once: no readers left
+	void clear();
+
+	u8 getBits() const
+	{
+		epoch_read_guard guard;
+		return getBitsNoGuard();
+	}
+	u8 getBitsNoGuard() const
+	{
+		return m_layout.load(std::memory_order_acquire)->bits;
+	}
+	// Entries in the palette, unused ones included; 0 without palette
+	u16 getPaletteSize() const;
+	MapNode getPaletteEntry(u16 i) const;
+	// Change the content of every palette entry, or of every node without
+	// palette; used to renumber node ids
+	template <class F>
+	void mapContent(F f)
+	{
+		Layout *l = m_layout.load(std::memory_order_relaxed);
+		u32 count = l->bits == BITS_PLAIN ? nodecount : l->size;
+		for (u32 i = 0; i < count; ++i)
+			l->palette()[i].param0 = f(l->palette()[i].param0);
+	}
+
+	size_t getMemoryUsage() const;
+
+	/*
+		u16 palette size, 0 without palette
+		without palette: nodecount * (u16 content, u8 param1, u8 param2)
+		with palette: palette size * (u16 content, u8 param1, u8 param2),
+			u8 bits, nodecount * bits / 8 index bytes, lowest bits first
+	*/
+	void serialize(std::string &out) const;
+	// Longest serialize() output: without palette
+	static const u32 SERIALIZED_MAX = 2 + nodecount * 4;
+	// Throws SerializationError
+	void deSerialize(const std::string &in);
+
+private:
+	struct Layout {
+		u8 bits;
+		u8 mask;
+		u16 size;
+		u16 capacity;
+		u16 padding;
+		// MapNode palette[capacity], then the indices
+
+		MapNode *palette() { return reinterpret_cast<MapNode *>(this + 1); }
+		const MapNode *palette() const { return reinterpret_cast<const MapNode *>(this + 1); }
+		u8 *indices() { return reinterpret_cast<u8 *>(palette() + capacity); }
+		const u8 *indices() const { return reinterpret_cast<const u8 *>(palette() + capacity); }
+	};
+
+	static inline u8 index(const Layout *l, u32 i)
+	{
+		u32 bit = i * l->bits;
+		return (l->indices()[bit >> 3] >> (bit & 7)) & l->mask;
+	}
+	static inline MapNode at(const Layout *l, u32 i)
+	{
+		return l->palette()[l->bits == BITS_PLAIN ? i : index(l, i)];
+	}
+
+	static Layout *createLayout(u8 bits);
+	static size_t layoutSize(const Layout *l);
+	static u8 bitsFor(u32 entries);
+	static int find(const Layout *l, const MapNode &n);
+	// Entry no node but the one at except refers to
+	static int findUnused(const Layout *l, u32 except);
+
+	static Layout *build(const MapNode *nodes);
+	// Used entries of from, at least bits wide, room: for one more entry
+	static Layout *rebuilt(const Layout *from, u8 bits, bool room);
+	// Make l current, the old layout is freed when no reader is left
+	void publish(Layout *l);
+	void freeRetired(bool all);
+
+	std::atomic<Layout *> m_layout;
+	// Replaced layouts with their epoch_retire() tag
+	std::vector<std::pair<uint64_t, Layout *>> m_retired;
+};
+
+#endif
@@ -25,26 +25,15 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "noise.h"
 #include <iostream>
 #include <string.h> // memset
+#include <vector>
 #include "debug.h"
 #include "util/numeric.h"
 #include "constants.h"
 #include "util/string.h"
 #include "exceptions.h"
 #include "log_types.h"
-
-#define NOISE_MAGIC_X    1619
-#define NOISE_MAGIC_Y    31337
-#define NOISE_MAGIC_Z    52591
-#define NOISE_MAGIC_SEED 1013
-
-typedef float (*Interp2dFxn)(
-		float v00, float v10, float v01, float v11,
-		float x, float y);
-
-typedef float (*Interp3dFxn)(
-		float v000, float v100, float v010, float v110,
-		float v001, float v101, float v011, float v111,
-		float x, float y, float z);
+#include "noise_simd.h"
+#include "util/string_stream.h"
 
 float cos_lookup[16] = {
 	1.0,  0.9238,  0.7071,  0.3826, 0, -0.3826, -0.7071, -0.9238,
@@ -578,54 +567,63 @@ void Noise::gradientMap2D(
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
+	float u, v;
+	u32 i, j, noisex, noisey, row = 0;
 	u32 nlx, nly;
 	s32 x0, y0;
 
 	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
-	Interp2dFxn interpolate = eased ?
-		biLinearInterpolation : biLinearInterpolationNoEase;
 
 	x0 = floor(x);
 	y0 = floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
 	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+		noise_lattice_row(&noise_buf[idx(0, j)], x0, nlx,
+			noise_lattice_base(y0 + j, 0, seed));
+
+	//x weights and lattice columns are the same for every row
+	SCRATCH_BUFFER(std::vector<float>, tx);
+	SCRATCH_BUFFER(std::vector<u32>, lx);
+	tx.resize(sx);
+	lx.resize(sx);
+	noisex = 0;
+	for (i = 0; i != sx; i++) {
+		tx[i] = u;
+		lx[i] = noisex;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
+	if (eased)
+		noise_ease(tx.data(), sx);
 
-	//calculate interpolations
-	index  = 0;
+	//calculate interpolations, corners change only on lattice row change
+	SCRATCH_BUFFER(std::vector<float>, corners);
+	corners.resize(sx * 4);
+	float *v00 = &corners[0], *v10 = v00 + sx, *v01 = v10 + sx, *v11 = v01 + sx;
 	noisey = 0;
 	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] = interpolate(v00, v10, v01, v11, u, v);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
+		if (j == 0 || noisey != row) {
+			row = noisey;
+			for (i = 0; i != sx; i++) {
+				v00[i] = noise_buf[idx(lx[i],     noisey)];
+				v10[i] = noise_buf[idx(lx[i] + 1, noisey)];
+				v01[i] = noise_buf[idx(lx[i],     noisey + 1)];
+				v11[i] = noise_buf[idx(lx[i] + 1, noisey + 1)];
 			}
 		}
 
+		noise_lerp2(&gradient_buf[j * sx], v00, v10, v01, v11,
+			tx.data(), eased ? easeCurve(v) : v, sx);
+
 		v += step_y;
 		if (v >= 1.0) {
 			v -= 1.0;
@@ -634,23 +632,18 @@ void Noise::gradientMap2D(
 	}
 }
 #undef idx
-
-
 #define idx(x, y, z) ((z) * nly * nlx + (y) * nlx + (x))
 void Noise::gradientMap3D(
 		float x, float y, float z,
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
-	u32 index, i, j, k, noisex, noisey, noisez;
+	float u, v, w, orig_v;
+	u32 i, j, k, noisex, noisey, noisez, row = 0, plane = 0;
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
-	Interp3dFxn interpolate = (np.flags & NOISE_FLAG_EASED) ?
-		triLinearInterpolation : triLinearInterpolationNoEase;
+	bool eased = np.flags & NOISE_FLAG_EASED;
 
 	x0 = floor(x);
 	y0 = floor(y);
@@ -658,59 +651,70 @@ void Noise::gradientMap3D(
 	u = x - (float)x0;
 	v = y - (float)y0;
 	w = z - (float)z0;
-	orig_u = u;
 	orig_v = v;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
 	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
 	for (k = 0; k != nlz; k++)
 		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
-
-	//calculate interpolations
-	index  = 0;
-	noisey = 0;
+			noise_lattice_row(&noise_buf[idx(0, j, k)], x0, nlx,
+				noise_lattice_base(y0 + j, z0 + k, seed));
+
+	//x weights and lattice columns are the same for every row
+	SCRATCH_BUFFER(std::vector<float>, tx);
+	SCRATCH_BUFFER(std::vector<u32>, lx);
+	tx.resize(sx);
+	lx.resize(sx);
+	noisex = 0;
+	for (i = 0; i != sx; i++) {
+		tx[i] = u;
+		lx[i] = noisex;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
+	if (eased)
+		noise_ease(tx.data(), sx);
+
+	//calculate interpolations, corners change only on lattice row change
+	SCRATCH_BUFFER(std::vector<float>, corners);
+	corners.resize(sx * 8);
+	const float *corner[8];
+	for (i = 0; i != 8; i++)
+		corner[i] = &corners[i * sx];
+	float *v000 = &corners[0],      *v100 = &corners[sx],
+		*v010 = &corners[sx * 2], *v110 = &corners[sx * 3],
+		*v001 = &corners[sx * 4], *v101 = &corners[sx * 5],
+		*v011 = &corners[sx * 6], *v111 = &corners[sx * 7];
 	noisez = 0;
 	for (k = 0; k != sz; k++) {
+		float tz = eased ? easeCurve(w) : w;
 		v = orig_v;
 		noisey = 0;
 		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = interpolate(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
+			if ((k == 0 && j == 0) || noisey != row || noisez != plane) {
+				row = noisey;
+				plane = noisez;
+				for (i = 0; i != sx; i++) {
+					v000[i] = noise_buf[idx(lx[i],     noisey,     noisez)];
+					v100[i] = noise_buf[idx(lx[i] + 1, noisey,     noisez)];
+					v010[i] = noise_buf[idx(lx[i],     noisey + 1, noisez)];
+					v110[i] = noise_buf[idx(lx[i] + 1, noisey + 1, noisez)];
+					v001[i] = noise_buf[idx(lx[i],     noisey,     noisez + 1)];
+					v101[i] = noise_buf[idx(lx[i] + 1, noisey,     noisez + 1)];
+					v011[i] = noise_buf[idx(lx[i],     noisey + 1, noisez + 1)];
+					v111[i] = noise_buf[idx(lx[i] + 1, noisey + 1, noisez + 1)];
 				}
 			}
 
+			noise_lerp3(&gradient_buf[(k * sy + j) * sx], corner,
+				tx.data(), eased ? easeCurve(v) : v, tz, sx);
+
 			v += step_y;
 			if (v >= 1.0) {
 				v -= 1.0;
@@ -816,29 +820,11 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 void Noise::updateResults(float g, float *gmap,
 	float *persistence_map, size_t bufsize)
 {
-	// This looks very ugly, but it is 50-70% faster than having
-	// conditional statements inside the loop
-	if (np.flags & NOISE_FLAG_ABSVALUE) {
-		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * fabs(gradient_buf[i]);
-				gmap[i] *= persistence_map[i];
-			}
-		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * fabs(gradient_buf[i]);
-		}
-	} else {
-		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * gradient_buf[i];
-				gmap[i] *= persistence_map[i];
-			}
-		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * gradient_buf[i];
-		}
-	}
+	bool absvalue = np.flags & NOISE_FLAG_ABSVALUE;
+	if (persistence_map)
+		noise_accumulate_map(result, gradient_buf, gmap, persistence_map, bufsize, absvalue);
+	else
+		noise_accumulate(result, gradient_buf, g, bufsize, absvalue);
 }
 
 float farscale(float scale, float z) {
@@ -0,0 +1,342 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "noise_simd.h"
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NOISE_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define NOISE_SIMD_X86 0
+#endif
+
+/*
+	Scalar kernels, also used for vector tails. Operation order here is
+	the reference for the vector versions, keep them in sync.
+*/
+
+static inline float lattice_value(u32 n)
+{
+	n &= 0x7fffffff;
+	n = (n >> 13) ^ n;
+	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
+	return 1.f - (float)(int)n / 0x40000000;
+}
+
+static void lattice_row_scalar(float *out, s32 x0, u32 i, u32 n, u32 base)
+{
+	for (; i < n; i++)
+		out[i] = lattice_value(NOISE_MAGIC_X * ((u32)x0 + i) + base);
+}
+
+static void ease_scalar(float *t, u32 i, u32 n)
+{
+	for (; i < n; i++)
+		t[i] = t[i] * t[i] * t[i] * (t[i] * (6.f * t[i] - 15.f) + 10.f);
+}
+
+static inline float lerp(float v0, float v1, float t)
+{
+	return v0 + (v1 - v0) * t;
+}
+
+static void lerp2_scalar(float *out,
+		const float *v00, const float *v10, const float *v01, const float *v11,
+		const float *tx, float ty, u32 i, u32 n)
+{
+	for (; i < n; i++) {
+		float u = lerp(v00[i], v10[i], tx[i]);
+		float v = lerp(v01[i], v11[i], tx[i]);
+		out[i] = lerp(u, v, ty);
+	}
+}
+
+static void lerp3_scalar(float *out, const float *const *v,
+		const float *tx, float ty, float tz, u32 i, u32 n)
+{
+	for (; i < n; i++) {
+		float u0 = lerp(v[0][i], v[1][i], tx[i]);
+		float v0 = lerp(v[2][i], v[3][i], tx[i]);
+		float u1 = lerp(v[4][i], v[5][i], tx[i]);
+		float v1 = lerp(v[6][i], v[7][i], tx[i]);
+		out[i] = lerp(lerp(u0, v0, ty), lerp(u1, v1, ty), tz);
+	}
+}
+
+static void accumulate_scalar(float *result, const float *gradient,
+		float g, size_t i, size_t n, bool absvalue)
+{
+	if (absvalue) {
+		for (; i < n; i++)
+			result[i] += g * fabs(gradient[i]);
+	} else {
+		for (; i < n; i++)
+			result[i] += g * gradient[i];
+	}
+}
+
+static void accumulate_map_scalar(float *result, const float *gradient,
+		float *gmap, const float *persistence_map, size_t i, size_t n, bool absvalue)
+{
+	if (absvalue) {
+		for (; i < n; i++) {
+			result[i] += gmap[i] * fabs(gradient[i]);
+			gmap[i] *= persistence_map[i];
+		}
+	} else {
+		for (; i < n; i++) {
+			result[i] += gmap[i] * gradient[i];
+			gmap[i] *= persistence_map[i];
+		}
+	}
+}
+
+#if NOISE_SIMD_X86
+
+/*
+	No "fma" in targets: contracting a * b + c would change rounding.
+*/
+
+#define SIMD_FN(name) name##_sse42
+#define SIMD_TARGET __attribute__((target("sse4.2")))
+#define SIMD_W 4
+typedef __m128 vf;
+typedef __m128i vi;
+#define VF_SET1(x) _mm_set1_ps(x)
+#define VF_LOAD(p) _mm_loadu_ps(p)
+#define VF_STORE(p, v) _mm_storeu_ps((p), (v))
+#define VF_ADD(a, b) _mm_add_ps((a), (b))
+#define VF_SUB(a, b) _mm_sub_ps((a), (b))
+#define VF_MUL(a, b) _mm_mul_ps((a), (b))
+#define VF_ABS(a) _mm_and_ps((a), _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)))
+#define VI_SET1(x) _mm_set1_epi32(x)
+#define VI_SEQ _mm_setr_epi32(0, 1, 2, 3)
+#define VI_ADD(a, b) _mm_add_epi32((a), (b))
+#define VI_MUL(a, b) _mm_mullo_epi32((a), (b))
+#define VI_SRL(a, n) _mm_srli_epi32((a), (n))
+#define VI_XOR(a, b) _mm_xor_si128((a), (b))
+#define VI_AND(a, b) _mm_and_si128((a), (b))
+#define VI_CVT(a) _mm_cvtepi32_ps(a)
+#define SIMD_END
+#include "noise_simd_impl.h"
+#undef SIMD_FN
+#undef SIMD_TARGET
+#undef SIMD_W
+#undef VF_SET1
+#undef VF_LOAD
+#undef VF_STORE
+#undef VF_ADD
+#undef VF_SUB
+#undef VF_MUL
+#undef VF_ABS
+#undef VI_SET1
+#undef VI_SEQ
+#undef VI_ADD
+#undef VI_MUL
+#undef VI_SRL
+#undef VI_XOR
+#undef VI_AND
+#undef VI_CVT
+#undef SIMD_END
+
+#define vf vf256
+#define vi vi256
+#define SIMD_FN(name) name##_avx2
+#define SIMD_TARGET __attribute__((target("avx2")))
+#define SIMD_W 8
+typedef __m256 vf;
+typedef __m256i vi;
+#define VF_SET1(x) _mm256_set1_ps(x)
+#define VF_LOAD(p) _mm256_loadu_ps(p)
+#define VF_STORE(p, v) _mm256_storeu_ps((p), (v))
+#define VF_ADD(a, b) _mm256_add_ps((a), (b))
+#define VF_SUB(a, b) _mm256_sub_ps((a), (b))
+#define VF_MUL(a, b) _mm256_mul_ps((a), (b))
+#define VF_ABS(a) _mm256_and_ps((a), _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)))
+#define VI_SET1(x) _mm256_set1_epi32(x)
+#define VI_SEQ _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+#define VI_ADD(a, b) _mm256_add_epi32((a), (b))
+#define VI_MUL(a, b) _mm256_mullo_epi32((a), (b))
+#define VI_SRL(a, n) _mm256_srli_epi32((a), (n))
+#define VI_XOR(a, b) _mm256_xor_si256((a), (b))
+#define VI_AND(a, b) _mm256_and_si256((a), (b))
+#define VI_CVT(a) _mm256_cvtepi32_ps(a)
+// gcc leaves upper halves dirty on tail calls, slowing down following sse code
+#define SIMD_END _mm256_zeroupper()
+#include "noise_simd_impl.h"
+#undef vf
+#undef vi
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+
+struct NoiseKernels {
+	void (*lattice_row)(float *, s32, u32, u32);
+	void (*ease)(float *, u32);
+	void (*lerp2)(float *, const float *, const float *, const float *, const float *,
+			const float *, float, u32);
+	void (*lerp3)(float *, const float *const *, const float *, float, float, u32);
+	void (*accumulate)(float *, const float *, float, size_t, bool);
+	void (*accumulate_map)(float *, const float *, float *, const float *, size_t, bool);
+};
+
+static void lattice_row_c(float *out, s32 x0, u32 n, u32 base)
+{
+	lattice_row_scalar(out, x0, 0, n, base);
+}
+
+static void ease_c(float *t, u32 n)
+{
+	ease_scalar(t, 0, n);
+}
+
+static void lerp2_c(float *out,
+		const float *v00, const float *v10, const float *v01, const float *v11,
+		const float *tx, float ty, u32 n)
+{
+	lerp2_scalar(out, v00, v10, v01, v11, tx, ty, 0, n);
+}
+
+static void lerp3_c(float *out, const float *const *v,
+		const float *tx, float ty, float tz, u32 n)
+{
+	lerp3_scalar(out, v, tx, ty, tz, 0, n);
+}
+
+static void accumulate_c(float *result, const float *gradient,
+		float g, size_t n, bool absvalue)
+{
+	accumulate_scalar(result, gradient, g, 0, n, absvalue);
+}
+
+static void accumulate_map_c(float *result, const float *gradient,
+		float *gmap, const float *persistence_map, size_t n, bool absvalue)
+{
+	accumulate_map_scalar(result, gradient, gmap, persistence_map, 0, n, absvalue);
+}
+
+static const NoiseKernels kernels_scalar = {
+	lattice_row_c, ease_c, lerp2_c, lerp3_c, accumulate_c, accumulate_map_c
+};
+
+#if NOISE_SIMD_X86
+static const NoiseKernels kernels_sse42 = {
+	lattice_row_sse42, ease_sse42, lerp2_sse42, lerp3_sse42,
+	accumulate_sse42, accumulate_map_sse42
+};
+
+static const NoiseKernels kernels_avx2 = {
+	lattice_row_avx2, ease_avx2, lerp2_avx2, lerp3_avx2,
+	accumulate_avx2, accumulate_map_avx2
+};
+#endif
+
+NoiseSimd noise_simd_supported()
+{
+#if NOISE_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return NOISE_SIMD_AVX2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return NOISE_SIMD_SSE42;
+#endif
+	return NOISE_SIMD_SCALAR;
+}
+
+static NoiseSimd g_noise_simd = noise_simd_supported();
+
+static const NoiseKernels *kernels_for(NoiseSimd level)
+{
+	switch (level) {
+#if NOISE_SIMD_X86
+	case NOISE_SIMD_AVX2:
+		return &kernels_avx2;
+	case NOISE_SIMD_SSE42:
+		return &kernels_sse42;
+#endif
+	default:
+		return &kernels_scalar;
+	}
+}
+
+static const NoiseKernels *g_noise_kernels = kernels_for(g_noise_simd);
+
+NoiseSimd noise_simd_get()
+{
+	return g_noise_simd;
+}
+
+NoiseSimd noise_simd_set(NoiseSimd level)
+{
+	NoiseSimd prev = g_noise_simd;
+	if (level > noise_simd_supported())
+		level = noise_simd_supported();
+	g_noise_simd = level;
+	g_noise_kernels = kernels_for(level);
+	return prev;
+}
+
+const char *noise_simd_name(NoiseSimd level)
+{
+	switch (level) {
+	case NOISE_SIMD_AVX2:
+		return "avx2";
+	case NOISE_SIMD_SSE42:
+		return "sse4.2";
+	default:
+		return "scalar";
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void noise_lattice_row(float *out, s32 x0, u32 n, u32 base)
+{
+	g_noise_kernels->lattice_row(out, x0, n, base);
+}
+
+void noise_ease(float *t, u32 n)
+{
+	g_noise_kernels->ease(t, n);
+}
+
+void noise_lerp2(float *out,
+		const float *v00, const float *v10, const float *v01, const float *v11,
+		const float *tx, float ty, u32 n)
+{
+	g_noise_kernels->lerp2(out, v00, v10, v01, v11, tx, ty, n);
+}
+
+void noise_lerp3(float *out, const float *const *v,
+		const float *tx, float ty, float tz, u32 n)
+{
+	g_noise_kernels->lerp3(out, v, tx, ty, tz, n);
+}
+
+void noise_accumulate(float *result, const float *gradient, float g,
+		size_t n, bool absvalue)
+{
+	g_noise_kernels->accumulate(result, gradient, g, n, absvalue);
+}
+
+void noise_accumulate_map(float *result, const float *gradient, float *gmap,
+		const float *persistence_map, size_t n, bool absvalue)
+{
+	g_noise_kernels->accumulate_map(result, gradient, gmap, persistence_map, n, absvalue);
+}
@@ -0,0 +1,78 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NOISE_SIMD_HEADER
+#define NOISE_SIMD_HEADER
+
+#include <stddef.h>
+#include "irrlichttypes.h"
+
+/*
+	Row kernels of Noise::gradientMap and perlinMap.
+	Instruction set is chosen once at runtime (AVX2, SSE4.2 or plain C++).
+	Every kernel does exactly the same float operations in the same order
+	as the scalar code, so results are bit-identical on all paths.
+*/
+
+#define NOISE_MAGIC_X    1619
+#define NOISE_MAGIC_Y    31337
+#define NOISE_MAGIC_Z    52591
+#define NOISE_MAGIC_SEED 1013
+
+enum NoiseSimd {
+	NOISE_SIMD_SCALAR,
+	NOISE_SIMD_SSE42,
+	NOISE_SIMD_AVX2,
+};
+
+// Best supported by cpu
+NoiseSimd noise_simd_supported();
+NoiseSimd noise_simd_get();
+// Not thread safe, for startup and tests. Returns previous level.
+NoiseSimd noise_simd_set(NoiseSimd level);
+const char *noise_simd_name(NoiseSimd level);
+
+// Part of lattice hash not depending on x
+inline u32 noise_lattice_base(s32 y, s32 z, s32 seed)
+{
+	return NOISE_MAGIC_Y * (u32)y + NOISE_MAGIC_Z * (u32)z + NOISE_MAGIC_SEED * (u32)seed;
+}
+
+// out[i] = noise3d(x0 + i, y, z, seed), base from noise_lattice_base
+void noise_lattice_row(float *out, s32 x0, u32 n, u32 base);
+
+// t[i] = easeCurve(t[i])
+void noise_ease(float *t, u32 n);
+
+// Bilinear interpolation with x varying per point
+void noise_lerp2(float *out,
+		const float *v00, const float *v10, const float *v01, const float *v11,
+		const float *tx, float ty, u32 n);
+
+// v: v000, v100, v010, v110, v001, v101, v011, v111
+void noise_lerp3(float *out, const float *const *v,
+		const float *tx, float ty, float tz, u32 n);
+
+// result[i] += g * gradient[i]
+void noise_accumulate(float *result, const float *gradient, float g,
+		size_t n, bool absvalue);
+
+// result[i] += gmap[i] * gradient[i]; gmap[i] *= persistence_map[i]
+void noise_accumulate_map(float *result, const float *gradient, float *gmap,
+		const float *persistence_map, size_t n, bool absvalue);
+
+#endif
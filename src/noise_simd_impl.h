@@ -0,0 +1,141 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+	Vector kernels, included by noise_simd.cpp once per instruction set.
+	Expects SIMD_FN(name), SIMD_TARGET, SIMD_W, vf/vi types, the VF_/VI_
+	operation macros and SIMD_END, run before tails shorter than a vector
+	go to the scalar kernels.
+*/
+
+SIMD_TARGET static void SIMD_FN(lattice_row)(float *out, s32 x0, u32 n, u32 base)
+{
+	const vi magic_x = VI_SET1(NOISE_MAGIC_X);
+	const vi vbase = VI_SET1(base);
+	const vi mask = VI_SET1(0x7fffffff);
+	const vi c1 = VI_SET1(60493);
+	const vi c2 = VI_SET1(19990303);
+	const vi c3 = VI_SET1(1376312589);
+	const vi step = VI_SET1(SIMD_W);
+	const vf scale = VF_SET1(1.f / 0x40000000);
+	const vf one = VF_SET1(1.f);
+
+	vi x = VI_ADD(VI_SET1(x0), VI_SEQ);
+	u32 i = 0;
+	for (; i + SIMD_W <= n; i += SIMD_W) {
+		vi h = VI_AND(VI_ADD(VI_MUL(magic_x, x), vbase), mask);
+		h = VI_XOR(VI_SRL(h, 13), h);
+		h = VI_AND(VI_ADD(VI_MUL(h, VI_ADD(VI_MUL(VI_MUL(h, h), c1), c2)), c3), mask);
+		VF_STORE(out + i, VF_SUB(one, VF_MUL(VI_CVT(h), scale)));
+		x = VI_ADD(x, step);
+	}
+	SIMD_END;
+	lattice_row_scalar(out, x0, i, n, base);
+}
+
+SIMD_TARGET static void SIMD_FN(ease)(float *t, u32 n)
+{
+	const vf c6 = VF_SET1(6.f);
+	const vf c15 = VF_SET1(15.f);
+	const vf c10 = VF_SET1(10.f);
+
+	u32 i = 0;
+	for (; i + SIMD_W <= n; i += SIMD_W) {
+		vf v = VF_LOAD(t + i);
+		vf poly = VF_ADD(VF_MUL(v, VF_SUB(VF_MUL(c6, v), c15)), c10);
+		VF_STORE(t + i, VF_MUL(VF_MUL(VF_MUL(v, v), v), poly));
+	}
+	SIMD_END;
+	ease_scalar(t, i, n);
+}
+
+#define SIMD_LERP(a, b, t) VF_ADD((a), VF_MUL(VF_SUB((b), (a)), (t)))
+
+SIMD_TARGET static void SIMD_FN(lerp2)(float *out,
+		const float *v00, const float *v10, const float *v01, const float *v11,
+		const float *tx, float ty, u32 n)
+{
+	const vf vty = VF_SET1(ty);
+
+	u32 i = 0;
+	for (; i + SIMD_W <= n; i += SIMD_W) {
+		vf t = VF_LOAD(tx + i);
+		vf u = SIMD_LERP(VF_LOAD(v00 + i), VF_LOAD(v10 + i), t);
+		vf v = SIMD_LERP(VF_LOAD(v01 + i), VF_LOAD(v11 + i), t);
+		VF_STORE(out + i, SIMD_LERP(u, v, vty));
+	}
+	SIMD_END;
+	lerp2_scalar(out, v00, v10, v01, v11, tx, ty, i, n);
+}
+
+SIMD_TARGET static void SIMD_FN(lerp3)(float *out, const float *const *v,
+		const float *tx, float ty, float tz, u32 n)
+{
+	const vf vty = VF_SET1(ty);
+	const vf vtz = VF_SET1(tz);
+	const float *v000 = v[0], *v100 = v[1], *v010 = v[2], *v110 = v[3];
+	const float *v001 = v[4], *v101 = v[5], *v011 = v[6], *v111 = v[7];
+
+	u32 i = 0;
+	for (; i + SIMD_W <= n; i += SIMD_W) {
+		vf t = VF_LOAD(tx + i);
+		vf u0 = SIMD_LERP(VF_LOAD(v000 + i), VF_LOAD(v100 + i), t);
+		vf v0 = SIMD_LERP(VF_LOAD(v010 + i), VF_LOAD(v110 + i), t);
+		vf u1 = SIMD_LERP(VF_LOAD(v001 + i), VF_LOAD(v101 + i), t);
+		vf v1 = SIMD_LERP(VF_LOAD(v011 + i), VF_LOAD(v111 + i), t);
+		VF_STORE(out + i, SIMD_LERP(SIMD_LERP(u0, v0, vty), SIMD_LERP(u1, v1, vty), vtz));
+	}
+	SIMD_END;
+	lerp3_scalar(out, v, tx, ty, tz, i, n);
+}
+
+#undef SIMD_LERP
+
+SIMD_TARGET static void SIMD_FN(accumulate)(float *result, const float *gradient,
+		float g, size_t n, bool absvalue)
+{
+	const vf vg = VF_SET1(g);
+
+	size_t i = 0;
+	if (absvalue) {
+		for (; i + SIMD_W <= n; i += SIMD_W)
+			VF_STORE(result + i, VF_ADD(VF_LOAD(result + i),
+					VF_MUL(vg, VF_ABS(VF_LOAD(gradient + i)))));
+	} else {
+		for (; i + SIMD_W <= n; i += SIMD_W)
+			VF_STORE(result + i, VF_ADD(VF_LOAD(result + i),
+					VF_MUL(vg, VF_LOAD(gradient + i))));
+	}
+	SIMD_END;
+	accumulate_scalar(result, gradient, g, i, n, absvalue);
+}
+
+SIMD_TARGET static void SIMD_FN(accumulate_map)(float *result, const float *gradient,
+		float *gmap, const float *persistence_map, size_t n, bool absvalue)
+{
+	size_t i = 0;
+	for (; i + SIMD_W <= n; i += SIMD_W) {
+		vf grad = VF_LOAD(gradient + i);
+		if (absvalue)
+			grad = VF_ABS(grad);
+		vf gm = VF_LOAD(gmap + i);
+		VF_STORE(result + i, VF_ADD(VF_LOAD(result + i), VF_MUL(gm, grad)));
+		VF_STORE(gmap + i, VF_MUL(gm, VF_LOAD(persistence_map + i)));
+	}
+	SIMD_END;
+	accumulate_map_scalar(result, gradient, gmap, persistence_map, i, n, absvalue);
+}
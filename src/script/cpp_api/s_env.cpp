@@ -158,9 +158,13 @@ void ScriptApiEnv::initializeEnvironment(ServerEnvironment *env)
 		bool simple_catch_up = true;
 		getboolfield(L, current_abm, "catch_up", simple_catch_up);
 
+		lua_getfield(L, current_abm, "action_batch");
+		bool batched = lua_isfunction(L, -1);
+		lua_pop(L, 1);
+
 		LuaABM *abm = new LuaABM(L, id, trigger_contents, required_neighbors,
 			neighbors_range,
-			trigger_interval, trigger_chance, simple_catch_up);
+			trigger_interval, trigger_chance, simple_catch_up, batched);
 
 		env->addActiveBlockModifier(abm);
 
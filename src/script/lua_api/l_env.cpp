@@ -102,6 +102,79 @@ void LuaABM::trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 	lua_pop(L, 1); // Pop error handler
 }
 
+// action_batch(positions, nodes, active_object_count, active_object_count_wider, activate)
+// positions = {x1, y1, z1, x2, y2, z2, ...}
+// nodes = {content1, param1_1, param2_1, content2, ...}
+void LuaABM::triggerBatch(ServerEnvironment *env, const std::vector<std::pair<v3POS, MapNode>> &nodes,
+		u32 active_object_count, u32 active_object_count_wider, bool activate)
+{
+	GameScripting *scriptIface = env->getScriptIface();
+	auto _script_lock = RecursiveMutexAutoLock(scriptIface->m_luastackmutex, std::try_to_lock);
+	if (!_script_lock.owns_lock()) {
+		return;
+	}
+	scriptIface->realityCheck();
+
+	lua_State *L = scriptIface->getStack();
+	sanity_check(lua_checkstack(L, 20));
+	StackUnroller stack_unroller(L);
+
+	int error_handler = PUSH_ERROR_HANDLER(L);
+
+	// Get registered_abms
+	lua_getglobal(L, "core");
+	lua_getfield(L, -1, "registered_abms");
+	luaL_checktype(L, -1, LUA_TTABLE);
+	lua_remove(L, -2); // Remove core
+
+	// Get registered_abms[m_id]
+	lua_pushnumber(L, m_id);
+	lua_gettable(L, -2);
+	if(lua_isnil(L, -1))
+		return;
+	lua_remove(L, -2); // Remove registered_abms
+
+	scriptIface->setOriginFromTable(-1);
+
+	// Call action_batch
+	luaL_checktype(L, -1, LUA_TTABLE);
+	lua_getfield(L, -1, "action_batch");
+	luaL_checktype(L, -1, LUA_TFUNCTION);
+	lua_remove(L, -2); // Remove registered_abms[m_id]
+
+	int i = 0;
+	lua_createtable(L, nodes.size() * 3, 0);
+	for (const auto & ir : nodes) {
+		lua_pushnumber(L, ir.first.X);
+		lua_rawseti(L, -2, ++i);
+		lua_pushnumber(L, ir.first.Y);
+		lua_rawseti(L, -2, ++i);
+		lua_pushnumber(L, ir.first.Z);
+		lua_rawseti(L, -2, ++i);
+	}
+
+	i = 0;
+	lua_createtable(L, nodes.size() * 3, 0);
+	for (const auto & ir : nodes) {
+		lua_pushnumber(L, ir.second.getContent());
+		lua_rawseti(L, -2, ++i);
+		lua_pushnumber(L, ir.second.getParam1());
+		lua_rawseti(L, -2, ++i);
+		lua_pushnumber(L, ir.second.getParam2());
+		lua_rawseti(L, -2, ++i);
+	}
+
+	lua_pushnumber(L, active_object_count);
+	lua_pushnumber(L, active_object_count_wider);
+	lua_pushboolean(L, activate);
+
+	int result = lua_pcall(L, 5, 0, error_handler);
+	if (result)
+		scriptIface->scriptError(result, "LuaABM::triggerBatch");
+
+	lua_pop(L, 1); // Pop error handler
+}
+
 void LuaLBM::trigger(ServerEnvironment *env, v3s16 p, MapNode n)
 {
 	GameScripting *scriptIface = env->getScriptIface();
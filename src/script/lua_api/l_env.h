@@ -210,19 +210,22 @@ class LuaABM : public ActiveBlockModifier {
 	float m_trigger_interval;
 	u32 m_trigger_chance;
 	bool m_simple_catch_up;
+	bool m_batched;
 public:
 	LuaABM(lua_State *L, int id,
 			const std::set<std::string> &trigger_contents,
 			const std::set<std::string> &required_neighbors,
 			int neighbors_range,
-			float trigger_interval, u32 trigger_chance, bool simple_catch_up):
+			float trigger_interval, u32 trigger_chance, bool simple_catch_up,
+			bool batched = false):
 		m_id(id),
 		m_trigger_contents(trigger_contents),
 		m_required_neighbors(required_neighbors),
 		m_neighbors_range(neighbors_range),
 		m_trigger_interval(trigger_interval),
 		m_trigger_chance(trigger_chance),
-		m_simple_catch_up(simple_catch_up)
+		m_simple_catch_up(simple_catch_up),
+		m_batched(batched)
 	{
 	}
 	virtual std::set<std::string> getTriggerContents()
@@ -251,6 +254,12 @@ class LuaABM : public ActiveBlockModifier {
 	}
 	virtual void trigger(ServerEnvironment *env, v3s16 p, MapNode n,
 			u32 active_object_count, u32 active_object_count_wider, MapNode neighbor, bool activate);
+	virtual bool getBatched()
+	{
+		return m_batched;
+	}
+	virtual void triggerBatch(ServerEnvironment *env, const std::vector<std::pair<v3POS, MapNode>> &nodes,
+			u32 active_object_count, u32 active_object_count_wider, bool activate);
 };
 
 class LuaLBM : public LoadingBlockModifierDef
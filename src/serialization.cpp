@@ -23,12 +23,22 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "serialization.h"
 
 #include "util/serialize.h"
+#include "util/string_stream.h"
 #if defined(_WIN32) && !defined(WIN32_NO_ZLIB_WINAPI)
 	#define ZLIB_WINAPI
 #endif
 #include "zlib.h"
+#include "config.h"
+#if USE_ZSTD
+#include <zstd.h>
+#endif
+#if USE_LZ4
+#include <lz4.h>
+#endif
 
+#include <algorithm>
 #include <sstream>
+#include <vector>
 
 /* report a zlib or i/o error */
 void zerr(int ret)
@@ -59,6 +69,11 @@ void zerr(int ret)
 }
 
 void compressZlib(SharedBuffer<u8> data, std::ostream &os, int level)
+{
+	compressZlib(*data, data.getSize(), os, level);
+}
+
+void compressZlib(const u8 *data, u32 size, std::ostream &os, int level)
 {
 	z_stream z;
 	const s32 bufsize = 16384;
@@ -75,8 +90,8 @@ void compressZlib(SharedBuffer<u8> data, std::ostream &os, int level)
 		throw SerializationError("compressZlib: deflateInit failed");
 	
 	// Point zlib to our input buffer
-	z.next_in = (Bytef*)&data[0];
-	z.avail_in = data.getSize();
+	z.next_in = (Bytef*)data;
+	z.avail_in = size;
 	// And get all output
 	for(;;)
 	{
@@ -103,8 +118,7 @@ void compressZlib(SharedBuffer<u8> data, std::ostream &os, int level)
 
 void compressZlib(const std::string &data, std::ostream &os, int level)
 {
-	SharedBuffer<u8> databuf((u8*)data.c_str(), data.size());
-	compressZlib(databuf, os, level);
+	compressZlib((const u8*)data.c_str(), data.size(), os, level);
 }
 
 void decompressZlib(std::istream &is, std::ostream &os)
@@ -289,3 +303,172 @@ void decompressZlib(const std::string &is, std::string &os) {
 	os = oss.str();
 }
 
+
+/*
+	Block compression codecs
+*/
+
+#if USE_ZSTD
+// Set once on server start, read only after
+static ZSTD_CDict *zstd_cdict = nullptr;
+static ZSTD_DDict *zstd_ddict = nullptr;
+#endif
+
+u32 blockCodecsSupported()
+{
+	u32 mask = 1 << BLOCK_CODEC_ZLIB;
+#if USE_ZSTD
+	mask |= 1 << BLOCK_CODEC_ZSTD;
+#endif
+#if USE_LZ4
+	mask |= 1 << BLOCK_CODEC_LZ4;
+#endif
+	return mask;
+}
+
+bool blockCodecSupported(u8 codec)
+{
+	return codec < BLOCK_CODEC_COUNT && (blockCodecsSupported() & (1 << codec));
+}
+
+u8 blockCodecFromString(const std::string &name)
+{
+	u8 codec = BLOCK_CODEC_ZLIB;
+	if (name == "zstd")
+		codec = BLOCK_CODEC_ZSTD;
+	else if (name == "lz4")
+		codec = BLOCK_CODEC_LZ4;
+	return blockCodecSupported(codec) ? codec : BLOCK_CODEC_ZLIB;
+}
+
+const char *blockCodecName(u8 codec)
+{
+	switch (codec) {
+	case BLOCK_CODEC_ZLIB:
+		return "zlib";
+	case BLOCK_CODEC_ZSTD:
+		return "zstd";
+	case BLOCK_CODEC_LZ4:
+		return "lz4";
+	}
+	return "unknown";
+}
+
+bool setBlockCodecDictionary(const std::string &dictionary)
+{
+#if USE_ZSTD
+	if (zstd_cdict || dictionary.empty())
+		return false;
+	zstd_cdict = ZSTD_createCDict(dictionary.data(), dictionary.size(), 3);
+	zstd_ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+	return zstd_cdict && zstd_ddict;
+#else
+	return false;
+#endif
+}
+
+void compressCodec(const u8 *data, u32 size, std::ostream &os, u8 codec, bool dictionary)
+{
+	if (codec == BLOCK_CODEC_ZLIB || !blockCodecSupported(codec)) {
+		compressZlib(data, size, os);
+		return;
+	}
+
+	SCRATCH_BUFFER(std::vector<char>, buf);
+	size_t compressed = 0;
+#if USE_ZSTD
+	if (codec == BLOCK_CODEC_ZSTD) {
+		buf.resize(ZSTD_compressBound(size));
+		if (dictionary && zstd_cdict) {
+			ZSTD_CCtx *ctx = ZSTD_createCCtx();
+			compressed = ZSTD_compress_usingCDict(ctx, &buf[0], buf.size(), data, size, zstd_cdict);
+			ZSTD_freeCCtx(ctx);
+		} else {
+			compressed = ZSTD_compress(&buf[0], buf.size(), data, size, 3);
+		}
+		if (ZSTD_isError(compressed))
+			throw SerializationError(std::string("compressCodec: zstd: ") + ZSTD_getErrorName(compressed));
+	}
+#endif
+#if USE_LZ4
+	if (codec == BLOCK_CODEC_LZ4) {
+		buf.resize(LZ4_compressBound(size));
+		int ret = LZ4_compress_default((const char *)data, &buf[0], size, buf.size());
+		if (ret <= 0)
+			throw SerializationError("compressCodec: lz4 failed");
+		compressed = ret;
+	}
+#endif
+	writeU32(os, size);
+	writeU32(os, compressed);
+	os.write(buf.data(), compressed);
+}
+
+void compressCodec(const std::string &data, std::ostream &os, u8 codec, bool dictionary)
+{
+	compressCodec((const u8 *)data.c_str(), data.size(), os, codec, dictionary);
+}
+
+void decompressCodec(std::istream &is, std::ostream &os, u8 codec, u32 max_size)
+{
+	if (codec == BLOCK_CODEC_ZLIB) {
+		decompressZlib(is, os);
+		return;
+	}
+	if (!blockCodecSupported(codec))
+		throw SerializationError(std::string("decompressCodec: codec not supported: ") + blockCodecName(codec));
+
+	u32 size = readU32(is);
+	u32 compressed = readU32(is);
+	if (size > max_size)
+		throw SerializationError("decompressCodec: size too big");
+	size_t compressed_max = 0;
+#if USE_ZSTD
+	if (codec == BLOCK_CODEC_ZSTD)
+		compressed_max = ZSTD_compressBound(size);
+#endif
+#if USE_LZ4
+	if (codec == BLOCK_CODEC_LZ4)
+		compressed_max = LZ4_compressBound(size);
+#endif
+	if (compressed > compressed_max)
+		throw SerializationError("decompressCodec: compressed size too big");
+
+	// Grow with the data actually read, not with the header
+	const u32 chunk = 64 * 1024;
+	std::vector<char> in;
+	for (u32 done = 0; done < compressed; ) {
+		u32 n = std::min(chunk, compressed - done);
+		in.resize(done + n);
+		is.read(&in[done], n);
+		if (is.fail())
+			throw SerializationError("decompressCodec: stream ended");
+		done += n;
+	}
+	std::vector<char> out(size);
+
+#if USE_ZSTD
+	if (codec == BLOCK_CODEC_ZSTD) {
+		size_t ret;
+		if (ZSTD_getDictID_fromFrame(in.data(), compressed)) {
+			if (!zstd_ddict)
+				throw SerializationError("decompressCodec: zstd dictionary not loaded");
+			ZSTD_DCtx *ctx = ZSTD_createDCtx();
+			ret = ZSTD_decompress_usingDDict(ctx, out.data(), size, in.data(), compressed, zstd_ddict);
+			ZSTD_freeDCtx(ctx);
+		} else {
+			ret = ZSTD_decompress(out.data(), size, in.data(), compressed);
+		}
+		if (ZSTD_isError(ret) || ret != size)
+			throw SerializationError("decompressCodec: zstd failed");
+	}
+#endif
+#if USE_LZ4
+	if (codec == BLOCK_CODEC_LZ4) {
+		int ret = LZ4_decompress_safe(in.data(), out.data(), compressed, size);
+		if (ret < 0 || (u32)ret != size)
+			throw SerializationError("decompressCodec: lz4 failed");
+	}
+#endif
+	os.write(out.data(), size);
+}
@@ -26,6 +26,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "irrlichttypes.h"
 #include "exceptions.h"
 #include <iostream>
+#include <string>
 #include "util/pointer.h"
 
 /*
@@ -65,13 +66,20 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 	24: 16-bit node ids and node timers (never released as stable)
 	25: Improved node timer format
 	26: Never written; read the same as 25
+	27: Compression codec byte after flags (BlockCodec)
+	28: Node data as palette and packed indices (NodePalette)
 */
 // This represents an uninitialized or invalid format
 #define SER_FMT_VER_INVALID 255
 // Highest supported serialization version
-#define SER_FMT_VER_HIGHEST_READ 26
+#define SER_FMT_VER_HIGHEST_READ 28
 // Saved on disk version
 #define SER_FMT_VER_HIGHEST_WRITE 25
+// First version with block compression codec byte,
+// written to disk only when map_compression is not zlib
+#define SER_FMT_VER_CODEC 27
+// First version with palette node data, same condition for disk
+#define SER_FMT_VER_PALETTE 28
 // Lowest supported serialization version
 #define SER_FMT_VER_LOWEST_READ 0
 // Lowest serialization version for writing
@@ -89,6 +97,7 @@ inline bool ser_ver_supported(s32 v) {
 
 void compressZlib(SharedBuffer<u8> data, std::ostream &os, int level = 2);
 void compressZlib(const std::string &data, std::ostream &os, int level = 2);
+void compressZlib(const u8 *data, u32 size, std::ostream &os, int level = 2);
 void decompressZlib(std::istream &is, std::ostream &os);
 
 // These choose between zlib and a self-made one according to version
@@ -100,5 +109,33 @@ void decompress(std::istream &is, std::ostream &os, u8 version);
 void compressZlib(const std::string &data, std::string &os, int level = 2);
 void decompressZlib(const std::string &is, std::string &os);
 
+/*
+	Block compression codecs.
+	zlib streams are self terminated, zstd and lz4 are written as
+	u32 raw size, u32 compressed size, compressed data.
+*/
+enum BlockCodec {
+	BLOCK_CODEC_ZLIB = 0,
+	BLOCK_CODEC_ZSTD = 1,
+	BLOCK_CODEC_LZ4 = 2,
+	BLOCK_CODEC_COUNT
+};
+
+// Bit (1 << codec) set for every codec compiled in
+u32 blockCodecsSupported();
+bool blockCodecSupported(u8 codec);
+// "zlib", "zstd", "lz4"; unknown or not compiled in gives zlib
+u8 blockCodecFromString(const std::string &name);
+const char *blockCodecName(u8 codec);
+// Load trained zstd dictionary, used for node data on disk
+bool setBlockCodecDictionary(const std::string &dictionary);
+
+// dictionary: use zstd dictionary if loaded
+void compressCodec(const u8 *data, u32 size, std::ostream &os, u8 codec, bool dictionary = false);
+void compressCodec(const std::string &data, std::ostream &os, u8 codec, bool dictionary = false);
+// max_size: largest decompressed size the caller accepts, checked before
+// anything is allocated. Not applied to zlib, which streams.
+void decompressCodec(std::istream &is, std::ostream &os, u8 codec, u32 max_size);
+
 #endif
 
@@ -22,6 +22,8 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "server.h"
 #include <iostream>
+#include <fstream>
+#include <iterator>
 #include <queue>
 #include <algorithm>
 #include "network/networkprotocol.h"
@@ -65,6 +67,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "util/mathconstants.h"
 #include "rollback.h"
 #include "util/serialize.h"
+#include "util/string_stream.h"
 #include "util/thread.h"
 #include "defaultsettings.h"
 //#include "stat.h"
@@ -258,6 +261,13 @@ Server::Server(
 		m_liquid = new LiquidThread(this);
 		m_envthread = new EnvThread(this);
 		m_abmthread = new AbmThread(this);
+
+#if !MINETEST_PROTO && !USE_SCTP
+		u8 receive_threads = rangelim(g_settings->getS32("receive_threads"), 1, 64);
+		m_con.setReceiveQueues(receive_threads);
+		for (u8 queue = 1; queue < receive_threads; ++queue)
+			m_receive_threads.push_back(new ReceiveThread(this, queue));
+#endif
 	}
 
 	// Create world if it doesn't exist
@@ -268,6 +278,17 @@ Server::Server(
 	std::string ban_path = m_path_world + DIR_DELIM "ipban.txt";
 	m_banmanager = new BanManager(ban_path);
 
+	// Trained zstd dictionary for map_compression = zstd
+	std::string dictionary_name = g_settings->get("map_compression_dictionary");
+	if (!dictionary_name.empty()) {
+		std::ifstream is((m_path_world + DIR_DELIM + dictionary_name).c_str(), std::ios_base::binary);
+		std::string dictionary((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+		if (!setBlockCodecDictionary(dictionary))
+			errorstream << "Server: cannot load map_compression_dictionary " << dictionary_name << std::endl;
+	}
+
+	m_block_send_cache.setLimit((size_t)std::max(0, g_settings->getS32("block_send_cache_size")) * 1024 * 1024);
+
 	ModConfiguration modconf(m_path_world);
 	m_mods = modconf.getMods();
 	std::vector<ModSpec> unsatisfied_mods = modconf.getUnsatisfiedMods();
@@ -466,6 +487,8 @@ Server::~Server()
 	delete m_map_thread;
 	delete m_abmthread;
 	delete m_envthread;
+	for (auto thread : m_receive_threads)
+		delete thread;
 
 	// stop all emerge threads before deleting players that may have
 	// requested blocks to be emerged
@@ -519,6 +542,8 @@ void Server::start(Address bind_addr)
 		m_envthread->restart();
 	if(m_abmthread)
 		m_abmthread->restart();
+	for (auto thread : m_receive_threads)
+		thread->restart();
 
 	actionstream << "\033[1mfree\033[1;33mminer \033[1;36mv" << g_version_hash << "\033[0m \t"
 #if ENABLE_THREADS
@@ -573,6 +598,8 @@ void Server::stop()
 		m_abmthread->stop();
 	if(m_envthread)
 		m_envthread->stop();
+	for (auto thread : m_receive_threads)
+		thread->stop();
 
 	//m_emergethread.setRun(false);
 	m_thread->join();
@@ -587,6 +614,8 @@ void Server::stop()
 		m_abmthread->join();
 	if(m_envthread)
 		m_envthread->join();
+	for (auto thread : m_receive_threads)
+		thread->join();
 
 	infostream<<"Server: Threads stopped"<<std::endl;
 }
@@ -621,6 +650,9 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 
 	TimeTaker timer_step("Server step");
 	g_profiler->add("Server::AsyncRunStep (num)", 1);
+
+	// Packet handlers of the receive threads wait for the step
+	MutexAutoLock process_data_lock(m_process_data_mutex);
 /*
 	float dtime;
 	{
@@ -804,6 +836,16 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 		if (player_radius == 0 && is_transfer_limited)
 			player_radius = radius;
 
+		// Compact movement updates if every client reads them
+		bool movement_deltas = true;
+#if MINETEST_PROTO
+		movement_deltas = false;
+#endif
+		for (auto & client : clients)
+			if (client->net_proto_version_fm < 4)
+				movement_deltas = false;
+		m_env->setMovementDeltas(movement_deltas);
+
 		for(auto & client : clients) {
 
 			// If definitions and textures have not been sent, don't
@@ -824,9 +866,7 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 			if (playersao == NULL)
 				continue;
 
-			s16 my_radius = MYMIN(radius, playersao->getWantedRange() * MAP_BLOCKSIZE);
-			if (my_radius <= 0) my_radius = radius;
-			my_radius *= 1.5;
+			s16 my_radius = getActiveObjectSendRadius(playersao);
 			//infostream << "Server: Active Radius " << my_radius << std::endl;
 
 			std::queue<u16> removed_objects;
@@ -898,8 +938,10 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 				// Add to known objects
 				client->m_known_objects.set(id, true);
 
-				if(obj)
+				if(obj) {
 					obj->m_known_by_count++;
+					obj->m_known_by_added++;
+				}
 
 				added_objects.pop();
 			}
@@ -960,6 +1002,7 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 				client->m_known_objects.set(id, true);
 
 				obj->m_known_by_count++;
+				obj->m_known_by_added++;
 
 			}
 
@@ -982,9 +1025,29 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 		//MutexAutoLock envlock(m_env_mutex);
 		ScopeProfiler sp(g_profiler, "Server: sending object messages");
 
-		// Key = object id
-		// Value = data sent by object
-		UNORDERED_MAP<u16, std::vector<ActiveObjectMessage>* > buffered_messages;
+		/*
+			Messages of each object encoded once, objects bucketed by
+			their cell in the active object grid. Players, and objects
+			not in the grid, go to every client that knows them.
+			The cells around a client are only a prefilter: a client may
+			still know an object outside them, it must get the reliable
+			messages of it anyway.
+		*/
+		struct ObjectMessages {
+			u16 id;
+			std::string reliable, unreliable;
+			u32 reliable_count, unreliable_count;
+			bool in_cell;
+			// Last client index that got it from the cell walk
+			u32 visited;
+		};
+		std::vector<ObjectMessages> objects;
+		std::unordered_map<u16, u32> object_index;
+		unordered_map_v3POS<std::vector<u32>> cells;
+		std::vector<u32> everywhere;
+		// In cells and with reliable messages
+		std::vector<u32> reliable_in_cells;
+		ActiveObjectGrid &grid = m_env->getActiveObjectGrid();
 
 		// Get active object messages from environment
 		for(;;) {
@@ -992,109 +1055,129 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 			if (aom.id == 0)
 				break;
 
-			std::vector<ActiveObjectMessage>* message_list = NULL;
-			UNORDERED_MAP<u16, std::vector<ActiveObjectMessage>* >::iterator n;
-			n = buffered_messages.find(aom.id);
-			if (n == buffered_messages.end()) {
-				message_list = new std::vector<ActiveObjectMessage>;
-				buffered_messages[aom.id] = message_list;
-			}
-			else {
-				message_list = n->second;
+			auto n = object_index.find(aom.id);
+			u32 index;
+			if (n == object_index.end()) {
+				index = objects.size();
+				object_index[aom.id] = index;
+				objects.push_back(ObjectMessages{aom.id, "", "", 0, 0, false, 0});
+				v3POS cell;
+				bool player;
+				if (grid.getIdCell(aom.id, cell, player) && !player) {
+					cells[cell].push_back(index);
+					objects.back().in_cell = true;
+				} else {
+					everywhere.push_back(index);
+				}
+			} else {
+				index = n->second;
 			}
-			message_list->push_back(aom);
+			ObjectMessages &object = objects[index];
+			if (aom.reliable && !object.reliable_count && object.in_cell)
+				reliable_in_cells.push_back(index);
+			std::string &data = aom.reliable ? object.reliable : object.unreliable;
+			++(aom.reliable ? object.reliable_count : object.unreliable_count);
+#if MINETEST_PROTO
+			// Object id and data
+			char buf[2];
+			writeU16((u8*)&buf[0], aom.id);
+			data.append(buf, 2);
+			data += serializeString(aom.datastring);
+#else
+			// Same as an ActiveObjectMessages item
+			string_ostream os(data);
+			msgpack::packer<string_ostream> pk(&os);
+			pk.pack(std::make_pair((unsigned int)aom.id, aom.datastring));
+#endif
 		}
 
 		auto clients = m_clients.getClientList();
+		u32 client_visit = 0;
 		// Route data to every client
 		for (auto & client : clients) {
+			if (objects.empty())
+				break;
+			++client_visit;
 
-#if MINETEST_PROTO
 			std::string reliable_data;
 			std::string unreliable_data;
-			// Go through all objects in message buffer
-			for (UNORDERED_MAP<u16, std::vector<ActiveObjectMessage>* >::iterator
-					j = buffered_messages.begin();
-					j != buffered_messages.end(); ++j) {
+			u32 reliable_count = 0, unreliable_count = 0;
+			auto add_object = [&](u32 index) {
+				ObjectMessages &object = objects[index];
+				object.visited = client_visit;
 				// If object is not known by client, skip it
-				u16 id = j->first;
-				if (client->m_known_objects.find(id) == client->m_known_objects.end())
-					continue;
+				if (client->m_known_objects.find(object.id) == client->m_known_objects.end())
+					return;
+				reliable_data += object.reliable;
+				reliable_count += object.reliable_count;
+				unreliable_data += object.unreliable;
+				unreliable_count += object.unreliable_count;
+			};
 
-				// Get message list of object
-				std::vector<ActiveObjectMessage>* list = j->second;
-				// Go through every message
-				for (std::vector<ActiveObjectMessage>::iterator
-						k = list->begin(); k != list->end(); ++k) {
-					// Compose the full new data with header
-					ActiveObjectMessage aom = *k;
-					std::string new_data;
-					// Add object id
-					char buf[2];
-					writeU16((u8*)&buf[0], aom.id);
-					new_data.append(buf, 2);
-					// Add data
-					new_data += serializeString(aom.datastring);
-					// Add data to buffer
-					if(aom.reliable)
-						reliable_data += new_data;
-					else
-						unreliable_data += new_data;
+			for (u32 index : everywhere)
+				add_object(index);
+
+			// Cells around the player; a client without player knows
+			// no objects but the ones already handled
+			PlayerSAO *playersao = getPlayerSAO(client->peer_id);
+			if (playersao && !cells.empty()) {
+				v3f pos = playersao->getBasePosition();
+				// A block more than getRemovedActiveObjects allows
+				f32 radius = (getActiveObjectSendRadius(playersao) + MAP_BLOCKSIZE) * BS;
+				v3f r(radius, radius, radius);
+				v3POS from = ActiveObjectGrid::getCell(pos - r);
+				v3POS to = ActiveObjectGrid::getCell(pos + r);
+				u64 range_cells = (u64)(to.X - from.X + 1) * (to.Y - from.Y + 1) * (to.Z - from.Z + 1);
+				if (range_cells > cells.size()) {
+					for (const auto &cell : cells)
+						if (ActiveObjectGrid::isCellNear(cell.first, pos, radius))
+							for (u32 index : cell.second)
+								add_object(index);
+				} else {
+					v3POS p;
+					for (p.Z = from.Z; p.Z <= to.Z; ++p.Z)
+					for (p.Y = from.Y; p.Y <= to.Y; ++p.Y)
+					for (p.X = from.X; p.X <= to.X; ++p.X) {
+						auto cell = cells.find(p);
+						if (cell != cells.end() && ActiveObjectGrid::isCellNear(p, pos, radius))
+							for (u32 index : cell->second)
+								add_object(index);
+					}
 				}
 			}
+
+			// Known objects outside the walked cells
+			for (u32 index : reliable_in_cells) {
+				const ObjectMessages &object = objects[index];
+				if (object.visited == client_visit ||
+						client->m_known_objects.find(object.id) == client->m_known_objects.end())
+					continue;
+				reliable_data += object.reliable;
+				reliable_count += object.reliable_count;
+			}
+
 			/*
 				reliable_data and unreliable_data are now ready.
 				Send them.
 			*/
-			if(reliable_data.size() > 0) {
+#if MINETEST_PROTO
+			if(reliable_count > 0) {
 				SendActiveObjectMessages(client->peer_id, reliable_data);
 			}
 
-			if(unreliable_data.size() > 0) {
+			if(unreliable_count > 0) {
 				SendActiveObjectMessages(client->peer_id, unreliable_data, false);
 			}
-
 #else
-			ActiveObjectMessages reliable_data;
-			ActiveObjectMessages unreliable_data;
-			// Go through all objects in message buffer
-			for(auto
-					j = buffered_messages.begin();
-					j != buffered_messages.end(); ++j) {
-				// If object is not known by client, skip it
-				u16 id = j->first;
-				if (client->m_known_objects.find(id) == client->m_known_objects.end())
-					continue;
-				// Get message list of object
-				std::vector<ActiveObjectMessage>* list = j->second;
-				// Go through every message
-				for(auto
-						k = list->begin(); k != list->end(); ++k) {
-					// Add data to buffer
-					if(k->reliable)
-						reliable_data.push_back(make_pair(k->id, k->datastring));
-					else
-						unreliable_data.push_back(make_pair(k->id, k->datastring));
-				}
+			if(reliable_count > 0) {
+				SendActiveObjectMessagesPacked(client->peer_id, reliable_data, reliable_count);
 			}
-			/*
-				reliable_data and unreliable_data are now ready.
-				Send them.
-			*/
-			if(reliable_data.size() > 0) {
-				SendActiveObjectMessages(client->peer_id, reliable_data);
-			}
-			if(unreliable_data.size() > 0) {
-				SendActiveObjectMessages(client->peer_id, unreliable_data, false);
+			if(unreliable_count > 0) {
+				SendActiveObjectMessagesPacked(client->peer_id, unreliable_data,
+						unreliable_count, false);
 			}
 #endif
 		}
-		// Clear buffered_messages
-		for (auto
-				i = buffered_messages.begin();
-				i != buffered_messages.end(); ++i) {
-			delete i->second;
-		}
 	}
 
 	/*
@@ -1313,7 +1396,7 @@ int Server::save(float dtime, float dedicated_server_step, bool breakable) {
 	return ret;
 }
 
-u16 Server::Receive(int ms)
+u16 Server::Receive(int ms, u8 queue)
 {
 	DSTACK(FUNCTION_NAME);
 	SharedBuffer<u8> data;
@@ -1323,7 +1406,11 @@ u16 Server::Receive(int ms)
 		TimeTaker timer_step("Server recieve one packet");
 
 		NetworkPacket pkt;
+#if !MINETEST_PROTO && !USE_SCTP
+		auto size = m_con.Receive(&pkt, ms, queue);
+#else
 		auto size = m_con.Receive(&pkt, ms);
+#endif
 		peer_id = pkt.getPeerId();
 		if (size) {
 			ProcessData(&pkt);
@@ -1442,6 +1529,18 @@ PlayerSAO* Server::StageTwoClientInit(u16 peer_id)
 	return playersao;
 }
 
+bool Server::isPeerLocalCommand(u16 command)
+{
+	switch (command) {
+	case TOSERVER_GOTBLOCKS:
+	case TOSERVER_PLAYERPOS:
+	case TOSERVER_DELETEDBLOCKS:
+	case TOSERVER_DRAWCONTROL:
+		return true;
+	}
+	return false;
+}
+
 inline void Server::handleCommand(NetworkPacket* pkt)
 {
 	const ToServerCommandHandler& opHandle = toServerCommandTable[pkt->getCommand()];
@@ -1499,6 +1598,11 @@ void Server::ProcessData(NetworkPacket *pkt)
 			return;
 		}
 
+		// Packets of different peers are handled by several threads
+		MutexAutoLock process_data_lock(m_process_data_mutex, std::defer_lock);
+		if (!isPeerLocalCommand(command))
+			process_data_lock.lock();
+
 		if (overload) {
 			if (command == TOSERVER_PLAYERPOS || command == TOSERVER_DRAWCONTROL)
 				return;
@@ -2478,15 +2582,33 @@ void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto
 		Create a packet with the block in the right format
 	*/
 
-	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver, false);
-	block->serializeNetworkSpecific(os, net_proto_version);
-	std::string s = os.str();
+	// Same payload for every client of a protocol version
+	BlockSendCacheKey key;
+	key.pos = p;
+	key.modified_counter = block->m_modified_counter;
+	key.net_proto_version_fm = net_proto_version;
+	key.version = ver;
+	key.codec = BLOCK_CODEC_ZLIB;
+	key.heat = block->heat + block->heat_add;
+	key.humidity = block->humidity + block->humidity_add;
+
+	auto data = m_block_send_cache.get(key);
+	if (data) {
+		g_profiler->add("Server: block send cache hit", 1);
+	} else {
+		g_profiler->add("Server: block send cache miss", 1);
+		data = std::make_shared<std::string>();
+		block->serializeNetwork(*data, ver, false, BLOCK_CODEC_ZLIB);
+		string_ostream os(*data);
+		block->serializeNetworkSpecific(os, net_proto_version);
+		if (m_block_send_cache.getLimit())
+			m_block_send_cache.set(key, data);
+	}
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + 2 + s.size(), peer_id);
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + 2 + data->size(), peer_id);
 
 	pkt << p;
-	pkt.putRawString(s.c_str(), s.size());
+	pkt.putRawString(data->c_str(), data->size());
 	Send(&pkt);
 }
 
@@ -2565,6 +2687,8 @@ int Server::SendBlocks(float dtime)
 		client->SentBlock(q.pos, m_uptime.get() + m_env->m_game_time_start);
 		++total;
 	}
+	if (!queue.empty())
+		g_profiler->avg("Server: block send cache KiB", m_block_send_cache.bytes() / 1024);
 	return total;
 }
 
@@ -3033,6 +3157,8 @@ void Server::DeleteClient(u16 peer_id, ClientDeletionReason reason)
 				++i;
 		}
 
+		m_emerge->removeView(peer_id);
+
 		RemotePlayer *player = m_env->getPlayer(peer_id);
 
 		/* Run scripts and remove from environment */
@@ -3252,6 +3378,17 @@ PlayerSAO* Server::getPlayerSAO(u16 peer_id)
 	return player->getPlayerSAO();
 }
 
+s16 Server::getActiveObjectSendRadius(PlayerSAO *playersao)
+{
+	// Radius inside which objects are active
+	static const s16 radius =
+		g_settings->getS16("active_object_send_range_blocks") * MAP_BLOCKSIZE;
+
+	s16 my_radius = MYMIN(radius, playersao->getWantedRange() * MAP_BLOCKSIZE);
+	if (my_radius <= 0) my_radius = radius;
+	return my_radius * 1.5;
+}
+
 std::string Server::getStatusString()
 {
 	std::ostringstream os(std::ios_base::binary);
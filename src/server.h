@@ -46,6 +46,7 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include <vector>
 #include "stat.h"
 #include "network/fm_lan.h"
+#include "network/fm_blocksendcache.h"
 
 class IWritableItemDefManager;
 class IWritableNodeDefManager;
@@ -68,6 +69,7 @@ class SendBlocksThread;
 class LiquidThread;
 class EnvThread;
 class AbmThread;
+class ReceiveThread;
 
 enum ClientDeletionReason {
 	CDR_LEAVE,
@@ -171,7 +173,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void AsyncRunStep(float dtime, bool initial_step=false);
 	int AsyncRunMapStep(float dtime, float dedicated_server_step = 0.1, bool async=true);
 	int save(float dtime, float dedicated_server_step = 0.1, bool breakable = false);
-	u16 Receive(int ms = 10);
+	// Packets of the connection receive queue, see ReceiveThread
+	u16 Receive(int ms = 10, u8 queue = 0);
 	PlayerSAO* StageTwoClientInit(u16 peer_id);
 
 	/*
@@ -207,6 +210,10 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void handleCommand_SrpBytesM(NetworkPacket* pkt);
 
 	void ProcessData(NetworkPacket *pkt);
+	// Handler touches only the state of the peer and its player, may run
+	// without m_process_data_mutex; it takes the lock itself only where
+	// it reaches further (PLAYERPOS cheat callbacks, periodic object step)
+	static bool isPeerLocalCommand(u16 command);
 
 	void handleCommand_Drawcontrol(NetworkPacket* pkt);
 
@@ -489,6 +496,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 //mt compat:
 	void SendActiveObjectMessages(u16 peer_id, const std::string &datas, bool reliable = true);
 	void SendActiveObjectMessages(u16 peer_id, const ActiveObjectMessages &datas, bool reliable = true);
+	// count messages already packed as ActiveObjectMessages items
+	void SendActiveObjectMessagesPacked(u16 peer_id, const std::string &packed,
+			u32 count, bool reliable = true);
 
 	/*
 		Something random
@@ -523,6 +533,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// When called, environment mutex should be locked
 	std::string getPlayerName(u16 peer_id);
 	PlayerSAO* getPlayerSAO(u16 peer_id);
+	// Radius in nodes inside which the player gets active objects
+	s16 getActiveObjectSendRadius(PlayerSAO *playersao);
 
 	/*
 		Get a player from memory or creates one.
@@ -625,6 +637,10 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	LiquidThread *m_liquid;
 	EnvThread *m_envthread;
 	AbmThread *m_abmthread;
+	// Handle the packets of other peers next to ServerThread
+	std::vector<ReceiveThread *> m_receive_threads;
+	// Held by AsyncRunStep and by packet handlers but the peer local ones
+	Mutex m_process_data_mutex;
 
 	/*
 		Time related stuff
@@ -643,6 +659,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	ClientInterface m_clients;
 
 private:
+	// Packed TOCLIENT_BLOCKDATA shared by all clients
+	BlockSendCache m_block_send_cache;
+
 	/*
 		Peer change queue.
 		Queues stuff from peerAdded() and deletingPeer() to
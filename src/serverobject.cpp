@@ -25,27 +25,93 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 #include "inventory.h"
 #include "constants.h" // BS
 #include "environment.h"
+#include "genericobject.h"
+#include "porting.h"
+
+// Resend the absolute position at least this often, ms
+#define MOVEMENT_KEYFRAME_INTERVAL 5000
 
 Queue<ActiveObjectMessage> dummy_queue;
 
+void ServerActiveObject::setBasePosition(v3f pos)
+{
+	std::lock_guard<Mutex> lock(m_base_position_mutex);
+	bool cell_changed = ActiveObjectGrid::getCell(pos) !=
+			ActiveObjectGrid::getCell(m_base_position);
+	m_base_position = pos;
+	// Under the position lock, grid moves keep the order of the positions
+	if (cell_changed && m_env && m_id)
+		m_env->getActiveObjectGrid().move(m_id, pos);
+}
+
 ServerActiveObject::ServerActiveObject(ServerEnvironment *env, v3f pos):
 	ActiveObject(0),
 	m_static_block(1337,1337,1337),
 	m_messages_out(env ? env->m_active_object_messages : dummy_queue),
 	m_uptime_last(0),
+	m_movement_send_interval(1),
 	m_env(env),
-	m_base_position(pos)
+	m_base_position(pos),
+	m_movement_keyframe_sent(false),
+	m_movement_keyframe_seq(0),
+	m_movement_keyframe_time(0),
+	m_movement_known_by_added(0)
 {
 	m_pending_deactivation = false;
 	m_removed = false;
 	m_static_exists = false;
 	m_known_by_count = 0;
+	m_known_by_added = 0;
 }
 
 ServerActiveObject::~ServerActiveObject()
 {
 }
 
+void ServerActiveObject::sendMovement(v3f position, v3f velocity,
+		v3f acceleration, f32 yaw, bool do_interpolate, bool is_movement_end,
+		f32 update_interval)
+{
+	std::string str;
+	bool keyframe = false;
+	unsigned int known_by_added = m_known_by_added;
+	if (m_env && m_env->getMovementDeltas()) {
+		u32 now = porting::getTimeMs();
+		// Clients which got no keyframe yet ignore the deltas
+		if (m_movement_keyframe_sent &&
+				known_by_added == m_movement_known_by_added &&
+				now - m_movement_keyframe_time < MOVEMENT_KEYFRAME_INTERVAL)
+			str = gob_cmd_update_movement(false, m_movement_keyframe_seq,
+					position, m_movement_keyframe_position, velocity,
+					acceleration, yaw, do_interpolate, is_movement_end,
+					update_interval);
+		if (str.empty()) {
+			keyframe = true;
+			str = gob_cmd_update_movement(true, m_movement_keyframe_seq + 1,
+					position, position, velocity, acceleration, yaw,
+					do_interpolate, is_movement_end, update_interval);
+		}
+		m_movement_keyframe_sent = !str.empty();
+		if (keyframe && m_movement_keyframe_sent) {
+			++m_movement_keyframe_seq;
+			m_movement_keyframe_position = position;
+			m_movement_keyframe_time = now;
+		}
+	} else {
+		m_movement_keyframe_sent = false;
+	}
+	m_movement_known_by_added = known_by_added;
+
+	if (str.empty()) {
+		keyframe = false;
+		str = gob_cmd_update_position(position, velocity, acceleration, yaw,
+				do_interpolate, is_movement_end, update_interval);
+	}
+	// create message and add to list
+	ActiveObjectMessage aom(getId(), keyframe, str);
+	m_messages_out.push(aom);
+}
+
 ServerActiveObject* ServerActiveObject::create(ActiveObjectType type,
 		ServerEnvironment *env, u16 id, v3f pos,
 		const std::string &data)
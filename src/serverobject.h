@@ -86,10 +86,7 @@ class ServerActiveObject : public ActiveObject
 		std::lock_guard<Mutex> lock(m_base_position_mutex);
 		return m_base_position;
 	}
-	void setBasePosition(v3f pos) {
-		std::lock_guard<Mutex> lock(m_base_position_mutex);
-		m_base_position = pos;
-	}
+	void setBasePosition(v3f pos);
 	ServerEnvironment* getEnv(){ return m_env; }
 
 	/*
@@ -215,6 +212,12 @@ class ServerActiveObject : public ActiveObject
 		object.
 	*/
 	std::atomic_ushort m_known_by_count;
+	/*
+		Incremented with m_known_by_count, never decremented: a changed
+		value means a client started to know the object, it needs a
+		movement keyframe even if another one forgot the object.
+	*/
+	std::atomic_uint m_known_by_added;
 
 	/*
 		- Whether this object is to be removed when nobody knows about
@@ -254,6 +257,13 @@ class ServerActiveObject : public ActiveObject
 	Queue<ActiveObjectMessage> & m_messages_out;
 	float m_uptime_last;
 
+	/*
+		Set by the environment before step(): 0 if movement is not to be
+		sent in this step, else the send steps until the next movement
+		update, more for objects far from every player
+	*/
+	u8 m_movement_send_interval;
+
 protected:
 	// Used for creating objects based on type
 	typedef ServerActiveObject* (*Factory)
@@ -261,6 +271,15 @@ class ServerActiveObject : public ActiveObject
 			const std::string &data);
 	static void registerType(u16 type, Factory f);
 
+	/*
+		Queue a movement update: relative to the last keyframe if every
+		client reads GENERIC_CMD_UPDATE_MOVEMENT, a new reliable keyframe
+		after a while, for new watchers or if the delta does not fit.
+	*/
+	void sendMovement(v3f position, v3f velocity, v3f acceleration,
+			f32 yaw, bool do_interpolate, bool is_movement_end,
+			f32 update_interval);
+
 	ServerEnvironment *m_env;
 	v3f m_base_position;
 	Mutex m_base_position_mutex;
@@ -269,6 +288,13 @@ class ServerActiveObject : public ActiveObject
 private:
 	// Used for creating objects based on type
 	static std::map<u16, Factory> m_types;
+
+	// Last keyframe sent by sendMovement
+	bool m_movement_keyframe_sent;
+	u8 m_movement_keyframe_seq;
+	v3f m_movement_keyframe_position;
+	u32 m_movement_keyframe_time;
+	unsigned int m_movement_known_by_added;
 };
 
 #endif
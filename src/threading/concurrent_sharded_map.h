@@ -0,0 +1,243 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADING_CONCURENT_SHARDED_MAP_HEADER
+#define THREADING_CONCURENT_SHARDED_MAP_HEADER
+
+#include <unordered_map>
+#include <vector>
+#include <array>
+#include <utility>
+
+#include "lock.h"
+
+/*
+	Hash map split into SHARDS independently locked unordered_maps.
+	Single key operations (get/set/set_new/erase/count) lock only one shard
+	with a stack lock, so readers of different keys never touch the same
+	mutex and no lock object is allocated on the hot path.
+	Whole map operations (iteration) must hold lock_shared_rec() or
+	lock_unique_rec() which lock every shard, in shard order.
+*/
+
+template <class Key, class T, class Hash = std::hash<Key>, class Pred = std::equal_to<Key>,
+          std::size_t SHARDS = 64>
+class concurrent_sharded_map {
+public:
+	typedef std::unordered_map<Key, T, Hash, Pred> shard_map_type;
+	typedef Key                                    key_type;
+	typedef T                                      mapped_type;
+	typedef std::pair<const key_type, mapped_type> value_type;
+	typedef std::size_t                            size_type;
+
+private:
+	struct shard_type : public maybe_shared_locker {
+		shard_map_type map;
+	};
+
+	std::array<shard_type, SHARDS> m_shards;
+	std::atomic<size_type> m_size;
+
+	shard_type & shard(const key_type & k) {
+		std::size_t h = Hash()(k);
+		// spread weak hashes (small coordinates) over all shards
+		h ^= h >> 16;
+		h *= 0x45d9f3b;
+		h ^= h >> 16;
+		return m_shards[h % SHARDS];
+	}
+
+#if ENABLE_THREADS
+	static std::size_t thread_me() {
+		return std::hash<std::thread::id>()(std::this_thread::get_id());
+	}
+#endif
+
+	mapped_type find_nolock(shard_type & s, const key_type & k) {
+		auto it = s.map.find(k);
+		if (it == s.map.end())
+			return mapped_type();
+		return it->second;
+	}
+
+public:
+	template <class LOCK>
+	class sharded_lock {
+	public:
+		std::vector<LOCK> locks;
+		bool owns = true;
+		bool owns_lock() { return owns; }
+		void unlock() {
+			while (!locks.empty())
+				locks.pop_back();
+		}
+		~sharded_lock() { unlock(); }
+	};
+
+	typedef decltype(std::declval<shard_type>().lock_shared_rec()) shard_lock_shared;
+	typedef decltype(std::declval<shard_type>().lock_unique_rec()) shard_lock_unique;
+	typedef sharded_lock<shard_lock_shared> lock_rec_shared;
+	typedef sharded_lock<shard_lock_unique> lock_rec_unique;
+
+	class iterator {
+	public:
+		concurrent_sharded_map * map;
+		std::size_t shard;
+		typename shard_map_type::iterator it;
+
+		iterator(concurrent_sharded_map * map_, std::size_t shard_) :
+			map(map_), shard(shard_) {
+			if (shard < SHARDS) {
+				it = map->m_shards[shard].map.begin();
+				skip();
+			}
+		}
+		void skip() {
+			while (shard < SHARDS && it == map->m_shards[shard].map.end()) {
+				if (++shard < SHARDS)
+					it = map->m_shards[shard].map.begin();
+			}
+		}
+		value_type & operator*() { return *it; }
+		value_type * operator->() { return &*it; }
+		iterator & operator++() {
+			++it;
+			skip();
+			return *this;
+		}
+		bool operator==(const iterator & other) const {
+			return shard == other.shard && (shard >= SHARDS || it == other.it);
+		}
+		bool operator!=(const iterator & other) const { return !(*this == other); }
+	};
+
+	concurrent_sharded_map() { m_size = 0; }
+
+	// Returns default constructed value (nullptr for pointers) when key is
+	// missing or when trylock is set and the shard is busy.
+	mapped_type get(const key_type & k, bool trylock = false) {
+		auto & s = shard(k);
+#if ENABLE_THREADS
+		if (s.thread_id != thread_me()) {
+			try_shared_lock lock(s.mtx, std::defer_lock);
+			if (trylock) {
+				if (!lock.try_lock())
+					return mapped_type();
+			} else {
+				lock.lock();
+			}
+			return find_nolock(s, k);
+		}
+#endif
+		return find_nolock(s, k);
+	}
+
+	void set(const key_type & k, const mapped_type & v) {
+		auto & s = shard(k);
+		auto lock = s.lock_unique_rec();
+		auto ins = s.map.emplace(k, v);
+		if (ins.second)
+			++m_size;
+		else
+			ins.first->second = v;
+	}
+
+	// Insert only if key is missing, returns false if already present
+	bool set_new(const key_type & k, const mapped_type & v) {
+		auto & s = shard(k);
+		auto lock = s.lock_unique_rec();
+		if (!s.map.emplace(k, v).second)
+			return false;
+		++m_size;
+		return true;
+	}
+
+	size_type erase(const key_type & k) {
+		auto & s = shard(k);
+		auto lock = s.lock_unique_rec();
+		auto erased = s.map.erase(k);
+		m_size -= erased;
+		return erased;
+	}
+
+	size_type count(const key_type & k) {
+		auto & s = shard(k);
+		auto lock = s.lock_shared_rec();
+		return s.map.count(k);
+	}
+
+	size_type size() const { return m_size; }
+
+	bool empty() const { return !m_size; }
+
+	void clear() {
+		auto lock = lock_unique_rec();
+		for (auto & s : m_shards)
+			s.map.clear();
+		m_size = 0;
+	}
+
+	// Iteration is valid only while holding one of the whole map locks
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, SHARDS); }
+
+	std::unique_ptr<lock_rec_shared> lock_shared_rec() {
+		std::unique_ptr<lock_rec_shared> lock(new lock_rec_shared);
+		lock->locks.reserve(SHARDS);
+		for (auto & s : m_shards)
+			lock->locks.emplace_back(s.lock_shared_rec());
+		return lock;
+	}
+
+	std::unique_ptr<lock_rec_shared> try_lock_shared_rec() {
+		std::unique_ptr<lock_rec_shared> lock(new lock_rec_shared);
+		lock->locks.reserve(SHARDS);
+		for (auto & s : m_shards) {
+			lock->locks.emplace_back(s.try_lock_shared_rec());
+			if (!lock->locks.back()->owns_lock()) {
+				lock->unlock();
+				lock->owns = false;
+				break;
+			}
+		}
+		return lock;
+	}
+
+	std::unique_ptr<lock_rec_unique> lock_unique_rec() {
+		std::unique_ptr<lock_rec_unique> lock(new lock_rec_unique);
+		lock->locks.reserve(SHARDS);
+		for (auto & s : m_shards)
+			lock->locks.emplace_back(s.lock_unique_rec());
+		return lock;
+	}
+
+	std::unique_ptr<lock_rec_unique> try_lock_unique_rec() {
+		std::unique_ptr<lock_rec_unique> lock(new lock_rec_unique);
+		lock->locks.reserve(SHARDS);
+		for (auto & s : m_shards) {
+			lock->locks.emplace_back(s.try_lock_unique_rec());
+			if (!lock->locks.back()->owns_lock()) {
+				lock->unlock();
+				lock->owns = false;
+				break;
+			}
+		}
+		return lock;
+	}
+};
+
+#endif
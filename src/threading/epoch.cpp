@@ -0,0 +1,102 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "epoch.h"
+#include <limits>
+#if !HAVE_THREAD_LOCAL
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#endif
+
+// 0 marks a slot not reading
+std::atomic<uint64_t> g_epoch(1);
+
+// Slots are never freed, a slot of an exited thread is reused
+static std::atomic<epoch_slot *> g_slots(nullptr);
+
+static epoch_slot *take_slot()
+{
+	for (epoch_slot *s = g_slots.load(std::memory_order_acquire); s; s = s->next) {
+		bool used = false;
+		if (!s->used.load(std::memory_order_relaxed) &&
+				s->used.compare_exchange_strong(used, true, std::memory_order_acq_rel))
+			return s;
+	}
+	epoch_slot *s = new epoch_slot;
+	s->active.store(0, std::memory_order_relaxed);
+	s->used.store(true, std::memory_order_relaxed);
+	s->depth = 0;
+	s->next = g_slots.load(std::memory_order_relaxed);
+	while (!g_slots.compare_exchange_weak(s->next, s, std::memory_order_acq_rel)) {}
+	return s;
+}
+
+#if HAVE_THREAD_LOCAL
+
+thread_local epoch_slot *t_epoch_slot = nullptr;
+
+namespace {
+struct slot_release {
+	~slot_release()
+	{
+		if (!t_epoch_slot)
+			return;
+		t_epoch_slot->active.store(0, std::memory_order_release);
+		t_epoch_slot->depth = 0;
+		t_epoch_slot->used.store(false, std::memory_order_release);
+		t_epoch_slot = nullptr;
+	}
+};
+}
+
+epoch_slot *epoch_register_thread()
+{
+	static thread_local slot_release release;
+	(void)release;
+	t_epoch_slot = take_slot();
+	return t_epoch_slot;
+}
+
+#else
+
+// Slots of exited threads are not reused here
+epoch_slot *epoch_register_thread()
+{
+	static std::mutex mutex;
+	static std::unordered_map<std::thread::id, epoch_slot *> slots;
+	std::lock_guard<std::mutex> lock(mutex);
+	epoch_slot *&s = slots[std::this_thread::get_id()];
+	if (!s)
+		s = take_slot();
+	return s;
+}
+
+#endif
+
+uint64_t epoch_oldest_reader()
+{
+	// A reader not seen here yet started after the data was unlinked
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	uint64_t oldest = std::numeric_limits<uint64_t>::max();
+	for (epoch_slot *s = g_slots.load(std::memory_order_acquire); s; s = s->next) {
+		uint64_t active = s->active.load(std::memory_order_acquire);
+		if (active && active < oldest)
+			oldest = active;
+	}
+	return oldest;
+}
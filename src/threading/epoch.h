@@ -0,0 +1,92 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADING_EPOCH_HEADER
+#define THREADING_EPOCH_HEADER
+
+#include <atomic>
+#include <cstdint>
+#include "thread_local.h"
+
+/*
+	Epoch based reclamation of data read without lock.
+	A reader holds an epoch_read_guard while it uses pointers to shared
+	data; the guard marks the epoch the reader started in. A writer
+	unlinks old data, tags it with epoch_retire() and frees it when
+	epoch_oldest_reader() is not older than the tag. Guards nest, only
+	the outermost one of a thread counts.
+*/
+
+struct epoch_slot {
+	// Epoch the reader started in, 0: not reading
+	std::atomic<uint64_t> active;
+	std::atomic<bool> used;
+	epoch_slot *next;
+	// Owner thread only
+	unsigned int depth;
+};
+
+extern std::atomic<uint64_t> g_epoch;
+
+epoch_slot *epoch_register_thread();
+#if HAVE_THREAD_LOCAL
+extern thread_local epoch_slot *t_epoch_slot;
+inline epoch_slot *epoch_thread_slot()
+{
+	return t_epoch_slot ? t_epoch_slot : epoch_register_thread();
+}
+#else
+// Looked up by thread id
+inline epoch_slot *epoch_thread_slot()
+{
+	return epoch_register_thread();
+}
+#endif
+
+class epoch_read_guard {
+public:
+	epoch_read_guard() : m_slot(epoch_thread_slot())
+	{
+		if (m_slot->depth++)
+			return;
+		m_slot->active.store(g_epoch.load(std::memory_order_acquire),
+				std::memory_order_relaxed);
+		// Pairs with the fence in epoch_oldest_reader
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+	~epoch_read_guard()
+	{
+		if (!--m_slot->depth)
+			m_slot->active.store(0, std::memory_order_release);
+	}
+	epoch_read_guard(const epoch_read_guard &) = delete;
+	epoch_read_guard &operator=(const epoch_read_guard &) = delete;
+
+private:
+	epoch_slot *m_slot;
+};
+
+// Call after the old data is unlinked, returns its tag
+inline uint64_t epoch_retire()
+{
+	return g_epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+}
+
+// Data tagged with an epoch up to this can be freed
+uint64_t epoch_oldest_reader();
+
+#endif
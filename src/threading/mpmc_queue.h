@@ -0,0 +1,124 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADING_MPMC_QUEUE_HEADER
+#define THREADING_MPMC_QUEUE_HEADER
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/*
+	Bounded lock-free FIFO for any number of producers and consumers
+	(Vyukov's array queue). Every cell has a sequence number telling
+	whether it is free for the push at that position or filled for the pop
+	at that position, so push and pop only CAS their own position counter.
+	Capacity is rounded up to a power of two. size() is approximate while
+	other threads push or pop.
+*/
+
+template <class T>
+class mpmc_queue {
+public:
+	explicit mpmc_queue(std::size_t capacity)
+	{
+		std::size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		m_cells.reset(new cell[size]);
+		m_mask = size - 1;
+		for (std::size_t i = 0; i < size; ++i)
+			m_cells[i].seq.store(i, std::memory_order_relaxed);
+		m_push_pos.store(0, std::memory_order_relaxed);
+		m_pop_pos.store(0, std::memory_order_relaxed);
+	}
+
+	// false if full
+	bool push(T value)
+	{
+		std::size_t pos = m_push_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell &c = m_cells[pos & m_mask];
+			std::size_t seq = c.seq.load(std::memory_order_acquire);
+			std::ptrdiff_t dif = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+			if (dif == 0) {
+				if (m_push_pos.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed)) {
+					c.value = std::move(value);
+					c.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = m_push_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// false if empty
+	bool pop(T &value)
+	{
+		std::size_t pos = m_pop_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell &c = m_cells[pos & m_mask];
+			std::size_t seq = c.seq.load(std::memory_order_acquire);
+			std::ptrdiff_t dif = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+			if (dif == 0) {
+				if (m_pop_pos.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed)) {
+					value = std::move(c.value);
+					c.seq.store(pos + m_mask + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = m_pop_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	std::size_t size() const
+	{
+		std::size_t pop = m_pop_pos.load(std::memory_order_relaxed);
+		std::size_t push = m_push_pos.load(std::memory_order_relaxed);
+		return push > pop ? push - pop : 0;
+	}
+
+	bool empty() const { return !size(); }
+
+	std::size_t capacity() const { return m_mask + 1; }
+
+private:
+	struct cell {
+		std::atomic<std::size_t> seq;
+		T value;
+	};
+
+	std::unique_ptr<cell[]> m_cells;
+	std::size_t m_mask;
+	// separate cache lines, producers and consumers do not share them
+	alignas(64) std::atomic<std::size_t> m_push_pos;
+	alignas(64) std::atomic<std::size_t> m_pop_pos;
+
+	mpmc_queue(const mpmc_queue &) = delete;
+	mpmc_queue &operator=(const mpmc_queue &) = delete;
+};
+
+#endif
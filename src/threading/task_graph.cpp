@@ -0,0 +1,151 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "task_graph.h"
+#include <algorithm>
+#include <chrono>
+
+task_graph::task_graph(task_pool *pool) :
+	m_state(std::make_shared<state>()),
+	m_pool(pool)
+{
+}
+
+task_graph::task_id task_graph::add(std::function<void()> func, const std::vector<task_id> &deps)
+{
+	task_id id = m_state->tasks.size();
+	m_state->tasks.emplace_back();
+	auto &task = m_state->tasks.back();
+	task.func = std::move(func);
+	task.deps = deps.size();
+	for (auto dep : deps)
+		m_state->tasks[dep].next.push_back(id);
+	return id;
+}
+
+void task_graph::run()
+{
+	auto &s = *m_state;
+	size_t ready;
+	{
+		std::lock_guard<std::mutex> lock(s.mutex);
+		for (task_id id = 0; id < s.tasks.size(); ++id)
+			if (!s.tasks[id].deps)
+				s.ready.push_back(id);
+		ready = s.ready.size();
+	}
+	if (m_pool && ready > 1)
+		m_pool->push(m_state, ready - 1);
+
+	for (;;) {
+		if (s.step(m_pool))
+			continue;
+		std::unique_lock<std::mutex> lock(s.mutex);
+		s.cv.wait(lock, [&s] { return !s.ready.empty() || s.done == s.tasks.size(); });
+		if (s.done == s.tasks.size())
+			break;
+	}
+
+	if (s.error)
+		std::rethrow_exception(s.error);
+}
+
+bool task_graph::state::step(task_pool *pool)
+{
+	task_id id;
+	bool skip;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (ready.empty())
+			return false;
+		id = ready.front();
+		ready.pop_front();
+		skip = !!error;
+	}
+
+	if (!skip) {
+		try {
+			tasks[id].func();
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error)
+				error = std::current_exception();
+		}
+	}
+
+	size_t released = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++done;
+		for (auto next : tasks[id].next) {
+			if (!--tasks[next].deps) {
+				ready.push_back(next);
+				++released;
+			}
+		}
+	}
+	cv.notify_all();
+
+	// This thread continues with one of them
+	if (pool && released > 1)
+		pool->push(shared_from_this(), released - 1);
+	return true;
+}
+
+task_pool::task_pool(const std::string &name, int priority) :
+	thread_pool(name, priority)
+{
+}
+
+task_pool::~task_pool()
+{
+	join();
+}
+
+void task_pool::push(const std::shared_ptr<task_graph::state> &graph, size_t count)
+{
+	count = std::min(count, workers.size());
+	if (!count)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < count; ++i)
+			m_queue.push_back(graph);
+	}
+	if (count == 1)
+		m_cv.notify_one();
+	else
+		m_cv.notify_all();
+}
+
+void * task_pool::run()
+{
+	while (!stopRequested()) {
+		std::shared_ptr<task_graph::state> graph;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait_for(lock, std::chrono::milliseconds(100),
+					[this] { return !m_queue.empty(); });
+			if (m_queue.empty())
+				continue;
+			graph = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+		while (graph->step(this)) {}
+	}
+	return nullptr;
+}
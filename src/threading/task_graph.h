@@ -0,0 +1,94 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADING_TASK_GRAPH_HEADER
+#define THREADING_TASK_GRAPH_HEADER
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "thread_pool.h"
+
+/*
+	Tasks with dependencies, executed by a shared task_pool together with
+	the thread waiting in task_graph::run(). The waiting thread always
+	helps, so a graph completes even when the pool is busy with graphs of
+	other threads or has no threads at all.
+	Tasks must not block on each other, ordering is only by dependencies.
+*/
+
+class task_pool;
+
+class task_graph {
+public:
+	typedef size_t task_id;
+
+	task_graph(task_pool *pool = nullptr);
+
+	// deps must be already added
+	task_id add(std::function<void()> func, const std::vector<task_id> &deps = {});
+
+	// Run every task once and wait, rethrows first exception of a task.
+	// Dependents of a failed task are skipped.
+	void run();
+
+	struct state;
+
+private:
+	std::shared_ptr<state> m_state;
+	task_pool *m_pool;
+};
+
+struct task_graph::state : public std::enable_shared_from_this<task_graph::state> {
+	struct task {
+		std::function<void()> func;
+		size_t deps = 0; // unfinished
+		std::vector<task_id> next;
+	};
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<task> tasks;
+	std::deque<task_id> ready;
+	size_t done = 0;
+	std::exception_ptr error;
+
+	// Run one ready task, false if there is none now
+	bool step(task_pool *pool);
+};
+
+class task_pool : public thread_pool {
+public:
+	task_pool(const std::string &name = "Tasks", int priority = 0);
+	~task_pool();
+
+	// Let up to count threads work on graph
+	void push(const std::shared_ptr<task_graph::state> &graph, size_t count);
+
+	void * run();
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::shared_ptr<task_graph::state>> m_queue;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include <map>
+#include "active_object_grid.h"
+#include "constants.h"
+#include "noise.h"
+
+class TestActiveObjectGrid : public TestBase {
+public:
+	TestActiveObjectGrid() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActiveObjectGrid"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testMoveAndRemove();
+	void testQueries();
+};
+
+static TestActiveObjectGrid g_test_instance;
+
+void TestActiveObjectGrid::runTests(IGameDef *gamedef)
+{
+	TEST(testMoveAndRemove);
+	TEST(testQueries);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool contains(const std::vector<u16> &ids, u16 id)
+{
+	return std::find(ids.begin(), ids.end(), id) != ids.end();
+}
+
+void TestActiveObjectGrid::testMoveAndRemove()
+{
+	const f32 cell = ACTIVE_OBJECT_GRID_CELL_SIZE * BS;
+	ActiveObjectGrid grid;
+	UASSERT(ActiveObjectGrid::getCell(v3f(-1, 0, cell)) == v3POS(-1, 0, 1));
+
+	grid.insert(1, v3f(5, 5, 5));
+	grid.insert(2, v3f(10, 5, 5), true);
+	UASSERT(grid.size() == 2);
+	UASSERT(grid.getCellCount() == 1);
+
+	std::vector<u16> ids;
+	grid.getIdsNear(v3f(cell * 10, 0, 0), BS, ids);
+	UASSERT(ids.empty());
+
+	// Far away and back
+	grid.move(1, v3f(cell * 10, 0, 0));
+	UASSERT(grid.getCellCount() == 2);
+	grid.getIdsNear(v3f(cell * 10, 0, 0), BS, ids);
+	UASSERT(ids.size() == 1 && ids[0] == 1);
+	grid.move(1, v3f(0, 0, 0));
+	UASSERT(grid.getCellCount() == 1);
+
+	// Unknown ids are ignored
+	grid.move(3, v3f(0, 0, 0));
+	grid.remove(3);
+	UASSERT(grid.size() == 2);
+
+	ids.clear();
+	grid.getPlayerIds(ids);
+	UASSERT(ids.size() == 1 && ids[0] == 2);
+	v3POS id_cell;
+	bool player = false;
+	UASSERT(grid.getIdCell(2, id_cell, player));
+	UASSERT(player && id_cell == v3POS(0, 0, 0));
+	UASSERT(!grid.getIdCell(3, id_cell, player));
+
+	// Next cell is a unit away from its border
+	UASSERT(ActiveObjectGrid::isCellNear(v3POS(1, 0, 0), v3f(cell - 1, 5, 5), 1));
+	UASSERT(!ActiveObjectGrid::isCellNear(v3POS(1, 0, 0), v3f(cell - 2, 5, 5), 1));
+
+	grid.remove(2);
+	ids.clear();
+	grid.getPlayerIds(ids);
+	UASSERT(ids.empty());
+	grid.remove(1);
+	UASSERT(grid.size() == 0);
+	UASSERT(grid.getCellCount() == 0);
+}
+
+void TestActiveObjectGrid::testQueries()
+{
+	PseudoRandom r(7);
+	ActiveObjectGrid grid;
+	std::map<u16, v3f> positions;
+	for (u16 id = 1; id <= 500; id++) {
+		v3f pos(r.range(-1500, 1500) * BS / 10, r.range(-200, 200) * BS / 10,
+				r.range(-1500, 1500) * BS / 10);
+		grid.insert(id, pos);
+		positions[id] = pos;
+	}
+	for (u16 id = 1; id <= 500; id += 3) {
+		positions[id] += v3f(r.range(-300, 300), 0, r.range(-300, 300)) * BS / 10;
+		grid.move(id, positions[id]);
+	}
+	for (u16 id = 2; id <= 500; id += 7) {
+		grid.remove(id);
+		positions.erase(id);
+	}
+	UASSERT(grid.size() == positions.size());
+
+	// Radii below and above the one where all occupied cells are walked
+	for (f32 radius : {5.0f * BS, 40.0f * BS, 300.0f * BS}) {
+		v3f center(r.range(-100, 100) * BS, 0, r.range(-100, 100) * BS);
+		std::vector<u16> ids;
+		grid.getIdsNear(center, radius, ids);
+		aabb3f box(center - v3f(radius, radius, radius), center + v3f(radius, radius, radius));
+		std::vector<u16> box_ids;
+		grid.getIdsInBox(box, box_ids);
+		for (const auto &it : positions) {
+			if (it.second.getDistanceFrom(center) <= radius)
+				UASSERT(contains(ids, it.first));
+			if (box.isPointInside(it.second))
+				UASSERT(contains(box_ids, it.first));
+		}
+		// Nothing from cells out of the box
+		for (u16 id : box_ids) {
+			UASSERT(positions.count(id));
+			v3POS cell = ActiveObjectGrid::getCell(positions[id]);
+			UASSERT(cell.X >= ActiveObjectGrid::getCell(box.MinEdge).X);
+			UASSERT(cell.X <= ActiveObjectGrid::getCell(box.MaxEdge).X);
+		}
+		UASSERT(ids.size() <= box_ids.size());
+	}
+}
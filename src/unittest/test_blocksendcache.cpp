@@ -0,0 +1,93 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#include "network/fm_blocksendcache.h"
+
+class TestBlockSendCache : public TestBase {
+public:
+	TestBlockSendCache() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestBlockSendCache"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testKey();
+	void testEvict();
+};
+
+static TestBlockSendCache g_test_instance;
+
+void TestBlockSendCache::runTests(IGameDef *gamedef)
+{
+	TEST(testKey);
+	TEST(testEvict);
+}
+
+static BlockSendCacheKey make_key(s16 x, u64 counter)
+{
+	BlockSendCacheKey key;
+	key.pos = v3POS(x, 0, 0);
+	key.modified_counter = counter;
+	key.net_proto_version_fm = 1;
+	key.version = 27;
+	key.codec = 0;
+	key.heat = 10;
+	key.humidity = 20;
+	return key;
+}
+
+void TestBlockSendCache::testKey()
+{
+	BlockSendCache cache(1000);
+	cache.set(make_key(1, 5), std::make_shared<std::string>("block"));
+	UASSERT(cache.get(make_key(1, 5)) && *cache.get(make_key(1, 5)) == "block");
+
+	// modified block or other client format never hits
+	UASSERT(!cache.get(make_key(1, 6)));
+	UASSERT(!cache.get(make_key(2, 5)));
+	auto key = make_key(1, 5);
+	key.codec = 2;
+	UASSERT(!cache.get(key));
+
+	cache.set(make_key(1, 5), std::make_shared<std::string>("changed"));
+	UASSERT(cache.size() == 1);
+	UASSERT(cache.bytes() == 7);
+}
+
+void TestBlockSendCache::testEvict()
+{
+	BlockSendCache cache(30);
+	for (s16 i = 0; i < 3; ++i)
+		cache.set(make_key(i, 1), std::make_shared<std::string>(10, 'a' + i));
+	UASSERT(cache.size() == 3);
+
+	// touch oldest, then overflow: second entry is least recently used
+	UASSERT(cache.get(make_key(0, 1)));
+	cache.set(make_key(3, 1), std::make_shared<std::string>(10, 'd'));
+	UASSERT(cache.bytes() <= 30);
+	UASSERT(cache.get(make_key(0, 1)));
+	UASSERT(!cache.get(make_key(1, 1)));
+	UASSERT(cache.get(make_key(3, 1)));
+
+	// larger than whole cache is not stored
+	cache.set(make_key(4, 1), std::make_shared<std::string>(40, 'e'));
+	UASSERT(!cache.get(make_key(4, 1)));
+
+	cache.setLimit(0);
+	UASSERT(cache.size() == 0 && cache.bytes() == 0);
+}
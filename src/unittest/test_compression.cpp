@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irrlichttypes_extrabloated.h"
 #include "log.h"
 #include "serialization.h"
+#include "util/serialize.h"
 #include "nodedef.h"
 #include "noise.h"
 
@@ -37,6 +38,7 @@ class TestCompression : public TestBase {
 	void testRLECompression();
 	void testZlibCompression();
 	void testZlibLargeData();
+	void testBlockCodecs();
 };
 
 static TestCompression g_test_instance;
@@ -46,6 +48,7 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testRLECompression);
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
+	TEST(testBlockCodecs);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -170,3 +173,50 @@ void TestCompression::testZlibLargeData()
 				i, str_decompressed[i], i, data_in[i]);
 	}
 }
+
+void TestCompression::testBlockCodecs()
+{
+	UASSERT(blockCodecSupported(BLOCK_CODEC_ZLIB));
+	UASSERT(!blockCodecSupported(BLOCK_CODEC_COUNT));
+	UASSERT(blockCodecFromString("zlib") == BLOCK_CODEC_ZLIB);
+	UASSERT(blockCodecFromString("unknown") == BLOCK_CODEC_ZLIB);
+
+	std::string data_in;
+	data_in.resize(16 * 16 * 16 * 4);
+	PseudoRandom pseudorandom(9421);
+	for (u32 i = 0; i < data_in.size(); i++)
+		data_in[i] = pseudorandom.range(0, 3);
+
+	for (u8 codec = 0; codec < BLOCK_CODEC_COUNT; ++codec) {
+		if (!blockCodecSupported(codec))
+			continue;
+		// Two streams back to back must be read separately, as in MapBlock
+		std::ostringstream os_compressed(std::ios::binary);
+		compressCodec(data_in, os_compressed, codec);
+		compressCodec("tail", os_compressed, codec);
+		infostream << "Test: " << blockCodecName(codec) << " " << data_in.size()
+			<< " -> " << os_compressed.str().size() << std::endl;
+
+		std::istringstream is_compressed(os_compressed.str(), std::ios::binary);
+		std::ostringstream os_decompressed(std::ios::binary), os_tail(std::ios::binary);
+		decompressCodec(is_compressed, os_decompressed, codec, data_in.size());
+		decompressCodec(is_compressed, os_tail, codec, 4);
+		UASSERT(os_decompressed.str() == data_in);
+		UASSERT(os_tail.str() == "tail");
+
+		if (codec == BLOCK_CODEC_ZLIB)
+			continue;
+		// Sizes from the header above the limit fail before allocating
+		std::istringstream is_big(os_compressed.str(), std::ios::binary);
+		std::ostringstream os_big(std::ios::binary);
+		EXCEPTION_CHECK(SerializationError,
+			decompressCodec(is_big, os_big, codec, data_in.size() - 1));
+
+		std::ostringstream os_header(std::ios::binary);
+		writeU32(os_header, 4);
+		writeU32(os_header, 0xffffffff);
+		std::istringstream is_header(os_header.str(), std::ios::binary);
+		EXCEPTION_CHECK(SerializationError,
+			decompressCodec(is_header, os_big, codec, 4));
+	}
+}
@@ -0,0 +1,215 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#include <atomic>
+#include <thread>
+#include "threading/concurrent_sharded_map.h"
+#include "threading/concurrent_unordered_map.h"
+#include "util/unordered_map_hash.h"
+#include "porting.h"
+#include "log.h"
+
+class TestConcurrentMap : public TestBase {
+public:
+	TestConcurrentMap() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestConcurrentMap"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testShardedBasic();
+	void testShardedIterate();
+	void testShardedThreads();
+	void testShardedBenchmark();
+};
+
+static TestConcurrentMap g_test_instance;
+
+typedef concurrent_sharded_map<v3POS, int, v3POSHash, v3POSEqual> sharded_type;
+typedef concurrent_unordered_map<v3POS, int, v3POSHash, v3POSEqual> single_type;
+
+void TestConcurrentMap::runTests(IGameDef *gamedef)
+{
+	TEST(testShardedBasic);
+	TEST(testShardedIterate);
+	TEST(testShardedThreads);
+	TEST(testShardedBenchmark);
+}
+
+void TestConcurrentMap::testShardedBasic()
+{
+	sharded_type map;
+	UASSERT(map.empty());
+	UASSERT(map.get(v3POS(1, 2, 3)) == 0);
+
+	map.set(v3POS(1, 2, 3), 5);
+	UASSERT(map.get(v3POS(1, 2, 3)) == 5);
+	UASSERT(map.get(v3POS(1, 2, 3), true) == 5);
+	UASSERT(map.size() == 1);
+
+	UASSERT(map.set_new(v3POS(1, 2, 3), 6) == false);
+	UASSERT(map.get(v3POS(1, 2, 3)) == 5);
+	UASSERT(map.set_new(v3POS(-1, 2, 3), 7) == true);
+	UASSERT(map.size() == 2);
+	UASSERT(map.count(v3POS(-1, 2, 3)) == 1);
+
+	map.set(v3POS(1, 2, 3), 8);
+	UASSERT(map.get(v3POS(1, 2, 3)) == 8);
+	UASSERT(map.size() == 2);
+
+	UASSERT(map.erase(v3POS(1, 2, 3)) == 1);
+	UASSERT(map.erase(v3POS(1, 2, 3)) == 0);
+	UASSERT(map.get(v3POS(1, 2, 3)) == 0);
+	UASSERT(map.size() == 1);
+
+	map.clear();
+	UASSERT(map.empty());
+}
+
+void TestConcurrentMap::testShardedIterate()
+{
+	sharded_type map;
+	{
+		auto lock = map.lock_shared_rec();
+		UASSERT(lock->owns_lock());
+		UASSERT(map.begin() == map.end());
+	}
+
+	int sum = 0;
+	for (int i = 0; i < 1000; ++i) {
+		map.set(v3POS(i % 10, i / 100, (i / 10) % 10), i);
+		sum += i;
+	}
+	UASSERT(map.size() == 1000);
+
+	auto lock = map.try_lock_shared_rec();
+	UASSERT(lock->owns_lock());
+	int count = 0, sum_iter = 0;
+	for (auto & ir : map) {
+		++count;
+		sum_iter += ir.second;
+		// recursive access from the thread holding the whole map
+		UASSERT(map.get(ir.first) == ir.second);
+	}
+	UASSERT(count == 1000);
+	UASSERT(sum_iter == sum);
+}
+
+/*
+	N readers do random lookups while one writer inserts and erases
+	blocks outside the read range, like getBlockNoCreateNoEx from map,
+	send, liquid, abm and emerge threads. Readers must always see the
+	values they expect.
+*/
+
+template <class MAP>
+static u32 check_map_threads(MAP & map, unsigned int threads, int range, int ops)
+{
+	std::atomic_bool stop(false);
+	std::atomic<u32> errors(0);
+
+	std::thread writer([&]() {
+		int i = 0;
+		while (!stop) {
+			v3POS p(range + i % range, 0, 0);
+			if (i++ & 1)
+				map.set(p, 1);
+			else
+				map.erase(p);
+		}
+	});
+
+	std::vector<std::thread> readers;
+	for (unsigned int t = 0; t < threads; ++t) {
+		readers.emplace_back([&, t]() {
+			u32 seed = t + 1;
+			for (int i = 0; i < ops; ++i) {
+				seed = seed * 1103515245 + 12345;
+				v3POS p((seed >> 8) % range, (seed >> 16) % range, (seed >> 24) % range);
+				int value = map.get(p);
+				if (value != p.X + 1)
+					++errors;
+			}
+		});
+	}
+	for (auto & thread : readers)
+		thread.join();
+	stop = true;
+	writer.join();
+
+	return errors;
+}
+
+void TestConcurrentMap::testShardedThreads()
+{
+	const int range = 8, ops = 2000;
+	const unsigned int threads = 4;
+
+	sharded_type sharded;
+	single_type single;
+	for (int x = 0; x < range; ++x)
+	for (int y = 0; y < range; ++y)
+	for (int z = 0; z < range; ++z) {
+		sharded.set(v3POS(x, y, z), x + 1);
+		single.set(v3POS(x, y, z), x + 1);
+	}
+
+	UASSERT(check_map_threads(sharded, threads, range, ops) == 0);
+	UASSERT(check_map_threads(single, threads, range, ops) == 0);
+
+	UASSERT(sharded.size() >= (size_t)range * range * range);
+	UASSERT(single.size() >= (size_t)range * range * range);
+}
+
+/*
+	Microbenchmark of the same load with every hardware thread reading.
+	Both times are reported, not asserted: they depend on the machine.
+*/
+
+template <class MAP>
+static void fill_map(MAP & map, int range)
+{
+	for (int x = 0; x < range; ++x)
+	for (int y = 0; y < range; ++y)
+	for (int z = 0; z < range; ++z)
+		map.set(v3POS(x, y, z), x + 1);
+}
+
+void TestConcurrentMap::testShardedBenchmark()
+{
+	const int range = 16, ops = 100000;
+	const unsigned int threads = std::min<unsigned int>(16,
+		std::max<unsigned int>(2, std::thread::hardware_concurrency()));
+
+	sharded_type sharded;
+	single_type single;
+	fill_map(sharded, range);
+	fill_map(single, range);
+
+	u32 start_ms = porting::getTimeMs();
+	UASSERT(check_map_threads(sharded, threads, range, ops) == 0);
+	u32 sharded_ms = porting::getTimeMs() - start_ms;
+
+	start_ms = porting::getTimeMs();
+	UASSERT(check_map_threads(single, threads, range, ops) == 0);
+	u32 single_ms = porting::getTimeMs() - start_ms;
+
+	rawstream << "TestConcurrentMap: " << threads << " threads x " << ops
+		<< " lookups: sharded=" << sharded_ms << "ms single lock="
+		<< single_ms << "ms" << std::endl;
+}
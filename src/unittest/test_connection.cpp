@@ -19,6 +19,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
 #include "log.h"
 #include "socket.h"
 #include "settings.h"
@@ -26,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "network/connection.h"
 
 #include "config.h"
+#include "porting.h"
 
 class TestConnection : public TestBase {
 public:
@@ -41,6 +46,7 @@ class TestConnection : public TestBase {
 
 	void testHelpers();
 	void testConnectSendReceive();
+	void testReceiveQueues();
 };
 
 static TestConnection g_test_instance;
@@ -50,6 +56,8 @@ void TestConnection::runTests(IGameDef *gamedef)
 #if MINETEST_PROTO
 	TEST(testHelpers);
 	TEST(testConnectSendReceive);
+#elif !USE_SCTP
+	TEST(testReceiveQueues);
 #endif
 }
 
@@ -353,4 +361,69 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.last_id == 2);
 }
 
+#elif !USE_SCTP
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestConnection::testReceiveQueues()
+{
+	// Several peers send numbered packets, a thread per receive queue
+	// drains the server; every peer must come in order and in one queue
+	const u8 queues = 3;
+	const int peers = 4;
+	const u32 packets = 200;
+	const u16 port = 30002;
+
+	con::Connection server(PROTOCOL_ID, 512, 5.0, false);
+	server.setReceiveQueues(queues);
+	UASSERT(server.getReceiveQueues() == queues);
+	server.Serve(Address(0, 0, 0, 0, port));
+	sleep_ms(50);
+
+	std::vector<std::unique_ptr<con::Connection>> clients;
+	for (int i = 0; i < peers; ++i) {
+		clients.emplace_back(new con::Connection(PROTOCOL_ID, 512, 5.0, false));
+		clients.back()->Connect(Address(127, 0, 0, 1, port));
+	}
+	for (u32 i = 0; i < packets; ++i) {
+		for (auto &client : clients) {
+			SharedBuffer<u8> data(6);
+			writeU16(&data[0], 0);
+			writeU32(&data[2], i);
+			client->Send(PEER_ID_SERVER, 0, data, true);
+		}
+	}
+
+	std::atomic_uint received(0), errors(0);
+	std::vector<std::map<u16, u32>> next(queues);
+	std::vector<std::thread> threads;
+	for (u8 q = 0; q < queues; ++q) {
+		threads.emplace_back([&, q]() {
+			u32 end_ms = porting::getTimeMs() + 10000;
+			while (received < peers * packets && porting::getTimeMs() < end_ms) {
+				NetworkPacket pkt;
+				if (!server.Receive(&pkt, 10, q))
+					continue;
+				u16 peer_id = pkt.getPeerId();
+				if (peer_id % queues != q ||
+						readU32(pkt.getU8Ptr(2)) != next[q][peer_id]++)
+					++errors;
+				++received;
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	UASSERT(errors == 0);
+	UASSERT(received == peers * packets);
+	size_t seen = 0;
+	for (const auto &queue : next) {
+		for (const auto &peer : queue)
+			UASSERT(peer.second == packets);
+		seen += queue.size();
+	}
+	UASSERT(seen == peers);
+}
+
 #endif
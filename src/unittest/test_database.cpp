@@ -0,0 +1,264 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#include <fstream>
+#include <thread>
+#include "database.h"
+#include "database-region.h"
+#include "database-leveldb.h"
+#include "filesys.h"
+#include "util/string.h"
+
+class TestDatabase : public TestBase {
+public:
+	TestDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testBlockAsInteger();
+	void testBlockAsMorton();
+	void testRegion();
+	void testRegionEviction();
+	void testLevelDBKeys();
+};
+
+static TestDatabase g_test_instance;
+
+void TestDatabase::runTests(IGameDef *gamedef)
+{
+	TEST(testBlockAsInteger);
+	TEST(testBlockAsMorton);
+#if USE_REGION
+	TEST(testRegion);
+	TEST(testRegionEviction);
+#endif
+#if USE_LEVELDB
+	TEST(testLevelDBKeys);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Values used for the two axes not walked over the whole range
+static const s16 edges[] = {-2048, -2047, -1, 0, 1, 2047};
+
+void TestDatabase::testBlockAsInteger()
+{
+	for (s16 v = -2048; v <= 2047; ++v)
+	for (s16 a : edges)
+	for (s16 b : edges) {
+		v3s16 ps[] = {v3s16(v, a, b), v3s16(a, v, b), v3s16(a, b, v)};
+		for (const auto &p : ps)
+			UASSERT(Database::getIntegerAsBlock(Database::getBlockAsInteger(p)) == p);
+	}
+}
+
+void TestDatabase::testBlockAsMorton()
+{
+	for (s16 v = -2048; v <= 2047; ++v)
+	for (s16 a : edges)
+	for (s16 b : edges) {
+		v3s16 ps[] = {v3s16(v, a, b), v3s16(a, v, b), v3s16(a, b, v)};
+		for (const auto &p : ps) {
+			std::string key = Database::getBlockAsMorton(p);
+			UASSERT(key.size() == 7 && key[0] == 'm');
+			UASSERT(Database::getMortonAsBlock(key) == p);
+		}
+		// Keys grow along every axis, negative coordinates first
+		if (v > -2048) {
+			UASSERT(Database::getBlockAsMorton(v3s16(v - 1, a, b)) <
+				Database::getBlockAsMorton(v3s16(v, a, b)));
+			UASSERT(Database::getBlockAsMorton(v3s16(a, v - 1, b)) <
+				Database::getBlockAsMorton(v3s16(a, v, b)));
+			UASSERT(Database::getBlockAsMorton(v3s16(a, b, v - 1)) <
+				Database::getBlockAsMorton(v3s16(a, b, v)));
+		}
+	}
+
+	// Whole s16 range fits the key
+	s16 limits[] = {-32768, -32767, 32766, 32767};
+	for (s16 x : limits)
+	for (s16 y : limits)
+	for (s16 z : limits)
+		UASSERT(Database::getMortonAsBlock(Database::getBlockAsMorton(v3s16(x, y, z))) ==
+			v3s16(x, y, z));
+}
+
+static std::string loadBlock(Database &db, v3s16 p)
+{
+	std::string data;
+	db.loadBlock(p, &data);
+	return data;
+}
+
+#if USE_REGION
+
+static std::string blockData(v3s16 p, u32 version, size_t size = 100)
+{
+	std::string data(size, 'x');
+	std::string head = itos(p.X) + "," + itos(p.Y) + "," + itos(p.Z) + ":" + itos(version);
+	data.replace(0, head.size(), head);
+	return data;
+}
+
+static u64 fileSize(const std::string &path)
+{
+	std::ifstream is(path.c_str(), std::ios::binary | std::ios::ate);
+	return is.good() ? (u64)is.tellg() : 0;
+}
+
+void TestDatabase::testRegion()
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + "region";
+	fs::RecursiveDelete(dir);
+	{
+		Database_Region db(dir);
+		v3s16 a(0, 0, 0), b(-1, 5, 17), c(100, -2000, 3);
+		UASSERT(db.saveBlock(a, blockData(a, 0)));
+		UASSERT(db.saveBlocks({{b, blockData(b, 0)}, {c, blockData(c, 0)}, {b, blockData(b, 1)}}));
+		UASSERT(loadBlock(db, a) == blockData(a, 0));
+		UASSERT(loadBlock(db, b) == blockData(b, 1));
+		UASSERT(loadBlock(db, c) == blockData(c, 0));
+		UASSERT(loadBlock(db, v3s16(1, 0, 0)).empty());
+
+		// Region remembered as absent is found once it is created
+		v3s16 d(500, 0, 0);
+		UASSERT(loadBlock(db, d).empty());
+		UASSERT(db.saveBlock(d, blockData(d, 0)));
+		UASSERT(loadBlock(db, d) == blockData(d, 0));
+		UASSERT(db.deleteBlock(d));
+
+		UASSERT(db.deleteBlock(c));
+		UASSERT(loadBlock(db, c).empty());
+
+		std::vector<v3s16> list;
+		db.listAllLoadableBlocks(list);
+		UASSERT(list.size() == 2);
+
+		// Overwrites leave garbage for compaction
+		std::string file = dir + DIR_DELIM + "map.region" + DIR_DELIM + "r.0.0.0";
+		for (u32 i = 1; i <= 40; ++i)
+			UASSERT(db.saveBlock(a, blockData(a, i, 64 * 1024)));
+		u64 size_before = fileSize(file);
+		db.compact();
+		UASSERT(fileSize(file) < size_before / 10);
+		UASSERT(loadBlock(db, a) == blockData(a, 40, 64 * 1024));
+		UASSERT(db.saveBlock(a, blockData(a, 41)));
+		UASSERT(loadBlock(db, a) == blockData(a, 41));
+	}
+
+	// Everything is back after reopening
+	{
+		Database_Region db(dir);
+		UASSERT(loadBlock(db, v3s16(0, 0, 0)) == blockData(v3s16(0, 0, 0), 41));
+		UASSERT(loadBlock(db, v3s16(-1, 5, 17)) == blockData(v3s16(-1, 5, 17), 1));
+		UASSERT(loadBlock(db, v3s16(100, -2000, 3)).empty());
+	}
+	fs::RecursiveDelete(dir);
+}
+
+void TestDatabase::testRegionEviction()
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + "region_evict";
+	fs::RecursiveDelete(dir);
+	// More regions than kept open; threads use the same regions in
+	// other orders, so evicted ones are reopened while in use
+	const int regions = 300, threads = 4, rounds = 2;
+	{
+		Database_Region db(dir);
+		// Coprime to regions: every thread visits all of them
+		const int steps[threads] = {1, 7, 11, 13};
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; ++t) {
+			workers.emplace_back([&db, &steps, t]() {
+				for (int round = 0; round < rounds; ++round)
+				for (int i = 0; i < regions; ++i) {
+					int r = (i * steps[t] + round * 7) % regions;
+					v3s16 p(r * Database_Region::REGION_SIZE, t, 0);
+					db.saveBlock(p, blockData(p, round));
+				}
+			});
+		}
+		for (auto &worker : workers)
+			worker.join();
+
+		for (int t = 0; t < threads; ++t)
+		for (int r = 0; r < regions; ++r) {
+			v3s16 p(r * Database_Region::REGION_SIZE, t, 0);
+			UASSERT(loadBlock(db, p) == blockData(p, rounds - 1));
+		}
+	}
+	// Records of one file never overwrote each other
+	{
+		Database_Region db(dir);
+		std::vector<v3s16> list;
+		db.listAllLoadableBlocks(list);
+		UASSERT(list.size() == regions * threads);
+		for (const auto &p : list)
+			UASSERT(loadBlock(db, p) == blockData(p, rounds - 1));
+	}
+	fs::RecursiveDelete(dir);
+}
+
+#endif
+
+#if USE_LEVELDB
+
+void TestDatabase::testLevelDBKeys()
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + "leveldb_keys";
+	fs::RecursiveDelete(dir);
+	fs::CreateAllDirs(dir);
+	v3s16 a(1, -2, 3), b(-100, 20, 2047), c(0, 0, -2048);
+	{
+		Database_LevelDB db(dir, false);
+		UASSERT(db.isOpen());
+		UASSERT(db.saveBlocks({{a, "a"}, {b, "b"}, {c, "c"}}));
+	}
+	// Part of the keys converted, as after an interrupted --migrate-keys
+	{
+		Database_LevelDB db(dir, true);
+		UASSERT(db.convertKeys({a}, true) == 1);
+		UASSERT(loadBlock(db, a) == "a");
+		UASSERT(loadBlock(db, b) == "b");
+		std::vector<std::string> blocks;
+		db.loadBlocks({a, b, c, v3s16(5, 5, 5)}, blocks);
+		UASSERT(blocks.size() == 4);
+		UASSERT(blocks[0] == "a" && blocks[1] == "b" && blocks[2] == "c");
+		UASSERT(blocks[3].empty());
+
+		// Saves and deletes reach the old formats too
+		UASSERT(db.saveBlock(b, "b1"));
+		UASSERT(db.deleteBlock(c));
+		UASSERT(loadBlock(db, c).empty());
+	}
+	{
+		Database_LevelDB db(dir, false);
+		UASSERT(loadBlock(db, a) == "a");
+		UASSERT(loadBlock(db, b) == "b1");
+		UASSERT(loadBlock(db, c).empty());
+		std::vector<v3s16> list;
+		db.listAllLoadableBlocks(list);
+		UASSERT(list.size() == 2);
+	}
+	fs::RecursiveDelete(dir);
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "test.h"
+
+#include <sstream>
+#include "constants.h"
+#include "genericobject.h"
+#include "util/serialize.h"
+
+class TestGenericObject : public TestBase {
+public:
+	TestGenericObject() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestGenericObject"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testUpdateMovement();
+	void testUpdateMovementRange();
+};
+
+static TestGenericObject g_test_instance;
+
+void TestGenericObject::runTests(IGameDef *gamedef)
+{
+	TEST(testUpdateMovement);
+	TEST(testUpdateMovementRange);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static GenericMovement readMovement(const std::string &str)
+{
+	std::istringstream is(str, std::ios::binary);
+	UASSERT(readU8(is) == GENERIC_CMD_UPDATE_MOVEMENT);
+	return gob_read_update_movement(is);
+}
+
+static bool near(v3f a, v3f b, f32 d)
+{
+	return a.getDistanceFrom(b) <= d;
+}
+
+void TestGenericObject::testUpdateMovement()
+{
+	v3f keyframe_pos(1000.5 * BS, -20.25 * BS, 3 * BS);
+	v3f pos = keyframe_pos + v3f(12.345 * BS, -0.5 * BS, 0.004 * BS);
+	v3f vel(3.5 * BS, -9.81 * BS, 0);
+	v3f acc(0, -9.81 * BS, 0);
+
+	std::string keyframe = gob_cmd_update_movement(true, 7, keyframe_pos,
+			keyframe_pos, vel, acc, -90, true, false, 0.1);
+	GenericMovement m = readMovement(keyframe);
+	UASSERT(m.keyframe);
+	UASSERT(m.keyframe_seq == 7);
+	UASSERT(near(m.position, keyframe_pos, 0.001 * BS));
+	UASSERT(near(m.velocity, vel, 0.01 * BS));
+	UASSERT(near(m.acceleration, acc, 0.01 * BS));
+	UASSERT(fabs(m.yaw - 270) < 0.01);
+	UASSERT(m.do_interpolate && !m.is_movement_end);
+	UASSERT(fabs(m.update_interval - 0.1) < 0.001);
+
+	std::string delta = gob_cmd_update_movement(false, 7, pos, keyframe_pos,
+			vel, acc, 45, false, true, 0.4);
+	m = readMovement(delta);
+	UASSERT(!m.keyframe);
+	UASSERT(m.keyframe_seq == 7);
+	UASSERT(near(m.position + keyframe_pos, pos, 0.01 * BS));
+	UASSERT(fabs(m.yaw - 45) < 0.01);
+	UASSERT(!m.do_interpolate && m.is_movement_end);
+	UASSERT(fabs(m.update_interval - 0.4) < 0.001);
+
+	// Smaller than the full update
+	std::string full = gob_cmd_update_position(pos, vel, acc, 45, false,
+			true, 0.4);
+	UASSERT(delta.size() < keyframe.size());
+	UASSERT(keyframe.size() < full.size());
+}
+
+void TestGenericObject::testUpdateMovementRange()
+{
+	v3f pos(0, 0, 0);
+	// Deltas of more than 327 nodes and such speeds do not fit
+	UASSERT(gob_cmd_update_movement(false, 0, pos + v3f(0, 400 * BS, 0),
+			pos, v3f(), v3f(), 0, true, false, 0.1).empty());
+	UASSERT(!gob_cmd_update_movement(true, 0, pos + v3f(0, 400 * BS, 0),
+			pos, v3f(), v3f(), 0, true, false, 0.1).empty());
+	UASSERT(gob_cmd_update_movement(true, 0, pos, pos,
+			v3f(400 * BS, 0, 0), v3f(), 0, true, false, 0.1).empty());
+	UASSERT(gob_cmd_update_movement(true, 0, pos, pos, v3f(), v3f(), 0,
+			true, false, 100).empty());
+}
@@ -0,0 +1,147 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#include "gamedef.h"
+#include "light_propagator.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapgen.h"
+#include "nodedef.h"
+
+class TestLightPropagator : public TestBase {
+public:
+	TestLightPropagator() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLightPropagator"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSpreadUnspread(IGameDef *gamedef);
+	void testMapgenLighting(IGameDef *gamedef);
+};
+
+static TestLightPropagator g_test_instance;
+
+void TestLightPropagator::runTests(IGameDef *gamedef)
+{
+	TEST(testSpreadUnspread, gamedef);
+	TEST(testMapgenLighting, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestLightPropagator::testSpreadUnspread(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	Map map(gamedef);
+
+	// Two blocks of dark air side by side, a wall in the second one
+	for (s16 b = 0; b != 2; b++) {
+		v3s16 blockpos(b, 0, 0);
+		MapBlock *block = map.createBlankBlock(blockpos);
+		for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+		for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+		for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+			MapNode n(b && x == 2 ? t_CONTENT_STONE : CONTENT_AIR);
+			block->setNode(v3s16(x, y, z), n);
+		}
+	}
+
+	v3s16 src(4, 8, 8);
+	MapNode n = map.getNodeNoEx(src);
+	n.setLight(LIGHTBANK_DAY, LIGHT_MAX, ndef);
+	map.getBlockNoCreateNoEx(v3s16(0, 0, 0))->setNode(src, n);
+
+	// Stopped by the time limit, then finished
+	LightPropagator light(&map, ndef);
+	std::map<v3POS, MapBlock *> modified_blocks;
+	light.addSource(src);
+	UASSERT(!light.spread(modified_blocks, 1));
+	UASSERT(!light.empty());
+	UASSERT(light.spread(modified_blocks));
+	UASSERT(light.empty());
+	UASSERT(modified_blocks.size() == 2);
+
+	// Distance along x, across the block border and up to the wall
+	for (s16 d = 0; d <= 13; d++) {
+		v3s16 p = src + v3s16(d, 0, 0);
+		UASSERT(map.getNodeNoEx(p).getLight(LIGHTBANK_DAY, ndef) == LIGHT_MAX - d);
+	}
+	UASSERT(map.getNodeNoEx(v3s16(18, 8, 8)).getLight(LIGHTBANK_DAY, ndef) == 0);
+	UASSERT(map.getNodeNoEx(v3s16(19, 8, 8)).getLight(LIGHTBANK_DAY, ndef) == 0);
+	UASSERT(map.getNodeNoEx(v3s16(4, 2, 3)).getLight(LIGHTBANK_DAY, ndef) == LIGHT_MAX - 11);
+	UASSERT(map.getNodeNoEx(src).getLight(LIGHTBANK_NIGHT, ndef) == 0);
+
+	// Removing the light darkens everything again
+	n.setLight(LIGHTBANK_DAY, 0, ndef);
+	map.getBlockNoCreateNoEx(v3s16(0, 0, 0))->setNode(src, n);
+	light.addUnlight(LIGHTBANK_DAY, src, LIGHT_MAX);
+	modified_blocks.clear();
+	light.unspread(modified_blocks);
+	UASSERT(light.spread(modified_blocks));
+	UASSERT(modified_blocks.size() == 2);
+
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE * 2; x++)
+		UASSERT(map.getNodeNoEx(v3s16(x, y, z)).getLight(LIGHTBANK_DAY, ndef) == 0);
+}
+
+void TestLightPropagator::testMapgenLighting(IGameDef *gamedef)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	MMVManip vm(NULL);
+	v3s16 nmin(0, 0, 0), nmax(47, 47, 47);
+
+	// Air under a stone roof with a hole, sunlight above, a torch in the
+	// dark far from the hole
+	vm.addArea(VoxelArea(nmin, nmax + v3s16(0, 1, 0)));
+	for (s16 z = nmin.Z; z <= nmax.Z; z++)
+	for (s16 y = nmin.Y; y <= nmax.Y + 1; y++)
+	for (s16 x = nmin.X; x <= nmax.X; x++) {
+		content_t c = CONTENT_AIR;
+		if (y == 40 && !(x == 20 && z == 20))
+			c = t_CONTENT_STONE;
+		else if (x == 40 && y == 5 && z == 40)
+			c = t_CONTENT_TORCH;
+		vm.setNodeNoRef(v3s16(x, y, z), MapNode(c, y > nmax.Y ? LIGHT_SUN : 0));
+	}
+
+	Mapgen mg;
+	mg.vm = &vm;
+	mg.ndef = ndef;
+	mg.water_level = -100;
+	mg.calcLighting(nmin, nmax, nmin, nmax);
+
+	// Down the hole, then sideways into the next tile
+	UASSERT(vm.getNodeNoExNoEmerge(v3s16(20, 0, 20)).getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN);
+	for (s16 d = 1; d <= 15; d++) {
+		v3s16 p(20 + d, 10, 20);
+		UASSERT(vm.getNodeNoExNoEmerge(p).getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN - d);
+		UASSERT(vm.getNodeNoExNoEmerge(p).getLight(LIGHTBANK_NIGHT, ndef) == 0);
+	}
+	UASSERT(vm.getNodeNoExNoEmerge(v3s16(5, 45, 5)).getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN);
+
+	// Torch light in both banks, across the tile border at z == 32
+	for (s16 d = 0; d <= 12; d++) {
+		v3s16 p(40, 5, 40 - d);
+		UASSERT(vm.getNodeNoExNoEmerge(p).getLight(LIGHTBANK_NIGHT, ndef) == LIGHT_MAX - 1 - d);
+		UASSERT(vm.getNodeNoExNoEmerge(p).getLight(LIGHTBANK_DAY, ndef) == LIGHT_MAX - 1 - d);
+	}
+	UASSERT(vm.getNodeNoExNoEmerge(v3s16(40, 5, 27)).getLight(LIGHTBANK_NIGHT, ndef) == 0);
+}
@@ -0,0 +1,195 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test.h"
+
+#include <vector>
+#include "exceptions.h"
+#include "node_palette.h"
+#include "noise.h"
+
+class TestNodePalette : public TestBase {
+public:
+	TestNodePalette() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestNodePalette"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testWidenAndReuse();
+	void testRandomWrites();
+	void testSerialize();
+	void testRetire();
+};
+
+static TestNodePalette g_test_instance;
+
+void TestNodePalette::runTests(IGameDef *gamedef)
+{
+	TEST(testWidenAndReuse);
+	TEST(testRandomWrites);
+	TEST(testSerialize);
+	TEST(testRetire);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool sameNode(const MapNode &a, const MapNode &b)
+{
+	return a.param0 == b.param0 && a.param1 == b.param1 && a.param2 == b.param2;
+}
+
+static bool sameNodes(const NodePalette &p, const std::vector<MapNode> &nodes)
+{
+	std::vector<MapNode> out(NodePalette::nodecount);
+	p.copyTo(&out[0]);
+	for (u32 i = 0; i < NodePalette::nodecount; i++)
+		if (!sameNode(p.get(i), nodes[i]) || !sameNode(out[i], nodes[i]))
+			return false;
+	return true;
+}
+
+void TestNodePalette::testWidenAndReuse()
+{
+	NodePalette p(MapNode(CONTENT_AIR));
+	UASSERT(p.getBits() == 0);
+	UASSERT(p.getPaletteSize() == 1);
+
+	// Second distinct node: one bit per node
+	UASSERT(sameNode(p.set(5, MapNode(10)), MapNode(CONTENT_AIR)));
+	UASSERT(p.getBits() == 1);
+	UASSERT(sameNode(p.get(5), MapNode(10)));
+	UASSERT(sameNode(p.get(6), MapNode(CONTENT_AIR)));
+
+	// Overwriting the only node 10 frees its entry for node 11
+	p.set(5, MapNode(11));
+	UASSERT(p.getBits() == 1);
+	UASSERT(p.getPaletteSize() == 2);
+
+	// Same content with other params is another entry
+	for (u32 i = 0; i < 16; i++)
+		p.set(i, MapNode(11, i));
+	UASSERT(p.getBits() == 8);
+	UASSERT(sameNode(p.get(15), MapNode(11, 15)));
+
+	// Back to two nodes
+	for (u32 i = 0; i < 16; i++)
+		p.set(i, MapNode(CONTENT_AIR));
+	p.set(0, MapNode(12));
+	p.compact();
+	UASSERT(p.getBits() == 1);
+	UASSERT(p.getPaletteSize() == 2);
+
+	// More than 256 distinct nodes are plain
+	for (u32 i = 0; i < 300; i++)
+		p.set(i, MapNode(100 + i));
+	UASSERT(p.getBits() == NodePalette::BITS_PLAIN);
+	UASSERT(p.getPaletteSize() == 0);
+	UASSERT(sameNode(p.get(299), MapNode(399)));
+
+	p.fill(MapNode(CONTENT_AIR));
+	UASSERT(p.getBits() == 0);
+	UASSERT(sameNode(p.get(NodePalette::nodecount - 1), MapNode(CONTENT_AIR)));
+}
+
+void TestNodePalette::testRandomWrites()
+{
+	PseudoRandom r(13);
+	for (int round = 0; round < 20; round++) {
+		NodePalette p;
+		std::vector<MapNode> nodes(NodePalette::nodecount, MapNode(CONTENT_IGNORE));
+		u32 distinct = 1 << r.range(0, 9);
+		for (int i = 0; i < 5000; i++) {
+			u32 index = r.range(0, 63) * 64 + r.range(0, 63);
+			MapNode n(r.range(0, distinct - 1), r.range(0, 2));
+			UASSERT(sameNode(p.set(index, n), nodes[index]));
+			nodes[index] = n;
+		}
+		UASSERT(sameNodes(p, nodes));
+
+		p.compact();
+		UASSERT(sameNodes(p, nodes));
+
+		NodePalette copy(p);
+		UASSERT(sameNodes(copy, nodes));
+
+		p.assign(&nodes[0]);
+		UASSERT(sameNodes(p, nodes));
+	}
+}
+
+void TestNodePalette::testSerialize()
+{
+	std::vector<MapNode> nodes(NodePalette::nodecount, MapNode(CONTENT_AIR));
+	for (u32 i = 0; i < NodePalette::nodecount; i += 7)
+		nodes[i] = MapNode(20 + i % 3, 0, i % 5);
+
+	NodePalette p;
+	p.assign(&nodes[0]);
+	UASSERT(p.getBits() == 4);
+	std::string s;
+	p.serialize(s);
+	// 16 entries, 4 bits per node
+	UASSERT(s.size() == 2 + 16 * 4 + 1 + NodePalette::nodecount / 2);
+
+	NodePalette q;
+	q.deSerialize(s);
+	UASSERT(sameNodes(q, nodes));
+
+	// Ids are changed on palette entries only
+	q.mapContent([](content_t c) { return c == CONTENT_AIR ? (content_t)30 : c; });
+	UASSERT(q.get(1).getContent() == 30);
+	UASSERT(q.get(0).getContent() == 20);
+
+	// Truncated, and index bits not matching the palette size
+	EXCEPTION_CHECK(SerializationError, q.deSerialize(s.substr(0, s.size() - 1)));
+	std::string bad("\x00\x05\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+		"\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x02", 23);
+	EXCEPTION_CHECK(SerializationError, q.deSerialize(bad));
+
+	// 3 entries in 2 bits, index 3 is past the palette
+	std::string past("\x00\x03", 2);
+	past.append(3 * 4, '\0');
+	past.append(1, '\x02');
+	past.append(NodePalette::nodecount * 2 / 8, '\0');
+	past[2 + 3 * 4 + 1 + 100] = '\x0c';
+	EXCEPTION_CHECK(SerializationError, q.deSerialize(past));
+	UASSERT(q.get(1).getContent() == 30);
+}
+
+void TestNodePalette::testRetire()
+{
+	std::vector<MapNode> nodes(NodePalette::nodecount, MapNode(CONTENT_AIR));
+	for (u32 i = 0; i < NodePalette::nodecount; i += 3)
+		nodes[i] = MapNode(20 + i % 5);
+	NodePalette expected;
+	expected.assign(&nodes[0]);
+
+	NodePalette p;
+	size_t held;
+	{
+		// A reader that started before the replacement keeps it alive
+		epoch_read_guard guard;
+		p.assign(&nodes[0]);
+		p.compact();
+		held = p.getMemoryUsage();
+		UASSERT(held > expected.getMemoryUsage());
+		UASSERT(sameNodes(p, nodes));
+	}
+	p.compact();
+	UASSERT(p.getMemoryUsage() == expected.getMemoryUsage());
+	UASSERT(sameNodes(p, nodes));
+}
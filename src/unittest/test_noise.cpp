@@ -19,8 +19,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <string.h>
 #include "exceptions.h"
 #include "noise.h"
+#include "noise_simd.h"
+#include "util/numeric.h"
 
 class TestNoise : public TestBase {
 public:
@@ -34,6 +37,7 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimd();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -48,6 +52,7 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimd);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -120,6 +125,42 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+void TestNoise::testNoiseSimd()
+{
+	// Vector kernels must give exactly the same maps as scalar ones
+	const u32 flags[] = {0, NOISE_FLAG_EASED, NOISE_FLAG_ABSVALUE, NOISE_FLAG_DEFAULTS};
+	float persist[13 * 14 * 15];
+	for (u32 i = 0; i != 13 * 14 * 15; i++)
+		persist[i] = 0.4 + (i % 7) * 0.05;
+
+	NoiseSimd supported = noise_simd_supported();
+	NoiseSimd prev = noise_simd_get();
+
+	for (u32 f = 0; f != ARRLEN(flags); f++) {
+		NoiseParams np(5, 20, v3f(37, 11, 23), 99, 4, 0.6, 2.0, flags[f]);
+		Noise n2(&np, 1337, 13, 14);
+		Noise n3(&np, 1337, 13, 14, 15);
+		std::vector<float> ref2, ref3;
+
+		for (int level = NOISE_SIMD_SCALAR; level <= supported; level++) {
+			noise_simd_set((NoiseSimd)level);
+			for (int p = 0; p != 2; p++) {
+				float *r2 = n2.perlinMap2D(-71.5, 1003.25, p ? persist : NULL);
+				float *r3 = n3.perlinMap3D(-3001, 17.7, 512, p ? persist : NULL);
+				if (level == NOISE_SIMD_SCALAR) {
+					ref2.insert(ref2.end(), r2, r2 + 13 * 14);
+					ref3.insert(ref3.end(), r3, r3 + 13 * 14 * 15);
+					continue;
+				}
+				UASSERT(memcmp(r2, &ref2[p * 13 * 14], sizeof(float) * 13 * 14) == 0);
+				UASSERT(memcmp(r3, &ref3[p * 13 * 14 * 15], sizeof(float) * 13 * 14 * 15) == 0);
+			}
+		}
+	}
+
+	noise_simd_set(prev);
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
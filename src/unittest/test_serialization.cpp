@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "util/string.h"
 #include "util/serialize.h"
+#include "util/msgpack_serialize.h"
 
 class TestSerialization : public TestBase {
 public:
@@ -43,6 +44,7 @@ class TestSerialization : public TestBase {
 	void testVecPut();
 	void testStringLengthLimits();
 	void testBufReader();
+	void testPacketBuffer();
 
 	std::string teststring2;
 	std::wstring teststring2_w;
@@ -70,6 +72,7 @@ void TestSerialization::runTests(IGameDef *gamedef)
 	TEST(testVecPut);
 	TEST(testStringLengthLimits);
 	TEST(testBufReader);
+	TEST(testPacketBuffer);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -647,3 +650,26 @@ const u8 TestSerialization::test_serialized_data[12 * 13] = {
 	0x6f, 0x6d, 0x65, 0x20, 0x6c, 0x6f, 0x6e, 0x67, 0x65, 0x72, 0x20, 0x73,
 	0x74, 0x72, 0x69, 0x6e, 0x67, 0x20, 0x68, 0x65, 0x72, 0x65, 0xF0, 0x0D,
 };
+
+void TestSerialization::testPacketBuffer()
+{
+	msgpack::sbuffer *first;
+	{
+		PacketBuffer packet_buffer;
+		first = &*packet_buffer;
+		first->write("abc", 3);
+		UASSERT(first->size() == 3);
+
+		// Nested packets do not share the buffer
+		PacketBuffer nested;
+		UASSERT(&*nested != first);
+		UASSERT((*nested).size() == 0);
+	}
+
+#if HAVE_THREAD_LOCAL
+	// Given back cleared
+	PacketBuffer packet_buffer;
+	UASSERT(&*packet_buffer == first);
+	UASSERT((*packet_buffer).size() == 0);
+#endif
+}
@@ -19,8 +19,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <thread>
+
 #include "threading/atomic.h"
+#include "threading/mpmc_queue.h"
 #include "threading/semaphore.h"
+#include "threading/task_graph.h"
 #include "threading/thread.h"
 
 
@@ -33,6 +37,8 @@ class TestThreading : public TestBase {
 	void testStartStopWait();
 	void testThreadKill();
 	void testAtomicSemaphoreThread();
+	void testTaskGraph();
+	void testMpmcQueue();
 };
 
 static TestThreading g_test_instance;
@@ -44,6 +50,8 @@ void TestThreading::runTests(IGameDef *gamedef)
 #endif
 	TEST(testThreadKill);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testTaskGraph);
+	TEST(testMpmcQueue);
 }
 
 class SimpleTestThread : public Thread {
@@ -183,3 +191,97 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+
+void TestThreading::testTaskGraph()
+{
+	task_pool pool;
+	pool.start(3);
+
+	// Diamond repeated: every task must see all of its deps finished
+	for (int pass = 0; pass != 2; pass++) {
+		task_graph graph(pass ? &pool : nullptr);
+		static const u32 num_slabs = 16;
+		std::atomic<u32> sources(0), slabs(0);
+		std::vector<u32> seen(num_slabs, 0);
+		u32 total = 0;
+
+		auto a = graph.add([&] { sources++; });
+		auto b = graph.add([&] { sources++; });
+		std::vector<task_graph::task_id> slab_ids;
+		for (u32 i = 0; i != num_slabs; i++) {
+			slab_ids.push_back(graph.add([&, i] {
+				seen[i] = sources;
+				slabs++;
+			}, {a, b}));
+		}
+		graph.add([&] { total = slabs; }, slab_ids);
+		graph.run();
+
+		UASSERT(total == num_slabs);
+		for (u32 i = 0; i != num_slabs; i++)
+			UASSERT(seen[i] == 2);
+	}
+
+	// Exception reaches run(), dependents are skipped
+	task_graph graph(&pool);
+	bool skipped = true;
+	auto t = graph.add([] { throw std::runtime_error("task"); });
+	graph.add([&] { skipped = false; }, {t});
+	bool thrown = false;
+	try {
+		graph.run();
+	} catch (std::runtime_error &e) {
+		thrown = true;
+	}
+	UASSERT(thrown);
+	UASSERT(skipped);
+}
+
+
+void TestThreading::testMpmcQueue()
+{
+	mpmc_queue<u32> queue(5);
+	UASSERT(queue.capacity() == 8);
+
+	// FIFO, bounded
+	u32 v;
+	UASSERT(!queue.pop(v));
+	for (u32 i = 0; i != 8; i++)
+		UASSERT(queue.push(i));
+	UASSERT(!queue.push(8));
+	UASSERT(queue.size() == 8);
+	for (u32 i = 0; i != 8; i++) {
+		UASSERT(queue.pop(v));
+		UASSERT(v == i);
+	}
+	UASSERT(queue.empty());
+
+	// Every value pushed by some thread is popped by exactly one thread
+	static const u32 num_threads = 4, per_thread = 20000;
+	mpmc_queue<u32> shared(64);
+	std::vector<std::atomic<u32>> popped(num_threads * per_thread);
+	for (auto &p : popped)
+		p = 0;
+	std::atomic<u32> total(0);
+	std::vector<std::thread> threads;
+	for (u32 t = 0; t != num_threads; t++) {
+		threads.emplace_back([&, t] {
+			u32 next = 0, value;
+			while (next != per_thread || total != num_threads * per_thread) {
+				if (next != per_thread && shared.push(t * per_thread + next))
+					next++;
+				if (shared.pop(value)) {
+					popped[value]++;
+					total++;
+				}
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	UASSERT(shared.empty());
+	for (auto &p : popped)
+		UASSERT(p == 1);
+}
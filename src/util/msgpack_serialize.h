@@ -22,7 +22,10 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include "../config.h"
 #include "../msgpack_fix.h"
+#include <memory>
+#include <vector>
 
 #include "../serialization.h" //decompressZlib
 
@@ -37,9 +40,56 @@ along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
 	PACK(x, s); \
 	}
 
+/*
+	Encode buffer from a pool of the thread, given back cleared when it
+	goes out of scope, so packets do not allocate their buffer each time.
+	Nested packets take another buffer. Big buffers are not kept.
+*/
+class PacketBuffer {
+public:
+	static const size_t POOL_SIZE = 16;
+	static const size_t KEEP_MAX = 64 * 1024;
+
+	PacketBuffer()
+	{
+#if HAVE_THREAD_LOCAL
+		auto & free = pool();
+		if (!free.empty()) {
+			m_buffer = std::move(free.back());
+			free.pop_back();
+			return;
+		}
+#endif
+		m_buffer.reset(new msgpack::sbuffer);
+	}
+	~PacketBuffer()
+	{
+#if HAVE_THREAD_LOCAL
+		auto & free = pool();
+		if (free.size() < POOL_SIZE && m_buffer->size() <= KEEP_MAX) {
+			m_buffer->clear();
+			free.emplace_back(std::move(m_buffer));
+		}
+#endif
+	}
+	msgpack::sbuffer & operator*() { return *m_buffer; }
+
+private:
+#if HAVE_THREAD_LOCAL
+	static std::vector<std::unique_ptr<msgpack::sbuffer>> & pool()
+	{
+		static thread_local std::vector<std::unique_ptr<msgpack::sbuffer>> free;
+		return free;
+	}
+#endif
+
+	std::unique_ptr<msgpack::sbuffer> m_buffer;
+};
+
 #define MSGPACK_COMMAND -1
 #define MSGPACK_PACKET_INIT(id, x) \
-	msgpack::sbuffer buffer; \
+	PacketBuffer packet_buffer; \
+	msgpack::sbuffer & buffer = *packet_buffer; \
 	msgpack::packer<msgpack::sbuffer> pk(&buffer); \
 	pk.pack_map((x)+1); \
 	PACK(MSGPACK_COMMAND, id);
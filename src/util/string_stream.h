@@ -0,0 +1,66 @@
+/*
+This file is part of Freeminer.
+
+Freeminer is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Freeminer  is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Freeminer.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef UTIL_STRING_STREAM_HEADER
+#define UTIL_STRING_STREAM_HEADER
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include "../config.h"
+
+/*
+	Output stream appending to a caller owned std::string.
+	Unlike std::ostringstream there is no str() copy at the end and the
+	string keeps its capacity, so a buffer can be cleared and reused.
+*/
+
+class string_streambuf : public std::streambuf {
+public:
+	string_streambuf(std::string & s) : m_str(s) {}
+
+protected:
+	std::streamsize xsputn(const char * s, std::streamsize n) override {
+		m_str.append(s, n);
+		return n;
+	}
+	int_type overflow(int_type c) override {
+		if (!traits_type::eq_int_type(c, traits_type::eof()))
+			m_str.push_back(traits_type::to_char_type(c));
+		return traits_type::not_eof(c);
+	}
+
+	std::string & m_str;
+};
+
+// streambuf is a base listed before ostream so it is constructed first
+class string_ostream : private string_streambuf, public std::ostream {
+public:
+	string_ostream(std::string & s) : string_streambuf(s), std::ostream(this) {}
+};
+
+/*
+	Per thread scratch buffer, keeps allocated memory between calls.
+	Without thread_local falls back to a plain local variable.
+*/
+#if HAVE_THREAD_LOCAL
+#define SCRATCH_BUFFER(type, name) static thread_local type name; name.clear();
+#else
+#define SCRATCH_BUFFER(type, name) type name;
+#endif
+
+#endif